@@ -1,50 +1,243 @@
 #include <CZ/Heaven/Bar/HNLog.h>
+#include <CZ/Heaven/HNBusPoll.h>
+#include <CZ/Heaven/HNTrace.h>
 #include <CZ/Heaven/Bar/HNBar.h>
 #include <CZ/Heaven/Bar/HNCompositor.h>
 #include <CZ/Heaven/Bar/HNClient.h>
 #include <CZ/Heaven/Bar/HNEvent.h>
+#include <CZ/Heaven/Bar/HNCache.h>
+#include <CZ/Heaven/Bar/HNCapture.h>
+#include <CZ/Heaven/Bar/HNIOThread.h>
+#include <CZ/Heaven/Bar/HNBusTransport.h>
+#include <CZ/Heaven/Bar/HNLoopback.h>
 #include <CZ/Core/CZBus.h>
+#include <algorithm>
+#include <cstring>
 #include <systemd/sd-bus.h>
 
+using namespace CZ;
 using namespace CZ::Bar;
 
 static std::weak_ptr<HNBar> s_bar;
 
+// Running capture, published and released by the thread decoding the messages, see HNBar::m_captureOwner.
+static std::atomic<HNCapture*> s_capture { nullptr };
+
+// Time a pulled client has to send its state before the next one is admitted.
+static constexpr UInt64 ResyncTimeoutMs { 1000 };
+
+// Delay between a commit and the memory budget being checked.
+static constexpr UInt64 MemoryBudgetDelayMs { 1000 };
+
+// Minimum time a client stays under backpressure.
+static constexpr UInt64 BackpressureHoldMs { 100 };
+
+// Hinted clients beyond this rank are ignored.
+static constexpr size_t MaxPrefetchHints { 8 };
+
+// Whether focus serial a is b or newer, serials wrap around.
+static bool SerialReached(UInt32 a, UInt32 b) noexcept { return Int32(a - b) >= 0; }
+
 struct CZ::Bar::HNIface
 {
-    static int ClientDisconnected(sd_bus_message *m, void *, sd_bus_error *)
+    /* Checks an incoming event against the client limits, applying backpressure if exceeded. */
+    static bool Admit(HNBar *bar, HNClient *cli, size_t stringBytes, bool createsObject)
+    {
+        if (cli->m_backpressured)
+            return false;
+
+        const auto &limits { bar->m_clientLimits };
+
+        const bool exceeded {
+            (limits.maxPendingEvents > 0 && cli->m_events.size() + cli->m_staged.size() >= limits.maxPendingEvents) ||
+            (limits.maxObjects > 0 && createsObject && cli->m_objects.size() + cli->m_evictedObjects + cli->m_queuedCreates >= limits.maxObjects) ||
+            (limits.maxStringBytes > 0 && stringBytes > 0 &&
+             cli->m_stringBytes + cli->m_evictedStringBytes + cli->m_queuedStringBytes + stringBytes > limits.maxStringBytes) };
+
+        if (!exceeded)
+        {
+            cli->m_queuedCreates += createsObject;
+            cli->m_queuedStringBytes += stringBytes;
+            return true;
+        }
+
+        // A resync over the limits would just trigger another one, truncate it instead.
+        if (cli->m_reconciling)
+        {
+            HNLog(CZWarning, CZLN, "Client {} exceeded its limits while resyncing, dropping event", cli->id());
+            return false;
+        }
+
+        bar->applyBackpressure(cli);
+        return false;
+    }
+
+    /*
+     * Handlers receive the HNIOThread as userdata when registered on its connection.
+     * They then only decode the message and hand it to the main thread, which
+     * applies it through Apply().
+     */
+
+    /* Queues an event received from a client. */
+    static void Receive(sd_bus_message *m, void *io, std::unique_ptr<HNEvent> event, size_t stringBytes, bool createsObject)
     {
+        const char *sender { sd_bus_message_get_sender(m) };
+
+        if (io)
+        {
+            static_cast<HNIOThread*>(io)->queueEvent(sender, std::move(event), stringBytes, createsObject);
+            return;
+        }
+
         auto bar { s_bar.lock() };
+
+        if (auto *cli = bar->getClientById(sender))
+        {
+            HN_TRACE(BarReceive, HNTrace::ClientId(sender), cli->m_receivedSeq + 1, event->type);
+            Enqueue(bar.get(), cli, event, stringBytes, createsObject);
+        }
+    }
+
+    /* Queues an event into the client if admitted, counting the message either way. */
+    static void Enqueue(HNBar *bar, HNClient *cli, std::unique_ptr<HNEvent> &event, size_t stringBytes, bool createsObject)
+    {
+        cli->m_stats.messagesReceived++;
+        const bool admitted { Admit(bar, cli, stringBytes, createsObject) };
+        HN_TRACE(BarEnqueue, HNTrace::ClientId(cli->id().c_str()), cli->m_receivedSeq + 1, admitted);
+
+        if (admitted)
+        {
+            cli->m_stats.eventsEnqueued++;
+            cli->m_events.push(std::move(event));
+        }
+        else
+            cli->m_stats.eventsDropped++;
+    }
+
+    /* Applies a batch decoded by the I/O thread. */
+    static void Apply(HNBar *bar, HNIOThread::Batch &batch)
+    {
+        using Batch = HNIOThread::Batch;
+
+        switch (batch.kind) {
+        case Batch::Events:
+            if (auto *cli = bar->getClientById(batch.sender.c_str()))
+                for (auto &entry : batch.events)
+                    Enqueue(bar, cli, entry.event, entry.stringBytes, entry.createsObject);
+            break;
+        case Batch::Commit:
+            HandleCommit(bar, batch.sender.c_str(), batch.ack ? &*batch.ack : nullptr);
+            break;
+        case Batch::RegisterClient:
+        {
+            const bool ok { HandleRegisterClient(bar, batch.sender.c_str()) };
+
+            // Loopback batches carry no request to reply to.
+            if (bar->m_io)
+                bar->m_io->reply(batch, ok);
+            break;
+        }
+        case Batch::AnnounceClient:
+            HandleAnnounceClient(bar, batch.sender);
+            break;
+        case Batch::SetActiveClient:
+        {
+            const bool ok { HandleSetActiveClient(bar, batch.sender.c_str(), batch.name.c_str(), batch.serial) };
+
+            if (bar->m_io)
+                bar->m_io->reply(batch, ok);
+            break;
+        }
+        case Batch::SetPrefetchHints:
+            HandleSetPrefetchHints(bar, batch.sender.c_str(), std::move(batch.hints));
+            break;
+        case Batch::GetStats:
+            // Counters are read here, the reply is built and sent on the I/O thread.
+            bar->m_io->post([request = std::exchange(batch.request, nullptr), rows = CollectStats(bar)]
+            {
+                ReplyStats(request, rows);
+                sd_bus_message_unref(request);
+            });
+            break;
+        case Batch::NameOwnerChanged:
+            if (batch.name == "org.cuarzo.HeavenCompositor")
+                HandleCompositorChanged(bar, batch.sender.c_str(), batch.newOwner.c_str());
+
+            if (!batch.sender.empty() && batch.newOwner.empty())
+                HandleClientDisconnected(bar, batch.sender.c_str());
+            break;
+        }
+    }
+
+    // Sees every message before it is dispatched.
+    static int CaptureFilter(sd_bus_message *m, void *, sd_bus_error *)
+    {
+        // Stored by this same thread, no ordering needed.
+        auto *capture { s_capture.load(std::memory_order_relaxed) };
+
+        if (!capture)
+            return 0;
+
+        if (sd_bus_message_is_method_call(m, "org.cuarzo.HeavenBar", nullptr))
+            capture->write(m);
+        else if (sd_bus_message_is_signal(m, "org.freedesktop.DBus", "NameOwnerChanged"))
+            capture->writeDisconnect(m);
+
+        return 0;
+    }
+
+    static int ClientDisconnected(sd_bus_message *m, void *io, sd_bus_error *)
+    {
         const char *name;
         const char *old_owner;
         const char *new_owner;
 
-        sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
+        int r = sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
+
+        if (r < 0)
+            return r;
 
-        if (old_owner[0] != '\0' && new_owner[0] == '\0')
+        const bool disconnected { old_owner[0] != '\0' && new_owner[0] == '\0' };
+
+        if (io)
         {
-            auto *client { bar->getClientById(old_owner) };
+            // Also covers the compositor, which has no match of its own on this connection.
+            if (!disconnected && strcmp(name, "org.cuarzo.HeavenCompositor") != 0)
+                return 0;
 
-            if (!client) return 0;
+            auto *thread { static_cast<HNIOThread*>(io) };
 
-            if (client == bar->m_activeClient)
+            if (disconnected)
             {
-                bar->m_activeClient = nullptr;
-                bar->m_activeClientId = "";
-                bar->onActiveClientChanged.notify(bar.get());
+                thread->drop(old_owner);
+                thread->calls().cancel(old_owner);
             }
 
-            for (auto it = client->m_objects.begin(); it != client->m_objects.end(); it++)
-                client->m_events.push(std::make_unique<HNObjectDestroyedEvent>((*it).first));
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::NameOwnerChanged, old_owner) };
+            batch->name = name;
+            batch->newOwner = new_owner;
+            thread->queue(std::move(batch));
+            return 0;
+        }
 
-            client->dispatch();
-            bar->onClientDestroyed.notify(client);
-            bar->m_clients.erase(old_owner);
+        if (disconnected)
+        {
+            auto bar { s_bar.lock() };
+            HandleClientDisconnected(bar.get(), old_owner);
         }
 
         return 0;
     }
 
+    static void HandleClientDisconnected(HNBar *bar, const char *id)
+    {
+        bar->cancelResync(id);
+        bar->m_transport->cancel(id);
+
+        if (auto *client = bar->getClientById(id))
+            bar->removeClient(client);
+    }
+
     static int CompositorChanged(sd_bus_message *m, void */*userdata*/, sd_bus_error */*ret_error*/)
     {
         auto bar { s_bar.lock() };
@@ -58,6 +251,12 @@ struct CZ::Bar::HNIface
         if (r < 0)
             return r;
 
+        HandleCompositorChanged(bar.get(), old_owner, new_owner);
+        return 0;
+    }
+
+    static void HandleCompositorChanged(HNBar *bar, const char *old_owner, const char *new_owner)
+    {
         if (old_owner[0] == '\0' && new_owner[0] != '\0')
         {
             HNLog(CZInfo, CZLN, "org.cuarzo.HeavenCompositor appeared");
@@ -67,7 +266,7 @@ struct CZ::Bar::HNIface
             else
             {
                 bar->m_compositor = std::unique_ptr<HNCompositor>(new HNCompositor(new_owner));
-                bar->onCompositorChanged.notify(bar.get());
+                bar->onCompositorChanged.notify(bar);
             }
 
         }
@@ -75,7 +274,7 @@ struct CZ::Bar::HNIface
         {
             HNLog(CZInfo, CZLN, "org.cuarzo.HeavenCompositor disappeared");
             bar->m_compositor.reset();
-            bar->onCompositorChanged.notify(bar.get());
+            bar->onCompositorChanged.notify(bar);
         }
         else
         {
@@ -86,304 +285,627 @@ struct CZ::Bar::HNIface
             else
             {
                 bar->m_compositor = std::unique_ptr<HNCompositor>(new HNCompositor(new_owner));
-                bar->onCompositorChanged.notify(bar.get());
+                bar->onCompositorChanged.notify(bar);
             }
         }
+    }
+
+    /* Reply callback of the initial GetNameOwner lookup of the compositor. */
+    static int CompositorOwnerACK(sd_bus_message *m, void *, sd_bus_error *)
+    {
+        auto bar { s_bar.lock() };
+        const char *owner;
+
+        // Not present, or already reported by NameOwnerChanged.
+        if (!bar || sd_bus_message_is_method_error(m, NULL) || sd_bus_message_read(m, "s", &owner) < 0 ||
+            (bar->m_compositor && bar->m_compositor->id() == owner))
+            return 0;
+
+        if (!bar->m_compositor)
+        {
+            bar->m_compositor = std::unique_ptr<HNCompositor>(new HNCompositor(owner));
+            HNLog(CZInfo, CZLN, "Compositor set: {}", bar->compositor()->id());
+            bar->onCompositorChanged.notify(bar.get());
+        }
+        else
+            bar->m_compositor->m_id = owner;
 
         return 0;
     }
 
-    static int SetActiveClient(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetActiveClient(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        bool success { false };
-        auto bar { s_bar.lock() };
-        auto *id { sd_bus_message_get_sender(m) };
+        const char *id;
+        int r = sd_bus_message_read(m, "s", &id);
+
+        if (r < 0)
+            return r;
+
+        return QueueSetActiveClient(m, io, id, 0);
+    }
 
-        if (bar->compositor() && strcmp(id, bar->compositor()->id().c_str()) == 0)
+    static int SetActiveClientWithSerial(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        const char *id;
+        UInt32 serial;
+        int r = sd_bus_message_read(m, "su", &id, &serial);
+
+        if (r < 0)
+            return r;
+
+        return QueueSetActiveClient(m, io, id, serial);
+    }
+
+    static int QueueSetActiveClient(sd_bus_message *m, void *io, const char *id, UInt32 serial)
+    {
+        if (io)
         {
-            success = true;
-            const char *id;
-            sd_bus_message_read(m, "s", &id);
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::SetActiveClient, sd_bus_message_get_sender(m)) };
+            batch->name = id;
+            batch->serial = serial;
+            batch->request = sd_bus_message_ref(m);
+            static_cast<HNIOThread*>(io)->queue(std::move(batch));
+            return 1;
+        }
+
+        auto bar { s_bar.lock() };
+        return sd_bus_reply_method_return(m, "b", HandleSetActiveClient(bar.get(), sd_bus_message_get_sender(m), id, serial));
+    }
 
+    static bool HandleSetActiveClient(HNBar *bar, const char *sender, const char *id, UInt32 serial)
+    {
+        if (!bar->compositor() || strcmp(sender, bar->compositor()->id().c_str()) != 0)
+            return false;
+
+        // Superseded by this request.
+        bar->cancelFocusHold();
 
-            if (strcmp(id, "") == 0)
+        if (strcmp(id, "") == 0)
+        {
+            if (bar->m_activeClient)
             {
-                if (bar->m_activeClient)
-                {
-                    bar->m_activeClientId = "";
-                    bar->m_activeClient = nullptr;
-                    bar->onActiveClientChanged.notify(bar.get());
-                }
+                bar->m_activeClientId = "";
+                bar->setActiveClient(nullptr);
             }
-            else
-            {
-                auto *client { bar->getClientById(id) };
+        }
+        else
+        {
+            auto *client { bar->getClientById(id) };
 
-                if (client)
-                {
-                    if (client != bar->m_activeClient)
-                    {
-                        bar->m_activeClientId = id;
-                        bar->m_activeClient = client;
-                        bar->onActiveClientChanged.notify(bar.get());
-                    }
-                }
-                else
+            if (client)
+            {
+                if (client != bar->m_activeClient)
                 {
                     bar->m_activeClientId = id;
-                    HNLog(CZDebug, CZLN, "Client {} set active but still not registered", id);
+
+                    // Wait for the commit referencing the serial, unless already applied.
+                    if (serial && client->m_focusAware && !SerialReached(client->m_focusSerial, serial) && bar->m_focusHoldTime > 0)
+                        bar->holdFocus(client, serial);
+                    else
+                        bar->setActiveClient(client);
                 }
             }
+            else
+            {
+                bar->m_activeClientId = id;
+                HNLog(CZDebug, CZLN, "Client {} set active but still not registered", id);
+            }
+        }
+
+        return true;
+    }
+
+    static int SetPrefetchHints(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        std::vector<std::string> hints;
+        int r = sd_bus_message_enter_container(m, 'a', "s");
+
+        if (r < 0)
+            return r;
+
+        const char *id;
+
+        while ((r = sd_bus_message_read_basic(m, 's', &id)) > 0)
+            if (hints.size() < MaxPrefetchHints)
+                hints.emplace_back(id);
+
+        if (r < 0 || (r = sd_bus_message_exit_container(m)) < 0)
+            return r;
+
+        if (io)
+        {
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::SetPrefetchHints, sd_bus_message_get_sender(m)) };
+            batch->hints = std::move(hints);
+            static_cast<HNIOThread*>(io)->queue(std::move(batch));
+        }
+        else
+        {
+            auto bar { s_bar.lock() };
+            HandleSetPrefetchHints(bar.get(), sd_bus_message_get_sender(m), std::move(hints));
+        }
+
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    static void HandleSetPrefetchHints(HNBar *bar, const char *sender, std::vector<std::string> hints)
+    {
+        if (!bar->compositor() || strcmp(sender, bar->compositor()->id().c_str()) != 0)
+            return;
+
+        if (hints.size() > MaxPrefetchHints)
+            hints.resize(MaxPrefetchHints);
+
+        bar->setPrefetchHints(std::move(hints));
+    }
+
+    /* org.cuarzo.HeavenBar.Stats */
+
+    struct StatsRow
+    {
+        std::string id;
+        std::string name;
+        HNClient::Stats stats;
+    };
+
+    static std::vector<StatsRow> CollectStats(HNBar *bar)
+    {
+        std::vector<StatsRow> rows;
+        rows.reserve(bar->m_clients.size());
+
+        for (const auto &[id, client] : bar->m_clients)
+            rows.emplace_back(id, client->name(), client->stats());
+
+        return rows;
+    }
+
+    static int ReplyStats(sd_bus_message *m, const std::vector<StatsRow> &rows)
+    {
+        sd_bus_message *reply {};
+        int r = sd_bus_message_new_method_return(m, &reply);
+
+        if (r >= 0)
+            r = sd_bus_message_open_container(reply, 'a', "(ssttttttttat)");
+
+        for (size_t i = 0; r >= 0 && i < rows.size(); i++)
+        {
+            const auto &row { rows[i] };
+            const auto &st { row.stats };
+
+            r = sd_bus_message_open_container(reply, 'r', "ssttttttttat");
+
+            if (r >= 0)
+                r = sd_bus_message_append(reply, "sstttttttt",
+                    row.id.c_str(), row.name.c_str(),
+                    st.messagesReceived, st.eventsEnqueued, st.eventsApplied, st.eventsRejected,
+                    st.eventsDropped, st.commits, st.objects, st.stringBytes);
+
+            if (r >= 0)
+                r = sd_bus_message_append_array(reply, 't', st.dispatchTime.data(), sizeof(st.dispatchTime));
+
+            if (r >= 0)
+                r = sd_bus_message_close_container(reply);
+        }
+
+        if (r >= 0)
+            r = sd_bus_message_close_container(reply);
+
+        if (r >= 0)
+            r = sd_bus_send(NULL, reply, NULL);
+        else
+            HNLog(CZError, CZLN, "Failed to build the stats reply. {}", strerror(-r));
+
+        sd_bus_message_unref(reply);
+        return r;
+    }
+
+    static int GetClientStats(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        if (io)
+        {
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::GetStats, sd_bus_message_get_sender(m)) };
+            batch->request = sd_bus_message_ref(m);
+            static_cast<HNIOThread*>(io)->queue(std::move(batch));
+            return 1;
         }
 
-        return sd_bus_reply_method_return(m, "b", success);
+        auto bar { s_bar.lock() };
+        return ReplyStats(m, CollectStats(bar.get()));
     }
 
-    static int RegisterClient(sd_bus_message *m, void */*userdata*/, sd_bus_error */*ret_error*/)
+    static int RegisterClient(sd_bus_message *m, void *io, sd_bus_error */*ret_error*/)
     {
-        bool success { true };
+        if (io)
+        {
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::RegisterClient, sd_bus_message_get_sender(m)) };
+            batch->request = sd_bus_message_ref(m);
+            static_cast<HNIOThread*>(io)->queue(std::move(batch));
+            return 1;
+        }
+
         auto bar { s_bar.lock() };
+        return sd_bus_reply_method_return(m, "b", HandleRegisterClient(bar.get(), sd_bus_message_get_sender(m)));
+    }
 
-        if (bar->m_clients.contains(sd_bus_message_get_sender(m)))
+    static bool HandleRegisterClient(HNBar *bar, const char *sender)
+    {
+        if (auto *existing = bar->getClientById(sender))
         {
-            HNLog(CZWarning, CZLN, "Rejected method: Client already registered {}", sd_bus_message_get_sender(m));
-            success = false;
+            if (existing->m_restored)
+            {
+                HNLog(CZInfo, CZLN, "Restored client re-registered: {}", existing->id());
+                existing->m_restored = false;
+                existing->beginReconcile();
+            }
+            else if (existing->m_reconciling)
+                HNLog(CZDebug, CZLN, "Client re-registered after backpressure: {}", existing->id());
+            else
+            {
+                HNLog(CZWarning, CZLN, "Rejected method: Client already registered {}", sender);
+                return false;
+            }
         }
         else
         {
-            auto client { std::shared_ptr<HNClient>(new HNClient(sd_bus_message_get_sender(m))) };
+            auto client { std::shared_ptr<HNClient>(new HNClient(sender)) };
             bar->m_clients[client->id()] = client;
             HNLog(CZInfo, CZLN, "New client: {}", client->id());
             bar->onClientCreated.notify(client.get());
 
             if (client->id() == bar->m_activeClientId)
-            {
-                bar->m_activeClient = client.get();
-                bar->onActiveClientChanged.notify(bar.get());
-            }
+                bar->setActiveClient(client.get());
         }
 
-        return sd_bus_reply_method_return(m, "b", success);
+        return true;
     }
 
-    static int SetClientName(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetClientName(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        const char *name;
+        int r = sd_bus_message_read(m, "s", &name);
 
-        if (cli)
-        {
-            const char *name;
-            sd_bus_message_read(m, "s", &name);
-            cli->m_events.push(std::make_unique<HNClientNameChangedEvent>(name));
-        }
+        if (r < 0)
+            return r;
 
+        Receive(m, io, std::make_unique<HNClientNameChangedEvent>(name), strlen(name), false);
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int SetClientTopbar(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetClientTopbar(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        int r = sd_bus_message_read(m, "u", &id);
 
-        if (cli)
-        {
-            UInt32 id;
-            sd_bus_message_read(m, "u", &id);
-            cli->m_events.push(std::make_unique<HNClientTopbarChangedEvent>(id));
-        }
+        if (r < 0)
+            return r;
 
+        Receive(m, io, std::make_unique<HNClientTopbarChangedEvent>(id), 0, false);
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int CreateObject(sd_bus_message *m, void *, sd_bus_error *)
+    static int CreateObject(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id, type;
+        int r = sd_bus_message_read(m, "uu", &id, &type);
 
-        if (cli)
-        {
-            UInt32 id, type;
-            sd_bus_message_read(m, "uu", &id, &type);
+        if (r < 0)
+            return r;
 
-            if (id > 0 && HNObject::IsValidType(type))
-                cli->m_events.push(std::make_unique<HNObjectCreatedEvent>(id, (HNObject::Type)type));
-        }
+        if (id > 0 && HNObject::IsValidType(type))
+            Receive(m, io, std::make_unique<HNObjectCreatedEvent>(id, (HNObject::Type)type), 0, true);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int DestroyObject(sd_bus_message *m, void *, sd_bus_error *)
+    static int DestroyObject(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        int r = sd_bus_message_read(m, "u", &id);
 
-        UInt32 id { 0 };
-
-        if (cli)
-        {
-            sd_bus_message_read(m, "u", &id);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectDestroyedEvent>(id));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectDestroyedEvent>(id), 0, false);
 
         /* The reply carries the object id back so the client can safely reuse it. */
         return sd_bus_reply_method_return(m, "u", id);
     }
 
-    static int SetObjectTitle(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetObjectTitle(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        const char *title;
+        int r = sd_bus_message_read(m, "us", &id, &title);
 
-        if (cli)
-        {
-            UInt32 id;
-            const char *title;
-            sd_bus_message_read(m, "us", &id, &title);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectTitleChangedEvent>(id, title));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectTitleChangedEvent>(id, title), strlen(title), false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int SetObjectParent(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetObjectParent(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id, parentId;
+        int r = sd_bus_message_read(m, "uu", &id, &parentId);
 
-        if (cli)
-        {
-            UInt32 id, parentId;
-            sd_bus_message_read(m, "uu", &id, &parentId);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectParentChangedEvent>(id, parentId));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectParentChangedEvent>(id, parentId), 0, false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int InsertObjectBefore(sd_bus_message *m, void *, sd_bus_error *)
+    static int InsertObjectBefore(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id, siblingId;
+        int r = sd_bus_message_read(m, "uu", &id, &siblingId);
 
-        if (cli)
-        {
-            UInt32 id, siblingId;
-            sd_bus_message_read(m, "uu", &id, &siblingId);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectInsertedBeforeEvent>(id, siblingId));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectInsertedBeforeEvent>(id, siblingId), 0, false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int SetObjectIcon(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetObjectIcon(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        const char *icon;
+        int r = sd_bus_message_read(m, "us", &id, &icon);
 
-        if (cli)
-        {
-            UInt32 id;
-            const char *icon;
-            sd_bus_message_read(m, "us", &id, &icon);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectIconChangedEvent>(id, icon));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectIconChangedEvent>(id, icon), strlen(icon), false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int SetObjectEnabled(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetObjectEnabled(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        int enabled;
+        int r = sd_bus_message_read(m, "ub", &id, &enabled);
 
-        if (cli)
-        {
-            UInt32 id;
-            int enabled;
-            sd_bus_message_read(m, "ub", &id, &enabled);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectEnabledChangedEvent>(id, enabled != 0));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectEnabledChangedEvent>(id, enabled != 0), 0, false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int SetObjectShortcut(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetObjectShortcut(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        const char *shortcut;
+        int r = sd_bus_message_read(m, "us", &id, &shortcut);
 
-        if (cli)
-        {
-            UInt32 id;
-            const char *shortcut;
-            sd_bus_message_read(m, "us", &id, &shortcut);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNObjectShortcutChangedEvent>(id, shortcut));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNObjectShortcutChangedEvent>(id, shortcut), strlen(shortcut), false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int SetToggleChecked(sd_bus_message *m, void *, sd_bus_error *)
+    static int SetToggleChecked(sd_bus_message *m, void *io, sd_bus_error *)
     {
-        auto bar { s_bar.lock() };
-        auto *cli { bar->getClientById(sd_bus_message_get_sender(m)) };
+        UInt32 id;
+        int checked;
+        int r = sd_bus_message_read(m, "ub", &id, &checked);
 
-        if (cli)
-        {
-            UInt32 id;
-            int checked;
-            sd_bus_message_read(m, "ub", &id, &checked);
+        if (r < 0)
+            return r;
 
-            if (id > 0)
-                cli->m_events.push(std::make_unique<HNToggleCheckedChangedEvent>(id, checked != 0));
-        }
+        if (id > 0)
+            Receive(m, io, std::make_unique<HNToggleCheckedChangedEvent>(id, checked != 0), 0, false);
 
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int Commit(sd_bus_message *m, void *, sd_bus_error *)
+    /* Shared by Commit and CommitWithSequence, ack is null for unsequenced commits. */
+    static void HandleCommit(HNBar *bar, const char *sender, const HNClient::CommitAck *ack)
     {
-        auto bar { s_bar.lock() };
-        auto cli { bar->m_clients.find(sd_bus_message_get_sender(m)) };
+        auto cli { bar->m_clients.find(sender) };
 
         if (cli != bar->m_clients.end())
-            cli->second->dispatch();
+        {
+            auto *client { cli->second.get() };
+            client->m_stats.messagesReceived++;
+            client->m_stats.commits++;
 
-        return sd_bus_reply_method_return(m, "");
-    }
-};
+            // Unsequenced commits are numbered as the client would have.
+            client->m_receivedSeq = ack ? ack->seq : client->m_receivedSeq + 1;
+            HN_TRACE(BarCommit, HNTrace::ClientId(sender), client->m_receivedSeq, 0);
 
-static const sd_bus_vtable VTable[]
-{
-    SD_BUS_VTABLE_START(0),
+            if (ack && ack->focusSerial)
+                client->m_focusAware = true;
 
-    /* Compositor requests */
+            // Under backpressure events were dropped, the whole state is resent once released.
+            if (client->m_backpressured)
+            {
+                // Acknowledged along with the resent state.
+                if (ack)
+                    client->m_droppedAcks.emplace_back(*ack);
+            }
+            // Reconciliation needs the re-sent state right away, and a held focus change the topbar.
+            else if (bar->m_deferInactiveCommits && client != bar->m_activeClient && client->id() != bar->m_heldFocusId &&
+                !client->m_restored && !client->m_reconciling)
+            {
+                // Acknowledged once the deferred changes are applied (before defer(), which may apply them).
+                if (ack)
+                {
+                    client->m_deferredAcks.emplace_back(*ack);
 
-    SD_BUS_METHOD(
-        "SetActiveClient",
-        "s",    /* in client id */
+                    // Activating the client applies the deferred changes first, no need to hold focus for them.
+                    if (ack->focusSerial)
+                        client->m_focusSerial = ack->focusSerial;
+                }
+
+                client->defer();
+
+                // Folded into nothing (or applied by defer()), nothing left to wait for.
+                if (!client->hasPendingChanges())
+                    for (const auto &deferred : std::exchange(client->m_deferredAcks, {}))
+                        bar->sendCommitApplied(client, deferred);
+            }
+            else
+            {
+                client->rehydrate();
+                client->stage();
+
+                // Acknowledged once the staged events are applied.
+                client->m_commitAcks.insert(client->m_commitAcks.end(), client->m_droppedAcks.begin(), client->m_droppedAcks.end());
+                client->m_droppedAcks.clear();
+
+                if (ack)
+                    client->m_commitAcks.emplace_back(*ack);
+
+                bar->scheduleDispatch(client);
+            }
+        }
+
+        // The state pulled by a resync is always sent as a single commit.
+        if (bar->m_resyncInFlight.erase(sender))
+            bar->pumpResync();
+    }
+
+    static int Commit(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        if (io)
+            static_cast<HNIOThread*>(io)->queue(std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::Commit, sd_bus_message_get_sender(m)));
+        else
+        {
+            auto bar { s_bar.lock() };
+            HandleCommit(bar.get(), sd_bus_message_get_sender(m), nullptr);
+        }
+
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    static int CommitWithSequence(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        HNClient::CommitAck ack {};
+        int r = sd_bus_message_read(m, "ut", &ack.seq, &ack.clientTime);
+
+        if (r < 0)
+            return r;
+
+        ack.received = std::chrono::steady_clock::now();
+
+        if (io)
+        {
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::Commit, sd_bus_message_get_sender(m)) };
+            batch->ack = ack;
+            static_cast<HNIOThread*>(io)->queue(std::move(batch));
+        }
+        else
+        {
+            auto bar { s_bar.lock() };
+            HandleCommit(bar.get(), sd_bus_message_get_sender(m), &ack);
+        }
+
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    static int CommitWithFocus(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        HNClient::CommitAck ack {};
+        int r = sd_bus_message_read(m, "utu", &ack.seq, &ack.clientTime, &ack.focusSerial);
+
+        if (r < 0)
+            return r;
+
+        ack.received = std::chrono::steady_clock::now();
+
+        if (io)
+        {
+            auto batch { std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::Commit, sd_bus_message_get_sender(m)) };
+            batch->ack = ack;
+            static_cast<HNIOThread*>(io)->queue(std::move(batch));
+        }
+        else
+        {
+            auto bar { s_bar.lock() };
+            HandleCommit(bar.get(), sd_bus_message_get_sender(m), &ack);
+        }
+
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    static int AnnounceClient(sd_bus_message *m, void *io, sd_bus_error *)
+    {
+        if (io)
+            static_cast<HNIOThread*>(io)->queue(std::make_unique<HNIOThread::Batch>(HNIOThread::Batch::AnnounceClient, sd_bus_message_get_sender(m)));
+        else
+        {
+            auto bar { s_bar.lock() };
+            HandleAnnounceClient(bar.get(), sd_bus_message_get_sender(m));
+        }
+
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    static void HandleAnnounceClient(HNBar *bar, const std::string &id)
+    {
+        if (!bar->m_resyncInFlight.contains(id) &&
+            std::find(bar->m_resyncQueue.begin(), bar->m_resyncQueue.end(), id) == bar->m_resyncQueue.end())
+        {
+            HNLog(CZDebug, CZLN, "Client {} queued for resync", id);
+            bar->m_resyncQueue.emplace_back(id);
+            bar->pumpResync();
+        }
+    }
+};
+
+static const sd_bus_vtable VTable[]
+{
+    SD_BUS_VTABLE_START(0),
+
+    /* Compositor requests */
+
+    SD_BUS_METHOD(
+        "SetActiveClient",
+        "s",    /* in client id */
         "b",
         HNIface::SetActiveClient,
         SD_BUS_VTABLE_UNPRIVILEGED
     ),
+    SD_BUS_METHOD(
+        "SetActiveClientWithSerial",
+        "su",   /* in client id, focus serial */
+        "b",
+        HNIface::SetActiveClientWithSerial,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
+    SD_BUS_METHOD(
+        "SetPrefetchHints",
+        "as",   /* in client ids, most likely first */
+        "",
+        HNIface::SetPrefetchHints,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
 
     /* Client Requests */
 
+    SD_BUS_METHOD(
+        "AnnounceClient",
+        "",
+        "",
+        HNIface::AnnounceClient,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
     SD_BUS_METHOD(
         "RegisterClient",
         "",
@@ -475,87 +997,188 @@ static const sd_bus_vtable VTable[]
         HNIface::Commit,
         SD_BUS_VTABLE_UNPRIVILEGED
     ),
+    SD_BUS_METHOD(
+        "CommitWithSequence",
+        "ut", /* Sequence, Client Timestamp (us) */
+        "",
+        HNIface::CommitWithSequence,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
+    SD_BUS_METHOD(
+        "CommitWithFocus",
+        "utu", /* Sequence, Client Timestamp (us), Focus Serial */
+        "",
+        HNIface::CommitWithFocus,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
     SD_BUS_VTABLE_END
 };
 
-std::shared_ptr<HNBar> HNBar::GetOrMake() noexcept
+static const sd_bus_vtable StatsVTable[]
 {
-    int r;
-
-    if (auto bar = s_bar.lock())
-        return bar;
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD(
+        "GetClientStats",
+        "",
+        "a(ssttttttttat)", /* See ReplyStats() and HNClient::Stats */
+        HNIface::GetClientStats,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
+    SD_BUS_VTABLE_END
+};
 
-    auto bus { CZBus::GetOrMakeUser() };
+/* Registers the bar interface, with the I/O thread as userdata if any. */
+static int SetupBus(sd_bus *bus, void *io)
+{
+    int r = sd_bus_add_object_vtable(
+        bus,
+        NULL,
+        "/org/cuarzo/HeavenBar",
+        "org.cuarzo.HeavenBar",
+        VTable,
+        io);
 
-    if (!bus)
+    if (r < 0)
     {
-        HNLog(CZFatal, CZLN, "Failed to create CZBus. Make sure a CZCore instance exists before creating a HNBar.");
-        return {};
+        HNLog(CZFatal, CZLN, "Failed to add object vtable. {}", strerror(-r));
+        return r;
     }
 
     r = sd_bus_add_object_vtable(
-        bus->bus(),
+        bus,
         NULL,
         "/org/cuarzo/HeavenBar",
-        "org.cuarzo.HeavenBar",
-        VTable,
-        NULL);
+        "org.cuarzo.HeavenBar.Stats",
+        StatsVTable,
+        io);
 
     if (r < 0)
     {
-        HNLog(CZFatal, CZLN, "Failed to add object vtable. {}", strerror(-r));
-        return {};
+        HNLog(CZFatal, CZLN, "Failed to add the stats vtable. {}", strerror(-r));
+        return r;
     }
 
-    r = sd_bus_add_match(
-        bus->bus(),
+    r = sd_bus_add_match_async(
+        bus,
         NULL,
         "type='signal',"
         "sender='org.freedesktop.DBus',"
         "interface='org.freedesktop.DBus',"
         "member='NameOwnerChanged'",
         &HNIface::ClientDisconnected,
-        NULL
+        NULL,
+        io
     );
 
     if (r < 0)
     {
         HNLog(CZFatal, CZLN, "Failed to add match for member='NameOwnerChanged'. {}", strerror(-r));
-        return {};
+        return r;
     }
 
-    r = sd_bus_add_match(
-        bus->bus(),
-        NULL,
-        "type='signal',"
-        "sender='org.freedesktop.DBus',"
-        "interface='org.freedesktop.DBus',"
-        "member='NameOwnerChanged',"
-        "arg0='org.cuarzo.HeavenCompositor'",
-        HNIface::CompositorChanged,
-        NULL
-    );
-
-    if (r < 0)
+    // The I/O thread forwards compositor changes from the match above, in order with its calls.
+    if (!io)
     {
-        HNLog(CZFatal, CZLN, "Failed to add signal match for arg0='org.cuarzo.HeavenCompositor'. {}", strerror(-r));
-        return {};
+        r = sd_bus_add_match_async(
+            bus,
+            NULL,
+            "type='signal',"
+            "sender='org.freedesktop.DBus',"
+            "interface='org.freedesktop.DBus',"
+            "member='NameOwnerChanged',"
+            "arg0='org.cuarzo.HeavenCompositor'",
+            HNIface::CompositorChanged,
+            NULL,
+            NULL
+        );
+
+        if (r < 0)
+        {
+            HNLog(CZFatal, CZLN, "Failed to add signal match for arg0='org.cuarzo.HeavenCompositor'. {}", strerror(-r));
+            return r;
+        }
     }
 
-    r = sd_bus_request_name(bus->bus(), "org.cuarzo.HeavenBar", 0);
+    r = sd_bus_request_name(bus, "org.cuarzo.HeavenBar", 0);
 
     if (r < 0)
-    {
         HNLog(CZFatal, CZLN, "Failed to acquire 'org.cuarzo.HeavenBar' name. {}", strerror(-r));
+
+    return r;
+}
+
+std::shared_ptr<HNBar> HNBar::GetOrMake(bool ioThread) noexcept
+{
+    if (auto bar = s_bar.lock())
+        return bar;
+
+    auto bus { CZBus::GetOrMakeUser() };
+
+    if (!bus)
+    {
+        HNLog(CZFatal, CZLN, "Failed to create CZBus. Make sure a CZCore instance exists before creating a HNBar.");
         return {};
     }
 
+#ifdef HEAVEN_TRACE
+    // Before the I/O thread starts tracing.
+    HNTrace::EnableFromEnv();
+#endif
+
     auto bar { std::shared_ptr<HNBar>(new HNBar(bus)) };
+
+    if (ioThread)
+    {
+        bar->m_io = HNIOThread::Make(SetupBus, [](HNIOThread::Batch &batch)
+        {
+            if (auto bar = s_bar.lock())
+                HNIface::Apply(bar.get(), batch);
+        });
+
+        if (!bar->m_io)
+            HNLog(CZWarning, CZLN, "Failed to start the I/O thread, decoding messages on the main thread");
+    }
+
+    if (!bar->m_io && SetupBus(bus->bus(), nullptr) < 0)
+        return {};
+
+    bar->m_transport = std::make_unique<HNBusTransport>(bus->bus(), bar->m_io.get());
+
+    if (!bar->m_poll.init(bus->bus(), { bar->m_io ? bar->m_io->wakeupFd() : -1 }))
+        HNLog(CZWarning, CZLN, "Failed to create the epoll instance, fd() returns the bus connection. {}", strerror(errno));
+
     s_bar = bar;
+
+    if (const char *capture = getenv("CZ_HEAVEN_BAR_CAPTURE"))
+        bar->startCapture(capture);
+
     bar->checkCompositor();
     return bar;
 }
 
+std::shared_ptr<HNBar> HNBar::MakeLoopback() noexcept
+{
+    if (s_bar.lock())
+    {
+        HNLog(CZError, CZLN, "A HNBar already exists in this process");
+        return {};
+    }
+
+    auto bar { std::shared_ptr<HNBar>(new HNBar(nullptr)) };
+    auto loopback { std::unique_ptr<HNLoopback>(new HNLoopback([bar = bar.get()](HNIOThread::Batch &batch)
+    {
+        HNIface::Apply(bar, batch);
+
+        if (bar->m_loopback->synchronousDispatch())
+            bar->dispatchStaged(true);
+    })) };
+
+    bar->m_loopback = loopback.get();
+    bar->m_transport = std::move(loopback);
+    s_bar = bar;
+    return bar;
+}
+
 std::shared_ptr<HNBar> HNBar::Get() noexcept
 {
     return s_bar.lock();
@@ -568,55 +1191,704 @@ HNClient *HNBar::getClientById(const char *id) const noexcept
     return it->second.get();
 }
 
-HNBar::HNBar(std::shared_ptr<CZBus> bus) noexcept : m_bus(bus) {}
+std::vector<HNClient*> HNBar::clients() const noexcept
+{
+    std::vector<HNClient*> clients;
+    clients.reserve(m_clients.size());
+
+    for (const auto &[id, client] : m_clients)
+        clients.emplace_back(client.get());
 
-void HNBar::checkCompositor() noexcept
+    return clients;
+}
+
+HNBar::HNBar(std::shared_ptr<CZBus> bus) noexcept :
+    m_bus(bus),
+    m_resyncTimer([this]
+    {
+        const auto now { std::chrono::steady_clock::now() };
+
+        // Slow clients go back to the queue, dead ones are removed once they leave the bus.
+        std::erase_if(m_resyncInFlight, [this, &now](const auto &pull)
+        {
+            if (pull.second > now)
+                return false;
+
+            HNLog(CZDebug, CZLN, "Resync of client {} timed out", pull.first);
+            m_resyncQueue.emplace_back(pull.first);
+            return true;
+        });
+
+        pumpResync();
+    }),
+    m_memoryBudgetTimer([this]{ enforceMemoryBudget(); }),
+    m_dispatchTimer([this]{ dispatchStaged(false); }),
+    m_backpressureTimer([this]
+    {
+        std::vector<HNClient*> drained;
+        bool pending { false };
+
+        for (const auto &[id, client] : m_clients)
+        {
+            if (!client->m_backpressured)
+                continue;
+
+            if (client->committing())
+                pending = true;
+            else
+                drained.emplace_back(client.get());
+        }
+
+        for (auto *client : drained)
+            releaseBackpressure(client);
+
+        if (pending)
+            m_backpressureTimer.start(BackpressureHoldMs);
+    }),
+    m_focusTimer([this]
+    {
+        HNLog(CZDebug, CZLN, "Client {} didn't reference focus serial {} in time", m_heldFocusId, m_heldFocusSerial);
+        releaseFocus();
+    }) {}
+
+HNBar::~HNBar() noexcept
+{
+    // Run by the I/O thread before it closes its connection.
+    setCaptureFilter(nullptr);
+    HNSnapshot::Publish(m_snapshot, nullptr);
+    HNSnapshot::ReclaimAll();
+}
+
+size_t HNBar::outstandingCalls() const noexcept
+{
+    return m_transport->outstandingCalls();
+}
+
+void HNBar::setResyncWindow(UInt32 window) noexcept
+{
+    m_resyncWindow = std::max(window, 1U);
+    pumpResync();
+}
+
+void HNBar::setActiveClient(HNClient *client) noexcept
+{
+    if (client == m_activeClient)
+        return;
+
+    const UInt64 now ( std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() );
+
+    for (auto *c : { m_activeClient, client })
+    {
+        if (!c) continue;
+
+        c->m_lastActiveTime = now;
+
+        if (m_cache)
+            m_cache->markDirty(c);
+    }
+
+    // Recreate the objects and apply deferred changes before announcing the new client.
+    if (client)
+    {
+        client->rehydrate();
+        client->applyPendingChanges();
+    }
+
+    m_activeClient = client;
+    publishSnapshot(nullptr);
+    onActiveClientChanged.notify(this);
+}
+
+void HNBar::pumpResync() noexcept
 {
-    sd_bus_message *reply {};
+    const auto now { std::chrono::steady_clock::now() };
+
+    while (m_resyncInFlight.size() < m_resyncWindow && !m_resyncQueue.empty())
+    {
+        // Active client first, then the most recently active ones, then in announcement order.
+        auto priority = [this](const std::string &id) -> UInt64
+        {
+            if (id == m_activeClientId)
+                return UINT64_MAX;
+
+            auto *client { getClientById(id.c_str()) };
+            return client ? client->m_lastActiveTime : 0;
+        };
+
+        auto next { m_resyncQueue.begin() };
+        UInt64 nextPriority { priority(*next) };
+
+        for (auto it = std::next(next); it != m_resyncQueue.end(); it++)
+        {
+            const UInt64 itPriority { priority(*it) };
+
+            if (itPriority > nextPriority)
+            {
+                next = it;
+                nextPriority = itPriority;
+            }
+        }
+
+        const std::string id { std::move(*next) };
+        m_resyncQueue.erase(next);
+        m_resyncInFlight[id] = now + std::chrono::milliseconds(ResyncTimeoutMs);
+        HNLog(CZDebug, CZLN, "Pulling state of client {}", id);
+
+        m_transport->resync(id);
+    }
+
+    if (m_resyncInFlight.empty())
+    {
+        m_resyncTimer.stop();
+        return;
+    }
 
-    int r = sd_bus_call_method(
+    auto deadline { m_resyncInFlight.begin()->second };
+
+    for (const auto &pull : m_resyncInFlight)
+        deadline = std::min(deadline, pull.second);
+
+    m_resyncTimer.start(std::max<Int64>(1, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count()));
+}
+
+void HNBar::cancelResync(const std::string &clientId) noexcept
+{
+    std::erase(m_resyncQueue, clientId);
+
+    if (m_resyncInFlight.erase(clientId))
+        pumpResync();
+}
+
+void HNBar::setMemoryBudget(size_t bytes) noexcept
+{
+    m_memoryBudget = bytes;
+
+    if (bytes == 0)
+    {
+        m_memoryBudgetTimer.stop();
+        return;
+    }
+
+    enforceMemoryBudget();
+}
+
+size_t HNBar::memoryUsage() const noexcept
+{
+    size_t usage { 0 };
+
+    for (const auto &[id, client] : m_clients)
+        usage += client->memoryUsage();
+
+    return usage;
+}
+
+void HNBar::scheduleMemoryBudget() noexcept
+{
+    if (!m_memoryBudgetTimer.running())
+        m_memoryBudgetTimer.start(MemoryBudgetDelayMs);
+}
+
+void HNBar::enforceMemoryBudget() noexcept
+{
+    m_memoryBudgetTimer.stop();
+
+    if (m_memoryBudget == 0)
+        return;
+
+    size_t usage { memoryUsage() };
+
+    if (usage <= m_memoryBudget)
+        return;
+
+    std::vector<HNClient*> candidates;
+
+    // Restored trees are still being reconciled, keep them until confirmed.
+    for (const auto &[id, client] : m_clients)
+        if (client.get() != m_activeClient && id != m_activeClientId && !client->m_evicted && !prefetchHinted(id) &&
+            !client->m_restored && !client->m_reconciling && !client->m_objects.empty())
+            candidates.emplace_back(client.get());
+
+    std::sort(candidates.begin(), candidates.end(), [](HNClient *a, HNClient *b)
+    {
+        return a->m_lastActiveTime < b->m_lastActiveTime;
+    });
+
+    for (auto *client : candidates)
+    {
+        if (usage <= m_memoryBudget)
+            break;
+
+        const size_t before { client->memoryUsage() };
+        client->evict();
+        usage -= before - std::min(before, client->memoryUsage());
+    }
+
+    if (usage > m_memoryBudget)
+        HNLog(CZDebug, CZLN, "Memory budget exceeded by {} bytes after evicting all inactive clients", usage - m_memoryBudget);
+}
+
+void HNBar::setDeferInactiveCommits(bool enabled) noexcept
+{
+    if (enabled == m_deferInactiveCommits)
+        return;
+
+    m_deferInactiveCommits = enabled;
+
+    if (enabled)
+        return;
+
+    std::vector<std::shared_ptr<HNClient>> clients;
+
+    for (const auto &[id, client] : m_clients)
+        clients.emplace_back(client);
+
+    for (auto &client : clients)
+        client->applyPendingChanges();
+}
+
+void HNBar::setDispatchBudget(UInt32 usec) noexcept
+{
+    m_dispatchBudget = usec;
+
+    if (usec == 0)
+        dispatchStaged(true);
+}
+
+void HNBar::scheduleDispatch(HNClient *client) noexcept
+{
+    if (std::find(m_dispatchQueue.begin(), m_dispatchQueue.end(), client->id()) == m_dispatchQueue.end())
+        m_dispatchQueue.emplace_back(client->id());
+
+    if (!m_dispatchTimer.running())
+        m_dispatchTimer.start(0);
+}
+
+void HNBar::dispatchStaged(bool untilDone) noexcept
+{
+    const auto deadline { untilDone || m_dispatchBudget == 0 ? std::chrono::steady_clock::time_point::max() :
+        std::chrono::steady_clock::now() + std::chrono::microseconds(m_dispatchBudget) };
+
+    m_dispatchTimer.stop();
+
+    // The active client is what the user is looking at, it doesn't take turns.
+    if (m_activeClient && m_activeClient->committing() &&
+        !m_activeClient->dispatchSlice(this, deadline, UINT32_MAX))
+    {
+        m_dispatchTimer.start(0);
+        return;
+    }
+
+    while (!m_dispatchQueue.empty())
+    {
+        const std::string id { std::move(m_dispatchQueue.front()) };
+        m_dispatchQueue.erase(m_dispatchQueue.begin());
+        auto *client { getClientById(id.c_str()) };
+
+        if (!client || !client->committing())
+            continue;
+
+        // Back of the queue until its next turn.
+        const UInt32 quantum ( std::min<UInt64>(UInt64(m_schedulingQuantum) * client->m_schedulingWeight, UINT32_MAX) );
+
+        if (!client->dispatchSlice(this, deadline, quantum))
+            m_dispatchQueue.emplace_back(id);
+
+        // Continue on the next main loop iteration.
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+    }
+
+    if (!m_dispatchQueue.empty())
+        m_dispatchTimer.start(0);
+}
+
+void HNBar::setClientLimits(const ClientLimits &limits) noexcept
+{
+    m_clientLimits = limits;
+}
+
+void HNBar::applyBackpressure(HNClient *client) noexcept
+{
+    if (client->m_backpressured)
+        return;
+
+    HNLog(CZWarning, CZLN, "Client {} exceeded its limits, applying backpressure", client->id());
+    client->m_backpressured = true;
+    sendBackpressure(client->id(), true);
+
+    if (!m_backpressureTimer.running())
+        m_backpressureTimer.start(BackpressureHoldMs);
+}
+
+void HNBar::releaseBackpressure(HNClient *client) noexcept
+{
+    HNLog(CZDebug, CZLN, "Releasing backpressure of client {}", client->id());
+    client->m_backpressured = false;
+
+    // Drop the partial uncommitted batch, the client resends its whole state to be reconciled.
+    client->m_events = {};
+    client->m_queuedCreates = 0;
+    client->m_queuedStringBytes = 0;
+    client->rehydrate();
+    client->applyPendingChanges();
+    client->beginReconcile();
+    sendBackpressure(client->id(), false);
+}
+
+void HNBar::setCacheDir(const std::string &dir) noexcept
+{
+    if (dir == cacheDir())
+        return;
+
+    if (dir.empty())
+    {
+        m_cache.reset();
+        return;
+    }
+
+    m_cache = std::make_unique<HNCache>(dir);
+    m_cache->restore();
+}
+
+const std::string &HNBar::cacheDir() const noexcept
+{
+    static const std::string empty;
+    return m_cache ? m_cache->dir() : empty;
+}
+
+void HNBar::removeClient(HNClient *client) noexcept
+{
+    // Keep the client alive until after the destroyed signal is emitted.
+    auto clientRef { m_clients[client->id()] };
+
+    if (client == m_activeClient)
+    {
+        m_activeClientId = "";
+        setActiveClient(nullptr);
+    }
+
+    client->m_reconciling = false;
+    client->m_pending.clear();
+    client->m_staged = {};
+
+    for (auto it = client->m_objects.begin(); it != client->m_objects.end(); it++)
+        client->m_events.push(std::make_unique<HNObjectDestroyedEvent>((*it).first));
+
+    client->dispatch();
+
+    if (m_cache)
+        m_cache->remove(client);
+
+    if (client->id() == m_heldFocusId)
+        cancelFocusHold();
+
+    onClientDestroyed.notify(client);
+    m_clients.erase(client->id());
+    publishSnapshot(nullptr);
+}
+
+int HNBar::fd() const noexcept
+{
+    return m_poll.fd();
+}
+
+UInt32 HNBar::events() const noexcept
+{
+    return m_poll.events();
+}
+
+int HNBar::timeout() const noexcept
+{
+    m_poll.update();
+    const auto now { HNDeadlineTimer::Clock::now() };
+    int timeout { m_bus ? HNBusPoll::Timeout(m_bus->bus()) : -1 };
+
+    for (const auto *timer : { &m_dispatchTimer, &m_focusTimer, &m_resyncTimer, &m_backpressureTimer, &m_memoryBudgetTimer })
+        timeout = HNBusPoll::MinTimeout(timeout, timer->timeout(now));
+
+    if (m_cache)
+        timeout = HNBusPoll::MinTimeout(timeout, m_cache->timeout(now));
+
+    return timeout;
+}
+
+int HNBar::processPending(UInt32 maxMessages) noexcept
+{
+    if (m_io)
+        m_io->applyBatches();
+
+    const int processed { m_bus ? HNBusPoll::Process(m_bus->bus(), maxMessages) : 0 };
+
+    // What CZCore timers would have run by now, commits received above included.
+    const auto now { HNDeadlineTimer::Clock::now() };
+
+    for (auto *timer : { &m_dispatchTimer, &m_focusTimer, &m_resyncTimer, &m_backpressureTimer, &m_memoryBudgetTimer })
+        timer->fireIfDue(now);
+
+    if (m_cache)
+        m_cache->fireDue(now);
+
+    m_poll.update();
+    return processed;
+}
+
+void HNBar::checkCompositor() noexcept
+{
+    sd_bus_call_method_async(
         m_bus->bus(),
+        NULL,
         "org.freedesktop.DBus",
         "/org/freedesktop/DBus",
         "org.freedesktop.DBus",
         "GetNameOwner",
+        HNIface::CompositorOwnerACK,
         NULL,
-        &reply,
         "s",
         "org.cuarzo.HeavenCompositor"
         );
+}
 
-    if (r >= 0)
+void HNBar::sendObjectClicked(const std::string &clientId, UInt32 objectId) noexcept
+{
+#ifdef HEAVEN_TRACE
+    if (auto *client = getClientById(clientId.c_str()))
+        HN_TRACE(BarClick, HNTrace::ClientId(clientId.c_str()), ++client->m_clicksSent, objectId);
+#endif
+
+    m_transport->objectClicked(clientId, objectId);
+}
+
+void HNBar::sendBackpressure(const std::string &clientId, bool active) noexcept
+{
+    m_transport->backpressure(clientId, active);
+}
+
+void HNBar::sendCommitApplied(HNClient *client, const HNClient::CommitAck &ack) noexcept
+{
+    const UInt64 dispatchTime ( std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - ack.received).count() );
+
+    m_heldAcks.emplace_back(client->id(), ack.seq, ack.clientTime, dispatchTime);
+
+    // Otherwise sent on the next frame.
+    if (!m_framePacing)
+        frameDone();
+}
+
+void HNBar::setSnapshots(bool enabled) noexcept
+{
+    if (enabled == m_snapshots)
+        return;
+
+    m_snapshots = enabled;
+
+    if (enabled)
     {
-        const char *owner;
-        sd_bus_message_read(reply, "s", &owner);
+        for (auto &[id, client] : m_clients)
+        {
+            client->m_snapshotRebuild = true;
+            client->m_snapshot = HNSnapshot::BuildClient(*client);
+        }
+
+        publishSnapshot(nullptr);
+        return;
+    }
+
+    for (auto &[id, client] : m_clients)
+    {
+        client->m_snapshot.reset();
+        client->m_snapshotNodes = {};
+        client->m_snapshotDirty.clear();
+    }
+
+    HNSnapshot::Publish(m_snapshot, nullptr);
+}
 
-        if (!m_compositor)
+bool HNBar::startCapture(const std::string &path) noexcept
+{
+    auto capture { HNCapture::Make(path) };
+
+    if (!capture)
+        return false;
+
+    m_capturing = true;
+    setCaptureFilter(std::move(capture));
+    HNLog(CZInfo, CZLN, "Capturing the incoming messages to {}", path);
+    return true;
+}
+
+void HNBar::stopCapture() noexcept
+{
+    m_capturing = false;
+    setCaptureFilter(nullptr);
+}
+
+void HNBar::setCaptureFilter(std::shared_ptr<HNCapture> capture) noexcept
+{
+    auto update { [this, capture](sd_bus *bus)
+    {
+        // The filter only runs on this thread, so the previous capture can't be in use.
+        s_capture.store(capture.get(), std::memory_order_relaxed);
+        m_captureOwner = capture;
+
+        if (!capture)
+            m_captureSlot = sd_bus_slot_unref(m_captureSlot);
+        else if (!m_captureSlot && bus)
         {
-            m_compositor = std::unique_ptr<HNCompositor>(new HNCompositor(owner));
-            HNLog(CZInfo, CZLN, "Compositor set: {}", compositor()->id());
-            onCompositorChanged.notify(this);
+            const int r { sd_bus_add_filter(bus, &m_captureSlot, HNIface::CaptureFilter, NULL) };
+
+            if (r < 0)
+                HNLog(CZError, CZLN, "Failed to add the capture filter. {}", strerror(-r));
         }
-        else
-            m_compositor->m_id = owner;
+    }};
+
+    // The I/O thread runs posted tasks in order, so starts and stops can't be reordered.
+    if (m_io)
+        m_io->post([update, io = m_io.get()]{ update(io->bus()); });
+    else
+        update(m_bus ? m_bus->bus() : nullptr);
+}
+
+bool HNBar::capturing() const noexcept
+{
+    return m_capturing;
+}
+
+void HNBar::setFocusHoldTime(UInt32 ms) noexcept
+{
+    m_focusHoldTime = ms;
+
+    if (ms == 0)
+        releaseFocus();
+}
+
+void HNBar::holdFocus(HNClient *client, UInt32 serial) noexcept
+{
+    HNLog(CZTrace, CZLN, "Holding focus change to client {} until serial {} is committed", client->id(), serial);
+    m_heldFocusId = client->id();
+    m_heldFocusSerial = serial;
+    m_focusTimer.start(m_focusHoldTime);
+
+    // Its commit may already be waiting, and must not be folded.
+    client->applyPendingChanges();
+}
+
+void HNBar::cancelFocusHold() noexcept
+{
+    m_focusTimer.stop();
+    m_heldFocusId.clear();
+    m_heldFocusSerial = 0;
+}
+
+void HNBar::releaseFocus() noexcept
+{
+    if (m_heldFocusId.empty())
+        return;
+
+    auto *client { getClientById(m_heldFocusId.c_str()) };
+    cancelFocusHold();
+
+    if (client)
+        setActiveClient(client);
+}
+
+void HNBar::focusCommitted(HNClient *client, UInt32 serial) noexcept
+{
+    client->m_focusSerial = serial;
+
+    if (client->id() == m_heldFocusId && SerialReached(serial, m_heldFocusSerial))
+        releaseFocus();
+}
+
+std::vector<HNClient*> HNBar::prefetchQueue() const noexcept
+{
+    std::vector<HNClient*> queue;
+
+    for (const auto &id : m_prefetchHints)
+    {
+        auto *client { getClientById(id.c_str()) };
+
+        if (client && client != m_activeClient)
+            queue.emplace_back(client);
     }
+
+    return queue;
 }
 
-static int IgnoreClickReply(sd_bus_message *, void *, sd_bus_error *) { return 0; }
+void HNBar::setPrefetchHints(std::vector<std::string> hints) noexcept
+{
+    if (hints.size() > MaxPrefetchHints)
+        hints.resize(MaxPrefetchHints);
+
+    m_prefetchHints = std::move(hints);
 
-void HNBar::sendObjectClicked(const std::string &clientId, UInt32 objectId) noexcept
+    UInt32 rank { 0 };
+
+    // By ID, in case a handler destroys a client.
+    for (const auto &id : std::vector<std::string>(m_prefetchHints))
+    {
+        auto *client { getClientById(id.c_str()) };
+
+        if (!client || client == m_activeClient)
+            continue;
+
+        client->rehydrate();
+        client->applyPendingChanges();
+        onClientPrefetchHint.notify(client, rank++);
+    }
+}
+
+bool HNBar::prefetchHinted(const std::string &clientId) const noexcept
 {
-    sd_bus_slot *slot { NULL };
+    return std::find(m_prefetchHints.begin(), m_prefetchHints.end(), clientId) != m_prefetchHints.end();
+}
 
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        clientId.c_str(),
-        "/org/cuarzo/HeavenClient",
-        "org.cuarzo.HeavenClient",
-        "ObjectClicked",
-        IgnoreClickReply,
-        NULL,
-        "u",
-        objectId);
+void HNBar::publishSnapshot(HNClient *client) noexcept
+{
+    if (!m_snapshots)
+        return;
+
+    if (client)
+        client->m_snapshot = HNSnapshot::BuildClient(*client);
+
+    auto *snapshot { new HNSnapshot() };
+    snapshot->serial = ++m_snapshotSerial;
+    snapshot->clients.reserve(m_clients.size());
+
+    for (auto &[id, c] : m_clients)
+    {
+        // Registered but not committed yet.
+        if (!c->m_snapshot)
+            c->m_snapshot = HNSnapshot::BuildClient(*c);
+
+        snapshot->clients.emplace_back(c->m_snapshot);
+    }
+
+    if (m_activeClient)
+        snapshot->activeClient = m_activeClient->m_snapshot;
+
+    HNSnapshot::Publish(m_snapshot, snapshot);
+}
+
+void HNBar::setFramePacing(bool enabled) noexcept
+{
+    m_framePacing = enabled;
+
+    if (!enabled)
+        frameDone();
+}
+
+void HNBar::frameDone() noexcept
+{
+    for (const auto &ack : m_heldAcks)
+    {
+        // The client may be gone by now.
+        if (!m_clients.contains(ack.clientId))
+            continue;
+
+        m_transport->commitApplied(ack.clientId, ack.seq, ack.clientTime, ack.dispatchTime);
+    }
+
+    m_heldAcks.clear();
 }
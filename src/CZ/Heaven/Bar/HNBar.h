@@ -2,9 +2,19 @@
 #define HNBAR_H
 
 #include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/Bar/HNTransport.h>
+#include <CZ/Heaven/Bar/HNClient.h>
 #include <CZ/Core/CZObject.h>
 #include <CZ/Core/CZSignal.h>
+#include <CZ/Heaven/HNDeadlineTimer.h>
+#include <CZ/Heaven/HNPollSet.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 /**
  * @brief Core class representing a bar application.
@@ -25,9 +35,18 @@ public:
     /**
      * @brief Retrieves the singleton bar instance, creating it if necessary.
      *
+     * With @p ioThread, the bar interface is served from a dedicated thread with
+     * its own bus connection. Incoming messages are parsed and replied there,
+     * and handed to the main thread as per-client batches of decoded events, so
+     * heavy client traffic costs the main loop only the time to apply them.
+     * Signals are still emitted on the main thread. Falls back to the main
+     * thread if the I/O thread can't be started.
+     *
+     * @param ioThread Whether to decode messages on a dedicated thread. Only
+     *                 used when the instance is created.
      * @return Shared pointer to the bar instance.
      */
-    static std::shared_ptr<HNBar> GetOrMake() noexcept;
+    static std::shared_ptr<HNBar> GetOrMake(bool ioThread = false) noexcept;
 
     /**
      * @brief Retrieves the existing bar instance.
@@ -36,6 +55,37 @@ public:
      */
     static std::shared_ptr<HNBar> Get() noexcept;
 
+    /**
+     * @brief Creates a bar connected to in-memory clients instead of the session bus.
+     *
+     * The clients and the compositor are emulated through loopback(), and the
+     * bar's calls to them are delivered as its signals, or the real
+     * Client::HNClient and Compositor::HNCompositor of the process connect to
+     * it with their own MakeLoopback(). Everything else behaves as in a bar
+     * created with GetOrMake(), which makes it suitable for deterministic
+     * benchmarks and stress tests. There is no fd() to watch, the work the bar
+     * schedules itself runs either on CZCore timers or, once due according to
+     * timeout(), on processPending(), and commits can also be applied
+     * synchronously (see HNLoopback::setSynchronousDispatch()).
+     *
+     * @return The bar, or nullptr if a bar already exists in this process.
+     */
+    static std::shared_ptr<HNBar> MakeLoopback() noexcept;
+
+    /**
+     * @brief Returns the loopback transport.
+     *
+     * @return The transport, or nullptr if the bar was not created with MakeLoopback().
+     */
+    HNLoopback *loopback() const noexcept { return m_loopback; }
+
+    /**
+     * @brief Destructor.
+     *
+     * Frees the published snapshots, no HNSnapshot::Guard may be alive.
+     */
+    ~HNBar() noexcept;
+
     /**
      * @brief Returns the currently bound compositor.
      *
@@ -60,6 +110,400 @@ public:
      */
     HNClient *getClientById(const char *id) const noexcept;
 
+    /**
+     * @brief Returns every registered client, in no particular order.
+     *
+     * @see HNClient::stats()
+     */
+    std::vector<HNClient*> clients() const noexcept;
+
+    /**
+     * @brief Enables the persistent warm-start cache.
+     *
+     * When enabled, the committed tree of each client is persisted to a compact
+     * memory-mapped file inside @p dir. If the bar crashes or is restarted, the
+     * cached clients are restored immediately by this call, so the correct menu
+     * can be displayed on the very first frame. Restored clients are reconciled
+     * against the state they re-send once they re-register, and are destroyed
+     * if they don't re-register within a few seconds.
+     *
+     * Should be called right after GetOrMake(), before dispatching any event.
+     *
+     * @param dir Cache directory (created if needed), or an empty string to disable the cache.
+     *
+     * @see HNClient::restored()
+     */
+    void setCacheDir(const std::string &dir) noexcept;
+
+    /**
+     * @brief Returns the warm-start cache directory.
+     *
+     * @return The directory, or an empty string if the cache is disabled.
+     */
+    const std::string &cacheDir() const noexcept;
+
+    /**
+     * @brief Sets the resync admission window.
+     *
+     * When the bar (re)starts, clients that already published their menus do
+     * not re-send them right away. Instead they announce themselves, and the
+     * bar pulls their state one by one in priority order: the active client
+     * first, then the most recently active ones. At most @p window clients are
+     * pulled at the same time, the next one being admitted as soon as one of
+     * them commits its state (or fails to do so within a second).
+     *
+     * This prevents every client from flooding the bar at the same instant, so
+     * the active client's menu is restored in a few milliseconds.
+     *
+     * @param window Maximum number of concurrent pulls (at least 1). Defaults to 2.
+     */
+    void setResyncWindow(UInt32 window) noexcept;
+
+    /**
+     * @brief Returns the resync admission window.
+     *
+     * @see setResyncWindow()
+     */
+    UInt32 resyncWindow() const noexcept { return m_resyncWindow; }
+
+    /**
+     * @brief Sets the memory budget for client trees.
+     *
+     * When the estimated memory held by all clients exceeds @p bytes, the trees
+     * of inactive clients are evicted in least recently active order until the
+     * usage fits the budget again (or only the active client is left). Evicted
+     * trees are kept as compressed blobs and rehydrated when the client becomes
+     * active or commits new changes.
+     *
+     * Eviction and rehydration emit only onClientEvicted and onClientRehydrated,
+     * not the signals of the objects destroyed and recreated. The budget is
+     * checked shortly after commits, so the usage may briefly exceed it.
+     *
+     * @param bytes Budget in bytes, or 0 to disable eviction (default).
+     *
+     * @see HNClient::evicted()
+     */
+    void setMemoryBudget(size_t bytes) noexcept;
+
+    /**
+     * @brief Returns the memory budget for client trees.
+     *
+     * @see setMemoryBudget()
+     */
+    size_t memoryBudget() const noexcept { return m_memoryBudget; }
+
+    /**
+     * @brief Returns the estimated memory held by all clients, in bytes.
+     *
+     * @see HNClient::memoryUsage()
+     */
+    size_t memoryUsage() const noexcept;
+
+    /**
+     * @brief Defers the commits of inactive clients.
+     *
+     * When enabled, commits of clients other than the active one are not
+     * applied (and emit no signals). They are instead folded into a per-client
+     * delta that only keeps the last value of each property, and applied when
+     * the client becomes active or HNClient::applyPendingChanges() is called.
+     *
+     * Useful to avoid redundant work for background clients that update their
+     * menus frequently, e.g. a media player toggling its Play/Pause action.
+     *
+     * Disabling it applies all pending changes.
+     *
+     * @param enabled Whether to defer inactive commits. Disabled by default.
+     *
+     * @see HNClient::hasPendingChanges()
+     */
+    void setDeferInactiveCommits(bool enabled) noexcept;
+
+    /**
+     * @brief Checks whether inactive commits are deferred.
+     *
+     * @see setDeferInactiveCommits()
+     */
+    bool deferInactiveCommits() const noexcept { return m_deferInactiveCommits; }
+
+    /**
+     * @brief Sets the time budget for applying commits.
+     *
+     * Commits are applied by a scheduler on the main loop iteration following
+     * their arrival. The active client is serviced first, and the remaining
+     * clients in weighted round-robin order (see setSchedulingQuantum()), so a
+     * client flooding the bar cannot delay the active client's updates.
+     *
+     * By default all the received commits are applied in that same iteration,
+     * which can block the bar for a long time if a client commits thousands of
+     * changes at once. With a budget, commits are applied in slices of at most
+     * @p usec microseconds per main loop iteration, so input and rendering stay
+     * responsive.
+     *
+     * Commits are presented atomically either way: the change signals of a
+     * commit are held while it is applied and emitted together once it is
+     * complete, followed by onClientCommitted. HNClient::committing() tells
+     * whether a client is in the middle of a commit.
+     *
+     * @param usec Budget in microseconds, or 0 to apply all commits at once (default).
+     */
+    void setDispatchBudget(UInt32 usec) noexcept;
+
+    /**
+     * @brief Returns the time budget for applying commits.
+     *
+     * @see setDispatchBudget()
+     */
+    UInt32 dispatchBudget() const noexcept { return m_dispatchBudget; }
+
+    /**
+     * @brief Sets the number of events an inactive client can apply per scheduling round.
+     *
+     * Each round, an inactive client with pending commits applies up to
+     * `quantum * HNClient::schedulingWeight()` events before the scheduler moves
+     * on to the next one.
+     *
+     * @param quantum Events per round and unit of weight (at least 1). Defaults to 256.
+     *
+     * @see setDispatchBudget()
+     */
+    void setSchedulingQuantum(UInt32 quantum) noexcept { m_schedulingQuantum = std::max(quantum, 1U); }
+
+    /**
+     * @brief Returns the number of events an inactive client can apply per scheduling round.
+     *
+     * @see setSchedulingQuantum()
+     */
+    UInt32 schedulingQuantum() const noexcept { return m_schedulingQuantum; }
+
+    /**
+     * @brief Per-client resource limits.
+     *
+     * A value of 0 disables the corresponding limit.
+     *
+     * @see setClientLimits()
+     */
+    struct ClientLimits
+    {
+        /// Maximum number of objects, including creations not applied yet.
+        UInt32 maxObjects { 0 };
+
+        /// Maximum bytes of strings (name, titles, icons and shortcuts), including changes not applied yet.
+        size_t maxStringBytes { 0 };
+
+        /// Maximum number of events received but not applied yet.
+        UInt32 maxPendingEvents { 0 };
+    };
+
+    /**
+     * @brief Sets the resource limits applied to every client.
+     *
+     * Events that would make a client exceed a limit are dropped, and the bar
+     * applies backpressure: the client stops streaming changes and coalesces
+     * them locally. Once the bar has applied the client's outstanding commits,
+     * it releases the backpressure and the client resends its whole state,
+     * which is reconciled against the current tree (unchanged items emit no
+     * signals).
+     *
+     * @note @p maxPendingEvents must leave room for the full state of the
+     *       largest expected client, since it is resent as a single batch.
+     *       Events over the limits during a resync are dropped.
+     *
+     * @param limits Limits for each client. All disabled by default.
+     */
+    void setClientLimits(const ClientLimits &limits) noexcept;
+
+    /**
+     * @brief Returns the resource limits applied to every client.
+     *
+     * @see setClientLimits()
+     */
+    const ClientLimits &clientLimits() const noexcept { return m_clientLimits; }
+
+    /**
+     * @brief Returns the number of D-Bus calls to clients awaiting a reply.
+     *
+     * At most a fixed number of calls per client are in flight, the rest are
+     * queued locally and sent in order as replies arrive. Always 0 on loopback.
+     */
+    size_t outstandingCalls() const noexcept;
+
+    /**
+     * @name Foreign event loops
+     *
+     * Bars embedded in a compositor or toolkit with its own epoll loop can be
+     * driven without dispatching CZCore: watch fd() for events(), wake up after
+     * timeout() at the latest, and call processPending().
+     *
+     * fd() also becomes readable when the I/O thread hands over batches, and
+     * timeout() includes the deadlines of the scheduling features (commit
+     * dispatch, resync pacing, memory budget, backpressure and focus holds),
+     * which processPending() runs once due.
+     * @{
+     */
+
+    /// Epoll file descriptor aggregating the bus connection and the I/O thread wakeups, -1 on loopback.
+    int fd() const noexcept;
+
+    /// Poll events to watch on fd() (POLLIN, equal to EPOLLIN).
+    UInt32 events() const noexcept;
+
+    /// Milliseconds until processPending() must be called even without events, or -1. Call it before each wait.
+    int timeout() const noexcept;
+
+    /**
+     * @brief Applies the batches decoded by the I/O thread, processes pending messages without blocking and runs the due scheduling work.
+     *
+     * @param maxMessages Maximum messages to process, 0 means all.
+     * @return Number of messages processed, or a negative errno if the connection failed.
+     */
+    int processPending(UInt32 maxMessages = 0) noexcept;
+
+    /** @} */
+
+    /**
+     * @brief Enables or disables frame pacing of commit acknowledgements.
+     *
+     * Clients with automatic commits (see Client::HNClient::setAutoCommit())
+     * send their next commit only after the previous one is acknowledged. With
+     * frame pacing, acknowledgements are held until frameDone() is called, so
+     * clients commit at most once per bar frame.
+     *
+     * Disabling it sends all held acknowledgements.
+     *
+     * @param enabled Whether to pace acknowledgements. Disabled by default.
+     */
+    void setFramePacing(bool enabled) noexcept;
+
+    /**
+     * @brief Checks whether commit acknowledgements are paced.
+     *
+     * @see setFramePacing()
+     */
+    bool framePacing() const noexcept { return m_framePacing; }
+
+    /**
+     * @brief Notifies that the bar presented a frame.
+     *
+     * Should be called once per presented frame when frame pacing is enabled.
+     * Sends the commit acknowledgements held since the previous frame.
+     *
+     * @see setFramePacing()
+     */
+    void frameDone() noexcept;
+
+    /**
+     * @brief Enables or disables the publication of immutable snapshots.
+     *
+     * When enabled, a new HNSnapshot is published each time a client commit is
+     * fully applied, a client is added or removed, or the active client changes.
+     * Building a snapshot only visits the objects the commit changed and their
+     * ancestors (before and after the change), the rest is shared with the
+     * previous snapshot.
+     *
+     * Disabling it unpublishes the snapshot, which is freed once no guard can
+     * reach it.
+     *
+     * @param enabled Whether to publish snapshots. Disabled by default.
+     *
+     * @see snapshot()
+     */
+    void setSnapshots(bool enabled) noexcept;
+
+    /**
+     * @brief Checks whether snapshots are published.
+     *
+     * @see setSnapshots()
+     */
+    bool snapshots() const noexcept { return m_snapshots; }
+
+    /**
+     * @brief Pins the latest published snapshot.
+     *
+     * This is the only method that can be called from any thread. The snapshot
+     * stays valid while the returned guard lives, independently of the changes
+     * applied meanwhile, and is empty if snapshots are disabled:
+     *
+     * @code
+     * if (auto snapshot = bar->snapshot())
+     *     draw(snapshot->activeClient);
+     * @endcode
+     *
+     * @see HNSnapshot::Guard
+     */
+    HNSnapshot::Guard snapshot() const noexcept { return HNSnapshot::Guard(m_snapshot); }
+
+    /**
+     * @brief Starts recording the incoming messages to a file.
+     *
+     * Every method call received on the bar interface and every disconnection of
+     * a recorded client is appended to the file with its reception time, see
+     * HNCapture for the format. The `heaven-replay` tool feeds a capture back to
+     * a bar, to reproduce real sessions or benchmark the bar against them.
+     *
+     * Only messages received from now on are recorded, so captures are usually
+     * started right after GetOrMake(), which starts one itself when the
+     * `CZ_HEAVEN_BAR_CAPTURE` environment variable is set to a file path.
+     * Starting a capture replaces the running one.
+     *
+     * @param path File to write, truncated if it exists.
+     * @return false if the file can't be created, the running capture is kept.
+     *
+     * @see stopCapture()
+     */
+    bool startCapture(const std::string &path) noexcept;
+
+    /**
+     * @brief Stops the running capture.
+     *
+     * The file is flushed and closed once the message being recorded (if any)
+     * is written, which may happen on the I/O thread. The message filter that
+     * records them is removed as well, it is only installed while capturing.
+     */
+    void stopCapture() noexcept;
+
+    /**
+     * @brief Checks whether a capture is running.
+     */
+    bool capturing() const noexcept;
+
+    /**
+     * @brief Sets how long a focus change may wait for the client's topbar.
+     *
+     * When the compositor switches focus, the newly focused client often
+     * changes its active topbar right after. To avoid presenting its stale
+     * topbar for a frame, the compositor tags the focus change with a serial
+     * that the client references in its next commit. The bar keeps the
+     * previous active client until that commit is fully applied, and then
+     * emits onActiveClientChanged with the right topbar already in place.
+     *
+     * Focus changes are only held for clients that referenced a serial before,
+     * and at most for @p ms milliseconds.
+     *
+     * @param ms Maximum wait in milliseconds, or 0 to apply focus changes right away. Defaults to 32.
+     */
+    void setFocusHoldTime(UInt32 ms) noexcept;
+
+    /**
+     * @brief Returns the maximum time a focus change waits for the client's topbar.
+     *
+     * @see setFocusHoldTime()
+     */
+    UInt32 focusHoldTime() const noexcept { return m_focusHoldTime; }
+
+    /**
+     * @brief Returns the clients the compositor expects to become active next.
+     *
+     * The compositor sends an ordered list of likely-next clients (e.g. the
+     * alt-tab most recently used order or the hovered window). Hinted clients
+     * are prepared right away: evicted trees are rehydrated, deferred changes
+     * applied, and they are excluded from eviction. Each one is also announced
+     * through onClientPrefetchHint, so expensive work such as loading icons or
+     * laying out the topbar happens before the focus switch.
+     *
+     * @return The registered hinted clients, most likely first. The active client is excluded.
+     */
+    std::vector<HNClient*> prefetchQueue() const noexcept;
+
     /**
      * @brief Emitted when a compositor connection is established or lost.
      */
@@ -72,6 +516,16 @@ public:
      */
     CZSignal<HNBar*> onActiveClientChanged;
 
+    /**
+     * @brief Emitted for each client the compositor hints as likely to become active.
+     *
+     * Emitted in priority order (rank 0 being the most likely), after the client
+     * tree has been rehydrated and its deferred changes applied.
+     *
+     * @see prefetchQueue()
+     */
+    CZSignal<HNClient* /*client*/, UInt32 /*rank*/> onClientPrefetchHint;
+
     /**
      * @brief Emitted when a new client is connected.
      */
@@ -84,6 +538,36 @@ public:
      */
     CZSignal<HNClient*> onClientDestroyed;
 
+    /**
+     * @brief Emitted after a batch of client changes has been fully applied.
+     *
+     * Batches are commits and deferred changes (see setDeferInactiveCommits()).
+     * The change signals of a batch are all emitted right before it, so
+     * consumers can also update their views once per batch instead of once per
+     * change.
+     */
+    CZSignal<HNClient*> onClientCommitted;
+
+    /**
+     * @brief Emitted right before the tree of a client is evicted.
+     *
+     * All the client's objects are destroyed right after, without emitting
+     * onObjectDestroyed or any other object signal, so pointers to them must
+     * be dropped here.
+     *
+     * @see setMemoryBudget()
+     */
+    CZSignal<HNClient*> onClientEvicted;
+
+    /**
+     * @brief Emitted after an evicted tree is recreated.
+     *
+     * The objects are new instances, created without emitting onObjectCreated
+     * or any other object signal. Consumers mirroring the tree should re-read
+     * it from HNClient::activeTopbar().
+     */
+    CZSignal<HNClient*> onClientRehydrated;
+
     /**
      * @brief Emitted when a client changes its application name.
      */
@@ -166,9 +650,40 @@ public:
 private:
     friend struct HNIface;
     friend class HNObject;
+    friend class HNClient;
+    friend class HNCache;
+    friend class HNLoopback;
     HNBar(std::shared_ptr<CZBus> bus) noexcept;
+
+    // Looks up the compositor asynchronously, see HNIface::CompositorOwnerACK.
     void checkCompositor() noexcept;
 
+    // Destroys all the objects of a client and then the client itself.
+    void removeClient(HNClient *client) noexcept;
+
+    // Updates m_activeClient and the activation timestamps.
+    void setActiveClient(HNClient *client) noexcept;
+
+    // Admits announced clients into the resync window.
+    void pumpResync() noexcept;
+    void cancelResync(const std::string &clientId) noexcept;
+
+    // Evicts the least recently active trees until the usage fits the budget.
+    void scheduleMemoryBudget() noexcept;
+    void enforceMemoryBudget() noexcept;
+
+    // Applies staged commits within the dispatch budget, active client first.
+    void scheduleDispatch(HNClient *client) noexcept;
+    void dispatchStaged(bool untilDone) noexcept;
+
+    // Backpressure of clients exceeding the limits.
+    void applyBackpressure(HNClient *client) noexcept;
+    void releaseBackpressure(HNClient *client) noexcept;
+    void sendBackpressure(const std::string &clientId, bool active) noexcept;
+
+    // Acknowledges a sequenced commit.
+    void sendCommitApplied(HNClient *client, const HNClient::CommitAck &ack) noexcept;
+
     /**
      * @brief Sends a click notification to a client over D-Bus.
      *
@@ -176,11 +691,89 @@ private:
      * @param objectId Identifier of the clicked object.
      */
     void sendObjectClicked(const std::string &clientId, UInt32 objectId) noexcept;
+
+    // Focus changes waiting for the client's commit, see setFocusHoldTime().
+    void holdFocus(HNClient *client, UInt32 serial) noexcept;
+    void cancelFocusHold() noexcept;
+    void releaseFocus() noexcept;
+    void focusCommitted(HNClient *client, UInt32 serial) noexcept;
+
+    // Prepares the hinted clients, see prefetchQueue().
+    void setPrefetchHints(std::vector<std::string> hints) noexcept;
+    bool prefetchHinted(const std::string &clientId) const noexcept;
+
+    // Rebuilds the snapshot of a client (if not null) and publishes a new bar snapshot.
+    void publishSnapshot(HNClient *client) noexcept;
+
+    // Publishes @p capture and adds HNIface::CaptureFilter on the connection decoding the messages, or removes both if null.
+    void setCaptureFilter(std::shared_ptr<HNCapture> capture) noexcept;
+
+    // Null on loopback
     std::shared_ptr<CZBus> m_bus;
+
+    // Calls to clients, see HNTransport
+    std::unique_ptr<HNTransport> m_transport;
+    HNLoopback *m_loopback {};
     std::unique_ptr<HNCompositor> m_compositor;
     HNClient *m_activeClient {};
     std::string m_activeClientId;
     std::unordered_map<std::string, std::shared_ptr<HNClient>> m_clients;
+    std::unique_ptr<HNCache> m_cache;
+
+    // Announced clients waiting to be pulled
+    std::vector<std::string> m_resyncQueue;
+
+    // Pulled clients (ID, deadline to send their state)
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> m_resyncInFlight;
+    UInt32 m_resyncWindow { 2 };
+    HNDeadlineTimer m_resyncTimer;
+    size_t m_memoryBudget { 0 };
+    HNDeadlineTimer m_memoryBudgetTimer;
+    bool m_deferInactiveCommits { false };
+
+    // Clients with staged commits, in round-robin order
+    std::vector<std::string> m_dispatchQueue;
+    UInt32 m_dispatchBudget { 0 };
+    UInt32 m_schedulingQuantum { 256 };
+    HNDeadlineTimer m_dispatchTimer;
+    ClientLimits m_clientLimits;
+
+    // Acknowledgements held until the next frame (client ID, sequence, client time, dispatch time)
+    struct HeldAck
+    {
+        std::string clientId;
+        UInt32 seq;
+        UInt64 clientTime;
+        UInt64 dispatchTime;
+    };
+    std::vector<HeldAck> m_heldAcks;
+    bool m_framePacing { false };
+    HNDeadlineTimer m_backpressureTimer;
+    bool m_snapshots { false };
+    UInt64 m_snapshotSerial { 0 };
+    std::atomic<const HNSnapshot*> m_snapshot { nullptr };
+
+    // Held focus change (client ID, serial)
+    std::string m_heldFocusId;
+    UInt32 m_heldFocusSerial { 0 };
+    UInt32 m_focusHoldTime { 32 };
+    HNDeadlineTimer m_focusTimer;
+
+    // Likely-next clients sent by the compositor, most likely first
+    std::vector<std::string> m_prefetchHints;
+
+    // See fd()
+    HNPollSet m_poll;
+
+    // Capture filter and the capture it records to, only touched on the thread of the decoding connection
+    sd_bus_slot *m_captureSlot {};
+    std::shared_ptr<HNCapture> m_captureOwner;
+
+    // See capturing(), main thread only
+    bool m_capturing {};
+
+    // Decodes incoming messages, see GetOrMake() (destroyed first)
+    std::unique_ptr<HNIOThread> m_io;
 };
 
 #endif // HNBAR_H
@@ -0,0 +1,54 @@
+#include <CZ/Heaven/Bar/HNBusTransport.h>
+#include <CZ/Heaven/Bar/HNIOThread.h>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+static int IgnoreReply(sd_bus_message *, void *, sd_bus_error *) { return 0; }
+
+template<typename... Args>
+void HNBusTransport::call(const std::string &clientId, const char *member, const char *types, Args... args) noexcept
+{
+    if (!m_io)
+    {
+        m_calls.call(clientId.c_str(), "/org/cuarzo/HeavenClient", "org.cuarzo.HeavenClient", member, IgnoreReply, NULL, types, args...);
+        return;
+    }
+
+    // Clients only accept calls from the connection owning the bar name.
+    m_io->post([io = m_io, clientId, member, types, args...]
+    {
+        io->calls().call(clientId.c_str(), "/org/cuarzo/HeavenClient", "org.cuarzo.HeavenClient", member, IgnoreReply, NULL, types, args...);
+    });
+}
+
+void HNBusTransport::resync(const std::string &clientId) noexcept
+{
+    call(clientId, "Resync", "");
+}
+
+void HNBusTransport::objectClicked(const std::string &clientId, UInt32 objectId) noexcept
+{
+    call(clientId, "ObjectClicked", "u", objectId);
+}
+
+void HNBusTransport::backpressure(const std::string &clientId, bool active) noexcept
+{
+    call(clientId, "Backpressure", "b", (int)active);
+}
+
+void HNBusTransport::commitApplied(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept
+{
+    call(clientId, "CommitApplied", "utt", seq, clientTime, dispatchTime);
+}
+
+void HNBusTransport::cancel(const std::string &clientId) noexcept
+{
+    // The I/O thread cancels its own calls when it sees the client leave.
+    m_calls.cancel(clientId);
+}
+
+size_t HNBusTransport::outstandingCalls() const noexcept
+{
+    return m_io ? m_io->outstandingCalls() : m_calls.outstanding();
+}
@@ -0,0 +1,37 @@
+#ifndef HNBUSTRANSPORT_H
+#define HNBUSTRANSPORT_H
+
+#include <CZ/Heaven/Bar/HNTransport.h>
+#include <CZ/Heaven/HNCallTracker.h>
+
+/**
+ * @brief D-Bus transport of the bar, used by HNBar::GetOrMake().
+ *
+ * Calls are sent through the main thread connection, or posted to the I/O
+ * thread when enabled, since clients only accept calls from the connection
+ * owning the bar name.
+ */
+class CZ::Bar::HNBusTransport final : public HNTransport
+{
+public:
+    /**
+     * @param bus Main thread connection.
+     * @param io  The I/O thread, or nullptr.
+     */
+    HNBusTransport(sd_bus *bus, HNIOThread *io) noexcept : m_calls(bus), m_io(io) {}
+
+    void resync(const std::string &clientId) noexcept override;
+    void objectClicked(const std::string &clientId, UInt32 objectId) noexcept override;
+    void backpressure(const std::string &clientId, bool active) noexcept override;
+    void commitApplied(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept override;
+    void cancel(const std::string &clientId) noexcept override;
+    size_t outstandingCalls() const noexcept override;
+
+private:
+    template<typename... Args>
+    void call(const std::string &clientId, const char *member, const char *types, Args... args) noexcept;
+    HNCallTracker m_calls;
+    HNIOThread *m_io;
+};
+
+#endif // HNBUSTRANSPORT_H
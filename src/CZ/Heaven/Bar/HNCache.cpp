@@ -0,0 +1,263 @@
+#include <CZ/Heaven/Bar/HNCache.h>
+#include <CZ/Heaven/Bar/HNTreeCodec.h>
+#include <CZ/Heaven/Bar/HNClient.h>
+#include <CZ/Heaven/Bar/HNBar.h>
+#include <CZ/Heaven/Bar/HNLog.h>
+#include <algorithm>
+#include <filesystem>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+// Delay between a commit and the cache file being rewritten.
+static constexpr UInt64 FlushDelayMs { 500 };
+
+// Time restored clients have to re-register before being destroyed.
+static constexpr UInt64 RestoredClientTimeoutMs { 10000 };
+
+static constexpr char FileMagic[4] { 'H', 'N', 'C', '1' };
+static constexpr const char *FileExtension { ".hnc" };
+
+struct FileHeader
+{
+    char magic[4];
+    UInt32 idSize;
+    UInt32 treeSize;
+    UInt32 reserved;
+    UInt64 treeHash;
+    UInt64 lastActiveTime;
+};
+
+HNCache::HNCache(const std::string &dir) noexcept :
+    m_dir(dir),
+    m_flushTimer([this]{ flush(); }),
+    m_expiryTimer([]
+    {
+        auto bar { HNBar::Get() };
+        if (!bar) return;
+
+        std::vector<HNClient*> expired;
+
+        // Clients waiting to be pulled are alive, they just didn't get their turn yet.
+        for (auto &[id, client] : bar->m_clients)
+            if (client->m_restored && !bar->m_resyncInFlight.contains(id) &&
+                std::find(bar->m_resyncQueue.begin(), bar->m_resyncQueue.end(), id) == bar->m_resyncQueue.end())
+                expired.emplace_back(client.get());
+
+        for (auto *client : expired)
+        {
+            HNLog(CZInfo, CZLN, "Restored client {} did not re-register, removing it", client->id());
+            bar->removeClient(client);
+        }
+    }) {}
+
+void HNCache::restore() noexcept
+{
+    auto bar { HNBar::Get() };
+    if (!bar) return;
+
+    std::error_code ec;
+    bool restoredAny { false };
+
+    for (const auto &file : std::filesystem::directory_iterator(m_dir, ec))
+    {
+        if (file.path().extension() != FileExtension)
+            continue;
+
+        const std::string path { file.path().string() };
+        const int fd { open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+
+        if (fd < 0)
+            continue;
+
+        struct stat st;
+        void *map { MAP_FAILED };
+
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(FileHeader))
+            map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        close(fd);
+
+        if (map == MAP_FAILED)
+        {
+            HNLog(CZWarning, CZLN, "Discarding unreadable cache file {}", path);
+            unlink(path.c_str());
+            continue;
+        }
+
+        const auto *header { static_cast<const FileHeader*>(map) };
+        const auto *id { static_cast<const char*>(map) + sizeof(FileHeader) };
+        const size_t size ( st.st_size );
+
+        const bool valid {
+            memcmp(header->magic, FileMagic, sizeof(FileMagic)) == 0 &&
+            sizeof(FileHeader) + UInt64(header->idSize) + header->treeSize == size &&
+            header->idSize > 0 &&
+            HNTreeCodec::Hash(id + header->idSize, header->treeSize) == header->treeHash };
+
+        if (!valid)
+        {
+            HNLog(CZWarning, CZLN, "Discarding invalid cache file {}", path);
+            munmap(map, size);
+            unlink(path.c_str());
+            continue;
+        }
+
+        const std::string clientId(id, header->idSize);
+
+        if (bar->m_clients.contains(clientId))
+        {
+            munmap(map, size);
+            continue;
+        }
+
+        auto client { std::shared_ptr<HNClient>(new HNClient(clientId)) };
+
+        if (!HNTreeCodec::Decode(id + header->idSize, header->treeSize, client->m_events))
+        {
+            HNLog(CZWarning, CZLN, "Discarding malformed cache file {}", path);
+            munmap(map, size);
+            unlink(path.c_str());
+            continue;
+        }
+
+        m_entries[clientId] = { path, header->treeHash, header->lastActiveTime };
+        client->m_lastActiveTime = header->lastActiveTime;
+        munmap(map, size);
+
+        client->m_restored = true;
+        bar->m_clients[clientId] = client;
+        HNLog(CZInfo, CZLN, "Restored client from cache: {}", clientId);
+        bar->onClientCreated.notify(client.get());
+        client->dispatch();
+        restoredAny = true;
+
+        if (clientId == bar->m_activeClientId)
+            bar->setActiveClient(client.get());
+    }
+
+    if (restoredAny)
+        m_expiryTimer.start(RestoredClientTimeoutMs);
+}
+
+void HNCache::markDirty(HNClient *client) noexcept
+{
+    m_dirty.emplace(client->id());
+
+    if (!m_flushTimer.running())
+        m_flushTimer.start(FlushDelayMs);
+}
+
+void HNCache::remove(HNClient *client) noexcept
+{
+    m_dirty.erase(client->id());
+    auto it { m_entries.find(client->id()) };
+
+    if (it == m_entries.end())
+        return;
+
+    unlink(it->second.path.c_str());
+    m_entries.erase(it);
+}
+
+void HNCache::flush() noexcept
+{
+    auto bar { HNBar::Get() };
+    if (!bar) return;
+
+    for (const auto &id : m_dirty)
+        if (auto *client = bar->getClientById(id.c_str()))
+            store(client);
+
+    m_dirty.clear();
+}
+
+void HNCache::store(HNClient *client) noexcept
+{
+    // Restored trees are already on disk, and may still be reconciled.
+    if (client->m_restored)
+        return;
+
+    const std::string tree { client->encodeTree() };
+    const UInt64 hash { HNTreeCodec::Hash(tree.data(), tree.size()) };
+    const std::string path { pathFor(*client) };
+    auto &entry { m_entries[client->id()] };
+
+    if (entry.path == path && entry.hash == hash && entry.lastActiveTime == client->m_lastActiveTime)
+        return;
+
+    std::error_code ec;
+    std::filesystem::create_directories(m_dir, ec);
+
+    const std::string tmpPath { path + ".tmp" };
+    const size_t size { sizeof(FileHeader) + client->id().size() + tree.size() };
+    const int fd { open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) };
+
+    if (fd < 0)
+    {
+        HNLog(CZError, CZLN, "Failed to create cache file {}. {}", tmpPath, strerror(errno));
+        return;
+    }
+
+    void *map { MAP_FAILED };
+
+    if (ftruncate(fd, size) == 0)
+        map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+        HNLog(CZError, CZLN, "Failed to map cache file {}. {}", tmpPath, strerror(errno));
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    FileHeader header {};
+    memcpy(header.magic, FileMagic, sizeof(FileMagic));
+    header.idSize = client->id().size();
+    header.treeSize = tree.size();
+    header.treeHash = hash;
+    header.lastActiveTime = client->m_lastActiveTime;
+
+    auto *dst { static_cast<char*>(map) };
+    memcpy(dst, &header, sizeof(header));
+    memcpy(dst + sizeof(header), client->id().data(), client->id().size());
+    memcpy(dst + sizeof(header) + client->id().size(), tree.data(), tree.size());
+    munmap(map, size);
+
+    if (rename(tmpPath.c_str(), path.c_str()) != 0)
+    {
+        HNLog(CZError, CZLN, "Failed to write cache file {}. {}", path, strerror(errno));
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    // The app name changed, drop the file stored under the old one.
+    if (!entry.path.empty() && entry.path != path)
+        unlink(entry.path.c_str());
+
+    entry.path = path;
+    entry.hash = hash;
+    entry.lastActiveTime = client->m_lastActiveTime;
+}
+
+std::string HNCache::pathFor(const HNClient &client) const noexcept
+{
+    std::string name;
+
+    for (char c : client.name().substr(0, 64))
+        name.push_back(isalnum((unsigned char)c) || c == '-' || c == '.' ? c : '_');
+
+    if (name.empty())
+        name = "unnamed";
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)HNTreeCodec::Hash(client.id().data(), client.id().size()));
+    return m_dir + "/" + name + "-" + key + FileExtension;
+}
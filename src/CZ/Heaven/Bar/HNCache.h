@@ -0,0 +1,98 @@
+#ifndef HNCACHE_H
+#define HNCACHE_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/HNBusPoll.h>
+#include <CZ/Heaven/HNDeadlineTimer.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * @brief Persistent warm-start cache of the clients' committed trees.
+ *
+ * Each client's tree is stored in its own memory-mapped file, named after the
+ * application name and a hash of the client's D-Bus id, and validated with a
+ * content hash. Files are rewritten shortly after a commit changes their
+ * content and removed when the client disconnects.
+ *
+ * The last time each client was active is stored as well, so resyncs can be
+ * prioritized by recency after a restart (see HNBar::setResyncWindow()).
+ *
+ * When the bar restarts, restore() recreates every cached client right away,
+ * so the menu of the active client can be displayed before the client resends
+ * its state. The resent state is then reconciled against the restored tree
+ * (see HNClient::beginReconcile()). Restored clients that do not re-register
+ * within a few seconds are assumed gone and destroyed.
+ *
+ * @see HNBar::setCacheDir()
+ */
+class CZ::Bar::HNCache
+{
+public:
+    /**
+     * @brief Creates a cache backed by the given directory.
+     *
+     * @param dir Directory where the cache files are stored.
+     */
+    HNCache(const std::string &dir) noexcept;
+
+    /**
+     * @brief Returns the cache directory.
+     */
+    const std::string &dir() const noexcept { return m_dir; }
+
+    /**
+     * @brief Recreates the cached clients not currently known by the bar.
+     */
+    void restore() noexcept;
+
+    /**
+     * @brief Schedules the tree of a client to be written to disk.
+     */
+    void markDirty(HNClient *client) noexcept;
+
+    /**
+     * @brief Removes the cache file of a client.
+     */
+    void remove(HNClient *client) noexcept;
+
+    /**
+     * @brief Milliseconds from @p now until the next pending write or expiry, or -1.
+     *
+     * @see HNBar::timeout()
+     */
+    int timeout(HNDeadlineTimer::Clock::time_point now) const noexcept
+    {
+        return HNBusPoll::MinTimeout(m_flushTimer.timeout(now), m_expiryTimer.timeout(now));
+    }
+
+    /**
+     * @brief Runs the pending writes and expiry if due.
+     *
+     * @see HNBar::processPending()
+     */
+    void fireDue(HNDeadlineTimer::Clock::time_point now) noexcept
+    {
+        m_flushTimer.fireIfDue(now);
+        m_expiryTimer.fireIfDue(now);
+    }
+
+private:
+    struct Entry
+    {
+        std::string path;
+        UInt64 hash {};
+        UInt64 lastActiveTime {};
+    };
+    void flush() noexcept;
+    void store(HNClient *client) noexcept;
+    std::string pathFor(const HNClient &client) const noexcept;
+    std::string m_dir;
+    std::unordered_set<std::string> m_dirty;
+    std::unordered_map<std::string, Entry> m_entries;
+    HNDeadlineTimer m_flushTimer;
+    HNDeadlineTimer m_expiryTimer;
+};
+
+#endif // HNCACHE_H
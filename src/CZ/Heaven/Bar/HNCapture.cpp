@@ -0,0 +1,382 @@
+#include <CZ/Heaven/Bar/HNCapture.h>
+#include <CZ/Heaven/Bar/HNLog.h>
+#include <chrono>
+#include <cstring>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+static constexpr char Magic[8] { 'H', 'N', 'C', 'A', 'P', '0', '0', '1' };
+
+// Records are buffered by stdio, flushed when the capture stops.
+static constexpr size_t FileBufferSize { 1 << 20 };
+
+static UInt64 NowUsec() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void PutVarint(std::string &out, UInt64 value) noexcept
+{
+    while (value >= 0x80)
+    {
+        out.push_back(char((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+
+    out.push_back(char(value));
+}
+
+static void PutString(std::string &out, const char *value) noexcept
+{
+    const size_t len { strlen(value) };
+    PutVarint(out, len);
+    out.append(value, len);
+}
+
+// Appends the arguments of a method call, false if the signature has unsupported types.
+static bool PutArgs(std::string &out, sd_bus_message *m, const char *signature) noexcept
+{
+    for (const char *type = signature; *type; type++)
+    {
+        int r;
+
+        switch (*type)
+        {
+        case 'u':
+        {
+            UInt32 value;
+            r = sd_bus_message_read_basic(m, 'u', &value);
+            PutVarint(out, value);
+            break;
+        }
+        case 't':
+        {
+            UInt64 value;
+            r = sd_bus_message_read_basic(m, 't', &value);
+            PutVarint(out, value);
+            break;
+        }
+        case 'b':
+        {
+            int value;
+            r = sd_bus_message_read_basic(m, 'b', &value);
+            PutVarint(out, value ? 1 : 0);
+            break;
+        }
+        case 's':
+        {
+            const char *value;
+            r = sd_bus_message_read_basic(m, 's', &value);
+            PutString(out, r > 0 ? value : "");
+            break;
+        }
+        case 'a':
+        {
+            if (type[1] != 's')
+                return false;
+
+            type++;
+            r = sd_bus_message_enter_container(m, 'a', "s");
+
+            if (r < 0)
+                return false;
+
+            std::vector<const char*> values;
+            const char *value;
+
+            while ((r = sd_bus_message_read_basic(m, 's', &value)) > 0)
+                values.emplace_back(value);
+
+            sd_bus_message_exit_container(m);
+            PutVarint(out, values.size());
+
+            for (const char *v : values)
+                PutString(out, v);
+            break;
+        }
+        default:
+            return false;
+        }
+
+        if (r < 0)
+            return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<HNCapture> HNCapture::Make(const std::string &path) noexcept
+{
+    FILE *file { fopen(path.c_str(), "we") };
+
+    if (!file)
+    {
+        HNLog(CZError, CZLN, "Failed to create capture file {}. {}", path, strerror(errno));
+        return {};
+    }
+
+    setvbuf(file, nullptr, _IOFBF, FileBufferSize);
+
+    if (fwrite(Magic, sizeof(Magic), 1, file) != 1)
+    {
+        HNLog(CZError, CZLN, "Failed to write capture file {}. {}", path, strerror(errno));
+        fclose(file);
+        return {};
+    }
+
+    return std::shared_ptr<HNCapture>(new HNCapture(file));
+}
+
+HNCapture::HNCapture(FILE *file) noexcept :
+    m_file(file),
+    m_last(NowUsec())
+{}
+
+HNCapture::~HNCapture() noexcept
+{
+    if (fclose(m_file) != 0)
+        HNLog(CZError, CZLN, "Failed to flush the capture file. {}", strerror(errno));
+}
+
+void HNCapture::write(sd_bus_message *m) noexcept
+{
+    const char *member { sd_bus_message_get_member(m) };
+    const char *signature { sd_bus_message_get_signature(m, 1) };
+    const char *sender { sd_bus_message_get_sender(m) };
+
+    if (!member || !signature || !sender)
+        return;
+
+    m_args.clear();
+    const bool supported { PutArgs(m_args, m, signature) };
+    sd_bus_message_rewind(m, 1);
+
+    if (!supported)
+    {
+        HNLog(CZDebug, CZLN, "Method {} not captured, unsupported signature {}", member, signature);
+        return;
+    }
+
+    const UInt32 senderId { senderIndex(sender) };
+    const UInt32 memberId { memberIndex(member, signature) };
+    beginTimed(Message);
+    PutVarint(m_record, senderId);
+    PutVarint(m_record, memberId);
+    m_record += m_args;
+    flush();
+}
+
+void HNCapture::writeDisconnect(sd_bus_message *m) noexcept
+{
+    const char *name, *oldOwner, *newOwner;
+    const int r { sd_bus_message_read(m, "sss", &name, &oldOwner, &newOwner) };
+    sd_bus_message_rewind(m, 1);
+
+    if (r < 0 || newOwner[0] != '\0')
+        return;
+
+    auto it { m_senders.find(oldOwner) };
+
+    // Never sent anything.
+    if (it == m_senders.end())
+        return;
+
+    beginTimed(Disconnect);
+    PutVarint(m_record, it->second);
+    flush();
+    m_senders.erase(it);
+}
+
+UInt32 HNCapture::senderIndex(const char *sender) noexcept
+{
+    auto [it, inserted] { m_senders.try_emplace(sender, m_senderCount) };
+
+    if (inserted)
+    {
+        m_senderCount++;
+        m_record.push_back(char(Sender));
+        PutString(m_record, sender);
+    }
+
+    return it->second;
+}
+
+UInt32 HNCapture::memberIndex(const char *member, const char *signature) noexcept
+{
+    auto [it, inserted] { m_members.try_emplace(std::string(member) + ' ' + signature, UInt32(m_members.size())) };
+
+    if (inserted)
+    {
+        m_record.push_back(char(Member));
+        PutString(m_record, member);
+        PutString(m_record, signature);
+    }
+
+    return it->second;
+}
+
+void HNCapture::beginTimed(Kind kind) noexcept
+{
+    const UInt64 now { NowUsec() };
+    m_record.push_back(char(kind));
+    PutVarint(m_record, now - m_last);
+    m_last = now;
+}
+
+void HNCapture::flush() noexcept
+{
+    if (fwrite(m_record.data(), 1, m_record.size(), m_file) != m_record.size())
+        HNLog(CZError, CZLN, "Failed to write the capture file. {}", strerror(errno));
+
+    m_record.clear();
+}
+
+std::unique_ptr<HNCapture::Reader> HNCapture::Reader::Open(const std::string &path) noexcept
+{
+    FILE *file { fopen(path.c_str(), "re") };
+
+    if (!file)
+    {
+        HNLog(CZError, CZLN, "Failed to open capture file {}. {}", path, strerror(errno));
+        return {};
+    }
+
+    char magic[sizeof(Magic)];
+
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, Magic, sizeof(Magic)) != 0)
+    {
+        HNLog(CZError, CZLN, "{} is not a Heaven capture file", path);
+        fclose(file);
+        return {};
+    }
+
+    return std::unique_ptr<Reader>(new Reader(file));
+}
+
+HNCapture::Reader::~Reader() noexcept
+{
+    fclose(m_file);
+}
+
+bool HNCapture::Reader::next(Record &record) noexcept
+{
+    int kind;
+
+    while ((kind = fgetc(m_file)) != EOF)
+    {
+        UInt64 value;
+
+        switch (kind)
+        {
+        case HNCapture::Sender:
+            if (!readString(m_senders.emplace_back()))
+                return fail();
+            break;
+        case HNCapture::Member:
+        {
+            auto &member { m_members.emplace_back() };
+
+            if (!readString(member.name) || !readString(member.signature))
+                return fail();
+            break;
+        }
+        case HNCapture::Message:
+        case HNCapture::Disconnect:
+        {
+            if (!readVarint(value))
+                return fail();
+
+            m_time += value;
+            record.kind = kind == HNCapture::Message ? Record::Message : Record::Disconnect;
+            record.time = m_time;
+            record.args.clear();
+
+            if (!readVarint(value) || value >= m_senders.size())
+                return fail();
+
+            record.sender = UInt32(value);
+
+            if (kind == HNCapture::Disconnect)
+                return true;
+
+            if (!readVarint(value) || value >= m_members.size())
+                return fail();
+
+            record.member = UInt32(value);
+
+            for (const char *type = m_members[record.member].signature.c_str(); *type; type++)
+            {
+                if (*type == 's')
+                {
+                    if (!readString(std::get<std::string>(record.args.emplace_back(std::string()))))
+                        return fail();
+                }
+                else if (*type == 'a')
+                {
+                    type++;
+                    auto &values { std::get<std::vector<std::string>>(record.args.emplace_back(std::vector<std::string>())) };
+
+                    if (!readVarint(value))
+                        return fail();
+
+                    values.resize(value);
+
+                    for (auto &v : values)
+                        if (!readString(v))
+                            return fail();
+                }
+                else if (!readVarint(value))
+                    return fail();
+                else
+                    record.args.emplace_back(value);
+            }
+
+            return true;
+        }
+        default:
+            return fail();
+        }
+    }
+
+    return false;
+}
+
+bool HNCapture::Reader::readVarint(UInt64 &value) noexcept
+{
+    value = 0;
+
+    for (UInt32 shift = 0; shift < 64; shift += 7)
+    {
+        const int byte { fgetc(m_file) };
+
+        if (byte == EOF)
+            return false;
+
+        value |= UInt64(byte & 0x7F) << shift;
+
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+bool HNCapture::Reader::readString(std::string &value) noexcept
+{
+    UInt64 len;
+
+    // Guards against corrupted lengths.
+    if (!readVarint(len) || len > (1 << 24))
+        return false;
+
+    value.resize(len);
+    return len == 0 || fread(value.data(), len, 1, m_file) == 1;
+}
+
+bool HNCapture::Reader::fail() noexcept
+{
+    m_failed = true;
+    return false;
+}
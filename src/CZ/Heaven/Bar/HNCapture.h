@@ -0,0 +1,166 @@
+#ifndef HNCAPTURE_H
+#define HNCAPTURE_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+#include <systemd/sd-bus.h>
+
+/**
+ * @brief Binary log of the messages received by the bar.
+ *
+ * While a capture runs (see HNBar::startCapture()), every method call received
+ * on the `org.cuarzo.HeavenBar` interface and every disconnection of a recorded
+ * sender is appended to the log with its reception time, before the bar handles
+ * it. Reader reads a log back, the `heaven-replay` tool uses it to feed the
+ * recorded traffic to a bar.
+ *
+ * The file starts with the 8-byte magic `HNCAP001`, followed by records, each
+ * introduced by its kind byte. Integers are LEB128 varints and strings a varint
+ * length followed by their bytes:
+ *
+ * | Kind         | Fields                          | Meaning                                            |
+ * | ------------ | ------------------------------- | -------------------------------------------------- |
+ * | `Sender`     | name                            | Assigns the next sender index to a unique name.    |
+ * | `Member`     | name, signature                 | Assigns the next member index.                     |
+ * | `Message`    | delta, sender, member, args...  | A method call.                                     |
+ * | `Disconnect` | delta, sender                   | The sender left the bus.                           |
+ *
+ * The delta is the time elapsed since the previous timed record in microseconds.
+ * Integer and boolean arguments are varints, strings are strings and string arrays
+ * a count followed by the strings. Sender and member names are thus stored once.
+ */
+class CZ::Bar::HNCapture
+{
+public:
+    /// A recorded argument: an integer or boolean, a string or a string array.
+    using Arg = std::variant<UInt64, std::string, std::vector<std::string>>;
+
+    /// A timed record.
+    struct Record
+    {
+        enum Kind : UInt8
+        {
+            Message,
+            Disconnect
+        };
+
+        Kind kind;
+
+        /// Microseconds since the capture started.
+        UInt64 time;
+
+        /// Index in Reader::senders().
+        UInt32 sender;
+
+        /// Index in Reader::members() (Message only).
+        UInt32 member;
+
+        /// Arguments, following the member's signature (Message only).
+        std::vector<Arg> args;
+    };
+
+    /**
+     * @brief Sequential reader of a capture file.
+     */
+    class Reader
+    {
+    public:
+        /// A recorded method.
+        struct Member
+        {
+            std::string name;
+            std::string signature;
+        };
+
+        /**
+         * @brief Opens a capture file.
+         *
+         * @return The reader, or nullptr if the file can't be read or isn't a capture.
+         */
+        static std::unique_ptr<Reader> Open(const std::string &path) noexcept;
+        ~Reader() noexcept;
+
+        /**
+         * @brief Reads the next timed record, loading the names it refers to.
+         *
+         * @return false at the end of the file or if it is malformed, see failed().
+         */
+        bool next(Record &record) noexcept;
+
+        /**
+         * @brief Whether reading stopped because the file is malformed or truncated.
+         */
+        bool failed() const noexcept { return m_failed; }
+
+        /**
+         * @brief D-Bus unique names of the senders read so far, by index.
+         */
+        const std::vector<std::string> &senders() const noexcept { return m_senders; }
+
+        /**
+         * @brief Members read so far, by index.
+         */
+        const std::vector<Member> &members() const noexcept { return m_members; }
+
+    private:
+        Reader(FILE *file) noexcept : m_file(file) {}
+        bool readVarint(UInt64 &value) noexcept;
+        bool readString(std::string &value) noexcept;
+        bool fail() noexcept;
+        FILE *m_file;
+        bool m_failed { false };
+        UInt64 m_time { 0 };
+        std::vector<std::string> m_senders;
+        std::vector<Member> m_members;
+    };
+
+    ~HNCapture() noexcept;
+
+private:
+    friend struct HNIface;
+    friend class HNBar;
+
+    enum Kind : UInt8
+    {
+        Sender,
+        Member,
+        Message,
+        Disconnect
+    };
+
+    static std::shared_ptr<HNCapture> Make(const std::string &path) noexcept;
+    HNCapture(FILE *file) noexcept;
+
+    // Records a method call, the message is rewound afterwards.
+    void write(sd_bus_message *m) noexcept;
+
+    // Records the disconnection of a recorded sender from a NameOwnerChanged signal.
+    void writeDisconnect(sd_bus_message *m) noexcept;
+
+    // Index of a sender or member, its definition is appended to m_record if new.
+    UInt32 senderIndex(const char *sender) noexcept;
+    UInt32 memberIndex(const char *member, const char *signature) noexcept;
+
+    // Appends the kind and the time elapsed since the previous timed record.
+    void beginTimed(Kind kind) noexcept;
+    void flush() noexcept;
+
+    // Only ever written from the thread that decodes the bar's messages
+    FILE *m_file;
+    std::string m_record;
+    std::string m_args;
+    UInt64 m_last { 0 };
+    UInt32 m_senderCount { 0 };
+
+    // Connected senders and members by name and signature, to their index
+    std::unordered_map<std::string, UInt32> m_senders;
+    std::unordered_map<std::string, UInt32> m_members;
+};
+
+#endif // HNCAPTURE_H
@@ -6,12 +6,66 @@
 #include <CZ/Heaven/Bar/HNToggle.h>
 #include <CZ/Heaven/Bar/HNDivider.h>
 #include <CZ/Heaven/Bar/HNEvent.h>
+#include <CZ/Heaven/Bar/HNCache.h>
+#include <CZ/Heaven/Bar/HNTreeCodec.h>
 #include <CZ/Heaven/Bar/HNLog.h>
+#include <CZ/Heaven/HNTrace.h>
+#include <algorithm>
+#include <bit>
 
 using namespace CZ::Bar;
 
+// Structural events a delta may hold before being applied anyway.
+static constexpr size_t MaxDeferredStructure { 4096 };
+
 CZ::Bar::HNClient::~HNClient() noexcept = default;
 
+// Heap bytes held by a string, short strings are stored inline.
+static size_t StringHeapSize(const std::string &str) noexcept
+{
+    return str.capacity() > std::string().capacity() ? str.capacity() + 1 : 0;
+}
+
+size_t CZ::Bar::HNClient::memoryUsage() const noexcept
+{
+    // Node of m_objects plus the shared_ptr control block.
+    constexpr size_t perObject { sizeof(decltype(m_objects)::value_type) + 2 * sizeof(void*) + 4 * sizeof(void*) };
+
+    size_t size { sizeof(HNClient) + StringHeapSize(m_name) + StringHeapSize(m_evictedTree) };
+
+    // Deferred events, roughly.
+    size += m_pending.size() * (sizeof(HNObjectTitleChangedEvent) + 4 * sizeof(void*));
+
+    for (const auto &[id, obj] : m_objects)
+    {
+        size += perObject;
+
+        switch (obj->type()) {
+        case HNObject::Topbar:  size += sizeof(HNTopbar);  break;
+        case HNObject::Menu:    size += sizeof(HNMenu);    break;
+        case HNObject::Action:  size += sizeof(HNAction);  break;
+        case HNObject::Toggle:  size += sizeof(HNToggle);  break;
+        case HNObject::Divider: size += sizeof(HNDivider); break;
+        default: break;
+        }
+
+        if (auto *withTitle = dynamic_cast<HNWithTitle*>(obj.get()))
+            size += StringHeapSize(withTitle->title());
+
+        if (auto *withIcon = dynamic_cast<HNWithIcon*>(obj.get()))
+            size += StringHeapSize(withIcon->icon());
+
+        if (auto *withShortcut = dynamic_cast<HNWithShortcut*>(obj.get()))
+            size += StringHeapSize(withShortcut->shortcut());
+
+        // Node in the parent's children list.
+        if (auto *withParent = dynamic_cast<HNWithParent*>(obj.get()); withParent && withParent->parent())
+            size += 3 * sizeof(void*);
+    }
+
+    return size;
+}
+
 static bool IsObjectOrSubchildOf(HNObject *obj, HNObject *possibleParent) noexcept
 {
     if (!obj) return false;
@@ -34,456 +88,855 @@ void CZ::Bar::HNClient::dispatch() noexcept
         auto event { std::move(m_events.front()) };
         m_events.pop();
 
-        switch (event->type) {
-        case HNEvent::ClientNameChanged:
-        {
-            auto *e { static_cast<HNClientNameChangedEvent*>(event.get()) };
+        if (apply(event))
+            m_stats.eventsApplied++;
+        else
+            m_stats.eventsRejected++;
+    }
 
-            if (e->name == m_name)
-                continue;
+    finishCommit(bar.get());
+}
 
-            m_name = e->name;
-            bar->onClientNameChanged.notify(this);
-            break;
-        }
-        case HNEvent::ClientTopbarChanged:
+bool CZ::Bar::HNClient::apply(std::unique_ptr<HNEvent> &event) noexcept
+{
+    switch (event->type) {
+    case HNEvent::ClientNameChanged:
+    {
+        auto *e { static_cast<HNClientNameChangedEvent*>(event.get()) };
+
+        if (e->name == m_name)
+            return true;
+
+        m_stringBytes += e->name.size() - m_name.size();
+        m_name = e->name;
+        hold(HNEvent::ClientNameChanged);
+        break;
+    }
+    case HNEvent::ClientTopbarChanged:
+    {
+        auto *e { static_cast<HNClientTopbarChangedEvent*>(event.get()) };
+        auto it { m_objects.find(e->topbarId) };
+
+        if (it == m_objects.end())
         {
-            auto *e { static_cast<HNClientTopbarChangedEvent*>(event.get()) };
-            auto it { m_objects.find(e->topbarId) };
+            HNLog(CZDebug, CZLN, "Attempt to activate non-existent topbar");
+            return false;
+        }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Attempt to activate non-existent topbar");
-                continue;
-            }
+        auto topbar { dynamic_pointer_cast<HNTopbar>((*it).second) };
 
-            auto topbar { dynamic_pointer_cast<HNTopbar>((*it).second) };
+        if (!topbar)
+        {
+            HNLog(CZDebug, CZLN, "Object is not a topbar");
+            return false;
+        }
 
-            if (!topbar)
-            {
-                HNLog(CZDebug, CZLN, "Object is not a topbar");
-                continue;
-            }
+        if (topbar.get() == m_activeTopbar.lock().get())
+            return true;
 
-            if (topbar.get() == m_activeTopbar.lock().get())
-                continue;
+        m_activeTopbar = topbar;
+        hold(HNEvent::ClientTopbarChanged);
+        break;
+    }
+    case HNEvent::ObjectCreated:
+    {
+        auto *e { static_cast<HNObjectCreatedEvent*>(event.get()) };
 
-            m_activeTopbar = topbar;
-            bar->onClientTopbarChanged.notify(this);
-            break;
+        if (e->objectId == 0)
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id 0");
+            return false;
         }
-        case HNEvent::ObjectCreated:
+
+        // A missing entry (destroyed meanwhile) is a fresh create.
+        if (m_reconciling && m_unconfirmed.erase(e->objectId))
         {
-            auto *e { static_cast<HNObjectCreatedEvent*>(event.get()) };
+            const auto restored { m_objects.find(e->objectId) };
 
-            if (e->objectId == 0)
+            // Restored object re-sent with the same role, keep it.
+            if (restored != m_objects.end())
             {
-                HNLog(CZDebug, CZLN, "Invalid object id 0");
-                continue;
-            }
+                if (restored->second->type() == e->objectType)
+                    return true;
 
-            if (m_objects.contains(e->objectId))
-            {
-                HNLog(CZDebug, CZLN, "Object id {} already in use", e->objectId);
-                continue;
+                destroyObject(e->objectId);
             }
+        }
 
-            std::shared_ptr<HNObject> obj;
-
-            switch (e->objectType) {
-            case HNObject::Type::Topbar:
-                obj = std::shared_ptr<HNTopbar>(new HNTopbar(e->objectId));
-                break;
-            case HNObject::Type::Menu:
-                obj = std::shared_ptr<HNMenu>(new HNMenu(e->objectId));
-                break;
-            case HNObject::Type::Action:
-                obj = std::shared_ptr<HNAction>(new HNAction(e->objectId));
-                break;
-            case HNObject::Type::Toggle:
-                obj = std::shared_ptr<HNToggle>(new HNToggle(e->objectId));
-                break;
-            case HNObject::Type::Divider:
-                obj = std::shared_ptr<HNDivider>(new HNDivider(e->objectId));
-                break;
-            default:
-                continue;
-            }
+        if (m_objects.contains(e->objectId))
+        {
+            HNLog(CZDebug, CZLN, "Object id {} already in use", e->objectId);
+            return false;
+        }
+
+        std::shared_ptr<HNObject> obj;
 
-            obj->m_client = this;
-            m_objects[e->objectId] = obj;
-            bar->onObjectCreated.notify(obj.get());
+        switch (e->objectType) {
+        case HNObject::Type::Topbar:
+            obj = std::shared_ptr<HNTopbar>(new HNTopbar(e->objectId));
+            break;
+        case HNObject::Type::Menu:
+            obj = std::shared_ptr<HNMenu>(new HNMenu(e->objectId));
+            break;
+        case HNObject::Type::Action:
+            obj = std::shared_ptr<HNAction>(new HNAction(e->objectId));
+            break;
+        case HNObject::Type::Toggle:
+            obj = std::shared_ptr<HNToggle>(new HNToggle(e->objectId));
             break;
+        case HNObject::Type::Divider:
+            obj = std::shared_ptr<HNDivider>(new HNDivider(e->objectId));
+            break;
+        default:
+            return false;
         }
-        case HNEvent::ObjectDestroyed:
+
+        obj->m_client = this;
+        m_objects[e->objectId] = obj;
+        hold(HNEvent::ObjectCreated, obj);
+        break;
+    }
+    case HNEvent::ObjectDestroyed:
+    {
+        auto *e { static_cast<HNObjectDestroyedEvent*>(event.get()) };
+
+        if (!m_objects.contains(e->objectId))
         {
-            auto *e { static_cast<HNObjectDestroyedEvent*>(event.get()) };
-            auto it { m_objects.find(e->objectId) };
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
+        }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
-            }
+        destroyObject(e->objectId);
+        break;
+    }
+    case HNEvent::ObjectTitleChanged:
+    {
+        auto *e { static_cast<HNObjectTitleChangedEvent*>(event.get()) };
+        auto it { m_objects.find(e->objectId) };
 
-            // Keep the object alive until after the destroyed signal is emitted.
-            auto obj { it->second };
+        if (it == m_objects.end())
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
+        }
 
-            if (auto topbar = dynamic_cast<HNTopbar*>(obj.get()))
-            {
-                if (topbar == m_activeTopbar.lock().get())
-                {
-                    m_activeTopbar.reset();
-                    bar->onClientTopbarChanged.notify(this);
-                }
-            }
+        auto *withTitle { dynamic_cast<HNWithTitle*>(it->second.get()) };
 
-            // Detach the object from its parent, if any.
-            if (auto withParent = dynamic_cast<HNWithParent*>(obj.get()))
-            {
-                if (auto *parentObj = withParent->m_parent)
-                {
-                    auto *withChildren { dynamic_cast<HNWithChildren*>(parentObj) };
-                    withChildren->m_children.erase(withParent->m_parentLink);
-                    withParent->m_parent = nullptr;
-                    bar->onObjectParentChanged.notify(obj.get());
-                }
-            }
+        if (!withTitle)
+        {
+            HNLog(CZDebug, CZLN, "Object {} type has no title", e->objectId);
+            return false;
+        }
 
-            // Detach every child of the object, if any.
-            if (auto withChildren = dynamic_cast<HNWithChildren*>(obj.get()))
-            {
-                while (!withChildren->children().empty())
-                {
-                    auto *childObj { withChildren->m_children.back() };
-                    auto *childWithParent { dynamic_cast<HNWithParent*>(childObj) };
-                    withChildren->m_children.pop_back();
-                    childWithParent->m_parent = nullptr;
-                    bar->onObjectParentChanged.notify(childObj);
-                }
-            }
+        if (withTitle->title() == e->title)
+            return true;
 
-            m_objects.erase(it);
-            bar->onObjectDestroyed.notify(obj.get());
-            break;
+        m_stringBytes += e->title.size() - withTitle->m_title.size();
+        withTitle->m_title = e->title;
+        hold(HNEvent::ObjectTitleChanged, it->second);
+        break;
+    }
+    case HNEvent::ObjectParentChanged:
+    {
+        auto *e { static_cast<HNObjectParentChangedEvent*>(event.get()) };
+        auto child { m_objects.find(e->objectId) };
+
+        if (child == m_objects.end())
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
         }
-        case HNEvent::ObjectTitleChanged:
+
+        auto *withParent { dynamic_cast<HNWithParent*>(child->second.get()) };
+
+        if (!withParent)
         {
-            auto *e { static_cast<HNObjectTitleChangedEvent*>(event.get()) };
-            auto it { m_objects.find(e->objectId) };
+            HNLog(CZDebug, CZLN, "Object {} type cannot have a parent", e->objectId);
+            return false;
+        }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
-            }
+        if (e->parentId == 0)
+        {
+            if (!withParent->parent())
+                return true;
 
-            auto *withTitle { dynamic_cast<HNWithTitle*>(it->second.get()) };
+            auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->m_parent) };
+            withChildren->m_children.erase(withParent->m_parentLink);
+            withParent->m_parent = nullptr;
+            hold(HNEvent::ObjectParentChanged, child->second);
+        }
+        else
+        {
+            auto parent { m_objects.find(e->parentId) };
 
-            if (!withTitle)
+            if (parent == m_objects.end())
             {
-                HNLog(CZDebug, CZLN, "Object {} type has no title", e->objectId);
-                continue;
+                HNLog(CZDebug, CZLN, "Invalid object id {}", e->parentId);
+                return false;
             }
 
-            if (withTitle->title() == e->title)
-                continue;
+            if (m_reconciling)
+                m_reconcileOrder[e->parentId].emplace_back(e->objectId);
 
-            withTitle->m_title = e->title;
-            bar->onObjectTitleChanged.notify(it->second.get());
-            break;
-        }
-        case HNEvent::ObjectParentChanged:
-        {
-            auto *e { static_cast<HNObjectParentChangedEvent*>(event.get()) };
-            auto child { m_objects.find(e->objectId) };
+            if (withParent->parent() == parent->second.get())
+                return true;
 
-            if (child == m_objects.end())
+            auto *parentWithChildren { dynamic_cast<HNWithChildren*>(parent->second.get()) };
+
+            if (!parentWithChildren)
             {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
+                HNLog(CZDebug, CZLN, "Object {} cannot host children", e->parentId);
+                return false;
             }
 
-            auto *withParent { dynamic_cast<HNWithParent*>(child->second.get()) };
-
-            if (!withParent)
+            if (IsObjectOrSubchildOf(parent->second.get(), child->second.get()))
             {
-                HNLog(CZDebug, CZLN, "Object {} type cannot have a parent", e->objectId);
-                continue;
+                HNLog(CZDebug, CZLN, "The new parent {} is equal or a subchild of the object {}", e->parentId, e->objectId);
+                return false;
             }
 
-            if (e->parentId == 0)
+            if (parent->second->type() == HNObject::Topbar && child->second->type() != HNObject::Menu)
             {
-                if (!withParent->parent())
-                    continue;
+                HNLog(CZDebug, CZLN, "HNTopbar can only host HNMenus");
+                return false;
+            }
 
+            if (withParent->parent())
+            {
                 auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->m_parent) };
                 withChildren->m_children.erase(withParent->m_parentLink);
                 withParent->m_parent = nullptr;
-                bar->onObjectParentChanged.notify(child->second.get());
             }
-            else
-            {
-                auto parent { m_objects.find(e->parentId) };
 
-                if (parent == m_objects.end())
-                {
-                    HNLog(CZDebug, CZLN, "Invalid object id {}", e->parentId);
-                    continue;
-                }
+            parentWithChildren->m_children.emplace_back(child->second.get());
+            withParent->m_parent = parent->second.get();
+            withParent->m_parentLink = std::prev(parentWithChildren->m_children.end());
+            hold(HNEvent::ObjectParentChanged, child->second);
+        }
 
-                if (withParent->parent() == parent->second.get())
-                    continue;
+        break;
+    }
+    case HNEvent::ObjectInsertedBefore:
+    {
+        auto *e { static_cast<HNObjectInsertedBeforeEvent*>(event.get()) };
 
-                auto *parentWithChildren { dynamic_cast<HNWithChildren*>(parent->second.get()) };
+        if (e->objectId == e->siblingId)
+        {
+            HNLog(CZDebug, CZLN, "Object and sibling are the same");
+            return false;
+        }
 
-                if (!parentWithChildren)
-                {
-                    HNLog(CZDebug, CZLN, "Object {} cannot host children", e->parentId);
-                    continue;
-                }
+        auto it { m_objects.find(e->objectId) };
 
-                if (IsObjectOrSubchildOf(parent->second.get(), child->second.get()))
-                {
-                    HNLog(CZDebug, CZLN, "The new parent {} is equal or a subchild of the object {}", e->parentId, e->objectId);
-                    continue;
-                }
+        if (it == m_objects.end())
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
+        }
 
-                if (parent->second->type() == HNObject::Topbar && child->second->type() != HNObject::Menu)
-                {
-                    HNLog(CZDebug, CZLN, "HNTopbar can only host HNMenus");
-                    continue;
-                }
+        auto *withParent { dynamic_cast<HNWithParent*>(it->second.get()) };
 
-                if (withParent->parent())
-                {
-                    auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->m_parent) };
-                    withChildren->m_children.erase(withParent->m_parentLink);
-                    withParent->m_parent = nullptr;
-                }
+        if (!withParent)
+        {
+            HNLog(CZDebug, CZLN, "Object {} type cannot have a parent", e->objectId);
+            return false;
+        }
 
-                parentWithChildren->m_children.emplace_back(child->second.get());
-                withParent->m_parent = parent->second.get();
-                withParent->m_parentLink = std::prev(parentWithChildren->m_children.end());
-                bar->onObjectParentChanged.notify(child->second.get());
-            }
+        if (e->siblingId == 0)
+        {
+            if (withParent->parent())
+            {
+                auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->parent()) };
 
-            break;
+                if (withChildren->children().back() == it->second.get())
+                    return true;
+
+                withChildren->m_children.erase(withParent->m_parentLink);
+                withChildren->m_children.emplace_back(it->second.get());
+                withParent->m_parentLink = std::prev(withChildren->m_children.end());
+                hold(HNEvent::ObjectInsertedBefore, it->second);
+            }
+            else
+                return true;
         }
-        case HNEvent::ObjectInsertedBefore:
+        else
         {
-            auto *e { static_cast<HNObjectInsertedBeforeEvent*>(event.get()) };
+            auto sibling { m_objects.find(e->siblingId) };
 
-            if (e->objectId == e->siblingId)
+            if (sibling == m_objects.end())
             {
-                HNLog(CZDebug, CZLN, "Object and sibling are the same");
-                continue;
+                HNLog(CZDebug, CZLN, "Invalid sibling id {}", e->siblingId);
+                return false;
             }
 
-            auto it { m_objects.find(e->objectId) };
+            auto *siblingWithParent { dynamic_cast<HNWithParent*>(sibling->second.get()) };
 
-            if (it == m_objects.end())
+            if (!siblingWithParent)
             {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
+                HNLog(CZDebug, CZLN, "Sibling {} type cannot have a parent", e->siblingId);
+                return false;
             }
 
-            auto *withParent { dynamic_cast<HNWithParent*>(it->second.get()) };
+            if (!siblingWithParent->parent())
+            {
+                HNLog(CZDebug, CZLN, "Sibling {} has no parent", e->siblingId);
+                return false;
+            }
 
-            if (!withParent)
+            if (siblingWithParent->parent()->type() == HNObject::Topbar && it->second->type() != HNObject::Menu)
             {
-                HNLog(CZDebug, CZLN, "Object {} type cannot have a parent", e->objectId);
-                continue;
+                HNLog(CZDebug, CZLN, "HNTopbar can only host HNMenus");
+                return false;
             }
 
-            if (e->siblingId == 0)
+            if (withParent->parent() == siblingWithParent->parent())
             {
-                if (withParent->parent())
-                {
-                    auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->parent()) };
+                auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->parent()) };
 
-                    if (withChildren->children().back() == it->second.get())
-                        continue;
+                if (siblingWithParent->m_parentLink != withChildren->m_children.begin() &&
+                    std::prev(siblingWithParent->m_parentLink) == withParent->m_parentLink)
+                    return true;
 
-                    withChildren->m_children.erase(withParent->m_parentLink);
-                    withChildren->m_children.emplace_back(it->second.get());
-                    withParent->m_parentLink = std::prev(withChildren->m_children.end());
-                    bar->onObjectInsertedBefore.notify(it->second.get(), nullptr);
-                }
-                else
-                    continue;
+                withChildren->m_children.erase(withParent->m_parentLink);
+                withParent->m_parentLink = withChildren->m_children.insert(
+                    siblingWithParent->m_parentLink,
+                    it->second.get());
+
+                hold(HNEvent::ObjectInsertedBefore, it->second, sibling->second);
             }
             else
             {
-                auto sibling { m_objects.find(e->siblingId) };
-
-                if (sibling == m_objects.end())
+                if (withParent->parent())
                 {
-                    HNLog(CZDebug, CZLN, "Invalid sibling id {}", e->siblingId);
-                    continue;
+                    auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->parent()) };
+                    withChildren->m_children.erase(withParent->m_parentLink);
                 }
+                auto *withChildren { dynamic_cast<HNWithChildren*>(siblingWithParent->parent()) };
+                withParent->m_parent = siblingWithParent->parent();
+                withParent->m_parentLink = withChildren->m_children.insert(
+                    siblingWithParent->m_parentLink,
+                    it->second.get());
 
-                auto *siblingWithParent { dynamic_cast<HNWithParent*>(sibling->second.get()) };
+                hold(HNEvent::ObjectInsertedBefore, it->second, sibling->second);
+            }
+        }
 
-                if (!siblingWithParent)
-                {
-                    HNLog(CZDebug, CZLN, "Sibling {} type cannot have a parent", e->siblingId);
-                    continue;
-                }
+        break;
+    }
+    case HNEvent::ObjectIconChanged:
+    {
+        auto *e { static_cast<HNObjectIconChangedEvent*>(event.get()) };
+        auto it { m_objects.find(e->objectId) };
 
-                if (!siblingWithParent->parent())
-                {
-                    HNLog(CZDebug, CZLN, "Sibling {} has no parent", e->siblingId);
-                    continue;
-                }
+        if (it == m_objects.end())
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
+        }
 
-                if (siblingWithParent->parent()->type() == HNObject::Topbar && it->second->type() != HNObject::Menu)
-                {
-                    HNLog(CZDebug, CZLN, "HNTopbar can only host HNMenus");
-                    continue;
-                }
+        auto *withIcon { dynamic_cast<HNWithIcon*>(it->second.get()) };
 
-                if (withParent->parent() == siblingWithParent->parent())
-                {
-                    auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->parent()) };
+        if (!withIcon)
+        {
+            HNLog(CZDebug, CZLN, "Object {} type has no icon", e->objectId);
+            return false;
+        }
 
-                    if (siblingWithParent->m_parentLink != withChildren->m_children.begin() &&
-                        std::prev(siblingWithParent->m_parentLink) == withParent->m_parentLink)
-                        continue;
+        if (withIcon->icon() == e->icon)
+            return true;
 
-                    withChildren->m_children.erase(withParent->m_parentLink);
-                    withParent->m_parentLink = withChildren->m_children.insert(
-                        siblingWithParent->m_parentLink,
-                        it->second.get());
+        m_stringBytes += e->icon.size() - withIcon->m_icon.size();
+        withIcon->m_icon = e->icon;
+        hold(HNEvent::ObjectIconChanged, it->second);
+        break;
+    }
+    case HNEvent::ObjectEnabledChanged:
+    {
+        auto *e { static_cast<HNObjectEnabledChangedEvent*>(event.get()) };
+        auto it { m_objects.find(e->objectId) };
 
-                    bar->onObjectInsertedBefore.notify(it->second.get(), sibling->second.get());
-                }
-                else
-                {
-                    if (withParent->parent())
-                    {
-                        auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->parent()) };
-                        withChildren->m_children.erase(withParent->m_parentLink);
-                    }
-                    auto *withChildren { dynamic_cast<HNWithChildren*>(siblingWithParent->parent()) };
-                    withParent->m_parent = siblingWithParent->parent();
-                    withParent->m_parentLink = withChildren->m_children.insert(
-                        siblingWithParent->m_parentLink,
-                        it->second.get());
-
-                    bar->onObjectInsertedBefore.notify(it->second.get(), sibling->second.get());
-                }
-            }
+        if (it == m_objects.end())
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
+        }
 
-            break;
+        auto *withEnabled { dynamic_cast<HNWithEnabled*>(it->second.get()) };
+
+        if (!withEnabled)
+        {
+            HNLog(CZDebug, CZLN, "Object {} type is has no 'enabled' param", e->objectId);
+            return false;
         }
-        case HNEvent::ObjectIconChanged:
+
+        if (withEnabled->enabled() == e->enabled)
+            return true;
+
+        withEnabled->m_enabled = e->enabled;
+        hold(HNEvent::ObjectEnabledChanged, it->second);
+        break;
+    }
+    case HNEvent::ObjectShortcutChanged:
+    {
+        auto *e { static_cast<HNObjectShortcutChangedEvent*>(event.get()) };
+        auto it { m_objects.find(e->objectId) };
+
+        if (it == m_objects.end())
         {
-            auto *e { static_cast<HNObjectIconChangedEvent*>(event.get()) };
-            auto it { m_objects.find(e->objectId) };
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
+        }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
-            }
+        auto *withShortcut { dynamic_cast<HNWithShortcut*>(it->second.get()) };
 
-            auto *withIcon { dynamic_cast<HNWithIcon*>(it->second.get()) };
+        if (!withShortcut)
+        {
+            HNLog(CZDebug, CZLN, "Object {} type has no shortcut", e->objectId);
+            return false;
+        }
 
-            if (!withIcon)
-            {
-                HNLog(CZDebug, CZLN, "Object {} type has no icon", e->objectId);
-                continue;
-            }
+        if (withShortcut->shortcut() == e->shortcut)
+            return true;
 
-            if (withIcon->icon() == e->icon)
-                continue;
+        m_stringBytes += e->shortcut.size() - withShortcut->m_shortcut.size();
+        withShortcut->m_shortcut = e->shortcut;
+        hold(HNEvent::ObjectShortcutChanged, it->second);
+        break;
+    }
+    case HNEvent::ToggleCheckedChanged:
+    {
+        auto *e { static_cast<HNToggleCheckedChangedEvent*>(event.get()) };
+        auto it { m_objects.find(e->objectId) };
 
-            withIcon->m_icon = e->icon;
-            bar->onObjectIconChanged.notify(it->second.get());
-            break;
+        if (it == m_objects.end())
+        {
+            HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
+            return false;
         }
-        case HNEvent::ObjectEnabledChanged:
+
+        auto *toggle { dynamic_cast<HNToggle*>(it->second.get()) };
+
+        if (!toggle)
         {
-            auto *e { static_cast<HNObjectEnabledChangedEvent*>(event.get()) };
-            auto it { m_objects.find(e->objectId) };
+            HNLog(CZDebug, CZLN, "Object {} type is not toggle", e->objectId);
+            return false;
+        }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
-            }
+        if (toggle->checked() == e->checked)
+            return true;
 
-            auto *withEnabled { dynamic_cast<HNWithEnabled*>(it->second.get()) };
+        toggle->m_checked = e->checked;
+        hold(HNEvent::ToggleCheckedChanged, it->second);
+        break;
+    }
+    default:
+        break;
+    }
 
-            if (!withEnabled)
-            {
-                HNLog(CZDebug, CZLN, "Object {} type is has no 'enabled' param", e->objectId);
-                continue;
-            }
+    return true;
+}
 
-            if (withEnabled->enabled() == e->enabled)
-                continue;
+void CZ::Bar::HNClient::finishCommit(HNBar *bar) noexcept
+{
+    if (m_reconciling)
+        finishReconcile();
 
-            withEnabled->m_enabled = e->enabled;
-            bar->onObjectEnabledChanged.notify(it->second.get());
-            break;
-        }
-        case HNEvent::ObjectShortcutChanged:
+    if (bar->m_cache)
+        bar->m_cache->markDirty(this);
+
+    if (bar->m_memoryBudget > 0)
+        bar->scheduleMemoryBudget();
+
+    if (m_staged.empty())
+    {
+        // The whole commit is visible by now.
+        emitHeldSignals(bar);
+
+        UInt32 focusSerial { 0 };
+
+        for (const auto &ack : m_commitAcks)
         {
-            auto *e { static_cast<HNObjectShortcutChangedEvent*>(event.get()) };
-            auto it { m_objects.find(e->objectId) };
+            bar->sendCommitApplied(this, ack);
+            focusSerial = std::max(focusSerial, ack.focusSerial);
+        }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
-            }
+        m_commitAcks.clear();
 
-            auto *withShortcut { dynamic_cast<HNWithShortcut*>(it->second.get()) };
+        // Only complete commits are published.
+        bar->publishSnapshot(this);
 
-            if (!withShortcut)
-            {
-                HNLog(CZDebug, CZLN, "Object {} type has no shortcut", e->objectId);
-                continue;
+        // May activate the client, now that its topbar is up to date.
+        if (focusSerial)
+            bar->focusCommitted(this, focusSerial);
+    }
+
+    if (!m_silent)
+        bar->onClientCommitted.notify(this);
+}
+
+void CZ::Bar::HNClient::emitHeldSignals(HNBar *bar) noexcept
+{
+    [[maybe_unused]] const UInt32 traceId { HNTrace::ClientId(m_id.c_str()) };
+    [[maybe_unused]] const UInt32 seq { dispatchSeq() };
+
+    // Handlers may change the tree again, their signals are emitted right after.
+    while (!m_heldSignals.empty())
+    {
+        const auto signals { std::exchange(m_heldSignals, {}) };
+
+        for (const auto &held : signals)
+        {
+            HN_TRACE(BarSignal, traceId, seq, held.type);
+            HNObject *obj { held.object.get() };
+
+            // Only these nodes (and their ancestors) are rebuilt in the next snapshot.
+            if (bar->m_snapshots && obj)
+                m_snapshotDirty.emplace(obj->id());
+
+            switch (held.type) {
+            case HNEvent::ClientNameChanged:     bar->onClientNameChanged.notify(this); break;
+            case HNEvent::ClientTopbarChanged:   bar->onClientTopbarChanged.notify(this); break;
+            case HNEvent::ObjectCreated:         bar->onObjectCreated.notify(obj); break;
+            case HNEvent::ObjectDestroyed:       bar->onObjectDestroyed.notify(obj); break;
+            case HNEvent::ObjectTitleChanged:    bar->onObjectTitleChanged.notify(obj); break;
+            case HNEvent::ObjectParentChanged:   bar->onObjectParentChanged.notify(obj); break;
+            case HNEvent::ObjectInsertedBefore:  bar->onObjectInsertedBefore.notify(obj, held.sibling.get()); break;
+            case HNEvent::ObjectIconChanged:     bar->onObjectIconChanged.notify(obj); break;
+            case HNEvent::ObjectEnabledChanged:  bar->onObjectEnabledChanged.notify(obj); break;
+            case HNEvent::ObjectShortcutChanged: bar->onObjectShortcutChanged.notify(obj); break;
+            case HNEvent::ToggleCheckedChanged:  bar->onToggleCheckedChanged.notify(static_cast<HNToggle*>(obj)); break;
             }
+        }
+    }
+}
 
-            if (withShortcut->shortcut() == e->shortcut)
-                continue;
+void CZ::Bar::HNClient::stage() noexcept
+{
+    takePending(m_staged);
+    m_queuedCreates = 0;
+    m_queuedStringBytes = 0;
+
+    while (!m_events.empty())
+    {
+        m_staged.push(std::move(m_events.front()));
+        m_events.pop();
+    }
+}
+
+bool CZ::Bar::HNClient::dispatchSlice(HNBar *bar, std::chrono::steady_clock::time_point deadline, UInt32 maxEvents) noexcept
+{
+    const auto start { std::chrono::steady_clock::now() };
+    auto elapsed = [start]
+    {
+        return UInt64(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    };
+
+    [[maybe_unused]] const UInt32 traceId { HNTrace::ClientId(m_id.c_str()) };
+    [[maybe_unused]] const UInt32 seq { dispatchSeq() };
+    HN_TRACE(BarDispatchStart, traceId, seq, 0);
 
-            withShortcut->m_shortcut = e->shortcut;
-            bar->onObjectShortcutChanged.notify(it->second.get());
+    // Checking the clock on every event would cost more than most events.
+    for (UInt32 i = 1; !m_staged.empty(); i++)
+    {
+        auto event { std::move(m_staged.front()) };
+        m_staged.pop();
+        if (apply(event))
+            m_stats.eventsApplied++;
+        else
+            m_stats.eventsRejected++;
+
+        if (m_staged.empty())
             break;
+
+        if (i >= maxEvents || (i % 32 == 0 && std::chrono::steady_clock::now() >= deadline))
+        {
+            m_commitDispatchTime += elapsed();
+            HN_TRACE(BarDispatchEnd, traceId, seq, 0);
+            return false;
         }
-        case HNEvent::ToggleCheckedChanged:
+    }
+
+    finishCommit(bar);
+    HN_TRACE(BarDispatchEnd, traceId, seq, 1);
+    recordDispatchTime(std::exchange(m_commitDispatchTime, 0) + elapsed());
+    return true;
+}
+
+void CZ::Bar::HNClient::recordDispatchTime(UInt64 usec) noexcept
+{
+    m_stats.dispatchTime[std::min<size_t>(std::bit_width(usec), DispatchTimeBuckets - 1)]++;
+}
+
+CZ::Bar::HNClient::Stats CZ::Bar::HNClient::stats() const noexcept
+{
+    Stats stats { m_stats };
+    stats.objects = m_objects.size();
+    stats.stringBytes = m_stringBytes;
+    return stats;
+}
+
+void CZ::Bar::HNClient::destroyObject(UInt32 id) noexcept
+{
+    auto it { m_objects.find(id) };
+
+    if (it == m_objects.end())
+        return;
+
+    auto obj { it->second };
+
+    if (auto topbar = dynamic_cast<HNTopbar*>(obj.get()))
+    {
+        if (topbar == m_activeTopbar.lock().get())
         {
-            auto *e { static_cast<HNToggleCheckedChangedEvent*>(event.get()) };
-            auto it { m_objects.find(e->objectId) };
+            m_activeTopbar.reset();
+            hold(HNEvent::ClientTopbarChanged);
+        }
+    }
 
-            if (it == m_objects.end())
-            {
-                HNLog(CZDebug, CZLN, "Invalid object id {}", e->objectId);
-                continue;
-            }
+    // Detach the object from its parent, if any.
+    if (auto withParent = dynamic_cast<HNWithParent*>(obj.get()))
+    {
+        if (auto *parentObj = withParent->m_parent)
+        {
+            auto *withChildren { dynamic_cast<HNWithChildren*>(parentObj) };
+            withChildren->m_children.erase(withParent->m_parentLink);
+            withParent->m_parent = nullptr;
+            hold(HNEvent::ObjectParentChanged, obj);
+        }
+    }
 
-            auto *toggle { dynamic_cast<HNToggle*>(it->second.get()) };
+    // Detach every child of the object, if any.
+    if (auto withChildren = dynamic_cast<HNWithChildren*>(obj.get()))
+    {
+        while (!withChildren->children().empty())
+        {
+            auto *childObj { withChildren->m_children.back() };
+            auto *childWithParent { dynamic_cast<HNWithParent*>(childObj) };
+            withChildren->m_children.pop_back();
+            childWithParent->m_parent = nullptr;
 
-            if (!toggle)
-            {
-                HNLog(CZDebug, CZLN, "Object {} type is not toggle", e->objectId);
-                continue;
-            }
+            if (const auto child { m_objects.find(childObj->id()) }; child != m_objects.end())
+                hold(HNEvent::ObjectParentChanged, child->second);
+        }
+    }
+
+    if (auto *withTitle = dynamic_cast<HNWithTitle*>(obj.get()))
+        m_stringBytes -= withTitle->title().size();
+
+    if (auto *withIcon = dynamic_cast<HNWithIcon*>(obj.get()))
+        m_stringBytes -= withIcon->icon().size();
+
+    if (auto *withShortcut = dynamic_cast<HNWithShortcut*>(obj.get()))
+        m_stringBytes -= withShortcut->shortcut().size();
+
+    m_objects.erase(it);
+    m_unconfirmed.erase(id);
+    hold(HNEvent::ObjectDestroyed, obj);
+}
+
+void CZ::Bar::HNClient::beginReconcile() noexcept
+{
+    m_reconciling = true;
+    m_unconfirmed.clear();
+    m_reconcileOrder.clear();
 
-            if (toggle->checked() == e->checked)
+    for (const auto &[id, obj] : m_objects)
+        m_unconfirmed.emplace(id);
+}
+
+void CZ::Bar::HNClient::finishReconcile() noexcept
+{
+    m_reconciling = false;
+
+    // 1. Objects the client no longer has (destroyObject() erases them from the set).
+    const auto unconfirmed { std::exchange(m_unconfirmed, {}) };
+
+    for (UInt32 id : unconfirmed)
+        destroyObject(id);
+
+    // 2. Restored parent links the client did not re-send.
+    for (const auto &[id, obj] : m_objects)
+    {
+        auto *withParent { dynamic_cast<HNWithParent*>(obj.get()) };
+
+        if (!withParent || !withParent->m_parent)
+            continue;
+
+        const auto order { m_reconcileOrder.find(withParent->m_parent->id()) };
+
+        if (order != m_reconcileOrder.end() && std::find(order->second.begin(), order->second.end(), id) != order->second.end())
+            continue;
+
+        auto *withChildren { dynamic_cast<HNWithChildren*>(withParent->m_parent) };
+        withChildren->m_children.erase(withParent->m_parentLink);
+        withParent->m_parent = nullptr;
+        hold(HNEvent::ObjectParentChanged, obj);
+    }
+
+    // 3. Children order, re-sent parent by parent in display order.
+    for (const auto &[parentId, childrenIds] : m_reconcileOrder)
+    {
+        auto parent { m_objects.find(parentId) };
+
+        if (parent == m_objects.end())
+            continue;
+
+        auto *withChildren { dynamic_cast<HNWithChildren*>(parent->second.get()) };
+        std::list<HNObject*> expected;
+
+        for (UInt32 childId : childrenIds)
+        {
+            auto child { m_objects.find(childId) };
+
+            if (child == m_objects.end())
                 continue;
 
-            toggle->m_checked = e->checked;
-            bar->onToggleCheckedChanged.notify(toggle);
-            break;
+            auto *withParent { dynamic_cast<HNWithParent*>(child->second.get()) };
+
+            if (withParent->m_parent == parent->second.get() &&
+                std::find(expected.begin(), expected.end(), child->second.get()) == expected.end())
+                expected.emplace_back(child->second.get());
         }
-        default:
-            break;
+
+        if (expected == withChildren->m_children)
+            continue;
+
+        for (auto *child : expected)
+        {
+            auto *withParent { dynamic_cast<HNWithParent*>(child) };
+            withChildren->m_children.erase(withParent->m_parentLink);
+            withChildren->m_children.emplace_back(child);
+            withParent->m_parentLink = std::prev(withChildren->m_children.end());
+
+            if (const auto childIt { m_objects.find(child->id()) }; childIt != m_objects.end())
+                hold(HNEvent::ObjectInsertedBefore, childIt->second);
         }
     }
 
+    m_reconcileOrder.clear();
+}
+
+void CZ::Bar::HNClient::evict() noexcept
+{
+    if (m_evicted || m_restored || m_reconciling || committing() || m_objects.empty())
+        return;
+
+    std::string tree { HNTreeCodec::Compress(HNTreeCodec::Encode(*this)) };
+    HNLog(CZDebug, CZLN, "Evicting tree of client {} ({} objects, {} bytes compressed)", m_id, m_objects.size(), tree.size());
+
+    auto bar { HNBar::Get() };
+
+    if (bar)
+        bar->onClientEvicted.notify(this);
+
+    // The tree is only stored differently, not changed.
+    m_silent = true;
+    m_evictedObjects = m_objects.size();
+    m_evictedStringBytes = m_stringBytes;
+
+    while (!m_objects.empty())
+        destroyObject(m_objects.begin()->first);
+
+    m_evictedStringBytes -= m_stringBytes;
+    m_silent = false;
+    m_snapshotRebuild = true;
+
+    m_evictedTree = std::move(tree);
+    m_evictedTree.shrink_to_fit();
+    m_evicted = true;
+
+    // Don't keep the evicted nodes alive.
+    if (bar)
+        bar->publishSnapshot(this);
+}
+
+void CZ::Bar::HNClient::rehydrate() noexcept
+{
+    if (!m_evicted)
+        return;
+
+    // Uncommitted events must wait for the client's next commit.
+    std::queue<std::unique_ptr<HNEvent>> pending;
+    std::swap(pending, m_events);
+
+    std::string tree;
+
+    if (!HNTreeCodec::Decompress(m_evictedTree.data(), m_evictedTree.size(), tree) ||
+        !HNTreeCodec::Decode(tree.data(), tree.size(), m_events))
+        HNLog(CZError, CZLN, "Failed to rehydrate the tree of client {}", m_id);
+
+    m_evictedTree = {};
+    m_evicted = false;
+    m_evictedObjects = 0;
+    m_evictedStringBytes = 0;
+    HNLog(CZDebug, CZLN, "Rehydrating tree of client {}", m_id);
+    m_silent = true;
+    m_snapshotRebuild = true;
+    dispatch();
+    m_silent = false;
+    std::swap(pending, m_events);
+
+    if (auto bar = HNBar::Get())
+        bar->onClientRehydrated.notify(this);
+}
+
+std::string CZ::Bar::HNClient::encodeTree() const noexcept
+{
+    if (!m_evicted)
+        return HNTreeCodec::Encode(*this);
+
+    std::string tree;
+    HNTreeCodec::Decompress(m_evictedTree.data(), m_evictedTree.size(), tree);
+    return tree;
+}
+
+void CZ::Bar::HNClient::defer() noexcept
+{
+    m_queuedCreates = 0;
+    m_queuedStringBytes = 0;
+
+    while (!m_events.empty())
+    {
+        m_pending.push(std::move(m_events.front()));
+        m_events.pop();
+    }
+
+    // Structural changes are not coalesced, don't let them pile up.
+    if (m_pending.structureSize() > MaxDeferredStructure)
+        applyPendingChanges();
+}
+
+void CZ::Bar::HNClient::takePending(std::queue<std::unique_ptr<HNEvent>> &queue) noexcept
+{
+    m_pending.take(queue);
+    m_commitAcks.insert(m_commitAcks.end(), m_deferredAcks.begin(), m_deferredAcks.end());
+    m_deferredAcks.clear();
+}
+
+void CZ::Bar::HNClient::applyPendingChanges() noexcept
+{
+    if (m_pending.empty())
+        return;
+
+    // Must not overtake the commit being applied.
+    if (committing())
+    {
+        takePending(m_staged);
+        return;
+    }
+
+    rehydrate();
+
+    // Uncommitted events must wait for the client's next commit.
+    std::queue<std::unique_ptr<HNEvent>> uncommitted;
+    std::swap(uncommitted, m_events);
+    takePending(m_events);
+
+    // The deferred commits, applied at once.
+    const auto start { std::chrono::steady_clock::now() };
+    HN_TRACE(BarDispatchStart, HNTrace::ClientId(m_id.c_str()), m_receivedSeq, 0);
+    dispatch();
+    HN_TRACE(BarDispatchEnd, HNTrace::ClientId(m_id.c_str()), m_receivedSeq, 1);
+    recordDispatchTime(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    std::swap(uncommitted, m_events);
 }
@@ -3,12 +3,19 @@
 
 #include <CZ/Heaven/Heaven.h>
 #include <CZ/Heaven/Bar/HNEvent.h>
+#include <CZ/Heaven/Bar/HNDelta.h>
+#include <CZ/Heaven/Bar/HNSnapshot.h>
 #include <CZ/Core/CZObject.h>
 #include <CZ/Core/CZWeak.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <memory>
 #include <string>
 #include <queue>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 /**
  * @brief Represents, on the bar side, a client connected over D-Bus.
@@ -46,18 +53,279 @@ public:
      */
     ~HNClient() noexcept;
 
+    /**
+     * @brief Checks whether the client was restored from the warm-start cache
+     *        and has not re-sent its state yet.
+     *
+     * @see HNBar::setCacheDir()
+     */
+    bool restored() const noexcept { return m_restored; }
+
+    /**
+     * @brief Checks whether the client's tree is currently evicted.
+     *
+     * Evicted clients keep their name, but all their objects are destroyed and
+     * kept compressed in memory. They are recreated as soon as the client
+     * becomes active or commits new changes. Neither emits object signals, see
+     * HNBar::onClientEvicted and HNBar::onClientRehydrated.
+     *
+     * @see HNBar::setMemoryBudget()
+     */
+    bool evicted() const noexcept { return m_evicted; }
+
+    /**
+     * @brief Returns an estimate of the memory held by the client, in bytes.
+     *
+     * Includes its objects, their strings and, if evicted, the compressed tree.
+     */
+    size_t memoryUsage() const noexcept;
+
+    /**
+     * @brief Checks whether the client has committed changes not applied yet.
+     *
+     * @see HNBar::setDeferInactiveCommits()
+     */
+    bool hasPendingChanges() const noexcept { return !m_pending.empty(); }
+
+    /**
+     * @brief Applies the changes deferred while the client was inactive.
+     *
+     * Must be called before inspecting the objects of an inactive client if
+     * commit deferral is enabled. Does nothing if there are no pending changes.
+     *
+     * @see HNBar::setDeferInactiveCommits()
+     */
+    void applyPendingChanges() noexcept;
+
+    /**
+     * @brief Checks whether a commit is being applied incrementally.
+     *
+     * While true, the client's objects already reflect part of the commit, but
+     * none of its change signals has been emitted: they are emitted together
+     * once the whole commit is applied, right before HNBar::onClientCommitted.
+     * Render threads get the same atomic view from HNBar::snapshot().
+     *
+     * @see HNBar::setDispatchBudget()
+     */
+    bool committing() const noexcept { return !m_staged.empty(); }
+
+    /**
+     * @brief Sets the scheduling weight of the client.
+     *
+     * In each round of the bar's commit scheduler, an inactive client can apply
+     * up to `weight * HNBar::schedulingQuantum()` events before the next client
+     * is serviced. The active client is always serviced first.
+     *
+     * @param weight Weight (at least 1). Defaults to 1.
+     */
+    void setSchedulingWeight(UInt32 weight) noexcept { m_schedulingWeight = std::max(weight, 1U); }
+
+    /**
+     * @brief Returns the scheduling weight of the client.
+     *
+     * @see setSchedulingWeight()
+     */
+    UInt32 schedulingWeight() const noexcept { return m_schedulingWeight; }
+
+    /// Number of buckets of Stats::dispatchTime.
+    static constexpr size_t DispatchTimeBuckets { 16 };
+
+    /**
+     * @brief Runtime counters of a client.
+     *
+     * Counters start at zero when the client registers and only grow.
+     *
+     * @see stats()
+     */
+    struct Stats
+    {
+        /// Event and commit messages received from the client.
+        UInt64 messagesReceived { 0 };
+
+        /// Events admitted into the client's queue.
+        UInt64 eventsEnqueued { 0 };
+
+        /// Events applied to the tree, including those replayed from the cache or an evicted tree.
+        UInt64 eventsApplied { 0 };
+
+        /// Events discarded by validation (unknown IDs, invalid types or parents).
+        UInt64 eventsRejected { 0 };
+
+        /// Events dropped over the client limits (see HNBar::setClientLimits()).
+        UInt64 eventsDropped { 0 };
+
+        /// Commits received.
+        UInt64 commits { 0 };
+
+        /// Objects alive.
+        UInt64 objects { 0 };
+
+        /// Bytes held by the client strings (name, titles, icons and shortcuts).
+        UInt64 stringBytes { 0 };
+
+        /**
+         * @brief Histogram of the time spent applying each commit.
+         *
+         * Bucket 0 counts the commits applied in less than 1 µs, bucket `i` those
+         * taking [2^(i-1), 2^i) µs, and the last one everything slower. Time spent
+         * waiting to be scheduled is not included.
+         */
+        std::array<UInt64, DispatchTimeBuckets> dispatchTime {};
+    };
+
+    /**
+     * @brief Returns the runtime counters of the client.
+     *
+     * Also served over D-Bus through the `org.cuarzo.HeavenBar.Stats` interface.
+     */
+    Stats stats() const noexcept;
+
 private:
     friend struct HNIface;
     friend class HNBar;
+    friend class HNCache;
+    friend class HNTreeCodec;
+    friend class HNIOThread;
+    friend class HNLoopback;
+    friend class HNSnapshot;
     HNClient(const std::string &id) noexcept :
         m_id(id) {}
+
+    // Sequenced commit awaiting its CommitApplied acknowledgement.
+    struct CommitAck
+    {
+        UInt32 seq;
+        UInt64 clientTime;
+        std::chrono::steady_clock::time_point received;
+
+        // Compositor focus serial referenced by the commit, 0 if none
+        UInt32 focusSerial { 0 };
+    };
+
     void dispatch() noexcept;
+
+    // Returns false if the event was rejected by validation, signals are held (see emitHeldSignals()).
+    bool apply(std::unique_ptr<HNEvent> &event) noexcept;
+    void finishCommit(HNBar *bar) noexcept;
+
+    // Moves the committed events to m_staged, to be applied in slices.
+    void stage() noexcept;
+
+    // Applies up to maxEvents staged events before the deadline, returns true once the commit is complete.
+    bool dispatchSlice(HNBar *bar, std::chrono::steady_clock::time_point deadline, UInt32 maxEvents) noexcept;
+    void destroyObject(UInt32 id) noexcept;
+
+    /*
+     * Reconciliation validates a tree restored from the cache against the state
+     * the client re-sends after re-registering. Objects, parents and children
+     * order not confirmed by the next commit are removed or fixed, and unchanged
+     * properties emit no signals.
+     */
+    void beginReconcile() noexcept;
+    void finishReconcile() noexcept;
+
+    // Compresses the tree into m_evictedTree and destroys all objects.
+    void evict() noexcept;
+
+    // Recreates the objects of an evicted tree.
+    void rehydrate() noexcept;
+
+    // Signal of an applied change, held until the whole commit is applied (objects are kept alive until then).
+    struct HeldSignal
+    {
+        HNEvent::Type type;
+        std::shared_ptr<HNObject> object;
+        std::shared_ptr<HNObject> sibling;
+    };
+
+    // Holds the signal of a change, unless silenced.
+    void hold(HNEvent::Type type, std::shared_ptr<HNObject> object = {}, std::shared_ptr<HNObject> sibling = {}) noexcept
+    {
+        if (!m_silent)
+            m_heldSignals.emplace_back(type, std::move(object), std::move(sibling));
+    }
+
+    // Emits the held signals in the order the changes were applied.
+    void emitHeldSignals(HNBar *bar) noexcept;
+
+    // Encoded tree, also valid while evicted.
+    std::string encodeTree() const noexcept;
+
+    // Folds the committed events into m_pending.
+    void defer() noexcept;
+
+    // Moves the deferred changes to @p queue, and their acknowledgements to m_commitAcks.
+    void takePending(std::queue<std::unique_ptr<HNEvent>> &queue) noexcept;
+
     std::string m_id;
     std::string m_name;
     std::weak_ptr<HNTopbar> m_activeTopbar;
     std::unordered_map<UInt32, std::shared_ptr<HNObject>> m_objects;
     std::queue<std::unique_ptr<HNEvent>> m_events;
+
+    // Committed events being applied incrementally
+    std::queue<std::unique_ptr<HNEvent>> m_staged;
+    std::vector<CommitAck> m_commitAcks;
+
+    // Acknowledgements of deferred commits, sent once their changes are applied
+    std::vector<CommitAck> m_deferredAcks;
+
+    // Acknowledgements of commits received under backpressure, sent once the resent state is applied
+    std::vector<CommitAck> m_droppedAcks;
+    UInt32 m_schedulingWeight { 1 };
+
+    // Runtime counters, and the time spent so far applying the staged commit (µs)
+    Stats m_stats;
+    UInt64 m_commitDispatchTime { 0 };
+    void recordDispatchTime(UInt64 usec) noexcept;
+
+    // Correlation IDs (see HNTrace): last commit sequence received, clicks sent, and the sequence of the commit being applied
+    UInt32 m_receivedSeq { 0 };
+    UInt32 m_clicksSent { 0 };
+    UInt32 dispatchSeq() const noexcept { return m_commitAcks.empty() ? m_receivedSeq : m_commitAcks.back().seq; }
+
+    // Resource accounting (see HNBar::setClientLimits())
+    bool m_backpressured { false };
+    UInt32 m_queuedCreates { 0 };
+    size_t m_queuedStringBytes { 0 };
+    size_t m_stringBytes { 0 };
     bool m_destroyed { false };
+    bool m_restored { false };
+    bool m_reconciling { false };
+    bool m_evicted { false };
+
+    // Objects and string bytes of the evicted tree, still counted against the limits
+    size_t m_evictedObjects { 0 };
+    size_t m_evictedStringBytes { 0 };
+
+    // Set while evicting or rehydrating, which emit no signals of their own
+    bool m_silent { false };
+    std::vector<HeldSignal> m_heldSignals;
+    std::string m_evictedTree;
+
+    // Committed events deferred while inactive
+    HNDelta m_pending;
+
+    // Last time the client was active (ms since epoch), used to prioritize resyncs
+    UInt64 m_lastActiveTime { 0 };
+
+    // Latest focus serial referenced by an applied commit, and whether the client ever referenced one
+    UInt32 m_focusSerial { 0 };
+    bool m_focusAware { false };
+
+    // Restored objects not re-created yet by the client
+    std::unordered_set<UInt32> m_unconfirmed;
+
+    // Children order re-sent by the client (parent ID, children IDs)
+    std::unordered_map<UInt32, std::vector<UInt32>> m_reconcileOrder;
+
+    // Last published tree, the nodes it reuses from, and the objects changed since (see HNBar::setSnapshots())
+    std::shared_ptr<const HNSnapshot::Client> m_snapshot;
+    HNSnapshot::NodeCache m_snapshotNodes;
+    std::unordered_set<UInt32> m_snapshotDirty;
+
+    // Set when the tree changed without signals, rebuilt from scratch
+    bool m_snapshotRebuild { true };
 };
 
 #endif // HNCLIENT_H
@@ -0,0 +1,70 @@
+#include <CZ/Heaven/Bar/HNDelta.h>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+// Object a property event targets, 0 for client properties.
+static UInt32 PropertyTarget(const HNEvent &event) noexcept
+{
+    switch (event.type) {
+    case HNEvent::ObjectTitleChanged:    return static_cast<const HNObjectTitleChangedEvent&>(event).objectId;
+    case HNEvent::ObjectIconChanged:     return static_cast<const HNObjectIconChangedEvent&>(event).objectId;
+    case HNEvent::ObjectEnabledChanged:  return static_cast<const HNObjectEnabledChangedEvent&>(event).objectId;
+    case HNEvent::ObjectShortcutChanged: return static_cast<const HNObjectShortcutChangedEvent&>(event).objectId;
+    case HNEvent::ToggleCheckedChanged:  return static_cast<const HNToggleCheckedChangedEvent&>(event).objectId;
+    default:                             return 0;
+    }
+}
+
+void HNDelta::push(std::unique_ptr<HNEvent> event) noexcept
+{
+    switch (event->type) {
+    case HNEvent::ObjectCreated:
+    case HNEvent::ObjectParentChanged:
+    case HNEvent::ObjectInsertedBefore:
+        m_structure.emplace_back(std::move(event));
+        return;
+    case HNEvent::ObjectDestroyed:
+    {
+        const UInt32 id { static_cast<HNObjectDestroyedEvent*>(event.get())->objectId };
+
+        // Properties set before the destruction no longer apply.
+        std::erase_if(m_properties, [id](const auto &property) { return property.first.first == id; });
+
+        // Activating a topbar that is then destroyed leaves no topbar active, keep that order.
+        auto topbar { m_properties.find({ 0, HNEvent::ClientTopbarChanged }) };
+
+        if (topbar != m_properties.end() && static_cast<HNClientTopbarChangedEvent*>(topbar->second.get())->topbarId == id)
+        {
+            m_structure.emplace_back(std::move(topbar->second));
+            m_properties.erase(topbar);
+        }
+
+        m_structure.emplace_back(std::move(event));
+        return;
+    }
+    default:
+    {
+        const UInt32 target { PropertyTarget(*event) };
+        m_properties[{ target, event->type }] = std::move(event);
+        return;
+    }
+    }
+}
+
+void HNDelta::take(std::queue<std::unique_ptr<HNEvent>> &events) noexcept
+{
+    for (auto &event : m_structure)
+        events.push(std::move(event));
+
+    for (auto &[key, event] : m_properties)
+        events.push(std::move(event));
+
+    clear();
+}
+
+void HNDelta::clear() noexcept
+{
+    m_structure.clear();
+    m_properties.clear();
+}
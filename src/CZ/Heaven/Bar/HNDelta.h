@@ -0,0 +1,66 @@
+#ifndef HNDELTA_H
+#define HNDELTA_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/Bar/HNEvent.h>
+#include <map>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Coalesced set of committed but not yet applied client events.
+ *
+ * Structural events (object creation and destruction, parent changes and
+ * reordering) are kept in order, while properties (name, active topbar,
+ * titles, icons, etc.) only keep their last value. Properties of objects
+ * destroyed within the delta are dropped.
+ *
+ * Taking the delta yields the structural events first and then the
+ * properties, which leads to the same final state as applying every event in
+ * its original order.
+ */
+class CZ::Bar::HNDelta
+{
+public:
+    /**
+     * @brief Folds an event into the delta.
+     */
+    void push(std::unique_ptr<HNEvent> event) noexcept;
+
+    /**
+     * @brief Moves the delta into an event queue and clears it.
+     *
+     * @param events Queue the events are appended to.
+     */
+    void take(std::queue<std::unique_ptr<HNEvent>> &events) noexcept;
+
+    /**
+     * @brief Discards all events.
+     */
+    void clear() noexcept;
+
+    /**
+     * @brief Checks whether the delta holds no events.
+     */
+    bool empty() const noexcept { return m_structure.empty() && m_properties.empty(); }
+
+    /**
+     * @brief Returns the number of structural events, which are not coalesced.
+     */
+    size_t structureSize() const noexcept { return m_structure.size(); }
+
+    /**
+     * @brief Returns the total number of events held.
+     */
+    size_t size() const noexcept { return m_structure.size() + m_properties.size(); }
+
+private:
+    std::vector<std::unique_ptr<HNEvent>> m_structure;
+
+    // Last value of each property (object ID or 0 for client properties, event type)
+    std::map<std::pair<UInt32, UInt32>, std::unique_ptr<HNEvent>> m_properties;
+};
+
+#endif // HNDELTA_H
@@ -0,0 +1,232 @@
+#include <CZ/Heaven/Bar/HNIOThread.h>
+#include <CZ/Heaven/Bar/HNLog.h>
+#include <CZ/Heaven/HNBusPoll.h>
+#include <CZ/Heaven/HNTrace.h>
+#include <CZ/Core/CZEventSource.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+// Events after which a batch is handed over even if the client didn't commit yet.
+static constexpr size_t MaxBatchEvents { 1024 };
+
+std::unique_ptr<HNIOThread> HNIOThread::Make(int (*setup)(sd_bus*, void*), std::function<void(Batch&)> apply) noexcept
+{
+    std::unique_ptr<HNIOThread> io { new HNIOThread(std::move(apply)) };
+
+    int r = sd_bus_open_user_with_description(&io->m_bus, "heaven-bar-io");
+
+    if (r < 0)
+    {
+        HNLog(CZError, CZLN, "Failed to open the I/O thread bus connection. {}", strerror(-r));
+        return {};
+    }
+
+    io->m_calls = std::make_unique<HNCallTracker>(io->m_bus);
+    io->m_postedFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    const int batchesFd { eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) };
+
+    if (io->m_postedFd < 0 || batchesFd < 0)
+    {
+        HNLog(CZError, CZLN, "Failed to create the I/O thread eventfds. {}", strerror(errno));
+
+        if (batchesFd >= 0)
+            close(batchesFd);
+
+        return {};
+    }
+
+    io->m_batchesFd = batchesFd;
+    io->m_batchesSource = CZEventSource::Make(batchesFd, EPOLLIN, CZOwn::Own, [io = io.get()](int, UInt32)
+    {
+        io->applyBatches();
+    });
+
+    if (!io->m_batchesSource || setup(io->m_bus, io.get()) < 0)
+        return {};
+
+    io->m_thread = std::thread(&HNIOThread::run, io.get());
+    return io;
+}
+
+HNIOThread::~HNIOThread() noexcept
+{
+    if (m_thread.joinable())
+    {
+        m_stop.store(true, std::memory_order_release);
+        eventfd_write(m_postedFd, 1);
+        m_thread.join();
+    }
+
+    m_batchesSource.reset();
+
+    // Replies posted after the last iteration.
+    m_postedWakeup.store(true, std::memory_order_relaxed);
+    runPosted();
+    m_calls.reset();
+
+    if (m_bus)
+        sd_bus_flush_close_unref(m_bus);
+
+    if (m_postedFd >= 0)
+        close(m_postedFd);
+}
+
+void HNIOThread::post(std::function<void()> task) noexcept
+{
+    m_posted.push(std::move(task));
+
+    // Only after the push completed, see HNMpscQueue.
+    if (!m_postedWakeup.exchange(true, std::memory_order_acq_rel))
+        eventfd_write(m_postedFd, 1);
+}
+
+void HNIOThread::reply(Batch &batch, bool success) noexcept
+{
+    if (!batch.request)
+        return;
+
+    post([request = std::exchange(batch.request, nullptr), success]
+    {
+        sd_bus_reply_method_return(request, "b", (int)success);
+        sd_bus_message_unref(request);
+    });
+}
+
+void HNIOThread::queueEvent(const char *sender, std::unique_ptr<HNEvent> event, size_t stringBytes, bool createsObject) noexcept
+{
+    HN_TRACE(BarReceive, HNTrace::ClientId(sender), m_receivedSeqs[sender] + 1, event->type);
+
+    auto &batch { m_pending[sender] };
+
+    if (!batch)
+        batch = std::make_unique<Batch>(Batch::Events, sender);
+
+    batch->events.emplace_back(std::move(event), stringBytes, createsObject);
+
+    // Keeps the client limits effective for clients that never commit.
+    if (batch->events.size() >= MaxBatchEvents)
+        flush(sender);
+}
+
+void HNIOThread::queue(std::unique_ptr<Batch> batch) noexcept
+{
+#ifdef HEAVEN_TRACE
+    if (batch->kind == Batch::Commit)
+    {
+        auto &seq { m_receivedSeqs[batch->sender] };
+        seq = batch->ack ? batch->ack->seq : seq + 1;
+    }
+#endif
+
+    flush(batch->sender);
+    push(std::move(batch));
+}
+
+void HNIOThread::drop(const std::string &sender) noexcept
+{
+    m_pending.erase(sender);
+    m_receivedSeqs.erase(sender);
+}
+
+void HNIOThread::run() noexcept
+{
+    while (!m_stop.load(std::memory_order_acquire))
+    {
+        runPosted();
+
+        int r;
+
+        while ((r = sd_bus_process(m_bus, nullptr)) > 0) {}
+
+        if (r < 0)
+        {
+            HNLog(CZError, CZLN, "I/O thread bus connection failed. {}", strerror(-r));
+            break;
+        }
+
+        // Everything received so far is handed over at once.
+        flushAll();
+        m_outstandingCalls.store(m_calls->outstanding(), std::memory_order_relaxed);
+        wait();
+    }
+
+    flushAll();
+}
+
+void HNIOThread::wait() noexcept
+{
+    pollfd fds[2] {
+        { sd_bus_get_fd(m_bus), (short)HNBusPoll::Events(m_bus), 0 },
+        { m_postedFd, POLLIN, 0 }};
+
+    if (poll(fds, 2, HNBusPoll::Timeout(m_bus)) > 0 && (fds[1].revents & POLLIN))
+    {
+        eventfd_t value;
+        eventfd_read(m_postedFd, &value);
+    }
+}
+
+void HNIOThread::runPosted() noexcept
+{
+    if (!m_postedWakeup.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    std::function<void()> task;
+
+    while (m_posted.pop(task))
+    {
+        task();
+        task = nullptr;
+    }
+}
+
+void HNIOThread::flush(const std::string &sender) noexcept
+{
+    auto it { m_pending.find(sender) };
+
+    if (it == m_pending.end())
+        return;
+
+    auto batch { std::move(it->second) };
+    m_pending.erase(it);
+    push(std::move(batch));
+}
+
+void HNIOThread::flushAll() noexcept
+{
+    for (auto &[sender, batch] : m_pending)
+        push(std::move(batch));
+
+    m_pending.clear();
+}
+
+void HNIOThread::push(std::unique_ptr<Batch> batch) noexcept
+{
+    m_batches.push(std::move(batch));
+
+    if (!m_batchesWakeup.exchange(true, std::memory_order_acq_rel))
+        eventfd_write(m_batchesFd, 1);
+}
+
+void HNIOThread::applyBatches() noexcept
+{
+    // Also called by HNBar::processPending(), the eventfd may be watched by a foreign loop.
+    eventfd_t value;
+    eventfd_read(m_batchesFd, &value);
+
+    if (!m_batchesWakeup.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    std::unique_ptr<Batch> batch;
+
+    while (m_batches.pop(batch))
+    {
+        m_apply(*batch);
+        batch.reset();
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef HNIOTHREAD_H
+#define HNIOTHREAD_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/HNCallTracker.h>
+#include <CZ/Heaven/HNMpscQueue.h>
+#include <CZ/Heaven/Bar/HNClient.h>
+#include <CZ/Heaven/Bar/HNEvent.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <systemd/sd-bus.h>
+
+/**
+ * @brief Dedicated thread decoding the bar's incoming D-Bus traffic.
+ *
+ * Owns a private bus connection that holds the `org.cuarzo.HeavenBar` name.
+ * Method calls are parsed and replied on this thread, and the decoded events
+ * are grouped into per-client batches handed to the main thread through a
+ * lock-free queue, so the main thread only applies them.
+ *
+ * Replies that depend on the bar state (the batch keeps the request until
+ * reply() is called) and the calls from the bar to its clients are posted back
+ * to this thread, so clients keep seeing a single bar connection.
+ *
+ * @see HNBar::GetOrMake()
+ */
+class CZ::Bar::HNIOThread
+{
+public:
+    /// A decoded event waiting to be admitted by the main thread.
+    struct Entry
+    {
+        std::unique_ptr<HNEvent> event;
+        size_t stringBytes;
+        bool createsObject;
+    };
+
+    /// Decoded messages handed to the main thread, in reception order.
+    struct Batch
+    {
+        enum Kind
+        {
+            Events,
+            Commit,
+            RegisterClient,
+            AnnounceClient,
+            SetActiveClient,
+            SetPrefetchHints,
+            GetStats,
+            NameOwnerChanged
+        };
+
+        Batch(Kind kind, const std::string &sender) noexcept : kind(kind), sender(sender) {}
+        ~Batch() noexcept { if (request) sd_bus_message_unref(request); }
+
+        Kind kind;
+
+        // D-Bus unique name of the client (the old owner for NameOwnerChanged)
+        std::string sender;
+
+        // Events
+        std::vector<Entry> events;
+
+        // Commit (unset for unsequenced commits)
+        std::optional<HNClient::CommitAck> ack;
+
+        // SetActiveClient (client id and focus serial) and NameOwnerChanged
+        std::string name;
+        std::string newOwner;
+        UInt32 serial { 0 };
+
+        // SetPrefetchHints
+        std::vector<std::string> hints;
+
+        // RegisterClient and SetActiveClient (replied through reply()), and GetStats
+        sd_bus_message *request {};
+    };
+
+    /**
+     * @brief Opens the connection and starts the thread.
+     *
+     * @param setup Registers the bar interface on the connection, with the thread as userdata.
+     * @param apply Invoked on the main thread for each batch.
+     * @return The thread, or nullptr on failure.
+     */
+    static std::unique_ptr<HNIOThread> Make(int (*setup)(sd_bus*, void*), std::function<void(Batch&)> apply) noexcept;
+
+    /**
+     * @brief Stops the thread, sends the pending replies and closes the connection.
+     */
+    ~HNIOThread() noexcept;
+
+    /**
+     * @brief Runs a task on the I/O thread. Can be called from any thread.
+     */
+    void post(std::function<void()> task) noexcept;
+
+    /**
+     * @brief Replies to a RegisterClient or SetActiveClient batch. Main thread only.
+     */
+    void reply(Batch &batch, bool success) noexcept;
+
+    /**
+     * @brief Calls tracker of the I/O connection. I/O thread only.
+     */
+    HNCallTracker &calls() noexcept { return *m_calls; }
+
+    /**
+     * @brief The I/O connection. I/O thread only.
+     */
+    sd_bus *bus() const noexcept { return m_bus; }
+
+    /**
+     * @brief Number of calls awaiting a reply, as of the last loop iteration.
+     */
+    size_t outstandingCalls() const noexcept { return m_outstandingCalls.load(std::memory_order_relaxed); }
+
+    /**
+     * @name I/O thread side
+     * @{
+     */
+
+    /// Appends an event to the sender's batch.
+    void queueEvent(const char *sender, std::unique_ptr<HNEvent> event, size_t stringBytes, bool createsObject) noexcept;
+
+    /// Hands the sender's pending events and then @p batch to the main thread.
+    void queue(std::unique_ptr<Batch> batch) noexcept;
+
+    /// Discards the pending events of a sender.
+    void drop(const std::string &sender) noexcept;
+
+    /** @} */
+
+    /**
+     * @brief Applies the batches handed over so far. Main thread only.
+     */
+    void applyBatches() noexcept;
+
+    /**
+     * @brief Eventfd readable while batches wait to be applied, see HNBar::fd().
+     */
+    int wakeupFd() const noexcept { return m_batchesFd; }
+
+private:
+    HNIOThread(std::function<void(Batch&)> apply) noexcept : m_apply(std::move(apply)) {}
+    void run() noexcept;
+    void wait() noexcept;
+    void runPosted() noexcept;
+    void flush(const std::string &sender) noexcept;
+    void flushAll() noexcept;
+    void push(std::unique_ptr<Batch> batch) noexcept;
+
+    sd_bus *m_bus {};
+    std::unique_ptr<HNCallTracker> m_calls;
+    std::thread m_thread;
+    std::atomic<bool> m_stop { false };
+    std::atomic<size_t> m_outstandingCalls { 0 };
+    std::function<void(Batch&)> m_apply;
+
+    // Events not handed over yet, per sender (I/O thread)
+    std::unordered_map<std::string, std::unique_ptr<Batch>> m_pending;
+
+    // Last commit sequence received per sender, for the BarReceive trace point (I/O thread)
+    std::unordered_map<std::string, UInt32> m_receivedSeqs;
+
+    // I/O thread -> main thread
+    HNMpscQueue<std::unique_ptr<Batch>> m_batches;
+    std::atomic<bool> m_batchesWakeup { false };
+    std::shared_ptr<CZEventSource> m_batchesSource;
+    int m_batchesFd { -1 };
+
+    // Any thread -> I/O thread
+    HNMpscQueue<std::function<void()>> m_posted;
+    std::atomic<bool> m_postedWakeup { false };
+    int m_postedFd { -1 };
+};
+
+#endif // HNIOTHREAD_H
@@ -0,0 +1,362 @@
+#include <CZ/Heaven/Bar/HNLoopback.h>
+#include <CZ/Heaven/Bar/HNEvent.h>
+#include <chrono>
+#include <utility>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+void HNLoopback::setCompositor(const std::string &id) noexcept
+{
+    Batch batch { Batch::NameOwnerChanged, m_compositorId };
+    batch.name = "org.cuarzo.HeavenCompositor";
+    batch.newOwner = id;
+    m_compositorId = id;
+    m_apply(batch);
+}
+
+void HNLoopback::setActiveClient(const std::string &clientId, UInt32 serial) noexcept
+{
+    Batch batch { Batch::SetActiveClient, m_compositorId };
+    batch.name = clientId;
+    batch.serial = serial;
+    m_apply(batch);
+}
+
+void HNLoopback::setPrefetchHints(std::vector<std::string> clientIds) noexcept
+{
+    Batch batch { Batch::SetPrefetchHints, m_compositorId };
+    batch.hints = std::move(clientIds);
+    m_apply(batch);
+}
+
+void HNLoopback::announceClient(const std::string &clientId) noexcept
+{
+    Batch batch { Batch::AnnounceClient, clientId };
+    apply(batch);
+}
+
+void HNLoopback::registerClient(const std::string &clientId) noexcept
+{
+    Batch batch { Batch::RegisterClient, clientId };
+    apply(batch);
+}
+
+void HNLoopback::setClientName(const std::string &clientId, const std::string &name) noexcept
+{
+    queueEvent(clientId, std::make_unique<HNClientNameChangedEvent>(name), name.size(), false);
+}
+
+void HNLoopback::setClientTopbar(const std::string &clientId, UInt32 topbarId) noexcept
+{
+    queueEvent(clientId, std::make_unique<HNClientTopbarChangedEvent>(topbarId), 0, false);
+}
+
+void HNLoopback::createObject(const std::string &clientId, UInt32 objectId, HNObject::Type type) noexcept
+{
+    if (objectId > 0 && HNObject::IsValidType(type))
+        queueEvent(clientId, std::make_unique<HNObjectCreatedEvent>(objectId, type), 0, true);
+}
+
+void HNLoopback::destroyObject(const std::string &clientId, UInt32 objectId) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectDestroyedEvent>(objectId), 0, false);
+}
+
+void HNLoopback::setObjectTitle(const std::string &clientId, UInt32 objectId, const std::string &title) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectTitleChangedEvent>(objectId, title), title.size(), false);
+}
+
+void HNLoopback::setObjectIcon(const std::string &clientId, UInt32 objectId, const std::string &icon) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectIconChangedEvent>(objectId, icon), icon.size(), false);
+}
+
+void HNLoopback::setObjectShortcut(const std::string &clientId, UInt32 objectId, const std::string &shortcut) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectShortcutChangedEvent>(objectId, shortcut), shortcut.size(), false);
+}
+
+void HNLoopback::setObjectEnabled(const std::string &clientId, UInt32 objectId, bool enabled) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectEnabledChangedEvent>(objectId, enabled), 0, false);
+}
+
+void HNLoopback::setToggleChecked(const std::string &clientId, UInt32 objectId, bool checked) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNToggleCheckedChangedEvent>(objectId, checked), 0, false);
+}
+
+void HNLoopback::setObjectParent(const std::string &clientId, UInt32 objectId, UInt32 parentId) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectParentChangedEvent>(objectId, parentId), 0, false);
+}
+
+void HNLoopback::insertObjectBefore(const std::string &clientId, UInt32 objectId, UInt32 siblingId) noexcept
+{
+    if (objectId > 0)
+        queueEvent(clientId, std::make_unique<HNObjectInsertedBeforeEvent>(objectId, siblingId), 0, false);
+}
+
+void HNLoopback::commit(const std::string &clientId) noexcept
+{
+    Batch batch { Batch::Commit, clientId };
+    apply(batch);
+}
+
+void HNLoopback::commit(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt32 focusSerial) noexcept
+{
+    Batch batch { Batch::Commit, clientId };
+    batch.ack = HNClient::CommitAck {};
+    batch.ack->seq = seq;
+    batch.ack->clientTime = clientTime;
+    batch.ack->focusSerial = focusSerial;
+    batch.ack->received = std::chrono::steady_clock::now();
+    apply(batch);
+}
+
+void HNLoopback::disconnect(const std::string &id) noexcept
+{
+    m_pending.erase(id);
+
+    if (m_peers.erase(id))
+    {
+        std::vector<std::string> names;
+
+        for (const auto &[name, owner] : m_names)
+            if (owner == id)
+                names.emplace_back(name);
+
+        for (const auto &name : names)
+        {
+            m_names.erase(name);
+            notifyOwnerChanged(name, id, "");
+        }
+
+        notifyOwnerChanged(id, id, "");
+    }
+
+    if (id == m_compositorId)
+    {
+        setCompositor("");
+        return;
+    }
+
+    Batch batch { Batch::NameOwnerChanged, id };
+    batch.name = id;
+    m_apply(batch);
+}
+
+void HNLoopback::connect(const std::string &id, const std::string &name, Receiver receiver) noexcept
+{
+    if (id.empty() || id == BarId || !receiver)
+        return;
+
+    if (m_peers.contains(id))
+        disconnect(id);
+
+    m_peers[id] = std::move(receiver);
+    notifyOwnerChanged(id, "", id);
+
+    if (name.empty())
+        return;
+
+    // Replaces the previous owner, as with name queueing disabled.
+    auto &owner { m_names[name] };
+    const std::string oldOwner { std::exchange(owner, id) };
+    notifyOwnerChanged(name, oldOwner, id);
+
+    if (name == "org.cuarzo.HeavenCompositor")
+        setCompositor(id);
+}
+
+std::string HNLoopback::owner(const std::string &name) const noexcept
+{
+    if (name == "org.cuarzo.HeavenBar")
+        return BarId;
+
+    auto it { m_names.find(name) };
+    return it == m_names.end() ? "" : it->second;
+}
+
+bool HNLoopback::call(const std::string &sender, const std::string &destination, const std::string &member, std::vector<Arg> args) noexcept
+{
+    if (destination == BarId || destination == "org.cuarzo.HeavenBar")
+    {
+        deliver([this, sender, member, args = std::move(args)]{ call(sender, member, args); });
+        return true;
+    }
+
+    auto name { m_names.find(destination) };
+    const std::string &id { name == m_names.end() ? destination : name->second };
+
+    if (!m_peers.contains(id))
+        return false;
+
+    deliver([this, id, sender, member, args = std::move(args)]
+    {
+        // May have disconnected meanwhile.
+        if (auto peer = m_peers.find(id); peer != m_peers.end())
+            peer->second(sender, member, args);
+    });
+
+    return true;
+}
+
+void HNLoopback::resync(const std::string &clientId) noexcept
+{
+    if (!callPeer(clientId, "Resync", {}))
+        onResync.notify(clientId);
+}
+
+void HNLoopback::objectClicked(const std::string &clientId, UInt32 objectId) noexcept
+{
+    if (!callPeer(clientId, "ObjectClicked", { UInt64(objectId) }))
+        onObjectClicked.notify(clientId, objectId);
+}
+
+void HNLoopback::backpressure(const std::string &clientId, bool active) noexcept
+{
+    if (!callPeer(clientId, "Backpressure", { UInt64(active) }))
+        onBackpressure.notify(clientId, active);
+}
+
+void HNLoopback::commitApplied(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept
+{
+    if (!callPeer(clientId, "CommitApplied", { UInt64(seq), clientTime, dispatchTime }))
+        onCommitApplied.notify(clientId, seq, clientTime, dispatchTime);
+}
+
+bool HNLoopback::callPeer(const std::string &clientId, const std::string &member, std::vector<Arg> args) noexcept
+{
+    return m_peers.contains(clientId) && call(BarId, clientId, member, std::move(args));
+}
+
+void HNLoopback::deliver(std::function<void()> delivery) noexcept
+{
+    m_deliveries.emplace_back(std::move(delivery));
+
+    if (m_delivering)
+        return;
+
+    m_delivering = true;
+
+    while (!m_deliveries.empty())
+    {
+        auto next { std::move(m_deliveries.front()) };
+        m_deliveries.pop_front();
+        next();
+    }
+
+    m_delivering = false;
+}
+
+void HNLoopback::notifyOwnerChanged(const std::string &name, const std::string &oldOwner, const std::string &newOwner) noexcept
+{
+    std::vector<std::string> peers;
+    peers.reserve(m_peers.size());
+
+    for (const auto &[id, receiver] : m_peers)
+        peers.emplace_back(id);
+
+    for (const auto &id : peers)
+        deliver([this, id, name, oldOwner, newOwner]
+        {
+            if (auto peer = m_peers.find(id); peer != m_peers.end())
+                peer->second("org.freedesktop.DBus", "NameOwnerChanged", { name, oldOwner, newOwner });
+        });
+}
+
+bool HNLoopback::call(const std::string &sender, const std::string &member, const std::vector<HNCapture::Arg> &args) noexcept
+{
+    const auto *u0 { args.size() > 0 ? std::get_if<UInt64>(&args[0]) : nullptr };
+    const auto *u1 { args.size() > 1 ? std::get_if<UInt64>(&args[1]) : nullptr };
+    const auto *u2 { args.size() > 2 ? std::get_if<UInt64>(&args[2]) : nullptr };
+    const auto *s0 { args.size() > 0 ? std::get_if<std::string>(&args[0]) : nullptr };
+    const auto *s1 { args.size() > 1 ? std::get_if<std::string>(&args[1]) : nullptr };
+    const auto *a0 { args.size() > 0 ? std::get_if<std::vector<std::string>>(&args[0]) : nullptr };
+
+    // The sender of compositor methods becomes the compositor.
+    if ((member == "SetActiveClient" && s0) || (member == "SetActiveClientWithSerial" && s0 && u1) || (member == "SetPrefetchHints" && a0))
+    {
+        if (sender != m_compositorId)
+            setCompositor(sender);
+
+        if (a0)
+            setPrefetchHints(*a0);
+        else
+            setActiveClient(*s0, u1 ? UInt32(*u1) : 0);
+    }
+    else if (member == "AnnounceClient")
+        announceClient(sender);
+    else if (member == "RegisterClient")
+        registerClient(sender);
+    else if (member == "SetClientName" && s0)
+        setClientName(sender, *s0);
+    else if (member == "SetClientTopbar" && u0)
+        setClientTopbar(sender, UInt32(*u0));
+    else if (member == "CreateObject" && u0 && u1)
+        createObject(sender, UInt32(*u0), HNObject::Type(*u1));
+    else if (member == "DestroyObject" && u0)
+        destroyObject(sender, UInt32(*u0));
+    else if (member == "SetObjectTitle" && u0 && s1)
+        setObjectTitle(sender, UInt32(*u0), *s1);
+    else if (member == "SetObjectIcon" && u0 && s1)
+        setObjectIcon(sender, UInt32(*u0), *s1);
+    else if (member == "SetObjectShortcut" && u0 && s1)
+        setObjectShortcut(sender, UInt32(*u0), *s1);
+    else if (member == "SetObjectEnabled" && u0 && u1)
+        setObjectEnabled(sender, UInt32(*u0), *u1 != 0);
+    else if (member == "SetToggleChecked" && u0 && u1)
+        setToggleChecked(sender, UInt32(*u0), *u1 != 0);
+    else if (member == "SetObjectParent" && u0 && u1)
+        setObjectParent(sender, UInt32(*u0), UInt32(*u1));
+    else if (member == "InsertObjectBefore" && u0 && u1)
+        insertObjectBefore(sender, UInt32(*u0), UInt32(*u1));
+    else if (member == "Commit")
+        commit(sender);
+    else if (member == "CommitWithSequence" && u0 && u1)
+        commit(sender, UInt32(*u0), *u1);
+    else if (member == "CommitWithFocus" && u0 && u1 && u2)
+        commit(sender, UInt32(*u0), *u1, UInt32(*u2));
+    else
+        return false;
+
+    return true;
+}
+
+void HNLoopback::queueEvent(const std::string &clientId, std::unique_ptr<HNEvent> event, size_t stringBytes, bool createsObject) noexcept
+{
+    auto &batch { m_pending[clientId] };
+
+    if (!batch)
+        batch = std::make_unique<Batch>(Batch::Events, clientId);
+
+    batch->events.emplace_back(std::move(event), stringBytes, createsObject);
+}
+
+void HNLoopback::apply(Batch &batch) noexcept
+{
+    flush(batch.sender);
+    m_apply(batch);
+}
+
+void HNLoopback::flush(const std::string &clientId) noexcept
+{
+    auto it { m_pending.find(clientId) };
+
+    if (it == m_pending.end())
+        return;
+
+    auto batch { std::move(it->second) };
+    m_pending.erase(it);
+    m_apply(*batch);
+}
@@ -0,0 +1,194 @@
+#ifndef HNLOOPBACK_H
+#define HNLOOPBACK_H
+
+#include <CZ/Heaven/Bar/HNTransport.h>
+#include <CZ/Heaven/Bar/HNCapture.h>
+#include <CZ/Heaven/Bar/HNIOThread.h>
+#include <CZ/Heaven/Bar/HNObject.h>
+#include <CZ/Heaven/HNLoopbackLink.h>
+#include <CZ/Core/CZSignal.h>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief In-memory transport connecting the bar to emulated clients and compositor.
+ *
+ * A bar created with HNBar::MakeLoopback() never touches the bus. The clients
+ * and the compositor are emulated through its loopback(): each method below is
+ * the bar method of the D-Bus interface with the same name, called on behalf
+ * of the client (or compositor) with the given ID, and the bar's calls back to
+ * its clients are emitted as signals.
+ *
+ * Events are grouped per client until its next commit or call of another kind,
+ * and applied by the same code as the batches of the I/O thread, all on the
+ * calling thread. Work the bar schedules itself (commit dispatch, resync pacing,
+ * backpressure) runs on CZCore timers, or on HNBar::processPending() once due.
+ * With setSynchronousDispatch(), commits are instead applied before the call
+ * delivering them returns.
+ *
+ * It is also the HNLoopbackLink of the process: a real Client::HNClient and
+ * Compositor::HNCompositor created with their MakeLoopback() connect to it,
+ * and the bar's calls to a connected client are delivered to it instead of
+ * being emitted as signals.
+ *
+ * @code
+ * auto bar { HNBar::MakeLoopback() };
+ * auto compositor { Compositor::HNCompositor::MakeLoopback(bar->loopback(), ":loopback.compositor") };
+ * auto client { Client::HNClient::MakeLoopback(bar->loopback(), ":loopback.client") };
+ * @endcode
+ *
+ * This makes the cost of the library alone (event admission, dispatch,
+ * allocation, signal emission) measurable deterministically and without a
+ * session bus, e.g. for microbenchmarks and stress tests on CI machines, see
+ * `heaven-replay --loopback`.
+ */
+class CZ::Bar::HNLoopback final : public HNTransport, public HNLoopbackLink
+{
+public:
+    /**
+     * @brief Applies commits as soon as they are received.
+     *
+     * Staged commits are dispatched whole, ignoring the dispatch budget, before
+     * the call that received them returns, instead of on the next CZCore
+     * iteration or HNBar::processPending().
+     *
+     * @param enabled Whether to dispatch synchronously. Disabled by default.
+     */
+    void setSynchronousDispatch(bool enabled) noexcept { m_synchronousDispatch = enabled; }
+
+    /**
+     * @brief Checks whether commits are dispatched synchronously.
+     *
+     * @see setSynchronousDispatch()
+     */
+    bool synchronousDispatch() const noexcept { return m_synchronousDispatch; }
+
+    /**
+     * @name Compositor side
+     * @{
+     */
+
+    /// Makes @p id the compositor, as if it acquired the compositor name.
+    void setCompositor(const std::string &id) noexcept;
+
+    /// `SetActiveClient` (@p serial 0) or `SetActiveClientWithSerial`, from the compositor.
+    void setActiveClient(const std::string &clientId, UInt32 serial = 0) noexcept;
+
+    /// `SetPrefetchHints`, from the compositor.
+    void setPrefetchHints(std::vector<std::string> clientIds) noexcept;
+
+    /** @} */
+
+    /**
+     * @name Client side
+     * @{
+     */
+
+    void announceClient(const std::string &clientId) noexcept;
+    void registerClient(const std::string &clientId) noexcept;
+    void setClientName(const std::string &clientId, const std::string &name) noexcept;
+    void setClientTopbar(const std::string &clientId, UInt32 topbarId) noexcept;
+    void createObject(const std::string &clientId, UInt32 objectId, HNObject::Type type) noexcept;
+    void destroyObject(const std::string &clientId, UInt32 objectId) noexcept;
+    void setObjectTitle(const std::string &clientId, UInt32 objectId, const std::string &title) noexcept;
+    void setObjectIcon(const std::string &clientId, UInt32 objectId, const std::string &icon) noexcept;
+    void setObjectShortcut(const std::string &clientId, UInt32 objectId, const std::string &shortcut) noexcept;
+    void setObjectEnabled(const std::string &clientId, UInt32 objectId, bool enabled) noexcept;
+    void setToggleChecked(const std::string &clientId, UInt32 objectId, bool checked) noexcept;
+    void setObjectParent(const std::string &clientId, UInt32 objectId, UInt32 parentId) noexcept;
+    void insertObjectBefore(const std::string &clientId, UInt32 objectId, UInt32 siblingId) noexcept;
+
+    /// `Commit`, not acknowledged.
+    void commit(const std::string &clientId) noexcept;
+
+    /// `CommitWithSequence` (@p focusSerial 0) or `CommitWithFocus`, acknowledged with onCommitApplied.
+    void commit(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt32 focusSerial = 0) noexcept;
+
+    /** @} */
+
+    /**
+     * @brief Disconnects a client or the compositor, as if it left the bus.
+     */
+    void disconnect(const std::string &id) noexcept override;
+
+    /**
+     * @name HNLoopbackLink
+     * @{
+     */
+
+    void connect(const std::string &id, const std::string &name, Receiver receiver) noexcept override;
+    std::string owner(const std::string &name) const noexcept override;
+    bool call(const std::string &sender, const std::string &destination, const std::string &member, std::vector<Arg> args) noexcept override;
+
+    /** @} */
+
+    /**
+     * @brief Delivers a method call recorded by HNCapture.
+     *
+     * @return false if @p member is not a method of the bar interface or @p args don't match it.
+     */
+    bool call(const std::string &sender, const std::string &member, const std::vector<HNCapture::Arg> &args) noexcept;
+
+    /**
+     * @name Calls from the bar to the emulated clients
+     *
+     * Clients connected through HNLoopbackLink receive them instead.
+     * @{
+     */
+
+    CZSignal<const std::string& /*clientId*/> onResync;
+    CZSignal<const std::string& /*clientId*/, UInt32 /*objectId*/> onObjectClicked;
+    CZSignal<const std::string& /*clientId*/, bool /*active*/> onBackpressure;
+    CZSignal<const std::string& /*clientId*/, UInt32 /*seq*/, UInt64 /*clientTime*/, UInt64 /*dispatchTime*/> onCommitApplied;
+
+    /** @} */
+
+    void resync(const std::string &clientId) noexcept override;
+    void objectClicked(const std::string &clientId, UInt32 objectId) noexcept override;
+    void backpressure(const std::string &clientId, bool active) noexcept override;
+    void commitApplied(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept override;
+    void cancel(const std::string &) noexcept override {}
+    size_t outstandingCalls() const noexcept override { return 0; }
+
+private:
+    friend class HNBar;
+    using Batch = HNIOThread::Batch;
+    HNLoopback(std::function<void(Batch&)> apply) noexcept : m_apply(std::move(apply)) {}
+
+    // Appends an event to the client's batch.
+    void queueEvent(const std::string &clientId, std::unique_ptr<HNEvent> event, size_t stringBytes, bool createsObject) noexcept;
+
+    // Applies the client's pending events and then @p batch.
+    void apply(Batch &batch) noexcept;
+    void flush(const std::string &clientId) noexcept;
+
+    // Runs @p delivery now, or after the one being delivered.
+    void deliver(std::function<void()> delivery) noexcept;
+
+    // Delivers a call from the bar to a connected peer, @return false if @p clientId isn't one.
+    bool callPeer(const std::string &clientId, const std::string &member, std::vector<Arg> args) noexcept;
+
+    // Sends NameOwnerChanged to every peer.
+    void notifyOwnerChanged(const std::string &name, const std::string &oldOwner, const std::string &newOwner) noexcept;
+
+    std::function<void(Batch&)> m_apply;
+    std::string m_compositorId;
+    bool m_synchronousDispatch { false };
+
+    // Peers connected through HNLoopbackLink (unique name, receiver), and the well-known names they own
+    std::unordered_map<std::string, Receiver> m_peers;
+    std::unordered_map<std::string, std::string> m_names;
+
+    // Deliveries waiting for the running one
+    std::deque<std::function<void()>> m_deliveries;
+    bool m_delivering { false };
+
+    // Events not applied yet, per client
+    std::unordered_map<std::string, std::unique_ptr<Batch>> m_pending;
+};
+
+#endif // HNLOOPBACK_H
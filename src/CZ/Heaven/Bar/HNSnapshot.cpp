@@ -0,0 +1,266 @@
+#include <CZ/Heaven/Bar/HNSnapshot.h>
+#include <CZ/Heaven/Bar/HNClient.h>
+#include <CZ/Heaven/Bar/HNToggle.h>
+#include <CZ/Heaven/Bar/HNTopbar.h>
+#include <CZ/Heaven/Bar/HNWithTitle.h>
+#include <CZ/Heaven/Bar/HNWithIcon.h>
+#include <CZ/Heaven/Bar/HNWithShortcut.h>
+#include <CZ/Heaven/Bar/HNWithEnabled.h>
+#include <CZ/Heaven/Bar/HNWithParent.h>
+#include <CZ/Heaven/Bar/HNWithChildren.h>
+#include <algorithm>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+using Node = HNSnapshot::Node;
+
+static const std::string EmptyString;
+
+// Compares an object against its previous node, without copying its strings.
+static bool Matches(const Node &node, HNObject *obj, const std::vector<std::shared_ptr<const Node>> &children) noexcept
+{
+    auto *withTitle { dynamic_cast<HNWithTitle*>(obj) };
+    auto *withIcon { dynamic_cast<HNWithIcon*>(obj) };
+    auto *withShortcut { dynamic_cast<HNWithShortcut*>(obj) };
+    auto *withEnabled { dynamic_cast<HNWithEnabled*>(obj) };
+    auto *toggle { dynamic_cast<HNToggle*>(obj) };
+
+    return node.type == obj->type() &&
+        node.title == (withTitle ? withTitle->title() : EmptyString) &&
+        node.icon == (withIcon ? withIcon->icon() : EmptyString) &&
+        node.shortcut == (withShortcut ? withShortcut->shortcut() : EmptyString) &&
+        node.enabled == (withEnabled ? withEnabled->enabled() : true) &&
+        node.checked == (toggle ? toggle->checked() : false) &&
+        node.children == children;
+}
+
+// Parent of an object, nullptr if none or not a child type.
+static HNObject *ParentOf(HNObject *obj) noexcept
+{
+    auto *withParent { dynamic_cast<HNWithParent*>(obj) };
+    return withParent ? withParent->parent() : nullptr;
+}
+
+std::shared_ptr<const Node> HNSnapshot::BuildNode(NodeCache &cache, const std::unordered_set<UInt32> &stale, HNObject *obj) noexcept
+{
+    std::vector<std::shared_ptr<const Node>> children;
+
+    if (auto *withChildren = dynamic_cast<HNWithChildren*>(obj))
+    {
+        children.reserve(withChildren->children().size());
+
+        for (auto *child : withChildren->children())
+        {
+            auto cached { cache.nodes.find(child->id()) };
+
+            if (cached == cache.nodes.end() || stale.contains(child->id()))
+                children.emplace_back(BuildNode(cache, stale, child));
+            else
+                children.emplace_back(cached->second.node);
+        }
+    }
+
+    // After the children, their insertions may rehash the map.
+    auto &entry { cache.nodes[obj->id()] };
+    auto *parent { ParentOf(obj) };
+    entry.parent = parent ? parent->id() : 0;
+
+    if (entry.node && Matches(*entry.node, obj, children))
+        return entry.node;
+
+    auto *withTitle { dynamic_cast<HNWithTitle*>(obj) };
+    auto *withIcon { dynamic_cast<HNWithIcon*>(obj) };
+    auto *withShortcut { dynamic_cast<HNWithShortcut*>(obj) };
+    auto *withEnabled { dynamic_cast<HNWithEnabled*>(obj) };
+    auto *toggle { dynamic_cast<HNToggle*>(obj) };
+
+    entry.node = std::make_shared<const Node>(Node {
+        obj->id(),
+        obj->type(),
+        withTitle ? withTitle->title() : EmptyString,
+        withIcon ? withIcon->icon() : EmptyString,
+        withShortcut ? withShortcut->shortcut() : EmptyString,
+        withEnabled ? withEnabled->enabled() : true,
+        toggle ? toggle->checked() : false,
+        std::move(children) });
+
+    return entry.node;
+}
+
+std::shared_ptr<const HNSnapshot::Client> HNSnapshot::BuildClient(HNClient &client) noexcept
+{
+    auto &cache { client.m_snapshotNodes };
+    auto dirty { std::exchange(client.m_snapshotDirty, {}) };
+
+    // Trees restored silently (evicted, rehydrated) or never built.
+    if (std::exchange(client.m_snapshotRebuild, false))
+    {
+        cache = {};
+        dirty.clear();
+
+        for (const auto &[id, obj] : client.m_objects)
+            dirty.emplace(id);
+    }
+
+    // Changed objects and their ancestors, before and after the change.
+    std::unordered_set<UInt32> stale;
+
+    auto markPath = [&stale](HNObject *obj)
+    {
+        for (; obj && stale.emplace(obj->id()).second; obj = ParentOf(obj)) {}
+    };
+
+    for (UInt32 id : dirty)
+    {
+        if (auto cached = cache.nodes.find(id); cached != cache.nodes.end() && cached->second.parent)
+            if (auto previousParent = client.m_objects.find(cached->second.parent); previousParent != client.m_objects.end())
+                markPath(previousParent->second.get());
+
+        auto obj { client.m_objects.find(id) };
+
+        if (obj == client.m_objects.end())
+        {
+            cache.nodes.erase(id);
+            cache.roots.erase(id);
+            continue;
+        }
+
+        markPath(obj->second.get());
+
+        if (ParentOf(obj->second.get()))
+            cache.roots.erase(id);
+        else
+            cache.roots.emplace(id);
+    }
+
+    auto snapshot { std::make_shared<Client>() };
+    snapshot->id = client.id();
+    snapshot->name = client.name();
+    snapshot->roots.reserve(cache.roots.size());
+
+    for (UInt32 id : cache.roots)
+    {
+        auto cached { cache.nodes.find(id) };
+
+        if (cached == cache.nodes.end() || stale.contains(id))
+            snapshot->roots.emplace_back(BuildNode(cache, stale, client.m_objects.at(id).get()));
+        else
+            snapshot->roots.emplace_back(cached->second.node);
+    }
+
+    if (auto *topbar = client.activeTopbar())
+        if (auto cached = cache.nodes.find(topbar->id()); cached != cache.nodes.end())
+            snapshot->activeTopbar = cached->second.node;
+
+    const auto &previous { client.m_snapshot };
+
+    if (previous && previous->name == snapshot->name && previous->activeTopbar == snapshot->activeTopbar && previous->roots == snapshot->roots)
+        return previous;
+
+    return snapshot;
+}
+
+// Reading slot of a thread, reused once the thread exits.
+struct alignas(64) ReaderSlot
+{
+    // Epoch the thread is reading in, 0 if not reading
+    std::atomic<UInt64> epoch { 0 };
+    std::atomic<bool> used { true };
+    ReaderSlot *next {};
+};
+
+// Slots are never freed, there are at most as many as concurrent reading threads.
+static std::atomic<ReaderSlot*> s_slots;
+static std::atomic<UInt64> s_epoch { 1 };
+
+// Replaced snapshots and the epoch they were retired in (main thread)
+static std::vector<std::pair<UInt64, const HNSnapshot*>> s_retired;
+
+struct ThreadReader
+{
+    ReaderSlot *slot {};
+    UInt32 depth { 0 };
+
+    ~ThreadReader() noexcept
+    {
+        if (slot)
+            slot->used.store(false, std::memory_order_release);
+    }
+
+    ReaderSlot *acquireSlot() noexcept
+    {
+        if (slot)
+            return slot;
+
+        for (auto *it = s_slots.load(std::memory_order_acquire); it; it = it->next)
+        {
+            bool expected { false };
+
+            if (it->used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return slot = it;
+        }
+
+        slot = new ReaderSlot();
+        slot->next = s_slots.load(std::memory_order_relaxed);
+
+        while (!s_slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+
+        return slot;
+    }
+};
+
+static thread_local ThreadReader t_reader;
+
+HNSnapshot::Guard::Guard(const std::atomic<const HNSnapshot*> &published) noexcept
+{
+    // Only the outermost guard announces an epoch, which also covers the nested ones.
+    if (t_reader.depth++ == 0)
+        t_reader.acquireSlot()->epoch.store(s_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+
+    m_snapshot = published.load(std::memory_order_seq_cst);
+}
+
+HNSnapshot::Guard::~Guard() noexcept
+{
+    if (--t_reader.depth == 0)
+        t_reader.slot->epoch.store(0, std::memory_order_release);
+}
+
+void HNSnapshot::Publish(std::atomic<const HNSnapshot*> &published, const HNSnapshot *snapshot) noexcept
+{
+    if (const auto *previous = published.exchange(snapshot, std::memory_order_seq_cst))
+        s_retired.emplace_back(s_epoch.fetch_add(1, std::memory_order_seq_cst), previous);
+
+    Reclaim();
+}
+
+void HNSnapshot::Reclaim() noexcept
+{
+    if (s_retired.empty())
+        return;
+
+    // Readers in an epoch up to the one a snapshot was retired in may still hold it.
+    UInt64 oldest { UINT64_MAX };
+
+    for (auto *slot = s_slots.load(std::memory_order_acquire); slot; slot = slot->next)
+        if (const UInt64 epoch = slot->epoch.load(std::memory_order_seq_cst); epoch && epoch < oldest)
+            oldest = epoch;
+
+    std::erase_if(s_retired, [oldest](const auto &retired)
+    {
+        if (retired.first >= oldest)
+            return false;
+
+        delete retired.second;
+        return true;
+    });
+}
+
+void HNSnapshot::ReclaimAll() noexcept
+{
+    for (const auto &retired : s_retired)
+        delete retired.second;
+
+    s_retired.clear();
+}
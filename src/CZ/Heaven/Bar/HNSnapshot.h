@@ -0,0 +1,144 @@
+#ifndef HNSNAPSHOT_H
+#define HNSNAPSHOT_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/Bar/HNObject.h>
+#include <atomic>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * @brief Immutable view of the bar state, safe to read from any thread.
+ *
+ * When enabled with HNBar::setSnapshots(), the bar publishes a new snapshot
+ * each time a client commit is fully applied, and HNBar::snapshot() pins the
+ * latest one with a Guard, which loads the published pointer without touching
+ * any shared reference count. A render thread can thus traverse the menus
+ * without locking while the main thread keeps applying changes.
+ *
+ * Snapshots are structurally shared: a new snapshot reuses the nodes of the
+ * previous one for every subtree (and client) left unchanged, so comparing
+ * node pointers is enough to tell what changed between two snapshots. Replaced
+ * snapshots are freed by the main thread once no guard can still reach them.
+ */
+class CZ::Bar::HNSnapshot
+{
+public:
+    /**
+     * @brief Keeps the latest published snapshot valid while it is read.
+     *
+     * Returned by HNBar::snapshot(). The snapshot, and every node reachable from
+     * it, stays valid until the guard is destroyed. Acquiring a guard stores the
+     * current epoch into a slot owned by the calling thread and loads the
+     * published pointer, the bar frees a replaced snapshot once no thread is
+     * reading in an epoch that could have loaded it.
+     *
+     * Guards can be nested, but must be released by the thread that acquired
+     * them, before the bar is destroyed. Pointers to the snapshot must not be
+     * kept after releasing its guard.
+     */
+    class Guard
+    {
+    public:
+        Guard(const Guard&) = delete;
+        Guard &operator=(const Guard&) = delete;
+        ~Guard() noexcept;
+
+        /// The snapshot, or nullptr if snapshots are disabled.
+        const HNSnapshot *get() const noexcept { return m_snapshot; }
+        const HNSnapshot *operator->() const noexcept { return m_snapshot; }
+        const HNSnapshot &operator*() const noexcept { return *m_snapshot; }
+        explicit operator bool() const noexcept { return m_snapshot != nullptr; }
+
+    private:
+        friend class HNBar;
+        Guard(const std::atomic<const HNSnapshot*> &published) noexcept;
+        const HNSnapshot *m_snapshot;
+    };
+
+    /**
+     * @brief Immutable copy of an object and its children.
+     *
+     * Properties the object type doesn't have are left empty (or true for
+     * enabled).
+     */
+    struct Node
+    {
+        UInt32 id;
+        HNObject::Type type;
+        std::string title;
+        std::string icon;
+        std::string shortcut;
+        bool enabled;
+        bool checked;
+        std::vector<std::shared_ptr<const Node>> children;
+    };
+
+    /**
+     * @brief Immutable copy of a client tree.
+     */
+    struct Client
+    {
+        /// D-Bus unique name of the client.
+        std::string id;
+
+        /// Application name.
+        std::string name;
+
+        /// Active topbar, or nullptr.
+        std::shared_ptr<const Node> activeTopbar;
+
+        /// Objects without a parent (topbars and detached objects), by ascending id.
+        std::vector<std::shared_ptr<const Node>> roots;
+    };
+
+    /// Incremented with each published snapshot.
+    UInt64 serial { 0 };
+
+    /// The active client, or nullptr.
+    std::shared_ptr<const Client> activeClient;
+
+    /// Every client, in no particular order.
+    std::vector<std::shared_ptr<const Client>> clients;
+
+private:
+    friend class HNBar;
+    friend class HNClient;
+
+    // Node of each object in the previous snapshot, with the ID of its parent then (0 if none).
+    struct CachedNode
+    {
+        std::shared_ptr<const Node> node;
+        UInt32 parent { 0 };
+    };
+
+    struct NodeCache
+    {
+        std::unordered_map<UInt32, CachedNode> nodes;
+
+        // Objects without a parent
+        std::set<UInt32> roots;
+    };
+
+    // Rebuilds the nodes of the objects changed since the previous snapshot of the client and their ancestors.
+    static std::shared_ptr<const Client> BuildClient(HNClient &client) noexcept;
+    static std::shared_ptr<const Node> BuildNode(NodeCache &cache, const std::unordered_set<UInt32> &stale, HNObject *obj) noexcept;
+
+    /*
+     * Epoch based reclamation, the bar publishes and reclaims on the main thread.
+     * Publish() replaces the published snapshot and retires the previous one,
+     * tagged with the current epoch, which it then advances. A retired snapshot
+     * is freed once every reading thread is in a newer epoch, or none reads.
+     */
+    static void Publish(std::atomic<const HNSnapshot*> &published, const HNSnapshot *snapshot) noexcept;
+    static void Reclaim() noexcept;
+
+    // Frees every retired snapshot, only when no guard is left.
+    static void ReclaimAll() noexcept;
+};
+
+#endif // HNSNAPSHOT_H
@@ -0,0 +1,42 @@
+#ifndef HNTRANSPORT_H
+#define HNTRANSPORT_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <string>
+
+/**
+ * @brief Carries the calls from the bar to its clients.
+ *
+ * The bar reaches its clients only through its transport: HNBusTransport sends
+ * them as D-Bus method calls (from the I/O thread if enabled), and HNLoopback
+ * delivers them in memory to the clients it emulates (see HNBar::MakeLoopback()).
+ *
+ * In the opposite direction, each transport turns what it receives into the
+ * same decoded events the bar applies, so the bar logic is shared by both.
+ */
+class CZ::Bar::HNTransport
+{
+public:
+    virtual ~HNTransport() noexcept = default;
+
+    /// Asks a client to resend its whole state.
+    virtual void resync(const std::string &clientId) noexcept = 0;
+
+    /// Notifies a client that one of its objects was clicked.
+    virtual void objectClicked(const std::string &clientId, UInt32 objectId) noexcept = 0;
+
+    /// Tells a client to stop (or resume) streaming changes.
+    virtual void backpressure(const std::string &clientId, bool active) noexcept = 0;
+
+    /// Acknowledges a sequenced commit.
+    virtual void commitApplied(const std::string &clientId, UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept = 0;
+
+    /// Drops the calls still pending to a client that left.
+    virtual void cancel(const std::string &clientId) noexcept = 0;
+
+    /// Number of calls to clients awaiting a reply.
+    virtual size_t outstandingCalls() const noexcept = 0;
+};
+
+#endif // HNTRANSPORT_H
@@ -0,0 +1,371 @@
+#include <CZ/Heaven/Bar/HNTreeCodec.h>
+#include <CZ/Heaven/Bar/HNClient.h>
+#include <CZ/Heaven/Bar/HNTopbar.h>
+#include <CZ/Heaven/Bar/HNToggle.h>
+#include <CZ/Heaven/Bar/HNWithTitle.h>
+#include <CZ/Heaven/Bar/HNWithIcon.h>
+#include <CZ/Heaven/Bar/HNWithShortcut.h>
+#include <CZ/Heaven/Bar/HNWithEnabled.h>
+#include <CZ/Heaven/Bar/HNWithParent.h>
+#include <CZ/Heaven/Bar/HNWithChildren.h>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+static constexpr UInt8 Version { 1 };
+
+// Properties carried by each object type (must match the HNWith* mixins).
+static bool HasTitle(UInt32 type) noexcept    { return type != HNObject::Topbar; }
+static bool HasIcon(UInt32 type) noexcept     { return type == HNObject::Menu || type == HNObject::Action || type == HNObject::Toggle; }
+static bool HasShortcut(UInt32 type) noexcept { return HasIcon(type); }
+static bool HasEnabled(UInt32 type) noexcept  { return HasIcon(type); }
+static bool HasChecked(UInt32 type) noexcept  { return type == HNObject::Toggle; }
+
+namespace
+{
+    struct Writer
+    {
+        std::string out;
+
+        void varint(UInt64 value) noexcept
+        {
+            while (value >= 0x80)
+            {
+                out.push_back(char((value & 0x7F) | 0x80));
+                value >>= 7;
+            }
+
+            out.push_back(char(value));
+        }
+
+        void string(const std::string &str) noexcept
+        {
+            varint(str.size());
+            out.append(str);
+        }
+    };
+
+    struct Reader
+    {
+        const UInt8 *pos;
+        const UInt8 *end;
+
+        bool varint(UInt64 &value) noexcept
+        {
+            value = 0;
+
+            for (UInt32 shift = 0; shift < 64; shift += 7)
+            {
+                if (pos == end)
+                    return false;
+
+                const UInt8 byte { *pos++ };
+                value |= UInt64(byte & 0x7F) << shift;
+
+                if ((byte & 0x80) == 0)
+                    return true;
+            }
+
+            return false;
+        }
+
+        bool u32(UInt32 &value) noexcept
+        {
+            UInt64 v;
+
+            if (!varint(v) || v > UINT32_MAX)
+                return false;
+
+            value = UInt32(v);
+            return true;
+        }
+
+        bool string(std::string &str) noexcept
+        {
+            UInt64 size;
+
+            if (!varint(size) || size > UInt64(end - pos))
+                return false;
+
+            str.assign(reinterpret_cast<const char*>(pos), size);
+            pos += size;
+            return true;
+        }
+    };
+}
+
+static void EncodeObject(Writer &w, HNObject *obj) noexcept
+{
+    const UInt32 type { obj->type() };
+    auto *withParent { dynamic_cast<HNWithParent*>(obj) };
+
+    w.varint(obj->id());
+    w.varint(type);
+    w.varint(withParent && withParent->parent() ? withParent->parent()->id() : 0);
+
+    if (HasTitle(type))    w.string(dynamic_cast<HNWithTitle*>(obj)->title());
+    if (HasIcon(type))     w.string(dynamic_cast<HNWithIcon*>(obj)->icon());
+    if (HasShortcut(type)) w.string(dynamic_cast<HNWithShortcut*>(obj)->shortcut());
+    if (HasEnabled(type))  w.varint(dynamic_cast<HNWithEnabled*>(obj)->enabled());
+    if (HasChecked(type))  w.varint(static_cast<HNToggle*>(obj)->checked());
+
+    // Children right after their parent, in display order.
+    if (auto *withChildren = dynamic_cast<HNWithChildren*>(obj))
+        for (auto *child : withChildren->children())
+            EncodeObject(w, child);
+}
+
+std::string HNTreeCodec::Encode(const HNClient &client) noexcept
+{
+    Writer w;
+    w.out.push_back(char(Version));
+    w.string(client.name());
+    w.varint(client.activeTopbar() ? client.activeTopbar()->id() : 0);
+    w.varint(client.m_objects.size());
+
+    for (const auto &[id, obj] : client.m_objects)
+    {
+        auto *withParent { dynamic_cast<HNWithParent*>(obj.get()) };
+
+        // Roots only, descendants are encoded recursively.
+        if (!withParent || !withParent->parent())
+            EncodeObject(w, obj.get());
+    }
+
+    return std::move(w.out);
+}
+
+bool HNTreeCodec::Decode(const void *data, size_t size, std::queue<std::unique_ptr<HNEvent>> &events) noexcept
+{
+    Reader r { static_cast<const UInt8*>(data), static_cast<const UInt8*>(data) + size };
+    std::queue<std::unique_ptr<HNEvent>> out;
+    std::string name;
+    UInt32 topbarId, count;
+
+    if (size == 0 || *r.pos++ != Version)
+        return false;
+
+    if (!r.string(name) || !r.u32(topbarId) || !r.u32(count))
+        return false;
+
+    out.push(std::make_unique<HNClientNameChangedEvent>(name));
+
+    for (UInt32 i = 0; i < count; i++)
+    {
+        UInt32 id, type, parentId, flag;
+        std::string str;
+
+        if (!r.u32(id) || !r.u32(type) || !r.u32(parentId) || id == 0 || !HNObject::IsValidType(type))
+            return false;
+
+        out.push(std::make_unique<HNObjectCreatedEvent>(id, (HNObject::Type)type));
+
+        if (parentId != 0)
+            out.push(std::make_unique<HNObjectParentChangedEvent>(id, parentId));
+
+        if (HasTitle(type))
+        {
+            if (!r.string(str)) return false;
+            out.push(std::make_unique<HNObjectTitleChangedEvent>(id, str));
+        }
+
+        if (HasIcon(type))
+        {
+            if (!r.string(str)) return false;
+            out.push(std::make_unique<HNObjectIconChangedEvent>(id, str));
+        }
+
+        if (HasShortcut(type))
+        {
+            if (!r.string(str)) return false;
+            out.push(std::make_unique<HNObjectShortcutChangedEvent>(id, str));
+        }
+
+        if (HasEnabled(type))
+        {
+            if (!r.u32(flag)) return false;
+            out.push(std::make_unique<HNObjectEnabledChangedEvent>(id, flag != 0));
+        }
+
+        if (HasChecked(type))
+        {
+            if (!r.u32(flag)) return false;
+            out.push(std::make_unique<HNToggleCheckedChangedEvent>(id, flag != 0));
+        }
+    }
+
+    if (topbarId != 0)
+        out.push(std::make_unique<HNClientTopbarChangedEvent>(topbarId));
+
+    while (!out.empty())
+    {
+        events.push(std::move(out.front()));
+        out.pop();
+    }
+
+    return true;
+}
+
+static constexpr size_t MinMatch { 4 };
+static constexpr size_t MaxOffset { 0xFFFF };
+static constexpr UInt32 HashBits { 12 };
+
+static UInt32 Read32(const UInt8 *p) noexcept
+{
+    UInt32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// Writes the part of a length that doesn't fit in a token nibble.
+static void WriteLengthTail(std::string &out, size_t length) noexcept
+{
+    while (length >= 255)
+    {
+        out.push_back(char(255));
+        length -= 255;
+    }
+
+    out.push_back(char(length));
+}
+
+static void WriteSequence(std::string &out, const UInt8 *literals, size_t literalsSize, size_t offset, size_t matchSize) noexcept
+{
+    const size_t matchTail { matchSize ? matchSize - MinMatch : 0 };
+    out.push_back(char((std::min<size_t>(literalsSize, 15) << 4) | std::min<size_t>(matchTail, 15)));
+
+    if (literalsSize >= 15)
+        WriteLengthTail(out, literalsSize - 15);
+
+    out.append(reinterpret_cast<const char*>(literals), literalsSize);
+
+    if (matchSize == 0)
+        return;
+
+    out.push_back(char(offset & 0xFF));
+    out.push_back(char(offset >> 8));
+
+    if (matchTail >= 15)
+        WriteLengthTail(out, matchTail - 15);
+}
+
+std::string HNTreeCodec::Compress(const std::string &data) noexcept
+{
+    const auto *src { reinterpret_cast<const UInt8*>(data.data()) };
+    const size_t size { data.size() };
+    std::vector<Int32> table(1 << HashBits, -1);
+    Writer w;
+    w.varint(size);
+
+    size_t anchor { 0 };
+    size_t i { 0 };
+
+    while (i + MinMatch <= size)
+    {
+        const UInt32 hash { (Read32(src + i) * 2654435761U) >> (32 - HashBits) };
+        const Int32 candidate { table[hash] };
+        table[hash] = Int32(i);
+
+        if (candidate < 0 || i - candidate > MaxOffset || Read32(src + candidate) != Read32(src + i))
+        {
+            i++;
+            continue;
+        }
+
+        size_t matchSize { MinMatch };
+
+        while (i + matchSize < size && src[candidate + matchSize] == src[i + matchSize])
+            matchSize++;
+
+        WriteSequence(w.out, src + anchor, i - anchor, i - candidate, matchSize);
+        i += matchSize;
+        anchor = i;
+    }
+
+    // Trailing literals, without a match.
+    WriteSequence(w.out, src + anchor, size - anchor, 0, 0);
+    return std::move(w.out);
+}
+
+bool HNTreeCodec::Decompress(const void *data, size_t size, std::string &out) noexcept
+{
+    Reader r { static_cast<const UInt8*>(data), static_cast<const UInt8*>(data) + size };
+    UInt64 outSize;
+
+    if (!r.varint(outSize) || outSize > UInt64(size) * 255 + 16)
+        return false;
+
+    auto readLengthTail = [&r](size_t &length) -> bool
+    {
+        UInt8 byte;
+
+        do
+        {
+            if (r.pos == r.end) return false;
+            byte = *r.pos++;
+            length += byte;
+        } while (byte == 255);
+
+        return true;
+    };
+
+    out.clear();
+    out.reserve(outSize);
+
+    while (r.pos < r.end)
+    {
+        const UInt8 token { *r.pos++ };
+        size_t literalsSize { size_t(token >> 4) };
+
+        if (literalsSize == 15 && !readLengthTail(literalsSize))
+            return false;
+
+        if (literalsSize > size_t(r.end - r.pos) || out.size() + literalsSize > outSize)
+            return false;
+
+        out.append(reinterpret_cast<const char*>(r.pos), literalsSize);
+        r.pos += literalsSize;
+
+        // The last sequence has no match.
+        if (r.pos == r.end)
+            break;
+
+        if (r.end - r.pos < 2)
+            return false;
+
+        const size_t offset { size_t(r.pos[0]) | size_t(r.pos[1]) << 8 };
+        r.pos += 2;
+        size_t matchSize { size_t(token & 0x0F) };
+
+        if (matchSize == 15 && !readLengthTail(matchSize))
+            return false;
+
+        matchSize += MinMatch;
+
+        if (offset == 0 || offset > out.size() || out.size() + matchSize > outSize)
+            return false;
+
+        // Byte by byte, the match may overlap the bytes it produces.
+        for (size_t j = out.size() - offset, k = 0; k < matchSize; k++)
+            out.push_back(out[j + k]);
+    }
+
+    return out.size() == outSize;
+}
+
+UInt64 HNTreeCodec::Hash(const void *data, size_t size) noexcept
+{
+    const auto *bytes { static_cast<const UInt8*>(data) };
+    UInt64 hash { 0xcbf29ce484222325ULL };
+
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
@@ -0,0 +1,70 @@
+#ifndef HNTREECODEC_H
+#define HNTREECODEC_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/Bar/HNEvent.h>
+#include <memory>
+#include <queue>
+#include <string>
+
+/**
+ * @brief Compact binary encoding of a client's committed menu tree.
+ *
+ * Encodes the client name, its active topbar and every object (with its
+ * properties) in parent-before-children order, so the tree can later be
+ * rebuilt by replaying the decoded events through HNClient::dispatch().
+ *
+ * Integers are stored as LEB128 varints and strings as a varint length
+ * followed by the raw bytes.
+ */
+class CZ::Bar::HNTreeCodec
+{
+public:
+    /**
+     * @brief Encodes the current state of a client.
+     *
+     * @param client Client to encode.
+     * @return The encoded tree.
+     */
+    static std::string Encode(const HNClient &client) noexcept;
+
+    /**
+     * @brief Decodes a tree into the events that rebuild it.
+     *
+     * @param data   Encoded tree.
+     * @param size   Size of @p data in bytes.
+     * @param events Queue the events are appended to.
+     * @return false if the data is truncated or malformed, in which case
+     *         @p events is left untouched.
+     */
+    static bool Decode(const void *data, size_t size, std::queue<std::unique_ptr<HNEvent>> &events) noexcept;
+
+    /**
+     * @brief Compresses an encoded tree.
+     *
+     * Uses a small byte-oriented LZ77 scheme (literal runs and back-references
+     * of up to 64 KiB), which is enough to fold the repeated icon names,
+     * shortcut prefixes and titles found in menus.
+     *
+     * @param data Data to compress.
+     * @return The compressed data.
+     */
+    static std::string Compress(const std::string &data) noexcept;
+
+    /**
+     * @brief Decompresses data produced by Compress().
+     *
+     * @param data Compressed data.
+     * @param size Size of @p data in bytes.
+     * @param out  Decompressed data.
+     * @return false if the data is malformed.
+     */
+    static bool Decompress(const void *data, size_t size, std::string &out) noexcept;
+
+    /**
+     * @brief 64-bit FNV-1a hash, used to key and validate encoded trees.
+     */
+    static UInt64 Hash(const void *data, size_t size) noexcept;
+};
+
+#endif // HNTREECODEC_H
@@ -1,5 +1,5 @@
-#ifndef HNACTION_H
-#define HNACTION_H
+#ifndef CLIENT_HNACTION_H
+#define CLIENT_HNACTION_H
 
 #include <CZ/Heaven/Client/HNObject.h>
 #include <CZ/Heaven/Client/HNWithParent.h>
@@ -45,4 +45,4 @@ private:
         HNObject(client, id, Type::Action) {}
 };
 
-#endif // HNACTION_H
+#endif // CLIENT_HNACTION_H
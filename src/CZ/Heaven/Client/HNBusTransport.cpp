@@ -0,0 +1,158 @@
+#include <CZ/Heaven/Client/HNBusTransport.h>
+#include <CZ/Heaven/Client/HNClient.h>
+
+using namespace CZ;
+using namespace CZ::Client;
+
+// Bar destination, path and interface.
+static const char *BD { "org.cuarzo.HeavenBar" };
+static const char *BP { "/org/cuarzo/HeavenBar" };
+
+// Compositor destination, path and interface.
+static const char *CD { "org.cuarzo.HeavenCompositor" };
+static const char *CP { "/org/cuarzo/HeavenCompositor" };
+
+static int IgnoreCallback(sd_bus_message *, void *, sd_bus_error *) { return 0; }
+
+template<typename... Args>
+void HNBusTransport::callBar(const char *member, sd_bus_message_handler_t callback, const char *types, Args... args) noexcept
+{
+    m_calls.call(BD, BP, BD, member, callback, NULL, types, args...);
+}
+
+void HNBusTransport::registerClient() noexcept
+{
+    callBar("RegisterClient", IgnoreCallback, "");
+}
+
+void HNBusTransport::announceClient() noexcept
+{
+    callBar("AnnounceClient", AnnounceACK, "");
+}
+
+void HNBusTransport::setClientName(const std::string &name) noexcept
+{
+    callBar("SetClientName", IgnoreCallback, "s", name.c_str());
+}
+
+void HNBusTransport::setClientTopbar(UInt32 topbarId) noexcept
+{
+    callBar("SetClientTopbar", IgnoreCallback, "u", topbarId);
+}
+
+void HNBusTransport::createObject(UInt32 objectId, UInt32 type) noexcept
+{
+    callBar("CreateObject", IgnoreCallback, "uu", objectId, type);
+}
+
+void HNBusTransport::destroyObject(UInt32 objectId) noexcept
+{
+    callBar("DestroyObject", DestroyObjectACK, "u", objectId);
+}
+
+void HNBusTransport::setObjectTitle(UInt32 objectId, const std::string &title) noexcept
+{
+    callBar("SetObjectTitle", IgnoreCallback, "us", objectId, title.c_str());
+}
+
+void HNBusTransport::setObjectIcon(UInt32 objectId, const std::string &icon) noexcept
+{
+    callBar("SetObjectIcon", IgnoreCallback, "us", objectId, icon.c_str());
+}
+
+void HNBusTransport::setObjectShortcut(UInt32 objectId, const std::string &shortcut) noexcept
+{
+    callBar("SetObjectShortcut", IgnoreCallback, "us", objectId, shortcut.c_str());
+}
+
+void HNBusTransport::setObjectEnabled(UInt32 objectId, bool enabled) noexcept
+{
+    callBar("SetObjectEnabled", IgnoreCallback, "ub", objectId, (int)enabled);
+}
+
+void HNBusTransport::setToggleChecked(UInt32 objectId, bool checked) noexcept
+{
+    callBar("SetToggleChecked", IgnoreCallback, "ub", objectId, (int)checked);
+}
+
+void HNBusTransport::setObjectParent(UInt32 objectId, UInt32 parentId) noexcept
+{
+    callBar("SetObjectParent", IgnoreCallback, "uu", objectId, parentId);
+}
+
+void HNBusTransport::insertObjectBefore(UInt32 objectId, UInt32 siblingId) noexcept
+{
+    callBar("InsertObjectBefore", IgnoreCallback, "uu", objectId, siblingId);
+}
+
+void HNBusTransport::commit() noexcept
+{
+    callBar("Commit", IgnoreCallback, "");
+}
+
+void HNBusTransport::commit(UInt32 seq, UInt64 clientTime, UInt32 focusSerial) noexcept
+{
+    if (focusSerial)
+        callBar("CommitWithFocus", FocusCommitACK, "utu", seq, clientTime, focusSerial);
+    else
+        callBar("CommitWithSequence", CommitACK, "ut", seq, clientTime);
+}
+
+void HNBusTransport::registerPrivateHandle(const std::string &privateHandle) noexcept
+{
+    m_calls.call(CD, CP, CD, "RegisterClient", IgnoreCallback, NULL, "s", privateHandle.c_str());
+}
+
+void HNBusTransport::cancelBar() noexcept
+{
+    m_calls.cancel(BD);
+}
+
+void HNBusTransport::cancelCompositor() noexcept
+{
+    m_calls.cancel(CD);
+}
+
+int HNBusTransport::CommitACK(sd_bus_message *m, void *, sd_bus_error *)
+{
+    auto cli { HNClient::Get() };
+
+    if (cli && sd_bus_message_is_method_error(m, SD_BUS_ERROR_UNKNOWN_METHOD))
+        cli->handleLegacyCommit(false);
+
+    return 0;
+}
+
+int HNBusTransport::FocusCommitACK(sd_bus_message *m, void *, sd_bus_error *)
+{
+    auto cli { HNClient::Get() };
+
+    if (cli && sd_bus_message_is_method_error(m, SD_BUS_ERROR_UNKNOWN_METHOD))
+        cli->handleLegacyCommit(true);
+
+    return 0;
+}
+
+int HNBusTransport::AnnounceACK(sd_bus_message *m, void *, sd_bus_error *)
+{
+    auto cli { HNClient::Get() };
+
+    if (cli && sd_bus_message_is_method_error(m, NULL))
+        cli->handleAnnounceFailed();
+
+    return 0;
+}
+
+int HNBusTransport::DestroyObjectACK(sd_bus_message *m, void *, sd_bus_error *)
+{
+    UInt32 objectId;
+    int r = sd_bus_message_read(m, "u", &objectId);
+
+    if (r < 0)
+        return r;
+
+    if (auto cli = HNClient::Get())
+        cli->handleObjectDestroyed(objectId);
+
+    return 0;
+}
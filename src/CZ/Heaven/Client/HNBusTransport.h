@@ -0,0 +1,52 @@
+#ifndef CLIENT_HNBUSTRANSPORT_H
+#define CLIENT_HNBUSTRANSPORT_H
+
+#include <CZ/Heaven/Client/HNTransport.h>
+#include <CZ/Heaven/HNCallTracker.h>
+
+/**
+ * @brief D-Bus transport of the client, used by HNClient::GetOrMake().
+ *
+ * Calls are sent asynchronously through an HNCallTracker, so at most a fixed
+ * number per destination await a reply (see HNClient::outstandingCalls()).
+ */
+class CZ::Client::HNBusTransport final : public HNTransport
+{
+public:
+    HNBusTransport(sd_bus *bus) noexcept : m_calls(bus) {}
+
+    void registerClient() noexcept override;
+    void announceClient() noexcept override;
+    void setClientName(const std::string &name) noexcept override;
+    void setClientTopbar(UInt32 topbarId) noexcept override;
+    void createObject(UInt32 objectId, UInt32 type) noexcept override;
+    void destroyObject(UInt32 objectId) noexcept override;
+    void setObjectTitle(UInt32 objectId, const std::string &title) noexcept override;
+    void setObjectIcon(UInt32 objectId, const std::string &icon) noexcept override;
+    void setObjectShortcut(UInt32 objectId, const std::string &shortcut) noexcept override;
+    void setObjectEnabled(UInt32 objectId, bool enabled) noexcept override;
+    void setToggleChecked(UInt32 objectId, bool checked) noexcept override;
+    void setObjectParent(UInt32 objectId, UInt32 parentId) noexcept override;
+    void insertObjectBefore(UInt32 objectId, UInt32 siblingId) noexcept override;
+    void commit() noexcept override;
+    void commit(UInt32 seq, UInt64 clientTime, UInt32 focusSerial) noexcept override;
+    void registerPrivateHandle(const std::string &privateHandle) noexcept override;
+    void cancelBar() noexcept override;
+    void cancelCompositor() noexcept override;
+    size_t outstandingCalls() const noexcept override { return m_calls.outstanding(); }
+    size_t queuedCalls() const noexcept override { return m_calls.queued(); }
+
+private:
+    // Reply callbacks
+    static int CommitACK(sd_bus_message *m, void *, sd_bus_error *);
+    static int FocusCommitACK(sd_bus_message *m, void *, sd_bus_error *);
+    static int AnnounceACK(sd_bus_message *m, void *, sd_bus_error *);
+    static int DestroyObjectACK(sd_bus_message *m, void *, sd_bus_error *);
+
+    template<typename... Args>
+    void callBar(const char *member, sd_bus_message_handler_t callback, const char *types, Args... args) noexcept;
+
+    HNCallTracker m_calls;
+};
+
+#endif // CLIENT_HNBUSTRANSPORT_H
@@ -9,24 +9,38 @@
 #include <CZ/Heaven/Client/HNTopbar.h>
 #include <CZ/Heaven/Client/HNToggle.h>
 #include <CZ/Heaven/Client/HNLog.h>
+#include <CZ/Heaven/Client/HNBusTransport.h>
+#include <CZ/Heaven/Client/HNLoopbackTransport.h>
+#include <CZ/Heaven/HNLoopbackLink.h>
+#include <CZ/Heaven/HNTrace.h>
+#include <CZ/Heaven/HNBusPoll.h>
+#include <CZ/Core/CZEventSource.h>
+#include <chrono>
 #include <cstring>
 #include <iterator>
 #include <systemd/sd-bus.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 using namespace CZ;
 using namespace CZ::Client;
 
 static std::weak_ptr<HNClient> s_client;
 
-// Bar destination, path and interface.
+// Well-known names of the bar and the compositor.
 static const char *BD { "org.cuarzo.HeavenBar" };
-static const char *BP { "/org/cuarzo/HeavenBar" };
-
-// Compositor destination, path and interface.
 static const char *CD { "org.cuarzo.HeavenCompositor" };
-static const char *CP { "/org/cuarzo/HeavenCompositor" };
 
-static int IgnoreCallback(sd_bus_message *, void *, sd_bus_error *) { return 0; }
+// Time an automatic commit waits for the previous one to be acknowledged.
+static constexpr UInt64 AutoCommitAckTimeoutMs { 1000 };
+
+// Monotonic clock shared by all processes on the host.
+static UInt64 NowUsec() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 struct CZ::Client::HNIface
 {
@@ -44,21 +58,8 @@ struct CZ::Client::HNIface
         if (r < 0)
             return r;
 
-        if (new_owner[0] == '\0')
-        {
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar disappeared");
-            cli->m_barId = "";
-        }
-        else
-        {
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar appeared: {}", new_owner);
-            cli->m_barId = new_owner;
-
-            // If the client already published its menu, re-send the whole
-            // state so the freshly (re)started bar is brought up to date.
-            if (!cli->m_pendingFirstCommit)
-                cli->flushAll();
-        }
+        if (cli)
+            cli->handleBarChanged(new_owner);
 
         return 0;
     }
@@ -77,17 +78,8 @@ struct CZ::Client::HNIface
         if (r < 0)
             return r;
 
-        if (new_owner[0] == '\0')
-        {
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenCompositor disappeared");
-            cli->m_compositorId = "";
-        }
-        else
-        {
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenCompositor appeared: {}", new_owner);
-            cli->m_compositorId = new_owner;
-            cli->sendPrivateHandle();
-        }
+        if (cli)
+            cli->handleCompositorChanged(new_owner);
 
         return 0;
     }
@@ -107,31 +99,98 @@ struct CZ::Client::HNIface
         if (r < 0)
             return r;
 
-        auto it { cli->m_objects.find(objectId) };
+        cli->handleObjectClicked(objectId);
+        return 0;
+    }
+
+    /* Invoked by the bar when it is ready to receive this client's state. */
+    static int Resync(sd_bus_message *m, void */*userdata*/, sd_bus_error */*ret_error*/)
+    {
+        auto cli { s_client.lock() };
 
-        if (it == cli->m_objects.end())
-            return 0;
+        if (strcmp(sd_bus_message_get_sender(m), cli->m_barId.c_str()) == 0)
+            cli->handleResync();
 
-        it->second->onClicked.notify(it->second);
-        return 0;
+        return sd_bus_reply_method_return(m, "");
     }
 
-    /* Reply callback of an asynchronous DestroyObject call. */
-    static int DestroyObjectACK(sd_bus_message *m, void *, sd_bus_error *)
+    /* Invoked by the bar when this client exceeds (true) or is released from (false) its limits. */
+    static int Backpressure(sd_bus_message *m, void */*userdata*/, sd_bus_error */*ret_error*/)
     {
-        UInt32 objectId;
-        int r = sd_bus_message_read(m, "u", &objectId);
+        auto cli { s_client.lock() };
+
+        if (strcmp(sd_bus_message_get_sender(m), cli->m_barId.c_str()) != 0)
+            return sd_bus_reply_method_return(m, "");
+
+        int active;
+        int r = sd_bus_message_read(m, "b", &active);
 
         if (r < 0)
             return r;
 
+        cli->handleBackpressure(active);
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    /* Invoked by the bar after applying a commit. */
+    static int CommitApplied(sd_bus_message *m, void */*userdata*/, sd_bus_error */*ret_error*/)
+    {
         auto cli { s_client.lock() };
 
-        if (!cli)
-            return 0;
+        if (strcmp(sd_bus_message_get_sender(m), cli->m_barId.c_str()) != 0)
+            return sd_bus_reply_method_return(m, "");
+
+        UInt32 seq;
+        UInt64 clientTime, dispatchTime;
+        int r = sd_bus_message_read(m, "utt", &seq, &clientTime, &dispatchTime);
+
+        if (r < 0)
+            return r;
+
+        cli->handleCommitApplied(seq, clientTime, dispatchTime);
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    /* Invoked by the compositor when one of this client's windows gains focus. */
+    static int FocusChanged(sd_bus_message *m, void */*userdata*/, sd_bus_error */*ret_error*/)
+    {
+        auto cli { s_client.lock() };
+
+        if (strcmp(sd_bus_message_get_sender(m), cli->m_compositorId.c_str()) != 0)
+            return sd_bus_reply_method_return(m, "");
+
+        UInt32 serial;
+        int r = sd_bus_message_read(m, "u", &serial);
+
+        if (r < 0)
+            return r;
+
+        cli->handleFocusChanged(serial);
+        return sd_bus_reply_method_return(m, "");
+    }
+
+    /* Reply callback of the initial GetNameOwner lookup of the bar. */
+    static int BarOwnerACK(sd_bus_message *m, void *, sd_bus_error *)
+    {
+        auto cli { s_client.lock() };
+        const char *owner;
+
+        // Not present.
+        if (cli && !sd_bus_message_is_method_error(m, NULL) && sd_bus_message_read(m, "s", &owner) >= 0)
+            cli->handleBarFound(owner);
+
+        return 0;
+    }
+
+    /* Reply callback of the initial GetNameOwner lookup of the compositor. */
+    static int CompositorOwnerACK(sd_bus_message *m, void *, sd_bus_error *)
+    {
+        auto cli { s_client.lock() };
+        const char *owner;
+
+        if (cli && !sd_bus_message_is_method_error(m, NULL) && sd_bus_message_read(m, "s", &owner) >= 0)
+            cli->handleCompositorFound(owner);
 
-        cli->m_destroyedIds.erase(objectId);
-        cli->m_freedIds.emplace(objectId);
         return 0;
     }
 };
@@ -146,6 +205,34 @@ static const sd_bus_vtable VTable[]
         HNIface::ObjectClicked,
         SD_BUS_VTABLE_UNPRIVILEGED
     ),
+    SD_BUS_METHOD(
+        "Resync",
+        "",
+        "",
+        HNIface::Resync,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
+    SD_BUS_METHOD(
+        "Backpressure",
+        "b",    /* active */
+        "",
+        HNIface::Backpressure,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
+    SD_BUS_METHOD(
+        "CommitApplied",
+        "utt",  /* sequence, client timestamp (us), dispatch time (us) */
+        "",
+        HNIface::CommitApplied,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
+    SD_BUS_METHOD(
+        "FocusChanged",
+        "u",    /* focus serial */
+        "",
+        HNIface::FocusChanged,
+        SD_BUS_VTABLE_UNPRIVILEGED
+    ),
     SD_BUS_VTABLE_END
 };
 
@@ -178,7 +265,7 @@ std::shared_ptr<HNClient> HNClient::GetOrMake() noexcept
         return {};
     }
 
-    r = sd_bus_add_match(
+    r = sd_bus_add_match_async(
         bus->bus(),
         NULL,
         "type='signal',"
@@ -187,6 +274,7 @@ std::shared_ptr<HNClient> HNClient::GetOrMake() noexcept
         "member='NameOwnerChanged',"
         "arg0='org.cuarzo.HeavenBar'",
         HNIface::BarChanged,
+        NULL,
         NULL
     );
 
@@ -196,7 +284,7 @@ std::shared_ptr<HNClient> HNClient::GetOrMake() noexcept
         return {};
     }
 
-    r = sd_bus_add_match(
+    r = sd_bus_add_match_async(
         bus->bus(),
         NULL,
         "type='signal',"
@@ -205,6 +293,7 @@ std::shared_ptr<HNClient> HNClient::GetOrMake() noexcept
         "member='NameOwnerChanged',"
         "arg0='org.cuarzo.HeavenCompositor'",
         HNIface::CompositorChanged,
+        NULL,
         NULL
     );
 
@@ -215,31 +304,71 @@ std::shared_ptr<HNClient> HNClient::GetOrMake() noexcept
     }
 
     auto cli { std::shared_ptr<HNClient>(new HNClient(bus)) };
+    cli->m_transport = std::make_unique<HNBusTransport>(bus->bus());
     s_client = cli;
 
-    // Detect processes that are already present on the bus.
-    sd_bus_message *reply {};
-    const char *owner;
+#ifdef HEAVEN_TRACE
+    HNTrace::EnableFromEnv();
 
-    if (sd_bus_call_method(bus->bus(), "org.freedesktop.DBus", "/org/freedesktop/DBus",
-            "org.freedesktop.DBus", "GetNameOwner", NULL, &reply, "s", BD) >= 0)
-    {
-        sd_bus_message_read(reply, "s", &owner);
-        cli->m_barId = owner;
-        HNLog(CZInfo, CZLN, "Bar already present: {}", cli->m_barId);
-    }
+    if (const char *uniqueName; sd_bus_get_unique_name(bus->bus(), &uniqueName) >= 0)
+        cli->m_traceId = HNTrace::ClientId(uniqueName);
+#endif
+
+    cli->setupLoop();
+
+    // Detect processes that are already present on the bus, resolved in parallel
+    // while the app keeps initializing. Later changes come from the matches above.
+    sd_bus_call_method_async(bus->bus(), NULL, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "GetNameOwner", HNIface::BarOwnerACK, NULL, "s", BD);
+
+    sd_bus_call_method_async(bus->bus(), NULL, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+        "org.freedesktop.DBus", "GetNameOwner", HNIface::CompositorOwnerACK, NULL, "s", CD);
 
-    reply = nullptr;
+    return cli;
+}
+
+std::shared_ptr<HNClient> HNClient::MakeLoopback(HNLoopbackLink *link, const std::string &id) noexcept
+{
+    if (!link || id.empty() || !s_client.expired())
+        return {};
+
+    auto cli { std::shared_ptr<HNClient>(new HNClient(nullptr)) };
+    cli->m_transport = std::make_unique<HNLoopbackTransport>(link, id);
+    s_client = cli;
+
+#ifdef HEAVEN_TRACE
+    HNTrace::EnableFromEnv();
+    cli->m_traceId = HNTrace::ClientId(id.c_str());
+#endif
+
+    cli->setupLoop();
+
+    if (const auto bar { link->owner(BD) }; !bar.empty())
+        cli->handleBarFound(bar);
+
+    if (const auto compositor { link->owner(CD) }; !compositor.empty())
+        cli->handleCompositorFound(compositor);
+
+    return cli;
+}
+
+void HNClient::setupLoop() noexcept
+{
+    const int stagedFd { eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) };
 
-    if (sd_bus_call_method(bus->bus(), "org.freedesktop.DBus", "/org/freedesktop/DBus",
-            "org.freedesktop.DBus", "GetNameOwner", NULL, &reply, "s", CD) >= 0)
+    if (stagedFd < 0)
+        HNLog(CZError, CZLN, "Failed to create eventfd, staged mutations will only run on commit(). {}", strerror(errno));
+    else
     {
-        sd_bus_message_read(reply, "s", &owner);
-        cli->m_compositorId = owner;
-        HNLog(CZInfo, CZLN, "Compositor already present: {}", cli->m_compositorId);
+        m_stagedSource = CZEventSource::Make(stagedFd, EPOLLIN, CZOwn::Own, [](int, UInt32)
+        {
+            if (auto cli = s_client.lock())
+                cli->drainStaged();
+        });
     }
 
-    return cli;
+    if (!m_poll.init(m_bus ? m_bus->bus() : nullptr, { m_stagedSource ? m_stagedSource->fd() : -1 }))
+        HNLog(CZWarning, CZLN, "Failed to create the epoll instance, fd() returns the bus connection. {}", strerror(errno));
 }
 
 std::shared_ptr<HNClient> HNClient::Get() noexcept
@@ -249,6 +378,10 @@ std::shared_ptr<HNClient> HNClient::Get() noexcept
 
 void HNClient::commit() noexcept
 {
+    drainStaged();
+    m_autoCommitPending = false;
+    m_autoCommitTimer.stop();
+
     if (m_pendingFirstCommit)
     {
         m_pendingFirstCommit = false;
@@ -256,10 +389,68 @@ void HNClient::commit() noexcept
         if (!m_barId.empty())
             flushAll();
     }
-    else if (!m_barId.empty())
+    else if (!m_barId.empty() && !m_awaitingResync && !m_backpressure)
         sendCommit();
 }
 
+void HNClient::stage(std::function<void()> mutation) noexcept
+{
+    if (!mutation) return;
+
+    m_staged.push(std::move(mutation));
+
+    // Only after the push completed, see HNMpscQueue.
+    if (!m_stagedWakeup.exchange(true, std::memory_order_acq_rel) && m_stagedSource)
+        eventfd_write(m_stagedSource->fd(), 1);
+}
+
+int HNClient::fd() const noexcept
+{
+    return m_poll.fd();
+}
+
+UInt32 HNClient::events() const noexcept
+{
+    return m_poll.events();
+}
+
+int HNClient::timeout() const noexcept
+{
+    m_poll.update();
+    const int autoCommit { m_autoCommitTimer.timeout(HNDeadlineTimer::Clock::now()) };
+    return m_bus ? HNBusPoll::MinTimeout(HNBusPoll::Timeout(m_bus->bus()), autoCommit) : autoCommit;
+}
+
+int HNClient::processPending(UInt32 maxMessages) noexcept
+{
+    drainStaged();
+    const int processed { m_bus ? HNBusPoll::Process(m_bus->bus(), maxMessages) : 0 };
+    m_autoCommitTimer.fireIfDue(HNDeadlineTimer::Clock::now());
+    m_poll.update();
+    return processed;
+}
+
+void HNClient::drainStaged() noexcept
+{
+    // The eventfd may be watched by a foreign loop, see fd().
+    if (m_stagedSource)
+    {
+        eventfd_t value;
+        eventfd_read(m_stagedSource->fd(), &value);
+    }
+
+    if (!m_stagedWakeup.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    std::function<void()> mutation;
+
+    while (m_staged.pop(mutation))
+    {
+        mutation();
+        mutation = nullptr;
+    }
+}
+
 void HNClient::setName(const std::string &name) noexcept
 {
     if (name == m_name) return;
@@ -285,17 +476,7 @@ void HNClient::sendPrivateHandle() noexcept
 {
     if (m_compositorId.empty() || m_privateHandle.empty()) return;
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        CD, CP, CD,
-        "RegisterClient",
-        IgnoreCallback,
-        NULL,
-        "s",
-        m_privateHandle.c_str());
+    m_transport->registerPrivateHandle(m_privateHandle);
 }
 
 void HNClient::addObject(HNObject *object) noexcept
@@ -305,24 +486,17 @@ void HNClient::addObject(HNObject *object) noexcept
 
 void HNClient::removeObject(HNObject *object) noexcept
 {
+    scheduleAutoCommit();
+
     UInt32 id { object->id() };
     m_objects.erase(id);
 
     if (canSend())
     {
         m_destroyedIds.emplace(id);
+        HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, id);
 
-        sd_bus_slot *slot { NULL };
-
-        sd_bus_call_method_async(
-            m_bus->bus(),
-            &slot,
-            BD, BP, BD,
-            "DestroyObject",
-            HNIface::DestroyObjectACK,
-            NULL,
-            "u",
-            id);
+        m_transport->destroyObject(id);
     }
     else
     {
@@ -360,128 +534,84 @@ UInt32 HNClient::getFreeObjectID() noexcept
 
 void HNClient::sendCreateObject(HNObject *o) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
-    sd_bus_slot *slot { NULL };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "CreateObject",
-        IgnoreCallback,
-        NULL,
-        "uu",
-        o->id(),
-        (UInt32)o->type());
+    m_transport->createObject(o->id(), (UInt32)o->type());
 }
 
 void HNClient::sendObjectTitle(HNWithTitle *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
     auto *o { dynamic_cast<HNObject*>(obj) };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetObjectTitle",
-        IgnoreCallback,
-        NULL,
-        "us",
-        o->id(),
-        obj->title().c_str());
+    m_transport->setObjectTitle(o->id(), obj->title());
 }
 
 void HNClient::sendObjectShortcut(HNWithShortcut *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
     auto *o { dynamic_cast<HNObject*>(obj) };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetObjectShortcut",
-        IgnoreCallback,
-        NULL,
-        "us",
-        o->id(),
-        obj->shortcut().c_str());
+    m_transport->setObjectShortcut(o->id(), obj->shortcut());
 }
 
 void HNClient::sendObjectIcon(HNWithIcon *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
     auto *o { dynamic_cast<HNObject*>(obj) };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetObjectIcon",
-        IgnoreCallback,
-        NULL,
-        "us",
-        o->id(),
-        obj->icon().c_str());
+    m_transport->setObjectIcon(o->id(), obj->icon());
 }
 
 void HNClient::sendObjectEnabled(HNWithEnabled *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
     auto *o { dynamic_cast<HNObject*>(obj) };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetObjectEnabled",
-        IgnoreCallback,
-        NULL,
-        "ub",
-        o->id(),
-        (int)obj->enabled());
+    m_transport->setObjectEnabled(o->id(), obj->enabled());
 }
 
 void HNClient::sendObjectParent(HNWithParent *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
     auto *o { dynamic_cast<HNObject*>(obj) };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetObjectParent",
-        IgnoreCallback,
-        NULL,
-        "uu",
-        o->id(),
-        obj->parent() ? obj->parent()->id() : 0);
+    m_transport->setObjectParent(o->id(), obj->parent() ? obj->parent()->id() : 0);
 }
 
 void HNClient::sendInsertObjectBefore(HNWithParent *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
     auto *o { dynamic_cast<HNObject*>(obj) };
     auto *parent { dynamic_cast<HNWithChildren*>(obj->parent()) };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, o->id());
 
     // The sibling is the object that now follows 'obj' in the parent's list,
     // or 0 (append) if 'obj' is the last child.
@@ -495,86 +625,99 @@ void HNClient::sendInsertObjectBefore(HNWithParent *obj) noexcept
             siblingId = dynamic_cast<HNObject*>(*next)->id();
     }
 
-    sd_bus_slot *slot { NULL };
-
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "InsertObjectBefore",
-        IgnoreCallback,
-        NULL,
-        "uu",
-        o->id(),
-        siblingId);
+    m_transport->insertObjectBefore(o->id(), siblingId);
 }
 
 void HNClient::sendToggleChecked(HNToggle *obj) noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
-    sd_bus_slot *slot { NULL };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, obj->id());
 
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetToggleChecked",
-        IgnoreCallback,
-        NULL,
-        "ub",
-        obj->id(),
-        (int)obj->checked());
+    m_transport->setToggleChecked(obj->id(), obj->checked());
 }
 
 void HNClient::sendClientName() noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend()) return;
 
-    sd_bus_slot *slot { NULL };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, 0);
 
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetClientName",
-        IgnoreCallback,
-        NULL,
-        "s",
-        m_name.c_str());
+    m_transport->setClientName(m_name);
 }
 
 void HNClient::sendClientTopbar() noexcept
 {
+    scheduleAutoCommit();
+
     if (!canSend() || !m_activeTopbar.get()) return;
 
-    sd_bus_slot *slot { NULL };
+    HN_TRACE(ClientSend, m_traceId, m_commitSeq + 1, 0);
 
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "SetClientTopbar",
-        IgnoreCallback,
-        NULL,
-        "u",
-        m_activeTopbar->id());
+    m_transport->setClientTopbar(m_activeTopbar->id());
 }
 
 void HNClient::sendCommit() noexcept
 {
     if (m_barId.empty()) return;
 
-    sd_bus_slot *slot { NULL };
+    HN_TRACE(ClientCommit, m_traceId, m_commitSeq + 1, 0);
 
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "Commit",
-        IgnoreCallback,
-        NULL,
-        "");
+    if (m_legacyCommit)
+    {
+        m_transport->commit();
+        return;
+    }
+
+    if (m_focusTransactions && !m_legacyFocus && m_focusSerial != m_sentFocusSerial)
+    {
+        // Before sending, a loopback bar may acknowledge it before commit() returns.
+        m_sentFocusSerial = m_focusSerial;
+        m_commitInFlight = ++m_commitSeq;
+        m_transport->commit(m_commitSeq, NowUsec(), m_focusSerial);
+        return;
+    }
+
+    m_commitInFlight = ++m_commitSeq;
+    m_transport->commit(m_commitSeq, NowUsec(), 0);
+}
+
+void HNClient::setAutoCommit(bool enabled) noexcept
+{
+    m_autoCommit = enabled;
+
+    if (!enabled)
+    {
+        m_autoCommitPending = false;
+        m_autoCommitTimer.stop();
+    }
+}
+
+void HNClient::scheduleAutoCommit() noexcept
+{
+    if (!m_autoCommit)
+        return;
+
+    m_autoCommitPending = true;
+
+    if (m_autoCommitTimer.running())
+        return;
+
+    // Wait for the previous commit to be applied, unless its ack got lost.
+    m_autoCommitTimer.start(m_commitInFlight ? AutoCommitAckTimeoutMs : 0);
+}
+
+void HNClient::sendAnnounce() noexcept
+{
+    if (m_barId.empty()) return;
+
+    m_awaitingResync = true;
+
+    m_transport->announceClient();
 }
 
 void HNClient::sendObjectProperties(HNObject *obj) noexcept
@@ -591,15 +734,7 @@ void HNClient::flushAll() noexcept
     if (m_barId.empty()) return;
 
     // 1. (Re)register with the bar.
-    sd_bus_slot *slot { NULL };
-    sd_bus_call_method_async(
-        m_bus->bus(),
-        &slot,
-        BD, BP, BD,
-        "RegisterClient",
-        IgnoreCallback,
-        NULL,
-        "");
+    m_transport->registerClient();
 
     // 2. Create every object and re-send its properties.
     for (auto &[id, obj] : m_objects)
@@ -623,3 +758,184 @@ void HNClient::flushAll() noexcept
     // 5. Apply everything atomically.
     sendCommit();
 }
+
+void HNClient::handleBarChanged(const std::string &owner) noexcept
+{
+    if (owner.empty())
+    {
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar disappeared");
+        m_barId = "";
+        m_awaitingResync = false;
+        m_backpressure = false;
+        m_legacyCommit = false;
+        m_legacyFocus = false;
+        m_sentFocusSerial = 0;
+        m_commitInFlight = 0;
+
+        // Queued changes are resent to the next bar, and unacked ids are unknown to it.
+        m_transport->cancelBar();
+        m_freedIds.merge(m_destroyedIds);
+    }
+    else
+    {
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar appeared: {}", owner);
+        m_barId = owner;
+
+        // If the client already published its menu, the freshly (re)started
+        // bar must be brought up to date. Rather than re-sending everything
+        // right away (all clients would flood the bar at the same instant),
+        // announce ourselves and let the bar pull the state when ready.
+        if (!m_pendingFirstCommit)
+            sendAnnounce();
+    }
+}
+
+void HNClient::handleBarFound(const std::string &owner) noexcept
+{
+    // Already reported by NameOwnerChanged.
+    if (m_barId == owner)
+        return;
+
+    m_barId = owner;
+    HNLog(CZInfo, CZLN, "Bar already present: {}", m_barId);
+
+    // Committed before the lookup completed.
+    if (!m_pendingFirstCommit)
+        flushAll();
+}
+
+void HNClient::handleCompositorChanged(const std::string &owner) noexcept
+{
+    if (owner.empty())
+    {
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenCompositor disappeared");
+        m_compositorId = "";
+        m_transport->cancelCompositor();
+    }
+    else
+    {
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenCompositor appeared: {}", owner);
+        m_compositorId = owner;
+        sendPrivateHandle();
+    }
+}
+
+void HNClient::handleCompositorFound(const std::string &owner) noexcept
+{
+    // Already reported by NameOwnerChanged.
+    if (m_compositorId == owner)
+        return;
+
+    m_compositorId = owner;
+    HNLog(CZInfo, CZLN, "Compositor already present: {}", m_compositorId);
+    sendPrivateHandle();
+}
+
+void HNClient::handleObjectClicked(UInt32 objectId) noexcept
+{
+    HN_TRACE(ClientClick, m_traceId, ++m_clicksReceived, objectId);
+
+    auto it { m_objects.find(objectId) };
+
+    if (it == m_objects.end())
+        return;
+
+    it->second->onClicked.notify(it->second);
+}
+
+void HNClient::handleResync() noexcept
+{
+    if (m_pendingFirstCommit)
+        return;
+
+    HNLog(CZDebug, CZLN, "State pulled by the bar");
+    m_awaitingResync = false;
+    flushAll();
+}
+
+void HNClient::handleBackpressure(bool active) noexcept
+{
+    if (active)
+    {
+        // Changes keep accumulating in the local objects, which is all the coalescing needed.
+        HNLog(CZWarning, CZLN, "Backpressure applied by the bar");
+        m_backpressure = true;
+    }
+    else if (m_backpressure)
+    {
+        // Some changes were dropped by the bar, resend the whole state to be reconciled.
+        HNLog(CZDebug, CZLN, "Backpressure released by the bar");
+        m_backpressure = false;
+
+        if (!m_pendingFirstCommit && !m_awaitingResync)
+            flushAll();
+    }
+}
+
+void HNClient::handleCommitApplied(UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept
+{
+    HN_TRACE(ClientAck, m_traceId, seq, 0);
+
+    const UInt64 now { NowUsec() };
+    m_lastCommitDispatchTime = dispatchTime;
+
+    // The bar is ready for the next automatic commit.
+    if (m_commitInFlight && seq >= m_commitInFlight)
+    {
+        m_commitInFlight = 0;
+
+        if (m_autoCommitPending)
+        {
+            m_autoCommitTimer.stop();
+            m_autoCommitTimer.start(0);
+        }
+    }
+
+    onCommitApplied.notify(seq, now > clientTime ? now - clientTime : 0);
+}
+
+void HNClient::handleFocusChanged(UInt32 serial) noexcept
+{
+    m_focusSerial = serial;
+    onFocusChanged.notify(serial);
+
+    // The bar is waiting for the serial, even if nothing changed.
+    if (m_focusTransactions && m_sentFocusSerial != serial)
+        scheduleAutoCommit();
+}
+
+void HNClient::handleObjectDestroyed(UInt32 objectId) noexcept
+{
+    m_destroyedIds.erase(objectId);
+    m_freedIds.emplace(objectId);
+}
+
+void HNClient::handleLegacyCommit(bool focus) noexcept
+{
+    if (focus)
+    {
+        // Older bar, focus changes can't be synchronized.
+        HNLog(CZDebug, CZLN, "The bar does not support focus transactions");
+        m_legacyFocus = true;
+    }
+    else
+    {
+        // Older bar, commits won't be acknowledged.
+        HNLog(CZDebug, CZLN, "The bar does not support sequenced commits");
+        m_legacyCommit = true;
+    }
+
+    m_commitInFlight = 0;
+    sendCommit();
+}
+
+void HNClient::handleAnnounceFailed() noexcept
+{
+    if (!m_awaitingResync)
+        return;
+
+    // The bar can't pull the state, push it instead.
+    HNLog(CZDebug, CZLN, "The bar does not support paced resyncs");
+    m_awaitingResync = false;
+    flushAll();
+}
@@ -1,9 +1,16 @@
-#ifndef HNCLIENT_H
-#define HNCLIENT_H
+#ifndef CLIENT_HNCLIENT_H
+#define CLIENT_HNCLIENT_H
 
 #include <CZ/Core/CZBus.h>
 #include <CZ/Core/CZWeak.h>
+#include <CZ/Core/CZSignal.h>
 #include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/Client/HNTransport.h>
+#include <CZ/Heaven/HNDeadlineTimer.h>
+#include <CZ/Heaven/HNPollSet.h>
+#include <CZ/Heaven/HNMpscQueue.h>
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -18,6 +25,9 @@
  * and reference the client that owns them.
  *
  * The instance is a lazily-created singleton; retrieve it with GetOrMake().
+ *
+ * Except for stage(), the client and the menu objects must only be used from
+ * the thread running the CZCore loop.
  */
 class CZ::Client::HNClient
 {
@@ -28,10 +38,28 @@ public:
      * Retrieves the shared singleton instance of HNClient. If the instance
      * does not already exist, a new one is created and initialized.
      *
+     * Creation doesn't wait for the bus: the bar and compositor are looked up
+     * in parallel and picked up when the replies arrive, so the menus can be
+     * built and committed right away.
+     *
      * @return Shared pointer to the singleton HNClient instance.
      */
     static std::shared_ptr<HNClient> GetOrMake() noexcept;
 
+    /**
+     * @brief Creates the client connected to a bar in the same process instead of the session bus.
+     *
+     * Calls to the bar and compositor go through @p link, usually the
+     * Bar::HNLoopback of a bar created with Bar::HNBar::MakeLoopback(), which
+     * must outlive the client. Everything else behaves as with GetOrMake(), so
+     * the whole library path can be measured without a bus, e.g. in benchmarks.
+     *
+     * @param link Loopback link of the bar.
+     * @param id   Unique name of the client, as seen by the bar and compositor.
+     * @return The client, or nullptr if a client already exists in this process.
+     */
+    static std::shared_ptr<HNClient> MakeLoopback(HNLoopbackLink *link, const std::string &id) noexcept;
+
     /**
      * @brief Returns the existing HNClient singleton instance.
      *
@@ -55,6 +83,62 @@ public:
      */
     void commit() noexcept;
 
+    /**
+     * @brief Enables or disables automatic commits.
+     *
+     * When enabled, changes are committed automatically once per main loop
+     * iteration, and at most one commit waits for the bar to apply it. Changes
+     * made meanwhile are coalesced into the next commit, sent as soon as the
+     * bar acknowledges the previous one (see onCommitApplied). The update rate
+     * is thus bounded by what the bar can actually apply and display (see
+     * Bar::HNBar::setFramePacing()).
+     *
+     * Calling commit() explicitly is still allowed.
+     *
+     * @param enabled Whether to commit automatically. Disabled by default.
+     */
+    void setAutoCommit(bool enabled) noexcept;
+
+    /**
+     * @brief Checks whether changes are committed automatically.
+     *
+     * @see setAutoCommit()
+     */
+    bool autoCommit() const noexcept { return m_autoCommit; }
+
+    /**
+     * @brief Queues a change to be made from the thread running the CZCore loop.
+     *
+     * This is the only method that can be called from any thread. It lets
+     * worker threads build or update menus without locking: the mutation is
+     * pushed to a lock-free queue and run on the loop thread shortly after,
+     * and in any case before the next commit() sends anything.
+     *
+     * Mutations staged by the same thread run in the order they were staged.
+     * Mutations from different threads are not ordered with respect to each
+     * other.
+     *
+     * The mutation is destroyed on the loop thread after it runs, so objects
+     * it captures (e.g. a std::shared_ptr<HNMenu>) are also released there.
+     * Objects must not be created, modified or released outside mutations.
+     *
+     * @code
+     * std::thread([client = HNClient::Get(), menu = recentMenu]() mutable
+     * {
+     *     auto projects { ScanRecentProjects() };
+     *
+     *     client->stage([menu = std::move(menu), projects = std::move(projects)]
+     *     {
+     *         menu->setEnabled(!projects.empty());
+     *         ...
+     *     });
+     * }).detach();
+     * @endcode
+     *
+     * @param mutation Function run on the loop thread.
+     */
+    void stage(std::function<void()> mutation) noexcept;
+
     /**
      * @brief Returns the application name advertised to the bar.
      *
@@ -136,10 +220,126 @@ public:
      * Provides access to the underlying D-Bus connection used for
      * communication with the compositor and bar processes.
      *
-     * @return Shared pointer to the active CZBus instance.
+     * @return Shared pointer to the active CZBus instance, or nullptr for a client created with MakeLoopback().
      */
     std::shared_ptr<CZBus> bus() const noexcept { return m_bus; }
 
+    /**
+     * @brief Returns the number of D-Bus calls awaiting a reply.
+     *
+     * Calls beyond the in-flight limit are queued locally and sent in order as
+     * replies arrive, see queuedCalls().
+     */
+    size_t outstandingCalls() const noexcept { return m_transport->outstandingCalls(); }
+
+    /**
+     * @brief Returns the number of D-Bus calls queued locally.
+     *
+     * @see outstandingCalls()
+     */
+    size_t queuedCalls() const noexcept { return m_transport->queuedCalls(); }
+
+    /**
+     * @name Foreign event loops
+     *
+     * Toolkits with their own epoll loop can drive the client without
+     * dispatching CZCore or spawning a thread: watch fd() for events(), wake up
+     * after timeout() at the latest, and call processPending().
+     *
+     * fd() also becomes readable when mutations are staged from other threads
+     * (see stage()), and timeout() includes the deadline of the next automatic
+     * commit (see setAutoCommit()), which processPending() sends once due.
+     * @{
+     */
+
+    /// Epoll file descriptor aggregating the bus connection (if any) and the staging wakeups.
+    int fd() const noexcept;
+
+    /// Poll events to watch on fd() (POLLIN, equal to EPOLLIN).
+    UInt32 events() const noexcept;
+
+    /// Milliseconds until processPending() must be called even without events, or -1. Call it before each wait.
+    int timeout() const noexcept;
+
+    /**
+     * @brief Runs the staged mutations, processes pending messages without blocking and sends the due automatic commit.
+     *
+     * @param maxMessages Maximum messages to process, 0 means all. The host can
+     *                    bound each call and process the rest on the next iteration.
+     * @return Number of messages processed, or a negative errno if the connection failed.
+     */
+    int processPending(UInt32 maxMessages = 0) noexcept;
+
+    /** @} */
+
+    /**
+     * @brief Returns the sequence number of the last commit sent to the bar.
+     *
+     * Each commit sent carries a monotonically increasing sequence number
+     * (starting at 1), echoed back by onCommitApplied.
+     *
+     * @return The sequence number, or 0 if nothing was committed yet.
+     */
+    UInt32 commitSequence() const noexcept { return m_commitSeq; }
+
+    /**
+     * @brief Returns how long the bar took to apply the last acknowledged commit, in microseconds.
+     *
+     * Measured by the bar from the reception of the commit until it was fully
+     * applied, including the time it waited to be scheduled.
+     */
+    UInt64 lastCommitDispatchTime() const noexcept { return m_lastCommitDispatchTime; }
+
+    /**
+     * @brief Emitted when the bar acknowledges a commit.
+     *
+     * Only sent once the commit's changes are applied: commits of inactive
+     * clients deferred by the bar (see Bar::HNBar::setDeferInactiveCommits())
+     * when the deferred changes are, and commits received under backpressure
+     * when the state resent after its release is.
+     *
+     * @param seq     Sequence number of the commit (see commitSequence()).
+     * @param latency Microseconds from the commit being sent until the acknowledgement was received.
+     */
+    CZSignal<UInt32 /*seq*/, UInt64 /*latency*/> onCommitApplied;
+
+    /**
+     * @brief Synchronizes topbar changes with focus changes.
+     *
+     * When the compositor focuses one of the client's windows it sends a focus
+     * serial (see onFocusChanged). With focus transactions enabled, the next
+     * commit references that serial, and the bar waits for it (up to a short
+     * deadline) before presenting the client, so it never shows the topbar of
+     * the previously focused window for a frame.
+     *
+     * Once enabled, the client must commit() after each onFocusChanged, even
+     * if nothing changed. With setAutoCommit() this happens automatically.
+     *
+     * @param enabled Whether to reference focus serials in commits. Disabled by default.
+     */
+    void setFocusTransactions(bool enabled) noexcept { m_focusTransactions = enabled; }
+
+    /**
+     * @brief Checks whether focus transactions are enabled.
+     *
+     * @see setFocusTransactions()
+     */
+    bool focusTransactions() const noexcept { return m_focusTransactions; }
+
+    /**
+     * @brief Returns the last focus serial received from the compositor, or 0.
+     */
+    UInt32 focusSerial() const noexcept { return m_focusSerial; }
+
+    /**
+     * @brief Emitted when the compositor focuses one of the client's windows.
+     *
+     * A good place to call setActiveTopbar() and commit().
+     *
+     * @param serial Focus serial, see setFocusTransactions().
+     */
+    CZSignal<UInt32 /*serial*/> onFocusChanged;
+
 private:
     friend class HNObject;
     friend class HNWithTitle;
@@ -154,15 +354,39 @@ private:
     friend class HNToggle;
     friend class HNDivider;
     friend struct HNIface;
+    friend class HNBusTransport;
+    friend class HNLoopbackTransport;
+
+    HNClient(std::shared_ptr<CZBus> bus) noexcept :
+        m_bus(bus),
+        m_autoCommitTimer([this]{ if (m_autoCommitPending) commit(); }) {}
+
+    // Creates the staging eventfd and the poll set, once the transport is set.
+    void setupLoop() noexcept;
 
-    HNClient(std::shared_ptr<CZBus> bus) noexcept : m_bus(bus) {}
+    /*
+     * Calls received from the current bar or compositor, and replies, handed
+     * over by the transport.
+     */
+    void handleBarChanged(const std::string &owner) noexcept;
+    void handleBarFound(const std::string &owner) noexcept;
+    void handleCompositorChanged(const std::string &owner) noexcept;
+    void handleCompositorFound(const std::string &owner) noexcept;
+    void handleObjectClicked(UInt32 objectId) noexcept;
+    void handleResync() noexcept;
+    void handleBackpressure(bool active) noexcept;
+    void handleCommitApplied(UInt32 seq, UInt64 clientTime, UInt64 dispatchTime) noexcept;
+    void handleFocusChanged(UInt32 serial) noexcept;
+    void handleObjectDestroyed(UInt32 objectId) noexcept;
+    void handleLegacyCommit(bool focus) noexcept;
+    void handleAnnounceFailed() noexcept;
     void sendPrivateHandle() noexcept;
     void addObject(HNObject *object) noexcept;
     void removeObject(HNObject *object) noexcept;
     UInt32 getFreeObjectID() noexcept;
 
-    /// @return true if the client is connected to the bar and has committed at least once.
-    bool canSend() const noexcept { return !m_pendingFirstCommit && !m_barId.empty(); }
+    /// @return true if the client is connected to the bar, has committed at least once, isn't waiting to be pulled and isn't under backpressure.
+    bool canSend() const noexcept { return !m_pendingFirstCommit && !m_barId.empty() && !m_awaitingResync && !m_backpressure; }
 
     void sendCreateObject(HNObject *obj) noexcept;
     void sendObjectTitle(HNWithTitle *obj) noexcept;
@@ -176,17 +400,75 @@ private:
     void sendClientTopbar() noexcept;
     void sendCommit() noexcept;
 
+    // Asks a (re)started bar to pull the client state (see handleResync()).
+    void sendAnnounce() noexcept;
+
+    // Runs the mutations staged from other threads (loop thread only).
+    void drainStaged() noexcept;
+
+    // Marks the client dirty for the next automatic commit.
+    void scheduleAutoCommit() noexcept;
+
     // Registers with the bar and (re)sends the entire client state.
     void flushAll() noexcept;
 
     // Sends every property currently set on an object.
     void sendObjectProperties(HNObject *obj) noexcept;
 
+    // Null on loopback
     std::shared_ptr<CZBus> m_bus;
 
+    // Calls to the bar and compositor, see HNTransport
+    std::unique_ptr<HNTransport> m_transport;
+
     // Becomes false after the first commit(); until then nothing is sent.
     bool m_pendingFirstCommit { true };
 
+    // Announced to a (re)started bar, nothing is sent until it pulls the state.
+    bool m_awaitingResync { false };
+
+    // The bar is over its limits for this client, changes are only kept locally until released.
+    bool m_backpressure { false };
+
+    // Sequence number of the last commit sent
+    UInt32 m_commitSeq { 0 };
+
+    // Bar dispatch time of the last acknowledged commit (us)
+    UInt64 m_lastCommitDispatchTime { 0 };
+
+    // The bar doesn't support sequenced commits
+    bool m_legacyCommit { false };
+
+    // Sequence of the commit awaiting its ack, 0 if none
+    UInt32 m_commitInFlight { 0 };
+
+    // Focus transactions (see setFocusTransactions())
+    bool m_focusTransactions { false };
+    bool m_legacyFocus { false };
+    UInt32 m_focusSerial { 0 };
+    UInt32 m_sentFocusSerial { 0 };
+
+    // Number of the unique name and clicks received, see HNTrace
+    UInt32 m_traceId { 0 };
+    UInt32 m_clicksReceived { 0 };
+
+    // Automatic commits (see setAutoCommit())
+    bool m_autoCommit { false };
+    bool m_autoCommitPending { false };
+    HNDeadlineTimer m_autoCommitTimer;
+
+    // Mutations staged from any thread (see stage())
+    HNMpscQueue<std::function<void()>> m_staged;
+
+    // Set by producers after staging, cleared by the loop thread before draining.
+    std::atomic<bool> m_stagedWakeup { false };
+
+    // Wakes the loop thread up when mutations are staged
+    std::shared_ptr<CZEventSource> m_stagedSource;
+
+    // See fd()
+    HNPollSet m_poll;
+
     // Application name advertised to the bar.
     std::string m_name;
 
@@ -215,4 +497,4 @@ private:
     std::unordered_map<UInt32, HNObject*> m_objects;
 };
 
-#endif // HNCLIENT_H
+#endif // CLIENT_HNCLIENT_H
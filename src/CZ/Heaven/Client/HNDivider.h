@@ -1,5 +1,5 @@
-#ifndef HNDIVIDER_H
-#define HNDIVIDER_H
+#ifndef CLIENT_HNDIVIDER_H
+#define CLIENT_HNDIVIDER_H
 
 #include <CZ/Heaven/Client/HNObject.h>
 #include <CZ/Heaven/Client/HNWithParent.h>
@@ -33,4 +33,4 @@ private:
         HNObject(client, id, Type::Divider) {}
 };
 
-#endif // HNDIVIDER_H
+#endif // CLIENT_HNDIVIDER_H
@@ -0,0 +1,148 @@
+#include <CZ/Heaven/Client/HNLoopbackTransport.h>
+#include <CZ/Heaven/Client/HNClient.h>
+
+using namespace CZ;
+using namespace CZ::Client;
+
+HNLoopbackTransport::HNLoopbackTransport(HNLoopbackLink *link, const std::string &id) noexcept :
+    m_link(link),
+    m_id(id)
+{
+    m_link->connect(m_id, "", [this](const std::string &sender, const std::string &member, const std::vector<Arg> &args)
+    {
+        receive(sender, member, args);
+    });
+}
+
+HNLoopbackTransport::~HNLoopbackTransport() noexcept
+{
+    m_link->disconnect(m_id);
+}
+
+bool HNLoopbackTransport::callBar(const char *member, std::vector<Arg> args) noexcept
+{
+    return m_link->call(m_id, "org.cuarzo.HeavenBar", member, std::move(args));
+}
+
+void HNLoopbackTransport::registerClient() noexcept
+{
+    callBar("RegisterClient");
+}
+
+void HNLoopbackTransport::announceClient() noexcept
+{
+    if (!callBar("AnnounceClient"))
+        if (auto cli = HNClient::Get())
+            cli->handleAnnounceFailed();
+}
+
+void HNLoopbackTransport::setClientName(const std::string &name) noexcept
+{
+    callBar("SetClientName", { name });
+}
+
+void HNLoopbackTransport::setClientTopbar(UInt32 topbarId) noexcept
+{
+    callBar("SetClientTopbar", { UInt64(topbarId) });
+}
+
+void HNLoopbackTransport::createObject(UInt32 objectId, UInt32 type) noexcept
+{
+    callBar("CreateObject", { UInt64(objectId), UInt64(type) });
+}
+
+void HNLoopbackTransport::destroyObject(UInt32 objectId) noexcept
+{
+    // Ordered before any later reuse of the id, which can be freed right away.
+    if (callBar("DestroyObject", { UInt64(objectId) }))
+        if (auto cli = HNClient::Get())
+            cli->handleObjectDestroyed(objectId);
+}
+
+void HNLoopbackTransport::setObjectTitle(UInt32 objectId, const std::string &title) noexcept
+{
+    callBar("SetObjectTitle", { UInt64(objectId), title });
+}
+
+void HNLoopbackTransport::setObjectIcon(UInt32 objectId, const std::string &icon) noexcept
+{
+    callBar("SetObjectIcon", { UInt64(objectId), icon });
+}
+
+void HNLoopbackTransport::setObjectShortcut(UInt32 objectId, const std::string &shortcut) noexcept
+{
+    callBar("SetObjectShortcut", { UInt64(objectId), shortcut });
+}
+
+void HNLoopbackTransport::setObjectEnabled(UInt32 objectId, bool enabled) noexcept
+{
+    callBar("SetObjectEnabled", { UInt64(objectId), UInt64(enabled) });
+}
+
+void HNLoopbackTransport::setToggleChecked(UInt32 objectId, bool checked) noexcept
+{
+    callBar("SetToggleChecked", { UInt64(objectId), UInt64(checked) });
+}
+
+void HNLoopbackTransport::setObjectParent(UInt32 objectId, UInt32 parentId) noexcept
+{
+    callBar("SetObjectParent", { UInt64(objectId), UInt64(parentId) });
+}
+
+void HNLoopbackTransport::insertObjectBefore(UInt32 objectId, UInt32 siblingId) noexcept
+{
+    callBar("InsertObjectBefore", { UInt64(objectId), UInt64(siblingId) });
+}
+
+void HNLoopbackTransport::commit() noexcept
+{
+    callBar("Commit");
+}
+
+void HNLoopbackTransport::commit(UInt32 seq, UInt64 clientTime, UInt32 focusSerial) noexcept
+{
+    if (focusSerial)
+        callBar("CommitWithFocus", { UInt64(seq), clientTime, UInt64(focusSerial) });
+    else
+        callBar("CommitWithSequence", { UInt64(seq), clientTime });
+}
+
+void HNLoopbackTransport::registerPrivateHandle(const std::string &privateHandle) noexcept
+{
+    m_link->call(m_id, "org.cuarzo.HeavenCompositor", "RegisterClient", { privateHandle });
+}
+
+void HNLoopbackTransport::receive(const std::string &sender, const std::string &member, const std::vector<Arg> &args) noexcept
+{
+    auto cli { HNClient::Get() };
+
+    if (!cli)
+        return;
+
+    const auto *u0 { args.size() > 0 ? std::get_if<UInt64>(&args[0]) : nullptr };
+    const auto *u1 { args.size() > 1 ? std::get_if<UInt64>(&args[1]) : nullptr };
+    const auto *u2 { args.size() > 2 ? std::get_if<UInt64>(&args[2]) : nullptr };
+    const auto *s0 { args.size() > 0 ? std::get_if<std::string>(&args[0]) : nullptr };
+    const auto *s2 { args.size() > 2 ? std::get_if<std::string>(&args[2]) : nullptr };
+
+    if (member == "NameOwnerChanged" && s0 && s2)
+    {
+        if (*s0 == "org.cuarzo.HeavenBar")
+            cli->handleBarChanged(*s2);
+        else if (*s0 == "org.cuarzo.HeavenCompositor")
+            cli->handleCompositorChanged(*s2);
+    }
+    else if (sender == cli->m_barId)
+    {
+        if (member == "ObjectClicked" && u0)
+            cli->handleObjectClicked(UInt32(*u0));
+        else if (member == "Resync")
+            cli->handleResync();
+        else if (member == "Backpressure" && u0)
+            cli->handleBackpressure(*u0 != 0);
+        else if (member == "CommitApplied" && u0 && u1 && u2)
+            cli->handleCommitApplied(UInt32(*u0), *u1, *u2);
+    }
+    else if (sender == cli->m_compositorId && member == "FocusChanged" && u0)
+        cli->handleFocusChanged(UInt32(*u0));
+}
@@ -0,0 +1,61 @@
+#ifndef CLIENT_HNLOOPBACKTRANSPORT_H
+#define CLIENT_HNLOOPBACKTRANSPORT_H
+
+#include <CZ/Heaven/Client/HNTransport.h>
+#include <CZ/Heaven/HNLoopbackLink.h>
+#include <vector>
+
+/**
+ * @brief In-memory transport of the client, used by HNClient::MakeLoopback().
+ *
+ * Calls are delivered through an HNLoopbackLink (usually the Bar::HNLoopback
+ * of a bar in the same process), replies are handed back to the client right
+ * away, and the calls addressed to the client are decoded and handled as if
+ * received from the bus.
+ */
+class CZ::Client::HNLoopbackTransport final : public HNTransport
+{
+public:
+    /**
+     * @brief Connects the client to @p link.
+     *
+     * @param id Unique name of the client.
+     */
+    HNLoopbackTransport(HNLoopbackLink *link, const std::string &id) noexcept;
+
+    /// Disconnects the client, as if it left the bus.
+    ~HNLoopbackTransport() noexcept;
+
+    void registerClient() noexcept override;
+    void announceClient() noexcept override;
+    void setClientName(const std::string &name) noexcept override;
+    void setClientTopbar(UInt32 topbarId) noexcept override;
+    void createObject(UInt32 objectId, UInt32 type) noexcept override;
+    void destroyObject(UInt32 objectId) noexcept override;
+    void setObjectTitle(UInt32 objectId, const std::string &title) noexcept override;
+    void setObjectIcon(UInt32 objectId, const std::string &icon) noexcept override;
+    void setObjectShortcut(UInt32 objectId, const std::string &shortcut) noexcept override;
+    void setObjectEnabled(UInt32 objectId, bool enabled) noexcept override;
+    void setToggleChecked(UInt32 objectId, bool checked) noexcept override;
+    void setObjectParent(UInt32 objectId, UInt32 parentId) noexcept override;
+    void insertObjectBefore(UInt32 objectId, UInt32 siblingId) noexcept override;
+    void commit() noexcept override;
+    void commit(UInt32 seq, UInt64 clientTime, UInt32 focusSerial) noexcept override;
+    void registerPrivateHandle(const std::string &privateHandle) noexcept override;
+    void cancelBar() noexcept override {}
+    void cancelCompositor() noexcept override {}
+    size_t outstandingCalls() const noexcept override { return 0; }
+    size_t queuedCalls() const noexcept override { return 0; }
+
+    /// Unique name of the client.
+    const std::string &id() const noexcept { return m_id; }
+
+private:
+    using Arg = HNLoopbackLink::Arg;
+    bool callBar(const char *member, std::vector<Arg> args = {}) noexcept;
+    void receive(const std::string &sender, const std::string &member, const std::vector<Arg> &args) noexcept;
+    HNLoopbackLink *m_link;
+    std::string m_id;
+};
+
+#endif // CLIENT_HNLOOPBACKTRANSPORT_H
@@ -1,5 +1,5 @@
-#ifndef HNMENU_H
-#define HNMENU_H
+#ifndef CLIENT_HNMENU_H
+#define CLIENT_HNMENU_H
 
 #include <CZ/Heaven/Client/HNObject.h>
 #include <CZ/Heaven/Client/HNWithParent.h>
@@ -47,4 +47,4 @@ private:
         HNObject(client, id, Type::Menu) {}
 };
 
-#endif // HNMENU_H
+#endif // CLIENT_HNMENU_H
@@ -1,5 +1,5 @@
-#ifndef HNOBJECT_H
-#define HNOBJECT_H
+#ifndef CLIENT_HNOBJECT_H
+#define CLIENT_HNOBJECT_H
 
 #include <CZ/Core/CZObject.h>
 #include <CZ/Core/CZSignal.h>
@@ -80,4 +80,4 @@ private:
     Type m_type;
 };
 
-#endif // HNOBJECT_H
+#endif // CLIENT_HNOBJECT_H
@@ -1,5 +1,5 @@
-#ifndef HNTOGGLE_H
-#define HNTOGGLE_H
+#ifndef CLIENT_HNTOGGLE_H
+#define CLIENT_HNTOGGLE_H
 
 #include <CZ/Heaven/Client/HNObject.h>
 #include <CZ/Heaven/Client/HNWithParent.h>
@@ -63,4 +63,4 @@ private:
     bool m_checked { false };
 };
 
-#endif // HNTOGGLE_H
+#endif // CLIENT_HNTOGGLE_H
@@ -1,5 +1,5 @@
-#ifndef HNTOPBAR_H
-#define HNTOPBAR_H
+#ifndef CLIENT_HNTOPBAR_H
+#define CLIENT_HNTOPBAR_H
 
 #include <CZ/Heaven/Client/HNObject.h>
 #include <CZ/Heaven/Client/HNWithParent.h>
@@ -30,4 +30,4 @@ private:
         HNObject(client, id, Type::Topbar) {}
 };
 
-#endif // HNTOPBAR_H
+#endif // CLIENT_HNTOPBAR_H
@@ -0,0 +1,66 @@
+#ifndef CLIENT_HNTRANSPORT_H
+#define CLIENT_HNTRANSPORT_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <string>
+
+/**
+ * @brief Carries the calls from the client to the bar and the compositor.
+ *
+ * The client reaches the other roles only through its transport: HNBusTransport
+ * sends D-Bus method calls, and HNLoopbackTransport delivers them through an
+ * HNLoopbackLink to a bar in the same process (see HNClient::MakeLoopback()).
+ *
+ * Each method is the bar (or compositor) method of the D-Bus interface with the
+ * same name. Replies are handed back to the client by the transport.
+ */
+class CZ::Client::HNTransport
+{
+public:
+    virtual ~HNTransport() noexcept = default;
+
+    /**
+     * @name Bar
+     * @{
+     */
+
+    virtual void registerClient() noexcept = 0;
+    virtual void announceClient() noexcept = 0;
+    virtual void setClientName(const std::string &name) noexcept = 0;
+    virtual void setClientTopbar(UInt32 topbarId) noexcept = 0;
+    virtual void createObject(UInt32 objectId, UInt32 type) noexcept = 0;
+    virtual void destroyObject(UInt32 objectId) noexcept = 0;
+    virtual void setObjectTitle(UInt32 objectId, const std::string &title) noexcept = 0;
+    virtual void setObjectIcon(UInt32 objectId, const std::string &icon) noexcept = 0;
+    virtual void setObjectShortcut(UInt32 objectId, const std::string &shortcut) noexcept = 0;
+    virtual void setObjectEnabled(UInt32 objectId, bool enabled) noexcept = 0;
+    virtual void setToggleChecked(UInt32 objectId, bool checked) noexcept = 0;
+    virtual void setObjectParent(UInt32 objectId, UInt32 parentId) noexcept = 0;
+    virtual void insertObjectBefore(UInt32 objectId, UInt32 siblingId) noexcept = 0;
+
+    /// `Commit`, not acknowledged.
+    virtual void commit() noexcept = 0;
+
+    /// `CommitWithSequence` (@p focusSerial 0) or `CommitWithFocus`.
+    virtual void commit(UInt32 seq, UInt64 clientTime, UInt32 focusSerial) noexcept = 0;
+
+    /** @} */
+
+    /// `RegisterClient` of the compositor.
+    virtual void registerPrivateHandle(const std::string &privateHandle) noexcept = 0;
+
+    /// Drops the calls still queued to the bar, which left.
+    virtual void cancelBar() noexcept = 0;
+
+    /// Drops the calls still queued to the compositor, which left.
+    virtual void cancelCompositor() noexcept = 0;
+
+    /// Number of calls awaiting a reply.
+    virtual size_t outstandingCalls() const noexcept = 0;
+
+    /// Number of calls queued behind the in-flight limit.
+    virtual size_t queuedCalls() const noexcept = 0;
+};
+
+#endif // CLIENT_HNTRANSPORT_H
@@ -1,5 +1,5 @@
-#ifndef HNWITHCHILDREN_H
-#define HNWITHCHILDREN_H
+#ifndef CLIENT_HNWITHCHILDREN_H
+#define CLIENT_HNWITHCHILDREN_H
 
 #include <CZ/Heaven/Heaven.h>
 #include <list>
@@ -30,4 +30,4 @@ protected:
     std::list<HNWithParent*> m_children;
 };
 
-#endif // HNWITHCHILDREN_H
+#endif // CLIENT_HNWITHCHILDREN_H
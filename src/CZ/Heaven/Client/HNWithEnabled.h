@@ -1,5 +1,5 @@
-#ifndef HNWITHENABLED_H
-#define HNWITHENABLED_H
+#ifndef CLIENT_HNWITHENABLED_H
+#define CLIENT_HNWITHENABLED_H
 
 #include <CZ/Heaven/Heaven.h>
 
@@ -34,4 +34,4 @@ protected:
     bool m_enabled { true };
 };
 
-#endif // HNWITHENABLED_H
+#endif // CLIENT_HNWITHENABLED_H
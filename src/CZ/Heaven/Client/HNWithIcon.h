@@ -1,5 +1,5 @@
-#ifndef HNWITHICON_H
-#define HNWITHICON_H
+#ifndef CLIENT_HNWITHICON_H
+#define CLIENT_HNWITHICON_H
 
 #include <CZ/Heaven/Heaven.h>
 #include <string>
@@ -35,4 +35,4 @@ protected:
     std::string m_icon;
 };
 
-#endif // HNWITHICON_H
+#endif // CLIENT_HNWITHICON_H
@@ -1,5 +1,5 @@
-#ifndef HNWITHPARENT_H
-#define HNWITHPARENT_H
+#ifndef CLIENT_HNWITHPARENT_H
+#define CLIENT_HNWITHPARENT_H
 
 #include <CZ/Heaven/Heaven.h>
 #include <list>
@@ -63,4 +63,4 @@ protected:
     std::list<HNWithParent*>::iterator m_parentLink;
 };
 
-#endif // HNWITHPARENT_H
+#endif // CLIENT_HNWITHPARENT_H
@@ -1,5 +1,5 @@
-#ifndef HNWITHSHORTCUT_H
-#define HNWITHSHORTCUT_H
+#ifndef CLIENT_HNWITHSHORTCUT_H
+#define CLIENT_HNWITHSHORTCUT_H
 
 #include <CZ/Heaven/Heaven.h>
 #include <string>
@@ -35,4 +35,4 @@ protected:
     std::string m_shortcut;
 };
 
-#endif // HNWITHSHORTCUT_H
+#endif // CLIENT_HNWITHSHORTCUT_H
@@ -1,5 +1,5 @@
-#ifndef HNWITHTITLE_H
-#define HNWITHTITLE_H
+#ifndef CLIENT_HNWITHTITLE_H
+#define CLIENT_HNWITHTITLE_H
 
 #include <CZ/Heaven/Heaven.h>
 #include <string>
@@ -35,4 +35,4 @@ protected:
     std::string m_title;
 };
 
-#endif // HNWITHTITLE_H
+#endif // CLIENT_HNWITHTITLE_H
@@ -0,0 +1,60 @@
+#include <CZ/Heaven/Compositor/HNBusTransport.h>
+#include <CZ/Heaven/Compositor/HNCompositor.h>
+#include <CZ/Heaven/Compositor/HNLog.h>
+#include <cstring>
+
+using namespace CZ;
+using namespace CZ::Compositor;
+
+// Bar destination, path and interface.
+static const char *BD { "org.cuarzo.HeavenBar" };
+static const char *BP { "/org/cuarzo/HeavenBar" };
+
+void HNBusTransport::setActiveClient(const std::string &clientId, UInt32 serial) noexcept
+{
+    if (serial == 0)
+    {
+        sd_bus_call_method_async(m_bus, NULL, BD, BP, BD, "SetActiveClient", NULL, NULL, "s", clientId.c_str());
+        return;
+    }
+
+    sd_bus_call_method_async(m_bus, NULL, BD, BP, BD, "SetActiveClientWithSerial", SetActiveClientReply, NULL, "su", clientId.c_str(), serial);
+}
+
+void HNBusTransport::setPrefetchHints(const std::vector<std::string> &clientIds) noexcept
+{
+    sd_bus_message *m {};
+
+    int r = sd_bus_message_new_method_call(m_bus, &m, BD, BP, BD, "SetPrefetchHints");
+
+    if (r >= 0) r = sd_bus_message_open_container(m, 'a', "s");
+
+    for (size_t i = 0; r >= 0 && i < clientIds.size(); i++)
+        r = sd_bus_message_append_basic(m, 's', clientIds[i].c_str());
+
+    if (r >= 0) r = sd_bus_message_close_container(m);
+    if (r >= 0) r = sd_bus_message_set_expect_reply(m, 0);
+    if (r >= 0) r = sd_bus_send(m_bus, m, NULL);
+
+    if (r < 0)
+        HNLog(CZError, CZLN, "Failed to send prefetch hints. {}", strerror(-r));
+
+    sd_bus_message_unref(m);
+}
+
+void HNBusTransport::focusChanged(const std::string &clientId, UInt32 serial) noexcept
+{
+    sd_bus_call_method_async(m_bus, NULL, clientId.c_str(), "/org/cuarzo/HeavenClient", "org.cuarzo.HeavenClient",
+        "FocusChanged", NULL, NULL, "u", serial);
+}
+
+int HNBusTransport::SetActiveClientReply(sd_bus_message *m, void *, sd_bus_error *)
+{
+    if (!sd_bus_message_is_method_error(m, SD_BUS_ERROR_UNKNOWN_METHOD))
+        return 0;
+
+    if (auto compositor = HNCompositor::Get())
+        compositor->handleLegacyBar();
+
+    return 0;
+}
@@ -0,0 +1,29 @@
+#ifndef COMPOSITOR_HNBUSTRANSPORT_H
+#define COMPOSITOR_HNBUSTRANSPORT_H
+
+#include <CZ/Heaven/Compositor/HNTransport.h>
+#include <systemd/sd-bus.h>
+
+/**
+ * @brief D-Bus transport of the compositor, used by HNCompositor::GetOrMake().
+ *
+ * Calls are sent asynchronously, the only reply handled is the one of
+ * `SetActiveClientWithSerial`, to detect bars without focus serials.
+ */
+class CZ::Compositor::HNBusTransport final : public HNTransport
+{
+public:
+    HNBusTransport(sd_bus *bus) noexcept : m_bus(bus) {}
+
+    void setActiveClient(const std::string &clientId, UInt32 serial) noexcept override;
+    void setPrefetchHints(const std::vector<std::string> &clientIds) noexcept override;
+    void focusChanged(const std::string &clientId, UInt32 serial) noexcept override;
+
+private:
+    // Reply callback of SetActiveClientWithSerial
+    static int SetActiveClientReply(sd_bus_message *m, void *, sd_bus_error *);
+
+    sd_bus *m_bus;
+};
+
+#endif // COMPOSITOR_HNBUSTRANSPORT_H
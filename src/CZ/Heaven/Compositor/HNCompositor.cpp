@@ -1,9 +1,18 @@
 #include <CZ/Heaven/Compositor/HNCompositor.h>
 #include <CZ/Heaven/Compositor/HNLog.h>
+#include <CZ/Heaven/Compositor/HNBusTransport.h>
+#include <CZ/Heaven/Compositor/HNLoopbackTransport.h>
+#include <CZ/Heaven/HNLoopbackLink.h>
+#include <CZ/Heaven/HNBusPoll.h>
 #include <CZ/Core/CZBus.h>
+#include <CZ/Core/CZEventSource.h>
 #include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #include <systemd/sd-bus.h>
 
+using namespace CZ;
 using namespace CZ::Compositor;
 
 static std::weak_ptr<HNCompositor> s_compositor;
@@ -16,11 +25,11 @@ struct CZ::Compositor::HNIface
         const char *id { sd_bus_message_get_sender(m) };
         const char *token;
         sd_bus_message_read(m, "s", &token);
-        compositor->onClientRegistered.notify(token, id);
+        compositor->handleRegisterClient(token, id);
         return sd_bus_reply_method_return(m, "");
     }
 
-    static int BarChanged(sd_bus_message *m, void *, sd_bus_error *)
+    static int ClientDisconnected(sd_bus_message *m, void *, sd_bus_error *)
     {
         auto compositor { s_compositor.lock() };
 
@@ -33,25 +42,40 @@ struct CZ::Compositor::HNIface
         if (r < 0)
             return r;
 
-        if (old_owner[0] == '\0' && new_owner[0] != '\0')
-        {
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar appeared");
-            compositor->m_isBarAvailable = true;
-            const auto activeClient { std::move(compositor->m_activeClientId) };
-            compositor->setActiveClient(activeClient);
-        } else if (old_owner[0] != '\0' && new_owner[0] == '\0')
-        {
-            compositor->m_isBarAvailable = false;
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar disappeared");
-        } else
-        {
-            HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar owner changed");
-            const auto activeClient { std::move(compositor->m_activeClientId) };
-            compositor->setActiveClient(activeClient);
-        }
+        if (compositor && old_owner[0] != '\0' && new_owner[0] == '\0')
+            compositor->unregisterClient(old_owner);
+
+        return 0;
+    }
+
+    /* Reply callback of the initial GetNameOwner lookup of the bar. */
+    static int BarOwnerACK(sd_bus_message *m, void *, sd_bus_error *)
+    {
+        auto compositor { s_compositor.lock() };
+
+        // Not present.
+        if (compositor && !sd_bus_message_is_method_error(m, NULL))
+            compositor->handleBarFound();
 
         return 0;
     }
+
+    static int BarChanged(sd_bus_message *m, void *, sd_bus_error *)
+    {
+        auto compositor { s_compositor.lock() };
+
+        const char *name;
+        const char *old_owner;
+        const char *new_owner;
+
+        int r = sd_bus_message_read(m, "sss", &name, &old_owner, &new_owner);
+
+        if (r < 0)
+            return r;
+
+        compositor->handleBarChanged(old_owner, new_owner);
+        return 0;
+    }
 };
 
 static const sd_bus_vtable VTable[]
@@ -106,7 +130,7 @@ std::shared_ptr<CZ::Compositor::HNCompositor> CZ::Compositor::HNCompositor::GetO
         return {};
     }
 
-    r = sd_bus_add_match(
+    r = sd_bus_add_match_async(
         bus->bus(),
         NULL,
         "type='signal',"
@@ -115,6 +139,7 @@ std::shared_ptr<CZ::Compositor::HNCompositor> CZ::Compositor::HNCompositor::GetO
         "member='NameOwnerChanged',"
         "arg0='org.cuarzo.HeavenBar'",
         HNIface::BarChanged,
+        NULL,
         NULL
     );
 
@@ -124,46 +149,360 @@ std::shared_ptr<CZ::Compositor::HNCompositor> CZ::Compositor::HNCompositor::GetO
         return {};
     }
 
+    r = sd_bus_add_match_async(
+        bus->bus(),
+        NULL,
+        "type='signal',"
+        "sender='org.freedesktop.DBus',"
+        "interface='org.freedesktop.DBus',"
+        "member='NameOwnerChanged'",
+        HNIface::ClientDisconnected,
+        NULL,
+        NULL
+    );
+
+    if (r < 0)
+    {
+        HNLog(CZFatal, CZLN, "Failed to add match for member='NameOwnerChanged'. {}", strerror(-r));
+        return {};
+    }
+
     auto compositor { std::shared_ptr<HNCompositor>(new HNCompositor(bus)) };
+    compositor->m_transport = std::make_unique<HNBusTransport>(bus->bus());
+    s_compositor = compositor;
+    compositor->checkBarState();
+    compositor->setupLoop();
+    return compositor;
+}
+
+std::shared_ptr<HNCompositor> HNCompositor::Get() noexcept
+{
+    return s_compositor.lock();
+}
+
+std::shared_ptr<HNCompositor> HNCompositor::MakeLoopback(HNLoopbackLink *link, const std::string &id) noexcept
+{
+    if (!link || id.empty() || !s_compositor.expired())
+        return {};
+
+    auto compositor { std::shared_ptr<HNCompositor>(new HNCompositor(nullptr)) };
+    compositor->m_transport = std::make_unique<HNLoopbackTransport>(link, id);
     s_compositor = compositor;
-    compositor->m_isBarAvailable = compositor->checkBarState();
+    compositor->setupLoop();
+
+    if (!link->owner("org.cuarzo.HeavenBar").empty())
+        compositor->handleBarFound();
+
     return compositor;
 }
 
+void HNCompositor::setupLoop() noexcept
+{
+    const int postedFd { eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK) };
+
+    if (postedFd < 0)
+        HNLog(CZError, CZLN, "Failed to create eventfd, posted active clients will not be sent. {}", strerror(errno));
+    else
+    {
+        m_postedSource = CZEventSource::Make(postedFd, EPOLLIN, CZOwn::Own, [](int, UInt32)
+        {
+            if (auto compositor = s_compositor.lock())
+                compositor->sendPostedActiveClient();
+        });
+    }
+
+    if (!m_poll.init(m_bus ? m_bus->bus() : nullptr, { m_postedSource ? m_postedSource->fd() : -1 }))
+        HNLog(CZWarning, CZLN, "Failed to create the epoll instance, fd() returns the bus connection. {}", strerror(errno));
+
+    m_registrationFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (m_registrationFd < 0)
+        HNLog(CZError, CZLN, "Failed to create eventfd, registrations will always be emitted. {}", strerror(errno));
+}
+
+HNCompositor::~HNCompositor() noexcept
+{
+    if (m_registrationFd >= 0)
+        close(m_registrationFd);
+}
+
 void HNCompositor::setActiveClient(const std::string &dbusId) noexcept
 {
     if (dbusId == m_activeClientId) return;
     m_activeClientId = dbusId;
     HNLog(CZDebug, CZLN, "Sending active client {}", dbusId);
 
-    sd_bus_message *reply {};
+    if (dbusId.empty() || m_legacyBar)
+    {
+        m_transport->setActiveClient(dbusId, 0);
+        return;
+    }
 
-    sd_bus_call_method(
-        m_bus->bus(),
-        "org.cuarzo.HeavenBar",
-        "/org/cuarzo/HeavenBar",
-        "org.cuarzo.HeavenBar",
-        "SetActiveClient",
-        NULL,
-        &reply,
-        "s",
-        dbusId.c_str());
+    // Serials skip 0, which means none.
+    if (++m_focusSerial == 0)
+        m_focusSerial = 1;
+
+    // The client references the serial in its next commit.
+    m_transport->focusChanged(dbusId, m_focusSerial);
+
+    // Bars without serials are detected from the reply, see handleLegacyBar().
+    m_transport->setActiveClient(dbusId, m_focusSerial);
 }
 
-HNCompositor::HNCompositor(std::shared_ptr<CZBus> bus) noexcept : m_bus(bus) {}
+void HNCompositor::postActiveClient(const std::string &dbusId) noexcept
+{
+    m_postedActiveClient.store(std::make_shared<const std::string>(dbusId), std::memory_order_release);
+
+    // Only after the slot was updated, a single wakeup covers any number of posts.
+    if (!m_postedWakeup.exchange(true, std::memory_order_acq_rel) && m_postedSource)
+        eventfd_write(m_postedSource->fd(), 1);
+}
+
+int HNCompositor::fd() const noexcept
+{
+    return m_poll.fd();
+}
+
+UInt32 HNCompositor::events() const noexcept
+{
+    return m_poll.events();
+}
 
-bool HNCompositor::checkBarState() const noexcept
+int HNCompositor::timeout() const noexcept
 {
-    sd_bus_message *reply {};
+    m_poll.update();
+    return m_bus ? HNBusPoll::Timeout(m_bus->bus()) : -1;
+}
 
-    return sd_bus_call_method(
+int HNCompositor::processPending(UInt32 maxMessages) noexcept
+{
+    sendPostedActiveClient();
+    const int processed { m_bus ? HNBusPoll::Process(m_bus->bus(), maxMessages) : 0 };
+    m_poll.update();
+    return processed;
+}
+
+void HNCompositor::sendPostedActiveClient() noexcept
+{
+    // The eventfd may be watched by a foreign loop, see fd().
+    if (m_postedSource)
+    {
+        eventfd_t value;
+        eventfd_read(m_postedSource->fd(), &value);
+    }
+
+    if (!m_postedWakeup.exchange(false, std::memory_order_acq_rel))
+        return;
+
+    if (auto dbusId = m_postedActiveClient.exchange(nullptr, std::memory_order_acq_rel))
+        setActiveClient(*dbusId);
+}
+
+void HNCompositor::setPrefetchHints(const std::vector<std::string> &dbusIds) noexcept
+{
+    if (dbusIds == m_prefetchHints) return;
+    m_prefetchHints = dbusIds;
+    sendPrefetchHints();
+}
+
+void HNCompositor::sendPrefetchHints() noexcept
+{
+    if (!m_isBarAvailable)
+        return;
+
+    m_transport->setPrefetchHints(m_prefetchHints);
+}
+
+bool HNCompositor::setActiveClientByHandle(const std::string &privateHandle) noexcept
+{
+    auto it { m_clientsByHandle.find(privateHandle) };
+
+    if (it == m_clientsByHandle.end())
+        return false;
+
+    setActiveClient(it->second->dbusId);
+    return true;
+}
+
+bool HNCompositor::setActiveClientByData(void *data) noexcept
+{
+    auto it { m_clientsByData.find(data) };
+
+    if (!data || it == m_clientsByData.end())
+        return false;
+
+    setActiveClient(it->second->dbusId);
+    return true;
+}
+
+bool HNCompositor::setClientData(const std::string &privateHandle, void *data) noexcept
+{
+    auto it { m_clientsByHandle.find(privateHandle) };
+
+    if (it == m_clientsByHandle.end())
+        return false;
+
+    auto *client { it->second };
+
+    if (client->data)
+        m_clientsByData.erase(client->data);
+
+    client->data = data;
+
+    if (data)
+        m_clientsByData[data] = client;
+
+    return true;
+}
+
+void *HNCompositor::clientData(const std::string &dbusId) const noexcept
+{
+    auto it { m_clients.find(dbusId) };
+    return it == m_clients.end() ? nullptr : it->second->data;
+}
+
+const std::string *HNCompositor::dbusIdByHandle(const std::string &privateHandle) const noexcept
+{
+    auto it { m_clientsByHandle.find(privateHandle) };
+    return it == m_clientsByHandle.end() ? nullptr : &it->second->dbusId;
+}
+
+const std::string *HNCompositor::handleByDbusId(const std::string &dbusId) const noexcept
+{
+    auto it { m_clients.find(dbusId) };
+    return it == m_clients.end() ? nullptr : &it->second->privateHandle;
+}
+
+void HNCompositor::registerClient(const char *privateHandle, const char *dbusId) noexcept
+{
+    // The handle now belongs to this client.
+    auto handleIt { m_clientsByHandle.find(privateHandle) };
+
+    if (handleIt != m_clientsByHandle.end() && handleIt->second->dbusId != dbusId)
+    {
+        handleIt->second->privateHandle.clear();
+        m_clientsByHandle.erase(handleIt);
+    }
+
+    auto &client { m_clients[dbusId] };
+
+    if (!client)
+    {
+        client = std::make_unique<RegisteredClient>();
+        client->dbusId = dbusId;
+    }
+    else if (client->privateHandle != privateHandle)
+        m_clientsByHandle.erase(client->privateHandle);
+
+    client->privateHandle = privateHandle;
+    m_clientsByHandle[client->privateHandle] = client.get();
+}
+
+void HNCompositor::unregisterClient(const char *dbusId) noexcept
+{
+    auto it { m_clients.find(dbusId) };
+
+    if (it == m_clients.end())
+        return;
+
+    // Kept alive until the signal returns.
+    auto client { std::move(it->second) };
+    m_clients.erase(it);
+
+    if (!client->privateHandle.empty())
+        m_clientsByHandle.erase(client->privateHandle);
+
+    if (client->data)
+        m_clientsByData.erase(client->data);
+
+    HNLog(CZDebug, CZLN, "Client unregistered {}", client->dbusId);
+    onClientUnregistered.notify(client->privateHandle.c_str(), client->dbusId.c_str(), client->data);
+}
+
+HNCompositor::HNCompositor(std::shared_ptr<CZBus> bus) noexcept : m_bus(bus) {}
+
+void HNCompositor::checkBarState() noexcept
+{
+    sd_bus_call_method_async(
         m_bus->bus(),
+        NULL,
         "org.freedesktop.DBus",
         "/org/freedesktop/DBus",
         "org.freedesktop.DBus",
         "GetNameOwner",
+        HNIface::BarOwnerACK,
         NULL,
-        &reply,
         "s",
-        "org.cuarzo.HeavenBar") >= 0;
+        "org.cuarzo.HeavenBar");
+}
+
+void HNCompositor::handleRegisterClient(const char *privateHandle, const char *dbusId) noexcept
+{
+    registerClient(privateHandle, dbusId);
+
+    if (m_registrationQueue && m_registrationFd >= 0)
+    {
+        m_registrations.push({ privateHandle, dbusId });
+        eventfd_write(m_registrationFd, 1);
+    }
+    else
+        onClientRegistered.notify(privateHandle, dbusId);
+}
+
+void HNCompositor::handleBarChanged(const std::string &oldOwner, const std::string &newOwner) noexcept
+{
+    if (oldOwner.empty() && !newOwner.empty())
+    {
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar appeared");
+        m_isBarAvailable = true;
+        m_legacyBar = false;
+        const auto activeClient { std::move(m_activeClientId) };
+        setActiveClient(activeClient);
+        sendPrefetchHints();
+    } else if (!oldOwner.empty() && newOwner.empty())
+    {
+        m_isBarAvailable = false;
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar disappeared");
+    } else
+    {
+        HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar owner changed");
+        m_legacyBar = false;
+        const auto activeClient { std::move(m_activeClientId) };
+        setActiveClient(activeClient);
+        sendPrefetchHints();
+    }
+}
+
+void HNCompositor::handleBarFound() noexcept
+{
+    // Already reported by NameOwnerChanged.
+    if (m_isBarAvailable)
+        return;
+
+    HNLog(CZInfo, CZLN, "org.cuarzo.HeavenBar already present");
+    m_isBarAvailable = true;
+
+    // Set before the lookup completed.
+    if (!m_activeClientId.empty())
+    {
+        const auto activeClient { std::move(m_activeClientId) };
+        setActiveClient(activeClient);
+    }
+
+    sendPrefetchHints();
+}
+
+void HNCompositor::handleLegacyBar() noexcept
+{
+    // Later calls failing the same way were already covered by the first.
+    if (m_legacyBar)
+        return;
+
+    HNLog(CZDebug, CZLN, "The bar does not support focus serials");
+    m_legacyBar = true;
+
+    // Re-sends the current one, which may be newer than the failed call.
+    const auto activeClient { std::move(m_activeClientId) };
+    m_activeClientId.clear();
+    setActiveClient(activeClient);
 }
@@ -1,9 +1,16 @@
-#ifndef HNCOMPOSITOR_H
-#define HNCOMPOSITOR_H
+#ifndef COMPOSITOR_HNCOMPOSITOR_H
+#define COMPOSITOR_HNCOMPOSITOR_H
 
 #include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/HNMpscQueue.h>
+#include <CZ/Heaven/HNPollSet.h>
+#include <CZ/Heaven/Compositor/HNTransport.h>
 #include <CZ/Core/CZObject.h>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 /**
  * @brief Core class representing a Wayland compositor integration.
@@ -13,6 +20,15 @@
  *
  * - Tracking Wayland clients and associating them with their DBus identifiers.
  * - Notifying the bar application which client is currently active.
+ *
+ * Registered clients are kept in a registry that maps their private handle,
+ * DBus identifier and an optional compositor pointer to each other, and that
+ * forgets them automatically when they disconnect from the bus.
+ *
+ * The compositor must be used from the thread running the CZCore loop, except
+ * for postActiveClient(), popRegistration() and registrationFd(), which let
+ * compositors that decide focus on another thread (e.g. input or render)
+ * avoid marshaling every call themselves.
  */
 class CZ::Compositor::HNCompositor : public CZObject
 {
@@ -31,16 +47,176 @@ public:
      */
     static std::shared_ptr<HNCompositor> Get() noexcept;
 
+    /**
+     * @brief Creates the compositor connected to a bar in the same process instead of the session bus.
+     *
+     * Owns the compositor name on @p link, usually the Bar::HNLoopback of a bar
+     * created with Bar::HNBar::MakeLoopback(), which must outlive the compositor.
+     * Clients created with Client::HNClient::MakeLoopback() on the same link
+     * register with it and receive its focus changes.
+     *
+     * @param link Loopback link of the bar.
+     * @param id   Unique name of the compositor, as seen by the bar and clients.
+     * @return The compositor, or nullptr if a compositor already exists in this process.
+     */
+    static std::shared_ptr<HNCompositor> MakeLoopback(HNLoopbackLink *link, const std::string &id) noexcept;
+
     /**
      * @brief Sets the currently active client.
      *
      * This notifies the bar application which client should be considered active.
+     * The call never blocks: bars that don't support focus serials are detected
+     * from the asynchronous reply, and the current client is then re-sent without one.
      *
      * @param dbusId The DBus identifier of the active client.
      *               Passing an empty string ("") clears the active client.
      */
     void setActiveClient(const std::string &dbusId) noexcept;
 
+    /**
+     * @brief Returns the serial of the last focus change sent by setActiveClient().
+     *
+     * Each focus change to a client is tagged with a new serial, which is also
+     * sent to the client. Clients referencing it in their next commit let the
+     * bar present the new active client and its topbar in a single frame (see
+     * Bar::HNBar::setFocusHoldTime()).
+     *
+     * @return The serial, or 0 if no client was focused yet.
+     */
+    UInt32 focusSerial() const noexcept { return m_focusSerial; }
+
+    /**
+     * @brief Thread-safe variant of setActiveClient().
+     *
+     * Can be called from any thread. The ID is stored in an atomic slot and sent
+     * by the loop thread on its next wakeup, so when called several times in a
+     * row only the latest value reaches the bar.
+     *
+     * Avoid mixing it with setActiveClient(): a posted value not sent yet
+     * overrides any later direct call.
+     *
+     * @param dbusId The DBus identifier of the active client, or "" to clear it.
+     */
+    void postActiveClient(const std::string &dbusId) noexcept;
+
+    /**
+     * @brief Sets the active client from its private handle.
+     *
+     * @return false if no registered client uses the handle.
+     */
+    bool setActiveClientByHandle(const std::string &privateHandle) noexcept;
+
+    /**
+     * @brief Sets the active client from the pointer given to setClientData().
+     *
+     * Avoids any string lookup, e.g. when the compositor stores its `wl_client`
+     * (or its own client object) as the data of each registered client.
+     *
+     * @return false if no registered client has this data.
+     */
+    bool setActiveClientByData(void *data) noexcept;
+
+    /**
+     * @brief Tells the bar which clients are likely to become active next.
+     *
+     * Lets the bar prepare their menus (rehydrate trees, load icons, lay out
+     * topbars) before the focus switch, e.g. with the alt-tab most recently used
+     * order while the switcher is shown, or the client of the hovered window.
+     *
+     * The hints are sent without waiting for a reply, and only when they differ
+     * from the previous ones. The bar considers the first 8 at most.
+     *
+     * @param dbusIds DBus identifiers of the clients, most likely first. An empty list clears the hints.
+     */
+    void setPrefetchHints(const std::vector<std::string> &dbusIds) noexcept;
+
+    /**
+     * @name Client registry
+     *
+     * Every client that called RegisterClient, until it disconnects from the bus.
+     * A client registering again replaces its previous handle, and a handle
+     * registered by another client moves to it.
+     * @{
+     */
+
+    /**
+     * @brief Associates an opaque compositor pointer with a registered client.
+     *
+     * @param data Any pointer, or nullptr to clear it. Must be unique among clients.
+     * @return false if no registered client uses the handle.
+     */
+    bool setClientData(const std::string &privateHandle, void *data) noexcept;
+
+    /**
+     * @brief Data associated with a client, or nullptr.
+     */
+    void *clientData(const std::string &dbusId) const noexcept;
+
+    /**
+     * @brief DBus identifier of the client with the given handle, or nullptr.
+     */
+    const std::string *dbusIdByHandle(const std::string &privateHandle) const noexcept;
+
+    /**
+     * @brief Private handle of the client with the given DBus identifier, or nullptr.
+     */
+    const std::string *handleByDbusId(const std::string &dbusId) const noexcept;
+
+    /**
+     * @brief Number of registered clients.
+     */
+    size_t registeredClients() const noexcept { return m_clients.size(); }
+
+    /**
+     * @brief Emitted when a registered client disconnects, before it is removed from the registry.
+     */
+    CZSignal<const char* /*privateHandle*/, const char* /*dbusId*/, void* /*data*/> onClientUnregistered;
+
+    /** @} */
+
+    /**
+     * @brief A client registration delivered through popRegistration().
+     */
+    struct Registration
+    {
+        /// Private handle sent by the client.
+        std::string privateHandle;
+
+        /// DBus identifier of the client.
+        std::string dbusId;
+    };
+
+    /**
+     * @brief Delivers registrations to a thread of the compositor's choosing.
+     *
+     * When enabled, registrations are pushed to a lock-free queue instead of
+     * emitting onClientRegistered. The consuming thread waits for
+     * registrationFd() to become readable, reads it, and then calls
+     * popRegistration() until it returns false.
+     *
+     * Disabled by default. Must be called from the loop thread.
+     */
+    void setRegistrationQueue(bool enabled) noexcept { m_registrationQueue = enabled; }
+
+    /**
+     * @brief Whether registrations are queued, see setRegistrationQueue().
+     */
+    bool registrationQueue() const noexcept { return m_registrationQueue; }
+
+    /**
+     * @brief Eventfd signaled each time a registration is queued, or -1 on failure.
+     */
+    int registrationFd() const noexcept { return m_registrationFd; }
+
+    /**
+     * @brief Removes the oldest queued registration.
+     *
+     * Must always be called from the same thread (the consumer of the queue).
+     *
+     * @return false if no registration is queued.
+     */
+    bool popRegistration(Registration &registration) noexcept { return m_registrations.pop(registration); }
+
     /**
      * @brief Emitted when a Wayland client is registered.
      *
@@ -58,13 +234,95 @@ public:
      */
     CZSignal<const char* /*privateHandle*/, const char* /*dbusId*/> onClientRegistered;
 
+    /**
+     * @name Foreign event loops
+     *
+     * Compositors with their own epoll loop can drive Heaven on that loop
+     * alone: watch fd() for events(), wake up after timeout() at the latest, and
+     * call processPending(). No CZCore dispatch nor extra thread is needed,
+     * fd() also becomes readable when postActiveClient() is called.
+     * @{
+     */
+
+    /// Epoll file descriptor aggregating the bus connection (if any) and the postActiveClient() wakeups.
+    int fd() const noexcept;
+
+    /// Poll events to watch on fd() (POLLIN, equal to EPOLLIN).
+    UInt32 events() const noexcept;
+
+    /// Milliseconds until processPending() must be called even without events, or -1. Call it before each wait.
+    int timeout() const noexcept;
+
+    /**
+     * @brief Sends the posted active client and processes pending messages without blocking.
+     *
+     * @param maxMessages Maximum messages to process, 0 means all.
+     * @return Number of messages processed, or a negative errno if the connection failed.
+     */
+    int processPending(UInt32 maxMessages = 0) noexcept;
+
+    /** @} */
+
+    ~HNCompositor() noexcept;
+
 private:
     friend struct HNIface;
+    friend class HNBusTransport;
+    friend class HNLoopbackTransport;
     HNCompositor(std::shared_ptr<CZBus> bus) noexcept;
-    bool checkBarState() const noexcept;
-    std::shared_ptr<CZBus> m_bus;
+
+    // Creates the posted and registration eventfds and the poll set.
+    void setupLoop() noexcept;
+
+    // Looks up the bar asynchronously, see HNIface::BarOwnerACK.
+    void checkBarState() noexcept;
+
+    /* Events received by the transport */
+    void handleRegisterClient(const char *privateHandle, const char *dbusId) noexcept;
+    void handleBarChanged(const std::string &oldOwner, const std::string &newOwner) noexcept;
+    void handleBarFound() noexcept;
+    void handleLegacyBar() noexcept;
+
+    // Sends the value posted with postActiveClient() (loop thread only).
+    void sendPostedActiveClient() noexcept;
+
+    void sendPrefetchHints() noexcept;
+
+    struct RegisteredClient
+    {
+        std::string privateHandle;
+        std::string dbusId;
+        void *data {};
+    };
+
+    void registerClient(const char *privateHandle, const char *dbusId) noexcept;
+    void unregisterClient(const char *dbusId) noexcept;
+
+    std::shared_ptr<CZBus> m_bus; // Null on loopback
+    std::unique_ptr<HNTransport> m_transport;
     std::string m_activeClientId;
     bool m_isBarAvailable {};
+    UInt32 m_focusSerial { 0 };
+    bool m_legacyBar {};
+    std::vector<std::string> m_prefetchHints;
+
+    // Registry, owned by DBus identifier
+    std::unordered_map<std::string, std::unique_ptr<RegisteredClient>> m_clients;
+    std::unordered_map<std::string, RegisteredClient*> m_clientsByHandle;
+    std::unordered_map<void*, RegisteredClient*> m_clientsByData;
+
+    // Latest value from postActiveClient(), nullptr once sent
+    std::atomic<std::shared_ptr<const std::string>> m_postedActiveClient;
+    std::atomic<bool> m_postedWakeup { false };
+    std::shared_ptr<CZEventSource> m_postedSource;
+
+    // See fd()
+    HNPollSet m_poll;
+
+    // Registrations for another thread (see setRegistrationQueue())
+    HNMpscQueue<Registration> m_registrations;
+    int m_registrationFd { -1 };
+    bool m_registrationQueue {};
 };
 
-#endif // HNCOMPOSITOR_H
+#endif // COMPOSITOR_HNCOMPOSITOR_H
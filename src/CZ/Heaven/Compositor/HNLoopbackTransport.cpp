@@ -0,0 +1,60 @@
+#include <CZ/Heaven/Compositor/HNLoopbackTransport.h>
+#include <CZ/Heaven/Compositor/HNCompositor.h>
+
+using namespace CZ;
+using namespace CZ::Compositor;
+
+HNLoopbackTransport::HNLoopbackTransport(HNLoopbackLink *link, const std::string &id) noexcept :
+    m_link(link),
+    m_id(id)
+{
+    m_link->connect(m_id, "org.cuarzo.HeavenCompositor", [this](const std::string &sender, const std::string &member, const std::vector<Arg> &args)
+    {
+        receive(sender, member, args);
+    });
+}
+
+HNLoopbackTransport::~HNLoopbackTransport() noexcept
+{
+    m_link->disconnect(m_id);
+}
+
+void HNLoopbackTransport::setActiveClient(const std::string &clientId, UInt32 serial) noexcept
+{
+    if (serial == 0)
+        m_link->call(m_id, "org.cuarzo.HeavenBar", "SetActiveClient", { clientId });
+    else
+        m_link->call(m_id, "org.cuarzo.HeavenBar", "SetActiveClientWithSerial", { clientId, UInt64(serial) });
+}
+
+void HNLoopbackTransport::setPrefetchHints(const std::vector<std::string> &clientIds) noexcept
+{
+    m_link->call(m_id, "org.cuarzo.HeavenBar", "SetPrefetchHints", { clientIds });
+}
+
+void HNLoopbackTransport::focusChanged(const std::string &clientId, UInt32 serial) noexcept
+{
+    m_link->call(m_id, clientId, "FocusChanged", { UInt64(serial) });
+}
+
+void HNLoopbackTransport::receive(const std::string &sender, const std::string &member, const std::vector<Arg> &args) noexcept
+{
+    auto compositor { HNCompositor::Get() };
+
+    if (!compositor)
+        return;
+
+    const auto *s0 { args.size() > 0 ? std::get_if<std::string>(&args[0]) : nullptr };
+    const auto *s1 { args.size() > 1 ? std::get_if<std::string>(&args[1]) : nullptr };
+    const auto *s2 { args.size() > 2 ? std::get_if<std::string>(&args[2]) : nullptr };
+
+    if (member == "NameOwnerChanged" && s0 && s1 && s2)
+    {
+        if (*s0 == "org.cuarzo.HeavenBar")
+            compositor->handleBarChanged(*s1, *s2);
+        else if (!s1->empty() && s2->empty())
+            compositor->unregisterClient(s1->c_str());
+    }
+    else if (member == "RegisterClient" && s0)
+        compositor->handleRegisterClient(s0->c_str(), sender.c_str());
+}
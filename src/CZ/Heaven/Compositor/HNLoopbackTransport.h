@@ -0,0 +1,41 @@
+#ifndef COMPOSITOR_HNLOOPBACKTRANSPORT_H
+#define COMPOSITOR_HNLOOPBACKTRANSPORT_H
+
+#include <CZ/Heaven/Compositor/HNTransport.h>
+#include <CZ/Heaven/HNLoopbackLink.h>
+
+/**
+ * @brief In-memory transport of the compositor, used by HNCompositor::MakeLoopback().
+ *
+ * Owns the compositor name on an HNLoopbackLink (usually the Bar::HNLoopback
+ * of a bar in the same process). Client registrations and disconnections
+ * received from it are handled as if received from the bus.
+ */
+class CZ::Compositor::HNLoopbackTransport final : public HNTransport
+{
+public:
+    /**
+     * @brief Connects the compositor to @p link.
+     *
+     * @param id Unique name of the compositor.
+     */
+    HNLoopbackTransport(HNLoopbackLink *link, const std::string &id) noexcept;
+
+    /// Disconnects the compositor, as if it left the bus.
+    ~HNLoopbackTransport() noexcept;
+
+    void setActiveClient(const std::string &clientId, UInt32 serial) noexcept override;
+    void setPrefetchHints(const std::vector<std::string> &clientIds) noexcept override;
+    void focusChanged(const std::string &clientId, UInt32 serial) noexcept override;
+
+    /// Unique name of the compositor.
+    const std::string &id() const noexcept { return m_id; }
+
+private:
+    using Arg = HNLoopbackLink::Arg;
+    void receive(const std::string &sender, const std::string &member, const std::vector<Arg> &args) noexcept;
+    HNLoopbackLink *m_link;
+    std::string m_id;
+};
+
+#endif // COMPOSITOR_HNLOOPBACKTRANSPORT_H
@@ -0,0 +1,35 @@
+#ifndef COMPOSITOR_HNTRANSPORT_H
+#define COMPOSITOR_HNTRANSPORT_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Carries the calls from the compositor to the bar and the clients.
+ *
+ * The compositor reaches the other roles only through its transport:
+ * HNBusTransport sends D-Bus method calls, and HNLoopbackTransport delivers
+ * them through an HNLoopbackLink to a bar in the same process (see
+ * HNCompositor::MakeLoopback()).
+ *
+ * Each method is the method of the D-Bus interface with the same name.
+ * Replies are handed back to the compositor by the transport.
+ */
+class CZ::Compositor::HNTransport
+{
+public:
+    virtual ~HNTransport() noexcept = default;
+
+    /// `SetActiveClient` (@p serial 0) or `SetActiveClientWithSerial` of the bar.
+    virtual void setActiveClient(const std::string &clientId, UInt32 serial) noexcept = 0;
+
+    /// `SetPrefetchHints` of the bar, not acknowledged.
+    virtual void setPrefetchHints(const std::vector<std::string> &clientIds) noexcept = 0;
+
+    /// `FocusChanged` of the client, not acknowledged.
+    virtual void focusChanged(const std::string &clientId, UInt32 serial) noexcept = 0;
+};
+
+#endif // COMPOSITOR_HNTRANSPORT_H
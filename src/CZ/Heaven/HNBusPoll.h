@@ -0,0 +1,75 @@
+#ifndef HNBUSPOLL_H
+#define HNBUSPOLL_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <ctime>
+#include <systemd/sd-bus.h>
+
+/**
+ * @brief Helpers to drive a bus connection from a foreign event loop.
+ *
+ * Shared by the fd(), events(), timeout() and processPending() methods of
+ * each role, and by the bar's I/O thread.
+ */
+class CZ::HNBusPoll
+{
+public:
+    /**
+     * @brief Poll events the connection waits for.
+     *
+     * @return POLLIN and/or POLLOUT, which have the same values as EPOLLIN and EPOLLOUT.
+     */
+    static UInt32 Events(sd_bus *bus) noexcept
+    {
+        const int events { sd_bus_get_events(bus) };
+        return events < 0 ? 0 : UInt32(events);
+    }
+
+    /**
+     * @brief Milliseconds until the connection must be processed even without I/O.
+     *
+     * @return The timeout rounded up, or -1 if there is none.
+     */
+    static int Timeout(sd_bus *bus) noexcept
+    {
+        UInt64 until;
+
+        if (sd_bus_get_timeout(bus, &until) < 0 || until == UINT64_MAX)
+            return -1;
+
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        const UInt64 now { UInt64(ts.tv_sec) * 1000000 + UInt64(ts.tv_nsec) / 1000 };
+        return until > now ? int((until - now + 999) / 1000) : 0;
+    }
+
+    /**
+     * @brief Earliest of two timeouts in milliseconds, where -1 means none.
+     */
+    static int MinTimeout(int a, int b) noexcept
+    {
+        if (a < 0) return b;
+        if (b < 0) return a;
+        return a < b ? a : b;
+    }
+
+    /**
+     * @brief Processes up to @p maxMessages pending messages without blocking.
+     *
+     * @param maxMessages Maximum messages to process, 0 means no limit.
+     * @return Number of messages processed, or a negative errno on failure.
+     */
+    static int Process(sd_bus *bus, UInt32 maxMessages) noexcept
+    {
+        int processed { 0 };
+        int r { 0 };
+
+        while ((maxMessages == 0 || UInt32(processed) < maxMessages) && (r = sd_bus_process(bus, nullptr)) > 0)
+            processed++;
+
+        return r < 0 ? r : processed;
+    }
+};
+
+#endif // HNBUSPOLL_H
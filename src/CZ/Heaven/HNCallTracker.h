@@ -0,0 +1,284 @@
+#ifndef HNCALLTRACKER_H
+#define HNCALLTRACKER_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <cstdarg>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <systemd/sd-bus.h>
+
+/**
+ * @brief Tracks the asynchronous D-Bus method calls of a Heaven process.
+ *
+ * Every call is sent with a slot owned by the tracker and released as soon as
+ * its reply (or error) is received, so long-running sessions do not accumulate
+ * slots. Call records are pooled and reused.
+ *
+ * At most maxInFlight() calls per destination wait for a reply at any time.
+ * Further calls are queued in order and sent as replies arrive, which keeps
+ * the number of replies tracked by sd-bus bounded and preserves the order in
+ * which calls reach each destination.
+ */
+class CZ::HNCallTracker
+{
+public:
+    /**
+     * @brief Creates a tracker for the given bus.
+     *
+     * @param bus         Bus the calls are sent through.
+     * @param maxInFlight Maximum calls awaiting a reply per destination.
+     */
+    HNCallTracker(sd_bus *bus, UInt32 maxInFlight = 64) noexcept :
+        m_bus(bus),
+        m_maxInFlight(maxInFlight > 0 ? maxInFlight : 1) {}
+
+    HNCallTracker(const HNCallTracker &) = delete;
+    HNCallTracker &operator=(const HNCallTracker &) = delete;
+
+    /**
+     * @brief Cancels all outstanding calls without invoking their callbacks.
+     */
+    ~HNCallTracker() noexcept
+    {
+        std::vector<std::string> destinations;
+
+        for (const auto &[destination, state] : m_destinations)
+            destinations.emplace_back(destination);
+
+        for (const auto &destination : destinations)
+            cancel(destination);
+    }
+
+    /**
+     * @brief Calls a method asynchronously.
+     *
+     * The arguments follow @p types as in sd_bus_call_method_async().
+     *
+     * @param callback Reply callback, or nullptr to ignore the reply.
+     * @param userdata Passed to @p callback.
+     * @return 0 or a positive value on success (1 if sent, 0 if queued), or a negative errno.
+     */
+    int call(const char *destination, const char *path, const char *interface, const char *member,
+             sd_bus_message_handler_t callback, void *userdata, const char *types, ...) noexcept
+    {
+        sd_bus_message *message {};
+        int r { sd_bus_message_new_method_call(m_bus, &message, destination, path, interface, member) };
+
+        if (r < 0)
+            return r;
+
+        if (types && types[0] != '\0')
+        {
+            va_list ap;
+            va_start(ap, types);
+            r = sd_bus_message_appendv(message, types, ap);
+            va_end(ap);
+
+            if (r < 0)
+            {
+                sd_bus_message_unref(message);
+                return r;
+            }
+        }
+
+        auto *call { acquire() };
+        call->destination = destination;
+        call->message = message;
+        call->callback = callback;
+        call->userdata = userdata;
+
+        auto &state { m_destinations[call->destination] };
+
+        // Keep the order, never overtake queued calls.
+        if (state.inFlight >= m_maxInFlight || !state.queue.empty())
+        {
+            state.queue.emplace_back(call);
+            m_queued++;
+            return 0;
+        }
+
+        r = send(call, state);
+        return r < 0 ? r : 1;
+    }
+
+    /**
+     * @brief Drops the queued calls to a destination and cancels those awaiting a reply.
+     *
+     * Their callbacks are not invoked. Useful when the destination disappears
+     * from the bus.
+     */
+    void cancel(const std::string &destination) noexcept
+    {
+        auto it { m_destinations.find(destination) };
+
+        if (it == m_destinations.end())
+            return;
+
+        for (auto *call : it->second.queue)
+        {
+            m_queued--;
+            release(call);
+        }
+
+        for (auto sent = m_inFlight.begin(); sent != m_inFlight.end();)
+        {
+            if ((*sent)->destination != destination)
+            {
+                sent++;
+                continue;
+            }
+
+            sd_bus_slot_unref((*sent)->slot);
+            (*sent)->slot = nullptr;
+            release(*sent);
+            sent = m_inFlight.erase(sent);
+        }
+
+        m_destinations.erase(it);
+    }
+
+    /**
+     * @brief Returns the number of calls awaiting a reply.
+     */
+    size_t outstanding() const noexcept { return m_inFlight.size(); }
+
+    /**
+     * @brief Returns the number of calls waiting for a free in-flight slot.
+     */
+    size_t queued() const noexcept { return m_queued; }
+
+    /**
+     * @brief Returns the maximum number of calls awaiting a reply per destination.
+     */
+    UInt32 maxInFlight() const noexcept { return m_maxInFlight; }
+
+private:
+    struct Call
+    {
+        HNCallTracker *tracker {};
+        std::string destination;
+        sd_bus_message *message {};
+        sd_bus_message_handler_t callback {};
+        void *userdata {};
+        sd_bus_slot *slot {};
+    };
+
+    struct Destination
+    {
+        UInt32 inFlight { 0 };
+        std::deque<Call*> queue;
+    };
+
+    // Released records kept for reuse.
+    static constexpr size_t MaxPooled { 64 };
+
+    static int OnReply(sd_bus_message *m, void *data, sd_bus_error *error) noexcept
+    {
+        auto *call { static_cast<Call*>(data) };
+        auto *tracker { call->tracker };
+        const auto callback { call->callback };
+        void *userdata { call->userdata };
+        const std::string destination { call->destination };
+
+        // sd-bus holds a reference to the slot while the callback runs.
+        sd_bus_slot_unref(call->slot);
+        call->slot = nullptr;
+        tracker->m_inFlight.erase(call);
+        tracker->release(call);
+
+        auto it { tracker->m_destinations.find(destination) };
+
+        if (it != tracker->m_destinations.end())
+            it->second.inFlight--;
+
+        const int r { callback ? callback(m, userdata, error) : 0 };
+        tracker->pump(destination);
+        return r;
+    }
+
+    int send(Call *call, Destination &state) noexcept
+    {
+        const int r { sd_bus_call_async(m_bus, &call->slot, call->message, &OnReply, call, 0) };
+        sd_bus_message_unref(call->message);
+        call->message = nullptr;
+
+        if (r < 0)
+        {
+            release(call);
+            return r;
+        }
+
+        state.inFlight++;
+        m_inFlight.emplace(call);
+        return r;
+    }
+
+    void pump(const std::string &destination) noexcept
+    {
+        auto it { m_destinations.find(destination) };
+
+        if (it == m_destinations.end())
+            return;
+
+        auto &state { it->second };
+
+        while (state.inFlight < m_maxInFlight && !state.queue.empty())
+        {
+            auto *call { state.queue.front() };
+            state.queue.pop_front();
+            m_queued--;
+            send(call, state);
+        }
+
+        // Destinations are often short-lived unique names.
+        if (state.inFlight == 0 && state.queue.empty())
+            m_destinations.erase(it);
+    }
+
+    Call *acquire() noexcept
+    {
+        Call *call;
+
+        if (m_pool.empty())
+            call = new Call();
+        else
+        {
+            call = m_pool.back().release();
+            m_pool.pop_back();
+        }
+
+        call->tracker = this;
+        return call;
+    }
+
+    void release(Call *call) noexcept
+    {
+        if (call->message)
+            call->message = sd_bus_message_unref(call->message);
+
+        if (m_pool.size() >= MaxPooled)
+        {
+            delete call;
+            return;
+        }
+
+        call->destination.clear();
+        call->callback = nullptr;
+        call->userdata = nullptr;
+        m_pool.emplace_back(call);
+    }
+
+    sd_bus *m_bus;
+    UInt32 m_maxInFlight;
+    size_t m_queued { 0 };
+    std::unordered_map<std::string, Destination> m_destinations;
+    std::unordered_set<Call*> m_inFlight;
+    std::vector<std::unique_ptr<Call>> m_pool;
+};
+
+#endif // HNCALLTRACKER_H
@@ -0,0 +1,92 @@
+#ifndef HNDEADLINETIMER_H
+#define HNDEADLINETIMER_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/CZTimer.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+/**
+ * @brief CZTimer that also keeps track of its deadline.
+ *
+ * It fires on the CZCore loop as usual, and can also be fired by the
+ * processPending() method of its role when the host drives it from a foreign
+ * event loop, with the deadline folded into the role's timeout().
+ */
+class CZ::HNDeadlineTimer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * @brief Creates a stopped timer.
+     *
+     * @param callback Invoked once each time the timer fires, it can restart it.
+     */
+    HNDeadlineTimer(std::function<void()> callback) noexcept :
+        m_callback(std::move(callback)),
+        m_timer([this](CZTimer*){ fire(); }) {}
+
+    HNDeadlineTimer(const HNDeadlineTimer &) = delete;
+    HNDeadlineTimer &operator=(const HNDeadlineTimer &) = delete;
+
+    /// Fires the timer in @p ms milliseconds, replacing the previous deadline.
+    void start(UInt64 ms) noexcept
+    {
+        m_deadline = Clock::now() + std::chrono::milliseconds(ms);
+        m_timer.start(ms);
+    }
+
+    void stop() noexcept
+    {
+        m_deadline = Clock::time_point::max();
+        m_timer.stop();
+    }
+
+    bool running() const noexcept { return m_deadline != Clock::time_point::max(); }
+
+    /**
+     * @brief Milliseconds from @p now until the deadline.
+     *
+     * @return The time rounded up, 0 if due, or -1 if not running.
+     */
+    int timeout(Clock::time_point now) const noexcept
+    {
+        if (!running())
+            return -1;
+
+        if (m_deadline <= now)
+            return 0;
+
+        const auto ms { std::chrono::ceil<std::chrono::milliseconds>(m_deadline - now).count() };
+        return ms > INT32_MAX ? INT32_MAX : int(ms);
+    }
+
+    /**
+     * @brief Fires the timer if its deadline passed.
+     *
+     * @return true if it fired.
+     */
+    bool fireIfDue(Clock::time_point now) noexcept
+    {
+        if (m_deadline > now)
+            return false;
+
+        fire();
+        return true;
+    }
+
+private:
+    void fire() noexcept
+    {
+        stop();
+        m_callback();
+    }
+
+    std::function<void()> m_callback;
+    Clock::time_point m_deadline { Clock::time_point::max() };
+    CZTimer m_timer;
+};
+
+#endif // HNDEADLINETIMER_H
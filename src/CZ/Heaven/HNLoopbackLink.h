@@ -0,0 +1,71 @@
+#ifndef HNLOOPBACKLINK_H
+#define HNLOOPBACKLINK_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <functional>
+#include <string>
+#include <variant>
+#include <vector>
+
+/**
+ * @brief In-process replacement of the session bus connecting the three roles.
+ *
+ * Implemented by Bar::HNLoopback (see Bar::HNBar::MakeLoopback()), and used by
+ * the client and compositor created with Client::HNClient::MakeLoopback() and
+ * Compositor::HNCompositor::MakeLoopback(), so the real role classes can run
+ * together in a single process without a bus.
+ *
+ * Calls carry the member names and arguments of their D-Bus counterparts.
+ * They are queued and delivered in order, and a call made while another is
+ * being delivered waits for it to return, so no role is ever reentered, as
+ * with a real bus.
+ */
+class CZ::HNLoopbackLink
+{
+public:
+    /// A call argument: an integer or boolean, a string or a string array.
+    using Arg = std::variant<UInt64, std::string, std::vector<std::string>>;
+
+    /**
+     * @brief Receives the calls addressed to a peer.
+     *
+     * Peers also receive `NameOwnerChanged` (name, old owner, new owner) from
+     * `org.freedesktop.DBus` each time a peer connects or disconnects.
+     */
+    using Receiver = std::function<void(const std::string &sender, const std::string &member, const std::vector<Arg> &args)>;
+
+    /// Unique name of the bar.
+    static constexpr const char *BarId { ":loopback.bar" };
+
+    virtual ~HNLoopbackLink() noexcept = default;
+
+    /**
+     * @brief Connects a peer.
+     *
+     * @param id       Unique name of the peer.
+     * @param name     Well-known name it owns (e.g. `org.cuarzo.HeavenCompositor`), or empty.
+     * @param receiver Invoked for each call addressed to @p id or @p name.
+     */
+    virtual void connect(const std::string &id, const std::string &name, Receiver receiver) noexcept = 0;
+
+    /**
+     * @brief Disconnects a peer, as if it left the bus.
+     */
+    virtual void disconnect(const std::string &id) noexcept = 0;
+
+    /**
+     * @brief Unique name of the owner of a well-known name, or empty.
+     */
+    virtual std::string owner(const std::string &name) const noexcept = 0;
+
+    /**
+     * @brief Queues a call.
+     *
+     * @param destination Unique or well-known name of the receiver.
+     * @return false if no peer owns @p destination.
+     */
+    virtual bool call(const std::string &sender, const std::string &destination, const std::string &member, std::vector<Arg> args) noexcept = 0;
+};
+
+#endif // HNLOOPBACKLINK_H
@@ -0,0 +1,104 @@
+#ifndef HNMPSCQUEUE_H
+#define HNMPSCQUEUE_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <atomic>
+#include <utility>
+
+/**
+ * @brief Unbounded lock-free multi-producer single-consumer queue.
+ *
+ * Any number of threads may push() concurrently, a single thread pops.
+ * Items pushed by the same thread are popped in the order they were pushed.
+ *
+ * push() is wait-free (one atomic exchange). While a push is halfway done,
+ * pop() may not see it nor the items pushed after it, and returns false as if
+ * the queue were empty. Producers are expected to signal the consumer after
+ * push() returns, so those items are picked up on its next wakeup.
+ *
+ * @tparam T Item type, must be default constructible and movable.
+ */
+template<typename T>
+class CZ::HNMpscQueue
+{
+public:
+    HNMpscQueue() noexcept : m_head(&m_stub), m_tail(&m_stub) {}
+
+    HNMpscQueue(const HNMpscQueue &) = delete;
+    HNMpscQueue &operator=(const HNMpscQueue &) = delete;
+
+    /**
+     * @brief Destroys the items still queued.
+     *
+     * Must not run concurrently with push().
+     */
+    ~HNMpscQueue() noexcept
+    {
+        T item;
+        while (pop(item)) {}
+
+        if (m_tail != &m_stub)
+            delete m_tail;
+    }
+
+    /**
+     * @brief Appends an item. Can be called from any thread.
+     */
+    void push(T item) noexcept
+    {
+        auto *node { new Node() };
+        node->item = std::move(item);
+
+        Node *prev { m_head.exchange(node, std::memory_order_acq_rel) };
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief Removes the oldest item. Consumer thread only.
+     *
+     * @return false if no item is available.
+     */
+    bool pop(T &item) noexcept
+    {
+        Node *tail { m_tail };
+        Node *next { tail->next.load(std::memory_order_acquire) };
+
+        if (!next)
+            return false;
+
+        // The popped node becomes the new stub, its item is moved out.
+        item = std::move(next->item);
+        next->item = T();
+        m_tail = next;
+
+        if (tail != &m_stub)
+            delete tail;
+
+        return true;
+    }
+
+    /**
+     * @brief Checks whether no item is available. Consumer thread only.
+     */
+    bool empty() const noexcept
+    {
+        return !m_tail->next.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Node
+    {
+        std::atomic<Node*> next { nullptr };
+        T item {};
+    };
+
+    Node m_stub;
+
+    // Last pushed node, shared by producers.
+    alignas(64) std::atomic<Node*> m_head;
+
+    // Last popped node (or the stub), owned by the consumer.
+    alignas(64) Node *m_tail;
+};
+
+#endif // HNMPSCQUEUE_H
@@ -0,0 +1,113 @@
+#ifndef HNPOLLSET_H
+#define HNPOLLSET_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Heaven/HNBusPoll.h>
+#include <initializer_list>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <systemd/sd-bus.h>
+
+/**
+ * @brief Single epoll file descriptor for a role driven by a foreign event loop.
+ *
+ * Aggregates the bus connection and the eventfds other threads use to wake
+ * the role up, so the host watches one descriptor for input. The bus
+ * descriptor is re-armed with the events sd-bus waits for by update().
+ *
+ * Falls back to the bare bus descriptor if the epoll instance can't be created.
+ */
+class CZ::HNPollSet
+{
+public:
+    HNPollSet() noexcept = default;
+    HNPollSet(const HNPollSet &) = delete;
+    HNPollSet &operator=(const HNPollSet &) = delete;
+
+    ~HNPollSet() noexcept
+    {
+        if (m_fd >= 0)
+            close(m_fd);
+    }
+
+    /**
+     * @brief Creates the epoll instance.
+     *
+     * @param bus       Bus connection, can be nullptr.
+     * @param wakeupFds Descriptors watched for input, negative ones are skipped.
+     * @return false if the epoll instance couldn't be created.
+     */
+    bool init(sd_bus *bus, std::initializer_list<int> wakeupFds) noexcept
+    {
+        m_bus = bus;
+        m_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        if (m_fd < 0)
+            return false;
+
+        epoll_event ev {};
+        ev.events = EPOLLIN;
+
+        for (int fd : wakeupFds)
+        {
+            if (fd < 0)
+                continue;
+
+            ev.data.fd = fd;
+            epoll_ctl(m_fd, EPOLL_CTL_ADD, fd, &ev);
+        }
+
+        if (m_bus)
+        {
+            m_busEvents = HNBusPoll::Events(m_bus);
+            ev.events = m_busEvents;
+            ev.data.fd = sd_bus_get_fd(m_bus);
+            epoll_ctl(m_fd, EPOLL_CTL_ADD, ev.data.fd, &ev);
+        }
+
+        return true;
+    }
+
+    /// The epoll descriptor, or the bus descriptor as fallback (-1 without bus).
+    int fd() const noexcept
+    {
+        if (m_fd >= 0)
+            return m_fd;
+
+        return m_bus ? sd_bus_get_fd(m_bus) : -1;
+    }
+
+    /// Poll events to watch on fd().
+    UInt32 events() const noexcept
+    {
+        if (m_fd >= 0)
+            return EPOLLIN;
+
+        return m_bus ? HNBusPoll::Events(m_bus) : 0;
+    }
+
+    /// Re-arms the bus descriptor if the events sd-bus waits for changed.
+    void update() const noexcept
+    {
+        if (m_fd < 0 || !m_bus)
+            return;
+
+        const UInt32 events { HNBusPoll::Events(m_bus) };
+
+        if (events == m_busEvents)
+            return;
+
+        m_busEvents = events;
+        epoll_event ev {};
+        ev.events = events;
+        ev.data.fd = sd_bus_get_fd(m_bus);
+        epoll_ctl(m_fd, EPOLL_CTL_MOD, ev.data.fd, &ev);
+    }
+
+private:
+    int m_fd { -1 };
+    sd_bus *m_bus {};
+    mutable UInt32 m_busEvents { 0 };
+};
+
+#endif // HNPOLLSET_H
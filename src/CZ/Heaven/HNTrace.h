@@ -0,0 +1,188 @@
+#ifndef HNTRACE_H
+#define HNTRACE_H
+
+#include <CZ/Heaven/Heaven.h>
+#include <CZ/Core/Cuarzo.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef HEAVEN_TRACE_SDT
+#include <sys/sdt.h>
+#endif
+
+/**
+ * @brief Trace points along the path of a commit, from the client to the bar signals.
+ *
+ * Only built when Heaven is configured with `-Dtrace=true`, otherwise HN_TRACE()
+ * expands to nothing. Each trace point is then:
+ *
+ * - A USDT probe of the `heaven` provider (if `sys/sdt.h` is available), named
+ *   after the Point and taking the client, correlation and argument, for use
+ *   with `perf` or `bpftrace`.
+ * - An Entry appended to an in-memory ring buffer, once enabled with Enable()
+ *   or the `CZ_HEAVEN_TRACE_ENTRIES` environment variable.
+ *
+ * Clients are identified by the number of their D-Bus unique name (`:1.42` is 42)
+ * on both sides. The correlation ID of the commit points is the commit sequence
+ * number sent with `CommitWithSequence`, and events carry the sequence of the
+ * commit they belong to: one past the last commit of the client. Both sides
+ * derive it the same way, since D-Bus preserves the order of the messages of a
+ * connection. Clicks are numbered per client on both sides likewise.
+ */
+class CZ::HNTrace
+{
+public:
+    /// Trace points, in the order a change goes through them.
+    enum Point : UInt16
+    {
+        ClientSend,         ///< Client sends an event (argument: object ID, 0 for client properties).
+        ClientCommit,       ///< Client sends a commit.
+        BarReceive,         ///< Bar decodes an event, on the I/O thread if enabled (argument: HNEvent type).
+        BarEnqueue,         ///< Bar admits an event into the client queue (argument: 1 if admitted).
+        BarCommit,          ///< Bar receives a commit.
+        BarDispatchStart,   ///< Bar starts applying a commit, or a slice of it.
+        BarSignal,          ///< Bar applied an event and emitted its signals (argument: HNEvent type).
+        BarDispatchEnd,     ///< Bar finished applying a commit (argument: 1) or a slice of it (argument: 0).
+        ClientAck,          ///< Client receives the commit acknowledgement.
+        BarClick,           ///< Bar sends a click (argument: object ID).
+        ClientClick         ///< Client receives a click (argument: object ID).
+    };
+
+    /// Entry of the ring buffer, also the record of the Save() format.
+    struct Entry
+    {
+        UInt64 time;        ///< CLOCK_MONOTONIC, in nanoseconds.
+        UInt32 client;      ///< Number of the client unique name.
+        UInt32 correlation; ///< Commit sequence or click number.
+        UInt32 arg;         ///< Depends on the point.
+        UInt16 point;       ///< Point
+        UInt16 reserved;
+    };
+
+    static_assert(sizeof(Entry) == 24);
+
+    /**
+     * @brief Starts recording into a ring buffer keeping the last @p capacity entries.
+     *
+     * Must be called before the traced threads start, e.g. before creating the
+     * bar or client. The capacity is rounded up to a power of two.
+     */
+    static void Enable(size_t capacity) noexcept
+    {
+        size_t size { 1 };
+
+        while (size < capacity)
+            size <<= 1;
+
+        s_entries.reset(new Entry[size] {});
+        s_mask = size - 1;
+        s_next.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Calls Enable() with the capacity in `CZ_HEAVEN_TRACE_ENTRIES`, if set and not already enabled.
+     */
+    static void EnableFromEnv() noexcept
+    {
+        if (s_entries)
+            return;
+
+        if (const char *env = getenv("CZ_HEAVEN_TRACE_ENTRIES"))
+            if (const size_t capacity = strtoul(env, nullptr, 10))
+                Enable(capacity);
+    }
+
+    /**
+     * @brief Number of the D-Bus unique name (the part after the dot), 0 if malformed.
+     */
+    static UInt32 ClientId(const char *uniqueName) noexcept
+    {
+        const char *dot { uniqueName ? strrchr(uniqueName, '.') : nullptr };
+        return dot ? UInt32(strtoul(dot + 1, nullptr, 10)) : 0;
+    }
+
+    /**
+     * @brief Appends an entry. Can be called from any thread, does nothing unless enabled.
+     */
+    static void Add(Point point, UInt32 client, UInt32 correlation, UInt32 arg) noexcept
+    {
+        if (!s_entries)
+            return;
+
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        Entry &entry { s_entries[s_next.fetch_add(1, std::memory_order_relaxed) & s_mask] };
+        entry = { UInt64(ts.tv_sec) * 1000000000 + UInt64(ts.tv_nsec), client, correlation, arg, point, 0 };
+    }
+
+    /**
+     * @brief Copies the recorded entries, oldest first.
+     *
+     * Entries being written by other threads meanwhile may be incomplete.
+     */
+    static std::vector<Entry> Entries() noexcept
+    {
+        std::vector<Entry> entries;
+
+        if (!s_entries)
+            return entries;
+
+        const UInt64 next { s_next.load(std::memory_order_relaxed) };
+        const UInt64 count { std::min<UInt64>(next, s_mask + 1) };
+        entries.reserve(count);
+
+        for (UInt64 i = next - count; i < next; i++)
+            entries.emplace_back(s_entries[i & s_mask]);
+
+        return entries;
+    }
+
+    /**
+     * @brief Writes the entries to a file: the `HNTRACE1` magic followed by the raw entries, in host byte order.
+     */
+    static bool Save(const std::string &path) noexcept
+    {
+        FILE *file { fopen(path.c_str(), "wb") };
+
+        if (!file)
+            return false;
+
+        const auto entries { Entries() };
+        const bool ok { fwrite("HNTRACE1", 1, 8, file) == 8 &&
+            fwrite(entries.data(), sizeof(Entry), entries.size(), file) == entries.size() };
+
+        return fclose(file) == 0 && ok;
+    }
+
+private:
+    static inline std::unique_ptr<Entry[]> s_entries;
+    static inline UInt64 s_mask { 0 };
+    static inline std::atomic<UInt64> s_next { 0 };
+};
+
+/**
+ * @brief Records a trace point, see HNTrace. Compiled out unless HEAVEN_TRACE is defined.
+ */
+#ifdef HEAVEN_TRACE
+#ifdef HEAVEN_TRACE_SDT
+#define HN_TRACE(point, client, correlation, arg) do { \
+    const UInt32 hnClient_ ( client ), hnCorrelation_ ( correlation ), hnArg_ ( arg ); \
+    DTRACE_PROBE3(heaven, point, hnClient_, hnCorrelation_, hnArg_); \
+    CZ::HNTrace::Add(CZ::HNTrace::point, hnClient_, hnCorrelation_, hnArg_); } while (0)
+#else
+#define HN_TRACE(point, client, correlation, arg) \
+    CZ::HNTrace::Add(CZ::HNTrace::point, client, correlation, arg)
+#endif
+#else
+#define HN_TRACE(point, client, correlation, arg) do {} while (0)
+#endif
+
+#endif // HNTRACE_H
@@ -3,19 +3,36 @@
 
 namespace CZ
 {
+    class HNBusPoll;
+    class HNCallTracker;
+    class HNDeadlineTimer;
+    class HNLoopbackLink;
+    class HNPollSet;
+    class HNTrace;
+    template<typename T> class HNMpscQueue;
+
     namespace Bar
     {
         struct HNIface;
         struct HNEvent;
         class HNBar;
+        class HNCache;
+        class HNBusTransport;
+        class HNCapture;
         class HNClient;
         class HNCompositor;
+        class HNDelta;
+        class HNIOThread;
+        class HNLoopback;
+        class HNSnapshot;
+        class HNTransport;
         class HNObject;
         class HNTopbar;
         class HNMenu;
         class HNAction;
         class HNToggle;
         class HNDivider;
+        class HNTreeCodec;
 
         class HNWithTitle;
         class HNWithIcon;
@@ -29,12 +46,18 @@ namespace CZ
     {
         struct HNIface;
         class HNCompositor;
+        class HNBusTransport;
+        class HNLoopbackTransport;
+        class HNTransport;
     }
 
     namespace Client
     {
         struct HNIface;
         class HNClient;
+        class HNBusTransport;
+        class HNLoopbackTransport;
+        class HNTransport;
         class HNObject;
         class HNTopbar;
         class HNMenu;
@@ -0,0 +1,76 @@
+#include "HNBench.h"
+#include <CZ/Heaven/Bar/HNBar.h>
+#include <CZ/Heaven/Bar/HNObject.h>
+#include <CZ/Heaven/Bar/HNWithTitle.h>
+#include <cstdio>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+/*
+ * Clicks the probe action and waits for the client to retitle it, which
+ * measures the bar -> client -> bar round trip.
+ */
+int CZ::Tools::RunBenchBar(const HNBenchOptions &options, HNReport &report) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto bar { HNBar::GetOrMake(options.ioThread) };
+
+    if (!bar)
+    {
+        fprintf(stderr, "heaven-bench: failed to start the bar\n");
+        return 1;
+    }
+
+    const std::string probePrefix { BenchClickProbe };
+    HNObject *probe {};
+    std::string handledTitle;
+    UInt64 clickTime { 0 };
+    UInt32 clicks { 0 };
+    bool finished { false };
+
+    auto track = [&](HNObject *obj)
+    {
+        if (auto *withTitle = dynamic_cast<HNWithTitle*>(obj); withTitle && withTitle->title().starts_with(probePrefix))
+            probe = obj;
+    };
+
+    bar->onObjectCreated.subscribe(bar.get(), track);
+    bar->onObjectTitleChanged.subscribe(bar.get(), track);
+    bar->onObjectDestroyed.subscribe(bar.get(), [&](HNObject *obj)
+    {
+        if (obj == probe)
+            probe = nullptr;
+    });
+
+    // The title is only final once the whole commit was applied.
+    bar->onClientCommitted.subscribe(bar.get(), [&](HNClient*)
+    {
+        if (!probe || finished)
+            return;
+
+        const std::string &title { dynamic_cast<HNWithTitle*>(probe)->title() };
+
+        if (title == handledTitle)
+            return;
+
+        handledTitle = title;
+
+        if (clickTime)
+            report.sample("click.roundtrip_us", double(NowUsec() - clickTime));
+
+        if (clicks++ == options.iterations)
+        {
+            finished = true;
+            report.done("bar");
+            return;
+        }
+
+        clickTime = NowUsec();
+        probe->click();
+    });
+
+    while (core->dispatch() >= 0) {}
+
+    return 0;
+}
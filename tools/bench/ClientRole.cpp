@@ -0,0 +1,170 @@
+#include "HNBench.h"
+#include <CZ/Heaven/Client/HNClient.h>
+#include <CZ/Heaven/Client/HNTopbar.h>
+#include <CZ/Heaven/Client/HNMenu.h>
+#include <CZ/Heaven/Client/HNAction.h>
+#include <cstdio>
+
+using namespace CZ;
+using namespace CZ::Client;
+
+// Actions per menu of the published trees.
+static constexpr UInt32 ActionsPerMenu { 24 };
+
+// Times each tree size is published.
+static constexpr UInt32 PublishRepeats { 10 };
+
+int CZ::Tools::RunBenchClient(const HNBenchOptions &options, HNReport &report) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto client { HNClient::GetOrMake() };
+
+    if (!client)
+    {
+        fprintf(stderr, "heaven-bench: failed to start the client\n");
+        return 1;
+    }
+
+    if (!WaitFor(*core, [&]{ return !client->barId().empty(); }))
+    {
+        fprintf(stderr, "heaven-bench: the bar never appeared\n");
+        return 1;
+    }
+
+    auto topbar { HNTopbar::Make() };
+    UInt32 acked { 0 };
+    UInt64 latency { 0 };
+
+    client->onCommitApplied.subscribe(topbar.get(), [&](UInt32 seq, UInt64 lat)
+    {
+        acked = seq;
+        latency = lat;
+    });
+
+    // Commits and waits for the acknowledgement.
+    auto commit = [&]() -> bool
+    {
+        client->commit();
+
+        if (WaitFor(*core, [&]{ return client->commitSequence() > 0 && acked == client->commitSequence(); }))
+            return true;
+
+        fprintf(stderr, "heaven-bench: commit %u was never acknowledged\n", client->commitSequence());
+        return false;
+    };
+
+    client->setName("heaven-bench");
+    client->setActiveTopbar(topbar.get());
+
+    if (!commit())
+        return 1;
+
+    // Publish time vs tree size
+    for (UInt32 size : options.sizes)
+    {
+        const std::string metric { "publish." + std::to_string(size) };
+
+        for (UInt32 rep = 0; rep < PublishRepeats; rep++)
+        {
+            std::vector<std::shared_ptr<HNObject>> tree;
+            tree.reserve(size);
+            HNObject *menu {};
+
+            for (UInt32 i = 0; i < size; i++)
+            {
+                if (i % (ActionsPerMenu + 1) == 0)
+                {
+                    tree.emplace_back(HNMenu::Make("Menu " + std::to_string(i), "", "", true, topbar.get()));
+                    menu = tree.back().get();
+                }
+                else
+                    tree.emplace_back(HNAction::Make("Action " + std::to_string(i), "document-open", "Ctrl+O", true, menu));
+            }
+
+            if (!commit())
+                return 1;
+
+            report.sample(metric + ".roundtrip_us", double(latency));
+            report.sample(metric + ".dispatch_us", double(client->lastCommitDispatchTime()));
+
+            tree.clear();
+
+            if (!commit())
+                return 1;
+        }
+    }
+
+    auto menu { HNMenu::Make("Bench", "", "", true, topbar.get()) };
+    auto action { HNAction::Make("Action", "", "", true, menu.get()) };
+
+    if (!commit())
+        return 1;
+
+    // Per-property update latency
+    for (UInt32 i = 0; i < options.iterations; i++)
+    {
+        const std::string n { std::to_string(i) };
+
+        action->setTitle("Action " + n);
+        if (!commit()) return 1;
+        report.sample("property.title_us", double(latency));
+
+        action->setIcon(i % 2 ? "document-open" : "document-save");
+        if (!commit()) return 1;
+        report.sample("property.icon_us", double(latency));
+
+        action->setShortcut("Ctrl+" + n);
+        if (!commit()) return 1;
+        report.sample("property.shortcut_us", double(latency));
+
+        action->setEnabled(i % 2);
+        if (!commit()) return 1;
+        report.sample("property.enabled_us", double(latency));
+    }
+
+    // Commit throughput: commits are sent back-to-back, without waiting for the acks.
+    const UInt32 firstSeq { client->commitSequence() };
+    const UInt64 throughputStart { NowUsec() };
+
+    for (UInt32 i = 0; i < options.commits; i++)
+    {
+        action->setTitle("Throughput " + std::to_string(i));
+        client->commit();
+        core->dispatch(0);
+    }
+
+    if (!WaitFor(*core, [&]{ return acked == client->commitSequence(); }, 60000))
+    {
+        fprintf(stderr, "heaven-bench: the throughput commits were never acknowledged\n");
+        return 1;
+    }
+
+    const UInt64 elapsed { std::max<UInt64>(NowUsec() - throughputStart, 1) };
+    report.sample("commit.throughput_per_s", double(client->commitSequence() - firstSeq) * 1000000.0 / double(elapsed));
+
+    // Click round trip, measured by the bar
+    UInt32 clicks { 0 };
+    auto probe { HNAction::Make(std::string(BenchClickProbe) + "0", "", "", true, menu.get()) };
+
+    probe->onClicked.subscribe(probe.get(), [&](HNObject*)
+    {
+        probe->setTitle(std::string(BenchClickProbe) + std::to_string(++clicks));
+        client->commit();
+    });
+
+    client->commit();
+
+    if (!WaitFor(*core, [&]{ return clicks == options.iterations; }, 60000))
+    {
+        fprintf(stderr, "heaven-bench: received %u of %u clicks\n", clicks, options.iterations);
+        return 1;
+    }
+
+    // Focus changes, measured by the compositor
+    client->setPrivateHandle(BenchHandle);
+    report.done("client");
+
+    while (core->dispatch() >= 0) {}
+
+    return 0;
+}
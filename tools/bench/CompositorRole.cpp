@@ -0,0 +1,54 @@
+#include "HNBench.h"
+#include <CZ/Heaven/Compositor/HNCompositor.h>
+#include <cstdio>
+
+using namespace CZ;
+using namespace CZ::Compositor;
+
+/*
+ * Once the client sends its private handle, alternates the focus between the
+ * client and no client. setActiveClient() returns after the bar applied the
+ * change, so each call measures a complete focus change.
+ */
+int CZ::Tools::RunBenchCompositor(const HNBenchOptions &options, HNReport &report) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto compositor { HNCompositor::GetOrMake() };
+
+    if (!compositor)
+    {
+        fprintf(stderr, "heaven-bench: failed to start the compositor\n");
+        return 1;
+    }
+
+    std::string clientId;
+
+    compositor->onClientRegistered.subscribe(compositor.get(), [&](const char *handle, const char *dbusId)
+    {
+        if (std::string_view(handle) == BenchHandle)
+            clientId = dbusId;
+    });
+
+    if (!WaitFor(*core, [&]{ return !clientId.empty(); }, 60000))
+    {
+        fprintf(stderr, "heaven-bench: the client never registered\n");
+        return 1;
+    }
+
+    for (UInt32 i = 0; i < options.iterations; i++)
+    {
+        const UInt64 start { NowUsec() };
+        compositor->setActiveClient(i % 2 == 0 ? clientId : "");
+        report.sample("focus.change_us", double(NowUsec() - start));
+
+        // Lets the client and bar traffic through between changes.
+        core->dispatch(0);
+    }
+
+    compositor->setActiveClient(clientId);
+    report.done("compositor");
+
+    while (core->dispatch() >= 0) {}
+
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef HNBENCH_H
+#define HNBENCH_H
+
+#include <HNToolUtils.h>
+#include <string>
+#include <vector>
+
+/*
+ * The roles live in separate translation units: the client and bar headers
+ * can't be included together.
+ */
+
+namespace CZ::Tools
+{
+    struct HNBenchOptions
+    {
+        // Number of objects of the published trees
+        std::vector<UInt32> sizes { 10, 100, 1000, 5000 };
+
+        // Samples per latency metric
+        UInt32 iterations { 200 };
+
+        // Commits sent back-to-back by the throughput phase
+        UInt32 commits { 2000 };
+
+        // Runs the bar with its I/O thread (see HNBar::GetOrMake())
+        bool ioThread { false };
+    };
+
+    // Title of the object the bar clicks, followed by the click number.
+    inline constexpr const char *BenchClickProbe { "heaven-bench:click-" };
+
+    // Private handle of the client, focused by the compositor role.
+    inline constexpr const char *BenchHandle { "heaven-bench" };
+
+    int RunBenchBar(const HNBenchOptions &options, HNReport &report) noexcept;
+    int RunBenchCompositor(const HNBenchOptions &options, HNReport &report) noexcept;
+    int RunBenchClient(const HNBenchOptions &options, HNReport &report) noexcept;
+}
+
+#endif // HNBENCH_H
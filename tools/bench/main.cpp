@@ -0,0 +1,121 @@
+/**
+ * heaven-bench
+ *
+ * Starts a private session bus, runs a bar, a compositor and a client on it
+ * (each in its own process) and measures:
+ *
+ * - Menu publish time vs tree size (commit round trip and bar dispatch time)
+ * - Per-property update latency
+ * - Commit throughput
+ * - Click round trip (bar -> client -> bar)
+ * - Focus change latency (compositor -> bar)
+ *
+ * Results are written as JSON, with the percentiles of each metric.
+ *
+ * Usage: heaven-bench [--sizes 10,100,1000] [--iterations N] [--commits N] [--io-thread] [--output FILE]
+ */
+
+#include "HNBench.h"
+#include <cstdio>
+#include <cstring>
+
+using namespace CZ;
+using namespace CZ::Tools;
+
+static void Usage() noexcept
+{
+    fprintf(stderr,
+        "Usage: heaven-bench [OPTIONS]\n"
+        "  --sizes LIST      Comma-separated tree sizes to publish (default 10,100,1000,5000)\n"
+        "  --iterations N    Samples per latency metric (default 200)\n"
+        "  --commits N       Commits sent by the throughput phase (default 2000)\n"
+        "  --io-thread       Run the bar with its I/O thread\n"
+        "  --output FILE     Write the JSON results to FILE instead of stdout\n");
+}
+
+static bool ParseSizes(const char *arg, std::vector<UInt32> &sizes) noexcept
+{
+    sizes.clear();
+
+    for (const char *p = arg; *p;)
+    {
+        char *end;
+        const unsigned long size { strtoul(p, &end, 10) };
+
+        if (end == p || size == 0)
+            return false;
+
+        sizes.emplace_back(UInt32(size));
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return !sizes.empty();
+}
+
+int main(int argc, char *argv[])
+{
+    HNBenchOptions options;
+    const char *output {};
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue { i + 1 < argc };
+
+        if (!strcmp(argv[i], "--sizes") && hasValue)
+        {
+            if (!ParseSizes(argv[++i], options.sizes))
+            {
+                Usage();
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--iterations") && hasValue)
+            options.iterations = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(argv[i], "--commits") && hasValue)
+            options.commits = std::max(1UL, strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(argv[i], "--io-thread"))
+            options.ioThread = true;
+        else if (!strcmp(argv[i], "--output") && hasValue)
+            output = argv[++i];
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    // Keeps the roles quiet, the results go to stdout.
+    setenv("CZ_HEAVEN_BAR_LOG_LEVEL", "1", 0);
+    setenv("CZ_HEAVEN_CLIENT_LOG_LEVEL", "1", 0);
+    setenv("CZ_HEAVEN_COMPOSITOR_LOG_LEVEL", "1", 0);
+
+    auto bus { HNPrivateBus::Start() };
+
+    if (!bus)
+        return 1;
+
+    int fds[2];
+
+    if (pipe(fds) < 0)
+        return 1;
+
+    std::vector<pid_t> roles;
+    roles.emplace_back(Spawn(fds[1], [&](HNReport &report) { return RunBenchBar(options, report); }));
+    roles.emplace_back(Spawn(fds[1], [&](HNReport &report) { return RunBenchCompositor(options, report); }));
+    roles.emplace_back(Spawn(fds[1], [&](HNReport &report) { return RunBenchClient(options, report); }));
+    close(fds[1]);
+
+    auto metrics { Collect(fds[0], roles.size(), 600000) };
+    close(fds[0]);
+    Reap(roles);
+
+    const std::string json { "{\n  \"options\": { \"iterations\": " + std::to_string(options.iterations) +
+        ", \"commits\": " + std::to_string(options.commits) +
+        ", \"ioThread\": " + (options.ioThread ? "true" : "false") + " },\n  \"metrics\": " + MetricsJson(metrics) + "\n}\n" };
+
+    if (!WriteOutput(output, json))
+        return 1;
+
+    // Incomplete runs fail, so they are noticed under `meson test --benchmark`.
+    return metrics.contains("focus.change_us") && metrics.contains("click.roundtrip_us") ? 0 : 1;
+}
@@ -0,0 +1,399 @@
+#ifndef HNTOOLUTILS_H
+#define HNTOOLUTILS_H
+
+/*
+ * Shared by the Heaven tools (heaven-bench, heaven-loadgen, heaven-replay): a
+ * private session bus, forked roles reporting to the parent through a pipe, and
+ * percentiles.
+ *
+ * The client, bar and compositor are process-wide singletons, so each role
+ * runs in its own process forked before any CZCore is created.
+ */
+
+#include <CZ/Core/CZCore.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace CZ::Tools
+{
+    // Monotonic clock shared by all processes on the host.
+    inline UInt64 NowUsec() noexcept
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /**
+     * @brief Dispatches the CZCore loop until @p done returns true.
+     *
+     * @return false on timeout or loop failure.
+     */
+    inline bool WaitFor(CZCore &core, const std::function<bool()> &done, int timeoutMs = 10000) noexcept
+    {
+        const UInt64 deadline { NowUsec() + UInt64(timeoutMs) * 1000 };
+
+        while (!done())
+        {
+            const UInt64 now { NowUsec() };
+
+            if (now >= deadline || core.dispatch(int((deadline - now + 999) / 1000)) < 0)
+                return false;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Private `dbus-daemon --session` listening in a temporary directory.
+     *
+     * Start() exports its address as DBUS_SESSION_BUS_ADDRESS, so every role
+     * forked afterwards connects to it. The daemon and the directory are removed
+     * on destruction.
+     */
+    class HNPrivateBus
+    {
+    public:
+        static std::unique_ptr<HNPrivateBus> Start() noexcept
+        {
+            char dir[] { "/tmp/heaven-bus-XXXXXX" };
+
+            if (!mkdtemp(dir))
+            {
+                fprintf(stderr, "Failed to create a temporary directory: %s\n", strerror(errno));
+                return {};
+            }
+
+            std::unique_ptr<HNPrivateBus> bus { new HNPrivateBus(dir) };
+            int fds[2];
+
+            if (pipe(fds) < 0)
+                return {};
+
+            bus->m_pid = fork();
+
+            if (bus->m_pid == 0)
+            {
+                close(fds[0]);
+                const std::string address { std::string("unix:dir=") + dir };
+                const std::string printAddress { "--print-address=" + std::to_string(fds[1]) };
+                execlp("dbus-daemon", "dbus-daemon", "--session", "--nofork", "--nopidfile",
+                    ("--address=" + address).c_str(), printAddress.c_str(), (char*)nullptr);
+                fprintf(stderr, "Failed to run dbus-daemon: %s\n", strerror(errno));
+                _exit(127);
+            }
+
+            close(fds[1]);
+
+            if (bus->m_pid < 0)
+            {
+                close(fds[0]);
+                return {};
+            }
+
+            char buf[512];
+            ssize_t len;
+
+            while ((len = read(fds[0], buf, sizeof(buf))) > 0)
+            {
+                bus->m_address.append(buf, size_t(len));
+
+                if (bus->m_address.find('\n') != std::string::npos)
+                    break;
+            }
+
+            close(fds[0]);
+
+            while (!bus->m_address.empty() && std::isspace((unsigned char)bus->m_address.back()))
+                bus->m_address.pop_back();
+
+            if (bus->m_address.empty())
+            {
+                fprintf(stderr, "dbus-daemon did not report its address\n");
+                return {};
+            }
+
+            setenv("DBUS_SESSION_BUS_ADDRESS", bus->m_address.c_str(), 1);
+            return bus;
+        }
+
+        ~HNPrivateBus() noexcept
+        {
+            if (m_pid > 0)
+            {
+                kill(m_pid, SIGTERM);
+                waitpid(m_pid, nullptr, 0);
+            }
+
+            std::error_code ec;
+            std::filesystem::remove_all(m_dir, ec);
+        }
+
+        const std::string &address() const noexcept { return m_address; }
+
+    private:
+        HNPrivateBus(const std::string &dir) noexcept : m_dir(dir) {}
+        std::string m_dir;
+        std::string m_address;
+        pid_t m_pid { -1 };
+    };
+
+    /**
+     * @brief Line-based channel from the roles to the parent.
+     *
+     * Each line is `<metric> <value>`, or `done <role>`. Lines are written with
+     * a single write() below PIPE_BUF, so concurrent roles never interleave.
+     */
+    class HNReport
+    {
+    public:
+        explicit HNReport(int fd) noexcept : m_fd(fd) {}
+
+        void sample(const std::string &metric, double value) const noexcept
+        {
+            char line[256];
+            const int len { snprintf(line, sizeof(line), "%s %.3f\n", metric.c_str(), value) };
+
+            if (len > 0 && len < int(sizeof(line)))
+                write(m_fd, line, size_t(len));
+        }
+
+        void done(const char *role) const noexcept
+        {
+            sample(std::string("done:") + role, 0);
+        }
+
+    private:
+        int m_fd;
+    };
+
+    /**
+     * @brief Forks a role, which reports through @p fd and exits with the returned code.
+     */
+    inline pid_t Spawn(int fd, const std::function<int(HNReport&)> &role) noexcept
+    {
+        const pid_t pid { fork() };
+
+        if (pid == 0)
+        {
+            HNReport report(fd);
+            _exit(role(report));
+        }
+
+        return pid;
+    }
+
+    /**
+     * @brief Samples of a metric.
+     */
+    struct HNDistribution
+    {
+        std::vector<double> values;
+
+        double percentile(double p) const noexcept
+        {
+            if (values.empty())
+                return 0;
+
+            // Nearest-rank on the sorted samples.
+            const size_t rank { size_t(std::ceil(p / 100.0 * double(values.size()))) };
+            return values[std::min(values.size() - 1, rank > 0 ? rank - 1 : 0)];
+        }
+
+        /// Sorts the samples and returns them summarized as a JSON object.
+        std::string json() noexcept
+        {
+            std::sort(values.begin(), values.end());
+            double sum { 0 };
+
+            for (double v : values)
+                sum += v;
+
+            char buf[512];
+            snprintf(buf, sizeof(buf),
+                "{ \"count\": %zu, \"sum\": %.3f, \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f }",
+                values.size(),
+                sum,
+                values.empty() ? 0.0 : values.front(),
+                values.empty() ? 0.0 : sum / double(values.size()),
+                percentile(50), percentile(90), percentile(99),
+                values.empty() ? 0.0 : values.back());
+            return buf;
+        }
+    };
+
+    /**
+     * @brief Parses the roles' reports.
+     */
+    class HNCollector
+    {
+    public:
+        /// Samples by metric name.
+        std::map<std::string, HNDistribution> metrics;
+
+        /// Number of `done` lines received.
+        size_t done { 0 };
+
+        /**
+         * @brief Reads the available data from @p fd.
+         *
+         * @return false once every writer closed the pipe.
+         */
+        bool read(int fd) noexcept
+        {
+            char buf[4096];
+            const ssize_t len { ::read(fd, buf, sizeof(buf)) };
+
+            if (len == 0 || (len < 0 && errno != EINTR && errno != EAGAIN))
+                return false;
+
+            if (len < 0)
+                return true;
+
+            m_pending.append(buf, size_t(len));
+            size_t eol;
+
+            while ((eol = m_pending.find('\n')) != std::string::npos)
+            {
+                const std::string line { m_pending.substr(0, eol) };
+                m_pending.erase(0, eol + 1);
+
+                const size_t space { line.rfind(' ') };
+
+                if (space == std::string::npos)
+                    continue;
+
+                const std::string metric { line.substr(0, space) };
+
+                if (metric.starts_with("done:"))
+                    done++;
+                else
+                    metrics[metric].values.emplace_back(std::strtod(line.c_str() + space + 1, nullptr));
+            }
+
+            return true;
+        }
+
+    private:
+        std::string m_pending;
+    };
+
+    /**
+     * @brief Reads the roles' reports until @p roles are done, the deadline expires or all writers exit.
+     *
+     * @return Samples by metric name.
+     */
+    inline std::map<std::string, HNDistribution> Collect(int fd, size_t roles, int timeoutMs) noexcept
+    {
+        HNCollector collector;
+        const UInt64 deadline { NowUsec() + UInt64(timeoutMs) * 1000 };
+
+        while (collector.done < roles)
+        {
+            const UInt64 now { NowUsec() };
+
+            if (now >= deadline)
+            {
+                fprintf(stderr, "Timed out waiting for the roles to finish\n");
+                break;
+            }
+
+            pollfd pfd { fd, POLLIN, 0 };
+
+            if (poll(&pfd, 1, int((deadline - now + 999) / 1000)) > 0 && !collector.read(fd))
+                break;
+        }
+
+        return std::move(collector.metrics);
+    }
+
+    /**
+     * @brief Formats the metrics as the members of a JSON object.
+     */
+    inline std::string MetricsJson(std::map<std::string, HNDistribution> &metrics) noexcept
+    {
+        std::string json { "{" };
+        bool first { true };
+
+        for (auto &[name, distribution] : metrics)
+        {
+            json += (first ? "\n    \"" : ",\n    \"") + name + "\": " + distribution.json();
+            first = false;
+        }
+
+        return json + "\n  }";
+    }
+
+    /**
+     * @brief Writes the results to @p path, or to stdout if nullptr.
+     */
+    inline bool WriteOutput(const char *path, const std::string &text) noexcept
+    {
+        FILE *out { path ? fopen(path, "w") : stdout };
+
+        if (!out)
+        {
+            fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+            return false;
+        }
+
+        fputs(text.c_str(), out);
+
+        if (out != stdout)
+            fclose(out);
+
+        return true;
+    }
+
+    /**
+     * @brief Resident set size of a process in KiB, or -1 if it can't be read.
+     */
+    inline long ReadRssKb(pid_t pid) noexcept
+    {
+        FILE *status { fopen(("/proc/" + std::to_string(pid) + "/status").c_str(), "r") };
+
+        if (!status)
+            return -1;
+
+        char line[256];
+        long rss { -1 };
+
+        while (fgets(line, sizeof(line), status))
+            if (sscanf(line, "VmRSS: %ld", &rss) == 1)
+                break;
+
+        fclose(status);
+        return rss;
+    }
+
+    /**
+     * @brief Stops the roles still running.
+     */
+    inline void Reap(const std::vector<pid_t> &pids) noexcept
+    {
+        for (pid_t pid : pids)
+            if (pid > 0)
+                kill(pid, SIGTERM);
+
+        for (pid_t pid : pids)
+            if (pid > 0)
+                waitpid(pid, nullptr, 0);
+    }
+}
+
+#endif // HNTOOLUTILS_H
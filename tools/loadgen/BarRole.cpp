@@ -0,0 +1,24 @@
+#include "HNLoadgen.h"
+#include <CZ/Heaven/Bar/HNBar.h>
+#include <cstdio>
+
+using namespace CZ;
+using namespace CZ::Bar;
+
+int CZ::Tools::RunLoadgenBar(const HNLoadgenOptions &options, HNReport &) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto bar { HNBar::GetOrMake(options.ioThread) };
+
+    if (!bar)
+    {
+        fprintf(stderr, "heaven-loadgen: failed to start the bar\n");
+        return 1;
+    }
+
+    bar->setDeferInactiveCommits(options.deferInactive);
+
+    while (core->dispatch() >= 0) {}
+
+    return 0;
+}
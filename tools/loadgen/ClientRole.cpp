@@ -0,0 +1,144 @@
+#include "HNLoadgen.h"
+#include <CZ/Heaven/Client/HNClient.h>
+#include <CZ/Heaven/Client/HNTopbar.h>
+#include <CZ/Heaven/Client/HNMenu.h>
+#include <CZ/Heaven/Client/HNAction.h>
+#include <cstdio>
+#include <random>
+
+using namespace CZ;
+using namespace CZ::Client;
+
+// Time given to the bar to acknowledge the last commits of a session.
+static constexpr int DrainTimeoutMs { 2000 };
+
+/*
+ * One client session: builds the tree, then mutates it at the configured rates
+ * until the deadline or the end of the session, and reports its acknowledgement
+ * latencies and the updates the bar never (or late) acknowledged.
+ */
+int CZ::Tools::RunLoadgenClient(const HNLoadgenOptions &options, UInt32 index, UInt64 deadline, HNReport &report) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto client { HNClient::GetOrMake() };
+
+    if (!client || !WaitFor(*core, [&]{ return !client->barId().empty(); }, 30000))
+    {
+        report.sample("clients.failed", 1);
+        return 1;
+    }
+
+    std::mt19937 rng { std::random_device{}() ^ index };
+    auto topbar { HNTopbar::Make() };
+
+    // Every menu and the levels nested in it
+    std::vector<std::shared_ptr<HNMenu>> containers;
+    std::vector<std::shared_ptr<HNAction>> actions;
+    UInt32 created { 0 };
+
+    for (UInt32 m = 0; m < options.menus; m++)
+    {
+        HNObject *parent { topbar.get() };
+
+        for (UInt32 level = 0; level < std::max(options.depth, 1U); level++)
+        {
+            containers.emplace_back(HNMenu::Make("Menu " + std::to_string(m), "", "", true, parent));
+            parent = containers.back().get();
+        }
+    }
+
+    if (!containers.empty())
+        for (UInt32 i = 0; i < options.menus * options.actions; i++, created++)
+            actions.emplace_back(HNAction::Make("Action " + std::to_string(i), "document-open", "", true,
+                containers[i % containers.size()].get()));
+
+    UInt32 acked { 0 };
+    UInt32 late { 0 };
+    const UInt64 lateUs { UInt64(options.lateMs) * 1000 };
+
+    client->onCommitApplied.subscribe(topbar.get(), [&](UInt32 seq, UInt64 latency)
+    {
+        acked = seq;
+
+        if (latency > lateUs)
+            late++;
+
+        report.sample("commit.roundtrip_us", double(latency));
+        report.sample("commit.dispatch_us", double(client->lastCommitDispatchTime()));
+    });
+
+    client->setName("heaven-loadgen " + std::to_string(index));
+    client->setActiveTopbar(topbar.get());
+    client->setPrivateHandle("heaven-loadgen-" + std::to_string(index));
+    client->commit();
+
+    // Time of the next event of a Poisson process, or never if the rate is 0.
+    auto after = [&](UInt64 from, double rate) -> UInt64
+    {
+        return rate > 0 ? from + UInt64(std::exponential_distribution<double>(rate)(rng) * 1000000.0) : UINT64_MAX;
+    };
+
+    const UInt64 start { NowUsec() };
+    const UInt64 sessionEnd { options.sessionLength > 0 ? std::min(deadline, after(start, 1.0 / options.sessionLength)) : deadline };
+    UInt64 nextProperty { after(start, options.propertyRate) };
+    UInt64 nextStructural { after(start, options.structuralRate) };
+
+    while (true)
+    {
+        const UInt64 now { NowUsec() };
+
+        if (now >= sessionEnd)
+            break;
+
+        if (now >= nextProperty)
+        {
+            nextProperty = after(now, options.propertyRate);
+
+            if (!actions.empty())
+            {
+                auto &action { actions[rng() % actions.size()] };
+
+                if (rng() % 4 == 0)
+                    action->setEnabled(!action->enabled());
+                else
+                    action->setTitle("Action " + std::to_string(rng()));
+
+                client->commit();
+            }
+
+            continue;
+        }
+
+        if (now >= nextStructural)
+        {
+            nextStructural = after(now, options.structuralRate);
+
+            // Destroys or creates an action, keeping the tree size around its initial value.
+            if (!actions.empty() && (actions.size() >= options.menus * options.actions || rng() % 2))
+            {
+                std::swap(actions[rng() % actions.size()], actions.back());
+                actions.pop_back();
+            }
+            else if (!containers.empty())
+                actions.emplace_back(HNAction::Make("Action " + std::to_string(created++), "", "", true,
+                    containers[rng() % containers.size()].get()));
+
+            client->commit();
+            continue;
+        }
+
+        const UInt64 next { std::min({ nextProperty, nextStructural, sessionEnd }) };
+
+        if (core->dispatch(int((next - now + 999) / 1000)) < 0)
+            break;
+    }
+
+    WaitFor(*core, [&]{ return acked == client->commitSequence(); }, DrainTimeoutMs);
+
+    report.sample("updates.sent", client->commitSequence());
+    report.sample("updates.dropped", client->commitSequence() - acked);
+    report.sample("updates.late", late);
+    report.sample("clients.sessions", 1);
+
+    return sessionEnd < deadline ? LoadgenReconnect : 0;
+}
@@ -0,0 +1,68 @@
+#include "HNLoadgen.h"
+#include <CZ/Heaven/Compositor/HNCompositor.h>
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+using namespace CZ;
+using namespace CZ::Compositor;
+
+/*
+ * Focuses a random connected client at the configured rate. setActiveClient()
+ * returns after the bar applied the change, so each call measures a complete
+ * focus change.
+ */
+int CZ::Tools::RunLoadgenCompositor(const HNLoadgenOptions &options, UInt64 deadline, HNReport &report) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto compositor { HNCompositor::GetOrMake() };
+
+    if (!compositor)
+    {
+        fprintf(stderr, "heaven-loadgen: failed to start the compositor\n");
+        return 1;
+    }
+
+    std::vector<std::string> clients;
+
+    compositor->onClientRegistered.subscribe(compositor.get(), [&](const char *, const char *dbusId)
+    {
+        clients.emplace_back(dbusId);
+    });
+
+    compositor->onClientUnregistered.subscribe(compositor.get(), [&](const char *, const char *dbusId, void *)
+    {
+        std::erase(clients, dbusId);
+    });
+
+    std::mt19937 rng { std::random_device{}() };
+    std::exponential_distribution<double> interval { options.focusRate > 0 ? options.focusRate : 1 };
+    UInt64 next { NowUsec() };
+
+    while (true)
+    {
+        const UInt64 now { NowUsec() };
+
+        if (options.focusRate > 0 && now >= next && now < deadline)
+        {
+            next = now + UInt64(interval(rng) * 1000000.0);
+
+            if (!clients.empty())
+            {
+                const std::string id { clients[rng() % clients.size()] };
+                const UInt64 start { NowUsec() };
+                compositor->setActiveClient(id);
+                report.sample("focus.change_us", double(NowUsec() - start));
+            }
+
+            continue;
+        }
+
+        const int timeout { options.focusRate > 0 && now < deadline ? int((next - now + 999) / 1000) : -1 };
+
+        if (core->dispatch(timeout) < 0)
+            break;
+    }
+
+    return 0;
+}
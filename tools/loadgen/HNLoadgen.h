@@ -0,0 +1,52 @@
+#ifndef HNLOADGEN_H
+#define HNLOADGEN_H
+
+#include <HNToolUtils.h>
+
+/*
+ * The roles live in separate translation units: the client and bar headers
+ * can't be included together.
+ */
+
+namespace CZ::Tools
+{
+    struct HNLoadgenOptions
+    {
+        // Simulated clients, each in its own process
+        UInt32 clients { 50 };
+
+        // Tree shape: menus in each topbar, nesting depth of each menu and actions per menu (spread over its levels)
+        UInt32 menus { 8 };
+        UInt32 depth { 1 };
+        UInt32 actions { 60 };
+
+        // Per client and second: property updates and object creations/destructions (each one a commit)
+        double propertyRate { 10 };
+        double structuralRate { 1 };
+
+        // Focus switches per second, performed by the compositor
+        double focusRate { 2 };
+
+        // Mean seconds a client stays connected before reconnecting (0 = never)
+        double sessionLength { 0 };
+
+        // Duration of the run in seconds
+        UInt32 duration { 30 };
+
+        // Acknowledgements slower than this are reported as late
+        UInt32 lateMs { 50 };
+
+        // Bar configuration
+        bool ioThread { false };
+        bool deferInactive { false };
+    };
+
+    // Exit status of a client ending its session early, respawned by the parent.
+    inline constexpr int LoadgenReconnect { 2 };
+
+    int RunLoadgenBar(const HNLoadgenOptions &options, HNReport &report) noexcept;
+    int RunLoadgenCompositor(const HNLoadgenOptions &options, UInt64 deadline, HNReport &report) noexcept;
+    int RunLoadgenClient(const HNLoadgenOptions &options, UInt32 index, UInt64 deadline, HNReport &report) noexcept;
+}
+
+#endif // HNLOADGEN_H
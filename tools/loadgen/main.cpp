@@ -0,0 +1,206 @@
+/**
+ * heaven-loadgen
+ *
+ * Capacity-planning harness: runs N simulated clients (each in its own process)
+ * against a real bar on a private session bus, with configurable tree shapes,
+ * property and structural churn, focus switches and reconnections, and reports:
+ *
+ * - The bar's RSS, sampled every second (`bar.rss_kb`)
+ * - The bar's commit dispatch time and the client acknowledgement latency
+ * - Updates never acknowledged (`updates.dropped`) or acknowledged late (`updates.late`)
+ * - Focus change latency
+ *
+ * Usage: heaven-loadgen [OPTIONS], see --help.
+ */
+
+#include "HNLoadgen.h"
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+using namespace CZ;
+using namespace CZ::Tools;
+
+static void Usage() noexcept
+{
+    fprintf(stderr,
+        "Usage: heaven-loadgen [OPTIONS]\n"
+        "  --clients N         Simulated clients (default 50)\n"
+        "  --menus N           Menus per topbar (default 8)\n"
+        "  --depth N           Nesting levels of each menu (default 1)\n"
+        "  --actions N         Actions per menu, spread over its levels (default 60)\n"
+        "  --property-rate R   Property updates per client and second (default 10)\n"
+        "  --structural-rate R Object creations/destructions per client and second (default 1)\n"
+        "  --focus-rate R      Focus switches per second (default 2)\n"
+        "  --session-length S  Mean seconds before a client reconnects, 0 = never (default 0)\n"
+        "  --duration S        Duration of the run in seconds (default 30)\n"
+        "  --late-ms N         Acknowledgements slower than this are late (default 50)\n"
+        "  --io-thread         Run the bar with its I/O thread\n"
+        "  --defer-inactive    Defer the commits of inactive clients\n"
+        "  --output FILE       Write the JSON results to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    HNLoadgenOptions options;
+    const char *output {};
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue { i + 1 < argc };
+        const char *arg { argv[i] };
+
+        if (!strcmp(arg, "--clients") && hasValue)
+            options.clients = UInt32(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(arg, "--menus") && hasValue)
+            options.menus = UInt32(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(arg, "--depth") && hasValue)
+            options.depth = UInt32(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(arg, "--actions") && hasValue)
+            options.actions = UInt32(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(arg, "--property-rate") && hasValue)
+            options.propertyRate = strtod(argv[++i], nullptr);
+        else if (!strcmp(arg, "--structural-rate") && hasValue)
+            options.structuralRate = strtod(argv[++i], nullptr);
+        else if (!strcmp(arg, "--focus-rate") && hasValue)
+            options.focusRate = strtod(argv[++i], nullptr);
+        else if (!strcmp(arg, "--session-length") && hasValue)
+            options.sessionLength = strtod(argv[++i], nullptr);
+        else if (!strcmp(arg, "--duration") && hasValue)
+            options.duration = UInt32(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(arg, "--late-ms") && hasValue)
+            options.lateMs = UInt32(strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(arg, "--io-thread"))
+            options.ioThread = true;
+        else if (!strcmp(arg, "--defer-inactive"))
+            options.deferInactive = true;
+        else if (!strcmp(arg, "--output") && hasValue)
+            output = argv[++i];
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    setenv("CZ_HEAVEN_BAR_LOG_LEVEL", "1", 0);
+    setenv("CZ_HEAVEN_CLIENT_LOG_LEVEL", "1", 0);
+    setenv("CZ_HEAVEN_COMPOSITOR_LOG_LEVEL", "1", 0);
+
+    auto bus { HNPrivateBus::Start() };
+
+    if (!bus)
+        return 1;
+
+    int fds[2];
+
+    if (pipe(fds) < 0)
+        return 1;
+
+    const UInt64 start { NowUsec() };
+    const UInt64 deadline { start + UInt64(options.duration) * 1000000 };
+
+    const pid_t bar { Spawn(fds[1], [&](HNReport &report) { return RunLoadgenBar(options, report); }) };
+    const pid_t compositor { Spawn(fds[1], [&](HNReport &report) { return RunLoadgenCompositor(options, deadline, report); }) };
+
+    // Running clients, by pid
+    std::unordered_map<pid_t, UInt32> clients;
+
+    auto spawnClient = [&](UInt32 index)
+    {
+        const pid_t pid { Spawn(fds[1], [&](HNReport &report) { return RunLoadgenClient(options, index, deadline, report); }) };
+
+        if (pid > 0)
+            clients[pid] = index;
+    };
+
+    for (UInt32 i = 0; i < options.clients; i++)
+        spawnClient(i);
+
+    HNCollector collector;
+    auto &rss { collector.metrics["bar.rss_kb"] };
+    UInt64 nextRss { start };
+    bool barCrashed { false };
+
+    // Sessions end by themselves, the grace period covers their final acknowledgements.
+    const UInt64 giveUp { deadline + 30000000 };
+
+    while (!clients.empty() && NowUsec() < giveUp)
+    {
+        const UInt64 now { NowUsec() };
+
+        if (now >= nextRss)
+        {
+            nextRss = now + 1000000;
+
+            if (const long kb { ReadRssKb(bar) }; kb >= 0)
+                rss.values.emplace_back(double(kb));
+        }
+
+        pollfd pfd { fds[0], POLLIN, 0 };
+
+        if (poll(&pfd, 1, int((nextRss - now + 999) / 1000)) > 0)
+            collector.read(fds[0]);
+
+        int status;
+
+        if (waitpid(bar, &status, WNOHANG) == bar)
+        {
+            fprintf(stderr, "heaven-loadgen: the bar exited\n");
+            barCrashed = true;
+            break;
+        }
+
+        for (auto it = clients.begin(); it != clients.end();)
+        {
+            if (waitpid(it->first, &status, WNOHANG) != it->first)
+            {
+                it++;
+                continue;
+            }
+
+            const UInt32 index { it->second };
+            it = clients.erase(it);
+
+            if (WIFEXITED(status) && WEXITSTATUS(status) == LoadgenReconnect && NowUsec() < deadline)
+                spawnClient(index);
+        }
+    }
+
+    // Reports still in the pipe.
+    close(fds[1]);
+
+    std::vector<pid_t> remaining { compositor };
+
+    if (!barCrashed)
+        remaining.emplace_back(bar);
+
+    for (const auto &[pid, index] : clients)
+        remaining.emplace_back(pid);
+
+    Reap(remaining);
+
+    while (collector.read(fds[0])) {}
+
+    close(fds[0]);
+
+    const std::string json { "{\n  \"options\": { \"clients\": " + std::to_string(options.clients) +
+        ", \"menus\": " + std::to_string(options.menus) +
+        ", \"depth\": " + std::to_string(options.depth) +
+        ", \"actions\": " + std::to_string(options.actions) +
+        ", \"propertyRate\": " + std::to_string(options.propertyRate) +
+        ", \"structuralRate\": " + std::to_string(options.structuralRate) +
+        ", \"focusRate\": " + std::to_string(options.focusRate) +
+        ", \"sessionLength\": " + std::to_string(options.sessionLength) +
+        ", \"duration\": " + std::to_string(options.duration) +
+        ", \"lateMs\": " + std::to_string(options.lateMs) +
+        ", \"ioThread\": " + (options.ioThread ? "true" : "false") +
+        ", \"deferInactive\": " + (options.deferInactive ? "true" : "false") +
+        " },\n  \"barCrashed\": " + (barCrashed ? "true" : "false") +
+        ",\n  \"metrics\": " + MetricsJson(collector.metrics) + "\n}\n" };
+
+    if (!WriteOutput(output, json))
+        return 1;
+
+    return barCrashed ? 1 : 0;
+}
@@ -0,0 +1,589 @@
+/**
+ * heaven-replay
+ *
+ * Feeds a capture recorded by the bar (see HNBar::startCapture()) back to a bar,
+ * either at the recorded pace (optionally scaled) or as fast as possible, and
+ * reports how the bar kept up:
+ *
+ * - Messages sent and method errors returned by the bar
+ * - Sequenced commits acknowledged, their latency (`commit.ack_us`) and the
+ *   bar's dispatch time (`commit.dispatch_us`)
+ * - The bar's RSS when it runs on a private bus or in process (`bar.rss_kb`)
+ *
+ * Each recorded sender is impersonated by its own bus connection, opened on its
+ * first message and closed where it disconnected, so the bar sees the same set
+ * of clients. The sender of compositor methods acquires the compositor name.
+ *
+ * With --loopback the bar runs in this process on an HNLoopback transport
+ * instead (see HNBar::MakeLoopback()), which leaves out the bus and the
+ * scheduling noise of a second process.
+ *
+ * Usage: heaven-replay [OPTIONS] CAPTURE, see --help.
+ */
+
+#include <HNToolUtils.h>
+#include <CZ/Heaven/HNBusPoll.h>
+#include <CZ/Heaven/Bar/HNBar.h>
+#include <CZ/Heaven/Bar/HNCapture.h>
+#include <CZ/Heaven/Bar/HNLoopback.h>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+using namespace CZ;
+using namespace CZ::Bar;
+using namespace CZ::Tools;
+
+struct Replay;
+
+// Connection impersonating a recorded sender.
+struct Peer
+{
+    Replay *replay;
+    sd_bus *bus {};
+    bool registered { false };
+    bool compositor { false };
+
+    // Sequenced commits waiting for their acknowledgement
+    UInt64 outstanding { 0 };
+};
+
+struct Replay
+{
+    // By recorded sender index
+    std::vector<std::unique_ptr<Peer>> peers;
+
+    // Recorded unique name -> unique name of the peer impersonating it
+    std::unordered_map<std::string, std::string> names;
+
+    UInt64 messages { 0 };
+    UInt64 errors { 0 };
+    UInt64 sequenced { 0 };
+    UInt64 acked { 0 };
+    UInt64 outstanding { 0 };
+    std::map<std::string, HNDistribution> metrics;
+
+    // Loopback only, sequenced commits waiting for their acknowledgement by recorded sender
+    HNLoopback *loopback {};
+    std::unordered_map<std::string, UInt64> pending;
+};
+
+static bool IsCompositorMethod(const std::string &member) noexcept
+{
+    return member == "SetActiveClient" || member == "SetActiveClientWithSerial" || member == "SetPrefetchHints";
+}
+
+static int CountReply(sd_bus_message *m, void *data, sd_bus_error *)
+{
+    if (sd_bus_message_is_method_error(m, nullptr))
+        static_cast<Replay*>(data)->errors++;
+
+    return 0;
+}
+
+static int CommitApplied(sd_bus_message *m, void *data, sd_bus_error *)
+{
+    auto *peer { static_cast<Peer*>(data) };
+    UInt32 seq;
+    UInt64 clientTime, dispatchTime;
+
+    if (sd_bus_message_read(m, "utt", &seq, &clientTime, &dispatchTime) >= 0 && peer->outstanding > 0)
+    {
+        peer->outstanding--;
+        peer->replay->outstanding--;
+        peer->replay->acked++;
+        peer->replay->metrics["commit.ack_us"].values.emplace_back(double(NowUsec() - clientTime));
+        peer->replay->metrics["commit.dispatch_us"].values.emplace_back(double(dispatchTime));
+    }
+
+    return sd_bus_reply_method_return(m, "");
+}
+
+// Resyncs, clicks, backpressure and focus notifications are accepted and ignored.
+static int Ignore(sd_bus_message *m, void *, sd_bus_error *)
+{
+    return sd_bus_reply_method_return(m, "");
+}
+
+static const sd_bus_vtable ClientVTable[]
+{
+    SD_BUS_VTABLE_START(0),
+    SD_BUS_METHOD("ObjectClicked", "u", "", Ignore, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Resync", "", "", Ignore, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("Backpressure", "b", "", Ignore, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("CommitApplied", "utt", "", CommitApplied, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_METHOD("FocusChanged", "u", "", Ignore, SD_BUS_VTABLE_UNPRIVILEGED),
+    SD_BUS_VTABLE_END
+};
+
+static Peer *GetOrOpenPeer(Replay &replay, const HNCapture::Reader &reader, UInt32 sender) noexcept
+{
+    if (replay.peers.size() <= sender)
+        replay.peers.resize(sender + 1);
+
+    auto &peer { replay.peers[sender] };
+
+    if (peer)
+        return peer->bus ? peer.get() : nullptr;
+
+    peer = std::make_unique<Peer>(&replay);
+    const char *name;
+
+    if (sd_bus_open_user(&peer->bus) < 0 ||
+        sd_bus_add_object_vtable(peer->bus, nullptr, "/org/cuarzo/HeavenClient", "org.cuarzo.HeavenClient", ClientVTable, peer.get()) < 0 ||
+        sd_bus_get_unique_name(peer->bus, &name) < 0)
+    {
+        fprintf(stderr, "heaven-replay: failed to open the connection of %s\n", reader.senders()[sender].c_str());
+
+        if (peer->bus)
+            peer->bus = sd_bus_flush_close_unref(peer->bus);
+
+        return nullptr;
+    }
+
+    replay.names[reader.senders()[sender]] = name;
+    return peer.get();
+}
+
+static void ClosePeer(Replay &replay, UInt32 sender) noexcept
+{
+    if (sender >= replay.peers.size() || !replay.peers[sender] || !replay.peers[sender]->bus)
+        return;
+
+    auto &peer { *replay.peers[sender] };
+    replay.outstanding -= peer.outstanding;
+    peer.outstanding = 0;
+    peer.bus = sd_bus_flush_close_unref(peer.bus);
+}
+
+// Recorded client IDs are replaced by the unique names of the peers impersonating them.
+static const char *Translate(const Replay &replay, const std::string &id) noexcept
+{
+    auto it { replay.names.find(id) };
+    return it == replay.names.end() ? id.c_str() : it->second.c_str();
+}
+
+static int Call(Peer &peer, const char *member, sd_bus_message **m) noexcept
+{
+    return sd_bus_message_new_method_call(peer.bus, m, "org.cuarzo.HeavenBar", "/org/cuarzo/HeavenBar", "org.cuarzo.HeavenBar", member);
+}
+
+static void Send(Replay &replay, const HNCapture::Reader &reader, const HNCapture::Record &record) noexcept
+{
+    Peer *peer { GetOrOpenPeer(replay, reader, record.sender) };
+
+    if (!peer)
+        return;
+
+    const auto &member { reader.members()[record.member] };
+    const bool compositorMethod { IsCompositorMethod(member.name) };
+    sd_bus_message *m {};
+
+    if (compositorMethod && !peer->compositor)
+    {
+        peer->compositor = true;
+
+        if (sd_bus_request_name(peer->bus, "org.cuarzo.HeavenCompositor", 0) < 0)
+            fprintf(stderr, "heaven-replay: failed to acquire the compositor name, is a compositor running?\n");
+    }
+    else if (!compositorMethod && !peer->registered)
+    {
+        peer->registered = true;
+
+        // Senders already registered when the capture started.
+        if (member.name != "RegisterClient" && member.name != "AnnounceClient" && Call(*peer, "RegisterClient", &m) >= 0)
+        {
+            sd_bus_call_async(peer->bus, nullptr, m, CountReply, &replay, 0);
+            m = sd_bus_message_unref(m);
+        }
+    }
+
+    if (Call(*peer, member.name.c_str(), &m) < 0)
+        return;
+
+    const bool sequenced { member.name == "CommitWithSequence" || member.name == "CommitWithFocus" };
+    size_t arg { 0 };
+    int r { 0 };
+
+    for (const char *type = member.signature.c_str(); *type && r >= 0; type++, arg++)
+    {
+        const auto &value { record.args[arg] };
+
+        switch (*type)
+        {
+        case 'u':
+        {
+            const UInt32 u { UInt32(std::get<UInt64>(value)) };
+            r = sd_bus_message_append_basic(m, 'u', &u);
+            break;
+        }
+        case 't':
+        {
+            // The client time is echoed in the acknowledgement.
+            const UInt64 t { sequenced ? NowUsec() : std::get<UInt64>(value) };
+            r = sd_bus_message_append_basic(m, 't', &t);
+            break;
+        }
+        case 'b':
+        {
+            const int b { std::get<UInt64>(value) ? 1 : 0 };
+            r = sd_bus_message_append_basic(m, 'b', &b);
+            break;
+        }
+        case 's':
+        {
+            const auto &s { std::get<std::string>(value) };
+            r = sd_bus_message_append_basic(m, 's', compositorMethod ? Translate(replay, s) : s.c_str());
+            break;
+        }
+        case 'a':
+        {
+            type++;
+            r = sd_bus_message_open_container(m, 'a', "s");
+
+            for (const auto &s : std::get<std::vector<std::string>>(value))
+                if (r >= 0)
+                    r = sd_bus_message_append_basic(m, 's', compositorMethod ? Translate(replay, s) : s.c_str());
+
+            if (r >= 0)
+                r = sd_bus_message_close_container(m);
+            break;
+        }
+        }
+    }
+
+    if (r >= 0 && sd_bus_call_async(peer->bus, nullptr, m, CountReply, &replay, 0) >= 0)
+    {
+        replay.messages++;
+
+        if (sequenced)
+        {
+            replay.sequenced++;
+            replay.outstanding++;
+            peer->outstanding++;
+        }
+    }
+    else
+        replay.errors++;
+
+    sd_bus_message_unref(m);
+}
+
+// Delivers a record to the in-process bar, mirroring Send() and ClosePeer().
+static void SendLoopback(Replay &replay, const HNCapture::Reader &reader, const HNCapture::Record &record) noexcept
+{
+    if (replay.peers.size() <= record.sender)
+        replay.peers.resize(record.sender + 1);
+
+    const auto &sender { reader.senders()[record.sender] };
+    auto &peer { replay.peers[record.sender] };
+
+    if (record.kind == HNCapture::Record::Disconnect)
+    {
+        if (peer)
+        {
+            replay.outstanding -= replay.pending[sender];
+            replay.pending.erase(sender);
+            replay.loopback->disconnect(sender);
+            peer.reset();
+        }
+        return;
+    }
+
+    if (!peer)
+        peer = std::make_unique<Peer>(&replay);
+
+    const auto &member { reader.members()[record.member] };
+    const bool sequenced { member.name == "CommitWithSequence" || member.name == "CommitWithFocus" };
+
+    if (!IsCompositorMethod(member.name) && !peer->registered)
+    {
+        peer->registered = true;
+
+        if (member.name != "RegisterClient" && member.name != "AnnounceClient")
+            replay.loopback->registerClient(sender);
+    }
+
+    auto args { record.args };
+
+    // The client time is echoed in the acknowledgement.
+    if (sequenced && args.size() > 1)
+        args[1] = NowUsec();
+
+    if (!replay.loopback->call(sender, member.name, args))
+    {
+        replay.errors++;
+        return;
+    }
+
+    replay.messages++;
+
+    if (sequenced)
+    {
+        replay.sequenced++;
+        replay.outstanding++;
+        replay.pending[sender]++;
+    }
+}
+
+// Processes every peer, waiting up to timeoutMs for I/O.
+static void ProcessPeers(Replay &replay, int timeoutMs) noexcept
+{
+    std::vector<pollfd> fds;
+
+    for (auto &peer : replay.peers)
+    {
+        if (!peer || !peer->bus)
+            continue;
+
+        if (HNBusPoll::Process(peer->bus, 0) < 0)
+        {
+            fprintf(stderr, "heaven-replay: a connection failed\n");
+            replay.outstanding -= peer->outstanding;
+            peer->outstanding = 0;
+            peer->bus = sd_bus_flush_close_unref(peer->bus);
+            continue;
+        }
+
+        const int timeout { HNBusPoll::Timeout(peer->bus) };
+
+        if (timeout >= 0 && (timeoutMs < 0 || timeout < timeoutMs))
+            timeoutMs = timeout;
+
+        fds.emplace_back(pollfd { sd_bus_get_fd(peer->bus), short(HNBusPoll::Events(peer->bus)), 0 });
+    }
+
+    // Also sleeps until the next message when no peer is open yet.
+    if (timeoutMs != 0)
+        poll(fds.data(), fds.size(), timeoutMs);
+}
+
+static int RunBar(bool ioThread, HNReport &report) noexcept
+{
+    auto core { CZCore::GetOrMake() };
+    auto bar { HNBar::GetOrMake(ioThread) };
+
+    if (!bar)
+    {
+        fprintf(stderr, "heaven-replay: failed to start the bar\n");
+        return 1;
+    }
+
+    report.done("bar");
+
+    while (core->dispatch() >= 0) {}
+
+    return 0;
+}
+
+static void Usage() noexcept
+{
+    fprintf(stderr,
+        "Usage: heaven-replay [OPTIONS] CAPTURE\n"
+        "  --fast              Send the messages as fast as possible instead of at the recorded pace\n"
+        "  --speed X           Scale the recorded pace by X (default 1)\n"
+        "  --spawn-bar         Replay against a bar started on a private bus instead of the session bar\n"
+        "  --io-thread         Run the spawned bar with its I/O thread\n"
+        "  --loopback          Replay against a bar in this process, without a bus\n"
+        "  --drain-timeout MS  Time to wait for the last acknowledgements (default 10000)\n"
+        "  --output FILE       Write the JSON results to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *capture {};
+    const char *output {};
+    bool fast { false };
+    bool spawnBar { false };
+    bool ioThread { false };
+    bool loopback { false };
+    double speed { 1 };
+    int drainTimeout { 10000 };
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool hasValue { i + 1 < argc };
+        const char *arg { argv[i] };
+
+        if (!strcmp(arg, "--fast"))
+            fast = true;
+        else if (!strcmp(arg, "--speed") && hasValue)
+            speed = strtod(argv[++i], nullptr);
+        else if (!strcmp(arg, "--spawn-bar"))
+            spawnBar = true;
+        else if (!strcmp(arg, "--io-thread"))
+            ioThread = true;
+        else if (!strcmp(arg, "--loopback"))
+            loopback = true;
+        else if (!strcmp(arg, "--drain-timeout") && hasValue)
+            drainTimeout = atoi(argv[++i]);
+        else if (!strcmp(arg, "--output") && hasValue)
+            output = argv[++i];
+        else if (arg[0] != '-' && !capture)
+            capture = arg;
+        else
+        {
+            Usage();
+            return 1;
+        }
+    }
+
+    if (!capture || speed <= 0 || (loopback && (spawnBar || ioThread)))
+    {
+        Usage();
+        return 1;
+    }
+
+    auto reader { HNCapture::Reader::Open(capture) };
+
+    if (!reader)
+        return 1;
+
+    std::unique_ptr<HNPrivateBus> bus;
+    pid_t bar { -1 };
+
+    if (spawnBar)
+    {
+        setenv("CZ_HEAVEN_BAR_LOG_LEVEL", "1", 0);
+        bus = HNPrivateBus::Start();
+
+        if (!bus)
+            return 1;
+
+        int fds[2];
+
+        if (pipe(fds) < 0)
+            return 1;
+
+        bar = Spawn(fds[1], [&](HNReport &report) { return RunBar(ioThread, report); });
+        close(fds[1]);
+
+        // Ready once it owns its name, the pipe closes if it exits.
+        HNCollector collector;
+        const UInt64 deadline { NowUsec() + 5000000 };
+
+        while (bar > 0 && collector.done == 0 && NowUsec() < deadline)
+        {
+            pollfd pfd { fds[0], POLLIN, 0 };
+
+            if (poll(&pfd, 1, 100) > 0 && !collector.read(fds[0]))
+                break;
+        }
+
+        close(fds[0]);
+
+        if (collector.done == 0)
+        {
+            fprintf(stderr, "heaven-replay: the bar did not start\n");
+            Reap({ bar });
+            return 1;
+        }
+    }
+
+    Replay replay;
+    std::shared_ptr<CZCore> core;
+    std::shared_ptr<HNBar> loopbackBar;
+
+    if (loopback)
+    {
+        setenv("CZ_HEAVEN_BAR_LOG_LEVEL", "1", 0);
+        core = CZCore::GetOrMake();
+        loopbackBar = HNBar::MakeLoopback();
+
+        if (!core || !loopbackBar)
+        {
+            fprintf(stderr, "heaven-replay: failed to start the bar\n");
+            return 1;
+        }
+
+        replay.loopback = loopbackBar->loopback();
+        replay.loopback->onCommitApplied.subscribe(&replay, [&replay](const std::string &clientId, UInt32, UInt64 clientTime, UInt64 dispatchTime)
+        {
+            auto it { replay.pending.find(clientId) };
+
+            if (it == replay.pending.end() || it->second == 0)
+                return;
+
+            it->second--;
+            replay.outstanding--;
+            replay.acked++;
+            replay.metrics["commit.ack_us"].values.emplace_back(double(NowUsec() - clientTime));
+            replay.metrics["commit.dispatch_us"].values.emplace_back(double(dispatchTime));
+        });
+    }
+
+    // The bar's timers run on CZCore in loopback mode.
+    const auto process { [&](int timeoutMs)
+    {
+        if (core)
+            core->dispatch(timeoutMs);
+        else
+            ProcessPeers(replay, timeoutMs);
+    }};
+
+    HNCapture::Record record;
+    const UInt64 start { NowUsec() };
+
+    while (reader->next(record))
+    {
+        if (!fast)
+        {
+            const UInt64 due { start + UInt64(double(record.time) / speed) };
+
+            for (UInt64 now = NowUsec(); now < due; now = NowUsec())
+                process(int((due - now + 999) / 1000));
+        }
+        else if (replay.messages % 64 == 0)
+            process(0);
+
+        if (loopback)
+            SendLoopback(replay, *reader, record);
+        else if (record.kind == HNCapture::Record::Disconnect)
+            ClosePeer(replay, record.sender);
+        else
+            Send(replay, *reader, record);
+    }
+
+    const UInt64 sent { NowUsec() };
+
+    if (reader->failed())
+        fprintf(stderr, "heaven-replay: %s is truncated or malformed, replayed up to the first bad record\n", capture);
+
+    for (const UInt64 deadline = sent + UInt64(drainTimeout) * 1000; replay.outstanding > 0 && NowUsec() < deadline;)
+        process(10);
+
+    const UInt64 end { NowUsec() };
+
+    if (bar > 0 || loopback)
+    {
+        if (const long kb { ReadRssKb(loopback ? getpid() : bar) }; kb >= 0)
+            replay.metrics["bar.rss_kb"].values.emplace_back(double(kb));
+    }
+
+    for (UInt32 i = 0; i < replay.peers.size(); i++)
+        ClosePeer(replay, i);
+
+    if (bar > 0)
+        Reap({ bar });
+
+    const double sendSeconds { double(sent - start) / 1000000.0 };
+    const std::string json { "{\n  \"options\": { \"fast\": " + std::string(fast ? "true" : "false") +
+        ", \"speed\": " + std::to_string(speed) +
+        ", \"spawnBar\": " + (spawnBar ? "true" : "false") +
+        ", \"ioThread\": " + (ioThread ? "true" : "false") +
+        ", \"loopback\": " + (loopback ? "true" : "false") +
+        " },\n  \"senders\": " + std::to_string(reader->senders().size()) +
+        ",\n  \"messages\": " + std::to_string(replay.messages) +
+        ",\n  \"errors\": " + std::to_string(replay.errors) +
+        ",\n  \"commitsSequenced\": " + std::to_string(replay.sequenced) +
+        ",\n  \"commitsAcked\": " + std::to_string(replay.acked) +
+        ",\n  \"sendUs\": " + std::to_string(sent - start) +
+        ",\n  \"totalUs\": " + std::to_string(end - start) +
+        ",\n  \"messagesPerSecond\": " + std::to_string(sendSeconds > 0 ? double(replay.messages) / sendSeconds : 0.0) +
+        ",\n  \"metrics\": " + MetricsJson(replay.metrics) + "\n}\n" };
+
+    if (!WriteOutput(output, json))
+        return 1;
+
+    return reader->failed() ? 1 : 0;
+}
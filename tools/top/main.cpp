@@ -0,0 +1,237 @@
+/**
+ * heaven-top
+ *
+ * Displays live per-client rates of a running bar, read from its
+ * `org.cuarzo.HeavenBar.Stats` interface on the session bus.
+ *
+ * Usage: heaven-top [--interval MS] [--count N]
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <systemd/sd-bus.h>
+
+// Must match Bar::HNClient::DispatchTimeBuckets.
+static constexpr size_t DispatchTimeBuckets { 16 };
+
+struct ClientStats
+{
+    std::string id;
+    std::string name;
+    uint64_t messagesReceived, eventsEnqueued, eventsApplied, eventsRejected, eventsDropped, commits, objects, stringBytes;
+    std::array<uint64_t, DispatchTimeBuckets> dispatchTime {};
+};
+
+static int Read(sd_bus *bus, std::vector<ClientStats> &clients)
+{
+    sd_bus_error error = SD_BUS_ERROR_NULL;
+    sd_bus_message *reply {};
+    int r = sd_bus_call_method(bus,
+        "org.cuarzo.HeavenBar",
+        "/org/cuarzo/HeavenBar",
+        "org.cuarzo.HeavenBar.Stats",
+        "GetClientStats",
+        &error, &reply, "");
+
+    if (r < 0)
+    {
+        fprintf(stderr, "heaven-top: %s\n", error.message ? error.message : strerror(-r));
+        sd_bus_error_free(&error);
+        return r;
+    }
+
+    clients.clear();
+    r = sd_bus_message_enter_container(reply, 'a', "(ssttttttttat)");
+
+    while (r >= 0 && (r = sd_bus_message_enter_container(reply, 'r', "ssttttttttat")) > 0)
+    {
+        ClientStats c {};
+        const char *id, *name;
+        const void *histogram;
+        size_t size;
+
+        r = sd_bus_message_read(reply, "sstttttttt", &id, &name,
+            &c.messagesReceived, &c.eventsEnqueued, &c.eventsApplied, &c.eventsRejected,
+            &c.eventsDropped, &c.commits, &c.objects, &c.stringBytes);
+
+        if (r >= 0)
+            r = sd_bus_message_read_array(reply, 't', &histogram, &size);
+
+        if (r >= 0)
+            r = sd_bus_message_exit_container(reply);
+
+        if (r < 0)
+            break;
+
+        c.id = id;
+        c.name = name;
+        memcpy(c.dispatchTime.data(), histogram, std::min(size, sizeof(c.dispatchTime)));
+        clients.emplace_back(std::move(c));
+    }
+
+    sd_bus_message_unref(reply);
+
+    if (r < 0)
+        fprintf(stderr, "heaven-top: invalid reply: %s\n", strerror(-r));
+
+    return r;
+}
+
+// Bucket holding the given percentile, or -1 without samples.
+static int Percentile(const std::array<uint64_t, DispatchTimeBuckets> &histogram, double p)
+{
+    uint64_t total { 0 };
+
+    for (uint64_t count : histogram)
+        total += count;
+
+    if (total == 0)
+        return -1;
+
+    const double rank { p / 100.0 * double(total) };
+    uint64_t seen { 0 };
+
+    for (size_t i = 0; i < DispatchTimeBuckets; i++)
+    {
+        seen += histogram[i];
+
+        if (double(seen) >= rank)
+            return int(i);
+    }
+
+    return DispatchTimeBuckets - 1;
+}
+
+// Range of a bucket in µs, see Bar::HNClient::Stats::dispatchTime.
+static std::string FormatBucket(int bucket)
+{
+    if (bucket < 0)
+        return "-";
+
+    if (size_t(bucket) == DispatchTimeBuckets - 1)
+        return ">=" + std::to_string(1UL << (bucket - 1));
+
+    return "<" + std::to_string(1UL << bucket);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned interval { 1000 };
+    long count { -1 };
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--interval") && i + 1 < argc)
+            interval = std::max(100UL, strtoul(argv[++i], nullptr, 10));
+        else if (!strcmp(argv[i], "--count") && i + 1 < argc)
+            count = strtol(argv[++i], nullptr, 10);
+        else
+        {
+            fprintf(stderr,
+                "Usage: heaven-top [OPTIONS]\n"
+                "  --interval MS  Refresh interval (default 1000)\n"
+                "  --count N      Exit after N refreshes\n");
+            return 1;
+        }
+    }
+
+    sd_bus *bus {};
+    int r = sd_bus_open_user(&bus);
+
+    if (r < 0)
+    {
+        fprintf(stderr, "heaven-top: failed to connect to the session bus: %s\n", strerror(-r));
+        return 1;
+    }
+
+    std::unordered_map<std::string, ClientStats> previous;
+    std::vector<ClientStats> clients;
+    auto previousTime { std::chrono::steady_clock::now() };
+
+    for (long n = 0; count < 0 || n <= count; n++)
+    {
+        if (Read(bus, clients) < 0)
+            break;
+
+        const auto now { std::chrono::steady_clock::now() };
+        const double seconds { std::max(std::chrono::duration<double>(now - previousTime).count(), 1e-3) };
+        previousTime = now;
+
+        // The first read only sets the baseline.
+        if (n > 0)
+        {
+            struct Row
+            {
+                const ClientStats *stats;
+                double messages, applied, rejected, dropped, commits;
+                int p50, p99;
+            };
+
+            std::vector<Row> rows;
+            uint64_t objects { 0 }, stringBytes { 0 };
+
+            for (const auto &c : clients)
+            {
+                const auto it { previous.find(c.id) };
+                const ClientStats base { it != previous.end() ? it->second : ClientStats {} };
+                std::array<uint64_t, DispatchTimeBuckets> histogram;
+
+                for (size_t i = 0; i < DispatchTimeBuckets; i++)
+                    histogram[i] = c.dispatchTime[i] - base.dispatchTime[i];
+
+                rows.emplace_back(&c,
+                    double(c.messagesReceived - base.messagesReceived) / seconds,
+                    double(c.eventsApplied - base.eventsApplied) / seconds,
+                    double(c.eventsRejected - base.eventsRejected) / seconds,
+                    double(c.eventsDropped - base.eventsDropped) / seconds,
+                    double(c.commits - base.commits) / seconds,
+                    Percentile(histogram, 50), Percentile(histogram, 99));
+
+                objects += c.objects;
+                stringBytes += c.stringBytes;
+            }
+
+            std::sort(rows.begin(), rows.end(), [](const Row &a, const Row &b) { return a.messages > b.messages; });
+
+            // Clears the screen.
+            printf("\033[H\033[2J");
+            printf("heaven-top - %zu clients, %lu objects, %lu KiB of strings\n\n",
+                clients.size(), (unsigned long)objects, (unsigned long)(stringBytes / 1024));
+            printf("%-28s %9s %9s %8s %8s %8s %8s %9s %9s %9s\n",
+                "CLIENT", "MSG/s", "APPLY/s", "REJ/s", "DROP/s", "COMMIT/s", "OBJECTS", "STR KiB", "P50 us", "P99 us");
+
+            for (const auto &row : rows)
+            {
+                const auto &c { *row.stats };
+                const std::string label { (c.name.empty() ? c.id : c.name).substr(0, 28) };
+
+                printf("%-28s %9.1f %9.1f %8.1f %8.1f %8.1f %8lu %9lu %9s %9s\n",
+                    label.c_str(), row.messages, row.applied, row.rejected, row.dropped, row.commits,
+                    (unsigned long)c.objects, (unsigned long)(c.stringBytes / 1024),
+                    FormatBucket(row.p50).c_str(), FormatBucket(row.p99).c_str());
+            }
+
+            fflush(stdout);
+        }
+
+        previous.clear();
+
+        for (const auto &c : clients)
+            previous.emplace(c.id, c);
+
+        if (count < 0 || n < count)
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+    }
+
+    sd_bus_flush_close_unref(bus);
+    return 0;
+}